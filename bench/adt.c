@@ -0,0 +1,974 @@
+/**
+ * @brief Micro-benchmarks of the ADT interfaces (include/adt), run by `make bench-adt`
+ *
+ * @details
+ * Times the operations of the map, set and list interfaces on synthetic workloads, for whichever
+ * implementation of each the driver is linked with. `make bench-adt` builds the driver once per implementation
+ * and runs the suite of its interface, such that the results of interchangeable implementations line up.
+ *
+ * - map: keys are terms whose lengths resemble those of words, drawn with a Zipf distribution like the terms
+ *   of a corpus. They are compared either by content (strcmp, as the document and cache maps of the index do)
+ *   or by address (as the term map of the index does, with interned terms).
+ * - set: elements are ascending ids, as the ids of documents are. Set operations are run across a range of
+ *   size ratios between the two sets.
+ * - list: elements are random, such that sorting them does some work.
+ *
+ * Every workload is run a number of rounds, and the fastest round is reported. Each row of the report holds
+ * the time, CPU cycles and cache misses per operation, along with the heap memory held per element where the
+ * workload builds a structure. Cycles and cache misses are read from the hardware performance counters
+ * (perf_event_open) where available. Otherwise, cycles are read from the time stamp counter, which ticks at
+ * a constant rate rather than that of the core, and cache misses are left out.
+ *
+ * Memory is as reported by the allocator (mallinfo2), so unlike the `.mem` report it includes its overhead,
+ * and does not depend on `MEMSTAT`.
+ *
+ * Only the report is written to stdout, one row per workload. Progress and errors go to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <time.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#  define HAVE_TSC
+#endif
+
+#include "printing.h"
+#include "defs.h"
+#include "common.h"
+#include "map.h"
+#include "set.h"
+#include "list.h"
+
+
+/* SETTING: default number of rounds of each workload, of which the fastest is reported */
+#define N_ROUNDS_DEFAULT 5
+
+/* SETTING: default size of the largest structures. Smaller sizes are powers of 8 below it, down to 1024. */
+#define N_MAX_DEFAULT (1 << 20)
+
+/* SETTING: exponent of the Zipf distribution of the terms, about 1 for natural language */
+#define ZIPF_EXPONENT 1.0
+
+/* SETTING: number of terms drawn per unique term, by workloads that look up terms */
+#define TERMS_PER_KEY 4
+
+/* SETTING: ratios of the size of the larger set to that of the smaller one, for set operations */
+static const size_t set_ratios[] = { 1, 16, 256 };
+
+/**
+ * SETTING: largest set built by inserting its elements in random order. An array set moves half of its
+ * elements on each such insert, so larger sizes take minutes.
+ */
+#define SET_RANDOM_INSERT_MAX (1 << 14)
+
+typedef struct bench_adt_args {
+    const char *suite; // map, set or list. NULL => all.
+    const char *impl;  // free-form label of each row, e.g. the implementation benchmarked
+    size_t n_rounds;
+    size_t n_max;
+} bench_adt_args_t;
+
+/* time, cycles and cache misses taken by a measured section */
+typedef struct measure {
+    double secs;
+    uint64_t cycles;
+    uint64_t misses;
+    double t_start;
+    uint64_t cycles_start;
+    uint64_t misses_start;
+} measure_t;
+
+/* performance counters of the process, or -1 where unavailable */
+static int cycles_fd = -1;
+static int misses_fd = -1;
+static int have_cycles; // from the cycle counter, or else the time stamp counter
+
+static bench_adt_args_t args;
+
+/* results of the workloads are added to this, such that the compiler cannot leave them out */
+static volatile uintptr_t sink;
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1.0E9;
+}
+
+/* open a hardware counter of this thread, counting in user space only. Returns -1 if unavailable. */
+static int perf_open(uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t perf_read(int fd) {
+    uint64_t count = 0;
+
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+
+    return count;
+}
+
+static void counters_open(void) {
+    cycles_fd = perf_open(PERF_COUNT_HW_CPU_CYCLES);
+    misses_fd = perf_open(PERF_COUNT_HW_CACHE_MISSES);
+
+#ifdef HAVE_TSC
+    have_cycles = 1;
+#else
+    have_cycles = (cycles_fd >= 0);
+#endif
+
+    if (cycles_fd < 0) {
+        fprintf(
+            stderr,
+            have_cycles ? "bench-adt: no cycle counter, reporting time stamp counter ticks as cycles\n"
+                        : "bench-adt: no cycle counter, leaving out cycles\n"
+        );
+    }
+    if (misses_fd < 0) {
+        fprintf(stderr, "bench-adt: no cache miss counter, leaving out cache misses\n");
+    }
+}
+
+static void counters_close(void) {
+    if (cycles_fd >= 0) {
+        close(cycles_fd);
+    }
+    if (misses_fd >= 0) {
+        close(misses_fd);
+    }
+}
+
+static uint64_t read_cycles(void) {
+    if (cycles_fd >= 0) {
+        return perf_read(cycles_fd);
+    }
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void measure_start(measure_t *m) {
+    m->misses_start = (misses_fd >= 0) ? perf_read(misses_fd) : 0;
+    m->cycles_start = read_cycles();
+    m->t_start = now_secs();
+}
+
+static void measure_stop(measure_t *m) {
+    m->secs = now_secs() - m->t_start;
+    m->cycles = read_cycles() - m->cycles_start;
+    m->misses = (misses_fd >= 0) ? perf_read(misses_fd) - m->misses_start : 0;
+}
+
+/* keep the fastest of the rounds of a workload. `best->secs` < 0 until the first round. */
+static void measure_keep_best(measure_t *best, const measure_t *m) {
+    if (best->secs < 0 || m->secs < best->secs) {
+        *best = *m;
+    }
+}
+
+/* bytes of heap in use, as the allocator sees it */
+static size_t heap_bytes(void) {
+    struct mallinfo2 info = mallinfo2();
+
+    return info.uordblks + info.hblkhd;
+}
+
+static void print_header(void) {
+    printf(
+        "%-5s %-12s %-7s %8s  %-20s %10s %10s %10s %10s\n",
+        "suite",
+        "workload",
+        "keys",
+        "n",
+        "impl",
+        "ns/op",
+        "cycles/op",
+        "misses/op",
+        "bytes/elem"
+    );
+}
+
+/**
+ * @brief Print the row of a workload
+ * @param n: size of the structure the workload runs on
+ * @param n_ops: operations per round, which the measures are divided by
+ * @param bytes: heap memory held by the structure built by the workload, or 0 if it builds none
+ */
+static void report(
+    const char *suite,
+    const char *workload,
+    const char *keys,
+    size_t n,
+    size_t n_ops,
+    const measure_t *best,
+    size_t bytes
+) {
+    char cycles[32] = "-";
+    char misses[32] = "-";
+    char per_elem[32] = "-";
+
+    if (have_cycles) {
+        snprintf(cycles, sizeof(cycles), "%.1f", (double) best->cycles / (double) n_ops);
+    }
+    if (misses_fd >= 0) {
+        snprintf(misses, sizeof(misses), "%.3f", (double) best->misses / (double) n_ops);
+    }
+    if (bytes) {
+        snprintf(per_elem, sizeof(per_elem), "%.1f", (double) bytes / (double) n);
+    }
+
+    printf(
+        "%-5s %-12s %-7s %8zu  %-20s %10.1f %10s %10s %10s\n",
+        suite,
+        workload,
+        keys,
+        n,
+        args.impl,
+        best->secs * 1.0E9 / (double) n_ops,
+        cycles,
+        misses,
+        per_elem
+    );
+    fflush(stdout);
+}
+
+/* ===== data ===== */
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+/* splitmix64, such that every run draws the same data */
+static uint64_t rng_next(void) {
+    uint64_t x = (rng_state += 0x9e3779b97f4a7c15);
+
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+
+    return x ^ (x >> 31);
+}
+
+/* uniform in [0, n) */
+static size_t rng_below(size_t n) {
+    return (size_t) (((unsigned __int128) rng_next() * n) >> 64);
+}
+
+static void shuffle(void **items, size_t n) {
+    for (size_t i = n; i > 1; i--) {
+        size_t j = rng_below(i);
+        void *tmp = items[i - 1];
+        items[i - 1] = items[j];
+        items[j] = tmp;
+    }
+}
+
+/**
+ * Terms of a map workload. Each term is a few random letters, most often 5 to 8 like the words of English
+ * text, followed by the digits of its number, which make the terms distinct.
+ */
+typedef struct terms {
+    size_t n;
+    char *buf;
+    char **keys;   // n terms inserted into the maps
+    char **copies; // the same n terms, copied elsewhere, as looked up by content
+    char **absent; // n terms that are not in the maps
+} terms_t;
+
+static size_t write_term(char *dst, size_t number) {
+    size_t len = 2 + rng_below(4) + rng_below(4) + rng_below(4);
+
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = (char) ('a' + rng_below(26));
+    }
+    len += (size_t) sprintf(&dst[len], "%zu", number);
+
+    return len + 1;
+}
+
+static terms_t terms_create(size_t n) {
+    terms_t terms = { .n = n };
+
+    /* at most 11 letters, 20 digits and the null byte, for each of the three arrays */
+    terms.buf = malloc(n * 3 * 32);
+    terms.keys = malloc(n * sizeof(char *));
+    terms.copies = malloc(n * sizeof(char *));
+    terms.absent = malloc(n * sizeof(char *));
+    if (!terms.buf || !terms.keys || !terms.copies || !terms.absent) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    char *pos = terms.buf;
+
+    for (size_t i = 0; i < n; i++) {
+        terms.keys[i] = pos;
+        pos += write_term(pos, i);
+    }
+    for (size_t i = 0; i < n; i++) {
+        terms.copies[i] = strcpy(pos, terms.keys[i]);
+        pos += strlen(pos) + 1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        terms.absent[i] = pos;
+        pos += write_term(pos, n + i);
+    }
+
+    return terms;
+}
+
+static void terms_destroy(terms_t *terms) {
+    free(terms->buf);
+    free(terms->keys);
+    free(terms->copies);
+    free(terms->absent);
+}
+
+/**
+ * @brief Draw `n_draws` of the terms with a Zipf distribution, as the terms of a corpus occur
+ * @returns the numbers of the terms drawn
+ */
+static size_t *zipf_draws(size_t n_terms, size_t n_draws) {
+    double *cdf = malloc(n_terms * sizeof(double));
+    size_t *draws = malloc(n_draws * sizeof(size_t));
+    if (!cdf || !draws) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    double sum = 0.0;
+    for (size_t i = 0; i < n_terms; i++) {
+        sum += 1.0 / pow((double) (i + 1), ZIPF_EXPONENT);
+        cdf[i] = sum;
+    }
+
+    /* the terms are random, so their numbers are as good a rank as any */
+    for (size_t i = 0; i < n_draws; i++) {
+        double u = (double) (rng_next() >> 11) * 0x1.0p-53 * sum;
+        size_t lo = 0;
+        size_t hi = n_terms - 1;
+
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        draws[i] = lo;
+    }
+
+    free(cdf);
+
+    return draws;
+}
+
+/* ===== map ===== */
+
+/* keys of a map workload, compared by content or by address */
+typedef struct key_kind {
+    const char *name;
+    cmp_fn cmpfn;
+    hash64_fn hashfn;
+} key_kind_t;
+
+static const key_kind_t key_kinds[] = {
+    { "str", (cmp_fn) strcmp, hash_string_fnv1a64 },
+    { "ptr", compare_pointers, hash_pointer },
+};
+
+static map_t *map_build(const key_kind_t *kind, char **keys, size_t n) {
+    map_t *map = map_create(kind->cmpfn, kind->hashfn);
+    if (!map) {
+        PANIC("Failed to create map\n");
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        map_insert(map, keys[i], (void *) (uintptr_t) i);
+    }
+
+    return map;
+}
+
+static void bench_map(const key_kind_t *kind, size_t n) {
+    terms_t terms = terms_create(n);
+    size_t n_draws = n * TERMS_PER_KEY;
+    size_t *draws = zipf_draws(n, n_draws);
+
+    /* terms are looked up by a copy of their content, such as a token, but by address once interned */
+    int by_content = (kind->cmpfn == (cmp_fn) strcmp);
+    char **lookups = by_content ? terms.copies : terms.keys;
+
+    void **drawn = malloc(n_draws * sizeof(void *));
+    void **removals = malloc(n * sizeof(void *));
+    if (!drawn || !removals) {
+        PANIC("Failed to allocate memory\n");
+    }
+    for (size_t i = 0; i < n_draws; i++) {
+        drawn[i] = lookups[draws[i]];
+    }
+    free(draws);
+
+    memcpy(removals, lookups, n * sizeof(void *));
+    shuffle(removals, n);
+
+    measure_t m;
+    measure_t best = { .secs = -1 };
+    size_t bytes = 0;
+
+    /* insert: every term once, into an empty map */
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        size_t heap_start = heap_bytes();
+
+        measure_start(&m);
+        map_t *map = map_build(kind, terms.keys, n);
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        bytes = heap_bytes() - heap_start;
+        map_destroy(map, NULL, NULL);
+    }
+    report("map", "insert", kind->name, n, n, &best, bytes);
+
+    /* count: the occurrences of drawn terms, inserting each the first time it is drawn, as indexing does */
+    best.secs = -1;
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        map_t *map = map_create(kind->cmpfn, kind->hashfn);
+        if (!map) {
+            PANIC("Failed to create map\n");
+        }
+
+        measure_start(&m);
+        for (size_t i = 0; i < n_draws; i++) {
+            entry_t *entry = map_get(map, drawn[i]);
+            if (entry) {
+                entry->val = (void *) ((uintptr_t) entry->val + 1);
+            } else {
+                map_insert(map, drawn[i], (void *) 1);
+            }
+        }
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        sink += map_length(map);
+        map_destroy(map, NULL, NULL);
+    }
+    report("map", "count-zipf", kind->name, n, n_draws, &best, 0);
+
+    map_t *map = map_build(kind, terms.keys, n);
+
+    /* get: drawn terms, which are all present */
+    best.secs = -1;
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        uintptr_t sum = 0;
+
+        measure_start(&m);
+        for (size_t i = 0; i < n_draws; i++) {
+            sum += (uintptr_t) map_get(map, drawn[i])->val;
+        }
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        sink += sum;
+    }
+    report("map", "get-zipf", kind->name, n, n_draws, &best, 0);
+
+    /* get: terms that are not present */
+    best.secs = -1;
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        uintptr_t sum = 0;
+
+        measure_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            sum += (uintptr_t) map_get(map, terms.absent[i]);
+        }
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        sink += sum;
+    }
+    report("map", "get-miss", kind->name, n, n, &best, 0);
+
+    /* iterate: over every entry */
+    best.secs = -1;
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        uintptr_t sum = 0;
+
+        measure_start(&m);
+        map_iter_t *iter = map_createiter(map);
+        if (!iter) {
+            PANIC("Failed to create iterator\n");
+        }
+        while (map_hasnext(iter)) {
+            sum += (uintptr_t) map_next(iter)->val;
+        }
+        map_destroyiter(iter);
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        sink += sum;
+    }
+    report("map", "iterate", kind->name, n, n, &best, 0);
+
+    map_destroy(map, NULL, NULL);
+
+    /* remove: every term, in random order, freeing the entries returned */
+    best.secs = -1;
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        map = map_build(kind, terms.keys, n);
+
+        measure_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            free(map_remove(map, removals[i]));
+        }
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        map_destroy(map, NULL, NULL);
+    }
+    report("map", "remove", kind->name, n, n, &best, 0);
+
+    free(drawn);
+    free(removals);
+    terms_destroy(&terms);
+}
+
+/* ===== set ===== */
+
+/* elements of sets are ids, stored as (non-NULL) pointers */
+static inline void *id_elem(size_t id) {
+    return (void *) (uintptr_t) (id + 1);
+}
+
+/* `n` distinct ids of [0, n_ids), each as likely as any other, in ascending order (selection sampling) */
+static void **draw_ids(size_t n_ids, size_t n) {
+    void **ids = malloc(n * sizeof(void *));
+    if (!ids) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    size_t n_drawn = 0;
+
+    for (size_t id = 0; id < n_ids && n_drawn < n; id++) {
+        if (rng_below(n_ids - id) < n - n_drawn) {
+            ids[n_drawn++] = id_elem(id);
+        }
+    }
+
+    return ids;
+}
+
+static set_t *set_build(void **elems, size_t n) {
+    set_t *set = set_create(compare_pointers);
+    if (!set) {
+        PANIC("Failed to create set\n");
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        set_insert(set, elems[i]);
+    }
+
+    return set;
+}
+
+/**
+ * @brief Time a set operation of `a` and `b`
+ * @param n: size of the larger of the two sets
+ * @param keys: the ratio of the size of `a` to that of `b`
+ */
+static void bench_set_op(
+    const char *workload,
+    set_t *(*op)(set_t *, set_t *),
+    set_t *a,
+    set_t *b,
+    size_t n,
+    const char *keys
+) {
+    measure_t m;
+    measure_t best = { .secs = -1 };
+
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        measure_start(&m);
+        set_t *result = op(a, b);
+        measure_stop(&m);
+
+        if (!result) {
+            PANIC("Set operation failed\n");
+        }
+        measure_keep_best(&best, &m);
+        sink += set_length(result);
+        set_destroy(result, NULL);
+    }
+
+    report("set", workload, keys, n, set_length(a) + set_length(b), &best, 0);
+}
+
+static void bench_set(size_t n) {
+    /* the ids of either set are drawn from twice as many, such that about half of those of the smaller set are
+     * in the larger one */
+    size_t n_ids = 2 * n;
+    void **elems = draw_ids(n_ids, n);
+
+    measure_t m;
+    measure_t best = { .secs = -1 };
+    size_t bytes = 0;
+
+    /* insert: ascending ids, as documents are added */
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        size_t heap_start = heap_bytes();
+
+        measure_start(&m);
+        set_t *set = set_build(elems, n);
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        bytes = heap_bytes() - heap_start;
+        set_destroy(set, NULL);
+    }
+    report("set", "insert-asc", "id", n, n, &best, bytes);
+
+    void **shuffled = malloc(n * sizeof(void *));
+    if (!shuffled) {
+        PANIC("Failed to allocate memory\n");
+    }
+    memcpy(shuffled, elems, n * sizeof(void *));
+    shuffle(shuffled, n);
+
+    /* insert: the same ids in random order, only up to SET_RANDOM_INSERT_MAX of them */
+    if (n <= SET_RANDOM_INSERT_MAX) {
+        best.secs = -1;
+        for (size_t r = 0; r < args.n_rounds; r++) {
+            size_t heap_start = heap_bytes();
+
+            measure_start(&m);
+            set_t *set = set_build(shuffled, n);
+            measure_stop(&m);
+
+            measure_keep_best(&best, &m);
+            bytes = heap_bytes() - heap_start;
+            set_destroy(set, NULL);
+        }
+        report("set", "insert-rand", "id", n, n, &best, bytes);
+    }
+
+    /* the shuffled ids, along with as many that are not present */
+    void **lookups = realloc(shuffled, n_ids * sizeof(void *));
+    if (!lookups) {
+        PANIC("Failed to allocate memory\n");
+    }
+    for (size_t i = 0; i < n; i++) {
+        lookups[n + i] = id_elem(n_ids + rng_below(n_ids));
+    }
+    shuffle(lookups, n_ids);
+
+    set_t *a = set_build(elems, n);
+
+    /* get: random ids, of which half are present */
+    best.secs = -1;
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        uintptr_t sum = 0;
+
+        measure_start(&m);
+        for (size_t i = 0; i < n_ids; i++) {
+            sum += (uintptr_t) set_get(a, lookups[i]);
+        }
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        sink += sum;
+    }
+    report("set", "get", "id", n, n_ids, &best, 0);
+    free(lookups);
+
+    /* iterate: over every element, in order */
+    best.secs = -1;
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        uintptr_t sum = 0;
+
+        measure_start(&m);
+        set_iter_t *iter = set_createiter(a);
+        if (!iter) {
+            PANIC("Failed to create iterator\n");
+        }
+        while (set_hasnext(iter)) {
+            sum += (uintptr_t) set_next(iter);
+        }
+        set_destroyiter(iter);
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        sink += sum;
+    }
+    report("set", "iterate", "id", n, n, &best, 0);
+
+    /* union, intersection and difference with a smaller set of the same ids, of which about half are in `a` */
+    for (size_t i = 0; i < sizeof(set_ratios) / sizeof(set_ratios[0]); i++) {
+        size_t ratio = set_ratios[i];
+        void **small_elems = draw_ids(n_ids, n / ratio);
+        set_t *b = set_build(small_elems, n / ratio);
+
+        char keys[32];
+        snprintf(keys, sizeof(keys), "r=%zu", ratio);
+
+        bench_set_op("union", set_union, a, b, n, keys);
+        bench_set_op("intersection", set_intersection, a, b, n, keys);
+        bench_set_op("difference", set_difference, a, b, n, keys);
+        if (ratio > 1) {
+            /* the smaller set minus the larger, which may take time by the size of either */
+            snprintf(keys, sizeof(keys), "r=1/%zu", ratio);
+            bench_set_op("difference", set_difference, b, a, n, keys);
+        }
+
+        set_destroy(b, NULL);
+        free(small_elems);
+    }
+
+    set_destroy(a, NULL);
+    free(elems);
+}
+
+/* ===== list ===== */
+
+static list_t *list_build(void **items, size_t n) {
+    list_t *list = list_create(compare_pointers);
+    if (!list) {
+        PANIC("Failed to create list\n");
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (list_addlast(list, items[i]) < 0) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+
+    return list;
+}
+
+static void bench_list(size_t n) {
+    void **items = malloc(n * sizeof(void *));
+    if (!items) {
+        PANIC("Failed to allocate memory\n");
+    }
+    for (size_t i = 0; i < n; i++) {
+        items[i] = (void *) (uintptr_t) (rng_next() | 1);
+    }
+
+    measure_t m;
+    measure_t best = { .secs = -1 };
+    size_t bytes = 0;
+
+    /* append: to the end of an empty list, as tokens are */
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        size_t heap_start = heap_bytes();
+
+        measure_start(&m);
+        list_t *list = list_build(items, n);
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        bytes = heap_bytes() - heap_start;
+        list_destroy(list, NULL);
+    }
+    report("list", "append", "rand", n, n, &best, bytes);
+
+    /* pop: every item from the front, as a queue, then from the back, as a stack */
+    best.secs = -1;
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        list_t *list = list_build(items, n);
+        uintptr_t sum = 0;
+
+        measure_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            sum += (uintptr_t) list_popfirst(list);
+        }
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        sink += sum;
+        list_destroy(list, NULL);
+    }
+    report("list", "pop-first", "rand", n, n, &best, 0);
+
+    best.secs = -1;
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        list_t *list = list_build(items, n);
+        uintptr_t sum = 0;
+
+        measure_start(&m);
+        for (size_t i = 0; i < n; i++) {
+            sum += (uintptr_t) list_poplast(list);
+        }
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        sink += sum;
+        list_destroy(list, NULL);
+    }
+    report("list", "pop-last", "rand", n, n, &best, 0);
+
+    /* sort: random items. Reported per item, not per comparison. */
+    best.secs = -1;
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        list_t *list = list_build(items, n);
+
+        measure_start(&m);
+        list_sort(list);
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        sink += (uintptr_t) list_popfirst(list);
+        list_destroy(list, NULL);
+    }
+    report("list", "sort", "rand", n, n, &best, 0);
+
+    /* iterate: over every item, in order */
+    list_t *list = list_build(items, n);
+
+    best.secs = -1;
+    for (size_t r = 0; r < args.n_rounds; r++) {
+        uintptr_t sum = 0;
+
+        measure_start(&m);
+        list_iter_t *iter = list_createiter(list);
+        if (!iter) {
+            PANIC("Failed to create iterator\n");
+        }
+        while (list_hasnext(iter)) {
+            sum += (uintptr_t) list_next(iter);
+        }
+        list_destroyiter(iter);
+        measure_stop(&m);
+
+        measure_keep_best(&best, &m);
+        sink += sum;
+    }
+    report("list", "iterate", "rand", n, n, &best, 0);
+
+    list_destroy(list, NULL);
+    free(items);
+}
+
+/* ===== driver ===== */
+
+static void print_usage(const char *exec) {
+    fprintf(stderr, "Usage: \"%s [--suite <map|set|list> --impl <str> --rounds <n> --max <n>]\"\n", exec);
+}
+
+static int parse_size(const char *arg, const char *val, size_t *dst) {
+    if (!val || !is_digit_string(val)) {
+        pr_error("Expected integer value following %s\n", arg);
+        return -1;
+    }
+
+    *dst = strtoul(val, NULL, 10);
+
+    return 0;
+}
+
+static int parse_args(int argc, char **argv) {
+    args = (bench_adt_args_t) {
+        .suite = NULL,
+        .impl = "",
+        .n_rounds = N_ROUNDS_DEFAULT,
+        .n_max = N_MAX_DEFAULT,
+    };
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+        int status = 0;
+
+        if (!strcmp(arg, "--suite") && val) {
+            args.suite = val;
+        } else if (!strcmp(arg, "--impl") && val) {
+            args.impl = val;
+        } else if (!strcmp(arg, "--rounds")) {
+            status = parse_size(arg, val, &args.n_rounds);
+        } else if (!strcmp(arg, "--max")) {
+            status = parse_size(arg, val, &args.n_max);
+        } else {
+            pr_error("Unrecognized argument: \"%s\"\n", arg);
+            return -1;
+        }
+
+        if (status != 0) {
+            return -1;
+        }
+        i++; // skip the value
+    }
+
+    if (args.suite && strcmp(args.suite, "map") && strcmp(args.suite, "set") && strcmp(args.suite, "list")) {
+        pr_error("Unknown suite: \"%s\"\n", args.suite);
+        return -1;
+    }
+    if (args.n_rounds == 0 || args.n_max < 1024) {
+        pr_error("Expected at least 1 round and a size of at least 1024\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int run_suite(const char *suite) {
+    return !args.suite || !strcmp(args.suite, suite);
+}
+
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) != 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    counters_open();
+    print_header();
+
+    /* the sizes are powers of 8 up to the largest, which is always included */
+    size_t sizes[8];
+    size_t n_sizes = 0;
+
+    for (size_t n = args.n_max; n >= 1024 && n_sizes < 8; n /= 8) {
+        sizes[n_sizes++] = n;
+    }
+
+    for (size_t i = n_sizes; i-- > 0;) {
+        size_t n = sizes[i];
+
+        if (run_suite("map")) {
+            fprintf(stderr, "bench-adt: map of %zu terms (%s)\n", n, args.impl);
+            for (size_t k = 0; k < sizeof(key_kinds) / sizeof(key_kinds[0]); k++) {
+                bench_map(&key_kinds[k], n);
+            }
+        }
+        if (run_suite("set")) {
+            fprintf(stderr, "bench-adt: set of %zu ids (%s)\n", n, args.impl);
+            bench_set(n);
+        }
+        if (run_suite("list")) {
+            fprintf(stderr, "bench-adt: list of %zu items (%s)\n", n, args.impl);
+            bench_list(n);
+        }
+    }
+
+    counters_close();
+
+    return EXIT_SUCCESS;
+}
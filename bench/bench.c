@@ -0,0 +1,437 @@
+/**
+ * @brief End-to-end benchmark driver, run by `make bench`
+ *
+ * @details
+ * Builds an index over a slice of a corpus, then replays a workload of queries against it, one query per
+ * line. Reports indexing throughput, the peak resident set size (RSS) as of the end of each phase and the
+ * latency percentiles of the queries.
+ *
+ * Only the report is written to stdout, as a single JSON object, such that runs with e.g. different ADT
+ * implementations may be compared by diffing or parsing the output. Progress and errors go to stderr.
+ *
+ * Documents are indexed on a single thread, in the same manner as the indexer does by default. The index is
+ * then frozen (see index_freeze) before the queries are replayed, unless `--no-freeze` is given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "printing.h"
+#include "findfiles.h"
+#include "defs.h"
+#include "common.h"
+#include "tokenize.h"
+#include "list.h"
+#include "index.h"
+#include "arena.h"
+
+
+/* SETTING: default number of times the query workload is replayed */
+#define N_REPEAT_DEFAULT 5
+
+/* SETTING: default number of highest ranked results gathered for each query. 0=all. Same as the indexer. */
+#define TOPK_DEFAULT 20
+
+typedef struct bench_args {
+    const char *data_dir;
+    const char *queries_path;
+    const char *tag;    // free-form label included in the report, e.g. the ADT implementations used
+    size_t n_files_max; // 0 => no limit
+    size_t n_repeat;
+    size_t topk;
+    size_t cache_mib; // 0 => no query cache, such that every query is evaluated
+    int freeze;       // freeze the index once built, as the indexer does
+} bench_args_t;
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1.0E9;
+}
+
+/* high-water mark of the resident set size of this process, in KiB */
+static long peak_rss_kib(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+
+    return usage.ru_maxrss;
+}
+
+/* same as in main.c: operators are kept as part of the query tokens */
+static int is_valid_query_char(int c) {
+    return c == '(' || c == ')' || c == '|' || c == '&' || c == '!' || is_ascii_alnum(c);
+}
+
+static int compare_doubles(const double *a, const double *b) {
+    return (*a > *b) - (*a < *b);
+}
+
+/* nearest-rank percentile of an ascending array */
+static double percentile(const double *sorted, size_t n, double p) {
+    if (n == 0) {
+        return 0.0;
+    }
+
+    size_t rank = (size_t) (p / 100.0 * (double) n + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > n) {
+        rank = n;
+    }
+
+    return sorted[rank - 1];
+}
+
+/* read the workload, skipping empty lines and lines starting with '#' */
+static list_t *read_queries(const char *fpath) {
+    FILE *f = fopen(fpath, "r");
+    if (!f) {
+        pr_error("Failed to open query workload \"%s\"\n", fpath);
+        return NULL;
+    }
+
+    list_t *queries = list_create((cmp_fn) strcmp);
+    if (!queries) {
+        fclose(f);
+        return NULL;
+    }
+
+    char line[LINE_MAX];
+
+    while (fgets(line, LINE_MAX, f)) {
+        char *query = trim(line);
+
+        if (*query == '\0' || *query == '#') {
+            continue;
+        }
+
+        char *cpy = strdup(query);
+        if (!cpy || list_addlast(queries, cpy) < 0) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+
+    fclose(f);
+
+    return queries;
+}
+
+static long file_size(const char *fpath) {
+    struct stat st;
+
+    return (stat(fpath, &st) == 0) ? (long) st.st_size : 0;
+}
+
+/**
+ * @brief Index all documents of `fpaths`, emptying the list
+ * @returns the total size of the documents that were indexed, in bytes
+ */
+static size_t index_documents(index_t *idx, list_t *fpaths) {
+    arena_t *arena = arena_create(0);
+    if (!arena) {
+        PANIC("Failed to create arena\n");
+    }
+
+    size_t n_bytes = 0;
+
+    while (list_length(fpaths)) {
+        char *path = list_popfirst(fpaths);
+        long size = file_size(path);
+
+        list_t *terms = list_create((cmp_fn) strcmp);
+        if (!terms) {
+            PANIC("Failed to allocate memory\n");
+        }
+
+        /* tokenize exactly like the indexer does */
+        interner_t *interner = index_interner(idx);
+        if (tokenize_file_mmap(path, terms, arena, interner, 1, isspace, is_ascii_alnum, tolower) < 0) {
+            pr_error("Failed to tokenize file '%s', ignoring it\n", path);
+            list_destroy(terms, NULL);
+            free(path);
+            continue;
+        }
+
+        if (index_document_interned(idx, path, terms) != 0) {
+            PANIC("index_document failed!\n");
+        }
+
+        n_bytes += (size_t) size;
+    }
+
+    arena_destroy(arena);
+
+    return n_bytes;
+}
+
+/**
+ * @brief Run every query of the workload `n_repeat` times, recording the latency of each
+ * @param latencies: array of length list_length(queries) * n_repeat, written in execution order
+ * @returns the number of queries that were rejected as invalid
+ */
+static size_t replay_queries(index_t *idx, list_t *queries, bench_args_t *args, double *latencies) {
+    size_t n_queries = list_length(queries);
+    size_t n_invalid = 0;
+    size_t n_done = 0;
+
+    list_t **tokens = calloc(n_queries, sizeof(list_t *));
+    if (!tokens) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    /* tokenize up front, so that only the index is timed */
+    list_iter_t *iter = list_createiter(queries);
+    for (size_t i = 0; i < n_queries; i++) {
+        tokens[i] = list_create((cmp_fn) strcmp);
+        if (!tokens[i]) {
+            PANIC("Failed to allocate memory\n");
+        }
+
+        char *query = list_next(iter);
+        if (tokenize_string(query, tokens[i], 1, is_space_or_par, is_valid_query_char, tolower) < 0) {
+            PANIC("Failed to tokenize query \"%s\"\n", query);
+        }
+    }
+    list_destroyiter(iter);
+
+    char errmsg[LINE_MAX];
+
+    for (size_t r = 0; r < args->n_repeat; r++) {
+        for (size_t i = 0; i < n_queries; i++) {
+            errmsg[0] = '\0';
+            match_count_t n_matches;
+
+            double t_start = now_secs();
+            list_t *results = index_query_topk(idx, tokens[i], args->topk, &n_matches, errmsg);
+            latencies[n_done++] = now_secs() - t_start;
+
+            if (results) {
+                list_destroy(results, free);
+            } else {
+                n_invalid++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n_queries; i++) {
+        list_destroy(tokens[i], free);
+    }
+    free(tokens);
+
+    /* every query is run n_repeat times, so only count each invalid one once */
+    return n_invalid / args->n_repeat;
+}
+
+static void print_usage(const char *exec) {
+    fprintf(stderr, "Usage: \"%s <data-dir> --queries <fpath> [--limit <n> --repeat <n> --topk <k> ", exec);
+    fprintf(stderr, "--cache <MiB> --tag <str> --no-freeze]\"\n");
+}
+
+static int parse_size(const char *arg, const char *val, size_t *dst) {
+    if (!val || !is_digit_string(val)) {
+        pr_error("Expected integer value following %s\n", arg);
+        return -1;
+    }
+
+    *dst = strtoul(val, NULL, 10);
+
+    return 0;
+}
+
+static int parse_args(int argc, char **argv, bench_args_t *args) {
+    *args = (bench_args_t) {
+        .data_dir = NULL,
+        .queries_path = NULL,
+        .tag = "",
+        .n_files_max = 0,
+        .n_repeat = N_REPEAT_DEFAULT,
+        .topk = TOPK_DEFAULT,
+        .cache_mib = 0,
+        .freeze = 1,
+    };
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+        int status = 0;
+
+        if (*arg != '-') {
+            args->data_dir = arg;
+            continue;
+        }
+        if (!strcmp(arg, "--no-freeze")) {
+            args->freeze = 0;
+            continue;
+        }
+
+        if (!strcmp(arg, "--queries") && val) {
+            args->queries_path = val;
+        } else if (!strcmp(arg, "--tag") && val) {
+            args->tag = val;
+        } else if (!strcmp(arg, "--limit")) {
+            status = parse_size(arg, val, &args->n_files_max);
+        } else if (!strcmp(arg, "--repeat")) {
+            status = parse_size(arg, val, &args->n_repeat);
+        } else if (!strcmp(arg, "--topk")) {
+            status = parse_size(arg, val, &args->topk);
+        } else if (!strcmp(arg, "--cache")) {
+            status = parse_size(arg, val, &args->cache_mib);
+        } else {
+            pr_error("Unrecognized argument: \"%s\"\n", arg);
+            return -1;
+        }
+
+        if (status != 0) {
+            return -1;
+        }
+        i++; // skip the value
+    }
+
+    if (!args->data_dir || !args->queries_path || args->n_repeat == 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    bench_args_t args;
+
+    if (parse_args(argc, argv, &args) != 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    list_t *queries = read_queries(args.queries_path);
+    if (!queries) {
+        return EXIT_FAILURE;
+    }
+
+    /* 1. discover the documents */
+    list_t *fpaths = list_create((cmp_fn) strcmp);
+    if (!fpaths) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    fprintf(stderr, "bench: finding files in \"%s\"\n", args.data_dir);
+
+    double t_start = now_secs();
+    if (find_files(args.data_dir, fpaths, NULL, args.n_files_max) < 0 || list_length(fpaths) == 0) {
+        pr_error("Found no files in \"%s\"\n", args.data_dir);
+        list_destroy(fpaths, free);
+        list_destroy(queries, free);
+        return EXIT_FAILURE;
+    }
+    double discover_secs = now_secs() - t_start;
+    size_t n_files = list_length(fpaths);
+    long discover_rss = peak_rss_kib();
+
+    /* 2. build the index */
+    fprintf(stderr, "bench: indexing %zu files\n", n_files);
+
+    index_t *idx = index_create();
+    if (!idx) {
+        PANIC("Failed to create index\n");
+    }
+
+    t_start = now_secs();
+    size_t n_bytes = index_documents(idx, fpaths);
+    double index_secs = now_secs() - t_start;
+    long index_rss = peak_rss_kib();
+
+    t_start = now_secs();
+    if (args.freeze && index_freeze(idx) != 0) {
+        PANIC("Failed to freeze index\n");
+    }
+    double freeze_secs = args.freeze ? now_secs() - t_start : 0.0;
+
+    size_t n_docs, n_terms;
+    index_stat(idx, &n_docs, &n_terms);
+
+    /* 3. replay the workload */
+    size_t n_queries = list_length(queries);
+    size_t n_runs = n_queries * args.n_repeat;
+
+    fprintf(stderr, "bench: replaying %zu queries %zu times\n", n_queries, args.n_repeat);
+
+    if (index_set_cache_size(idx, args.cache_mib * 1024 * 1024) != 0) {
+        PANIC("Failed to create query cache\n");
+    }
+
+    double *latencies = malloc((n_runs ? n_runs : 1) * sizeof(double));
+    if (!latencies) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    t_start = now_secs();
+    size_t n_invalid = replay_queries(idx, queries, &args, latencies);
+    double query_secs = now_secs() - t_start;
+    long query_rss = peak_rss_kib();
+
+    double latency_sum = 0.0;
+    for (size_t i = 0; i < n_runs; i++) {
+        latency_sum += latencies[i];
+    }
+    qsort(latencies, n_runs, sizeof(double), (cmp_fn) compare_doubles);
+
+    cache_stat_t cstat;
+    index_cache_stat(idx, &cstat);
+
+    /* 4. report. Latencies are in microseconds. */
+    const double us = 1.0E6;
+
+    printf("{\n");
+    printf("  \"tag\": \"%s\",\n", args.tag);
+    printf("  \"corpus\": \"%s\",\n", args.data_dir);
+    printf("  \"limit\": %zu,\n", args.n_files_max);
+    printf("  \"discover\": {\n");
+    printf("    \"n_files\": %zu,\n", n_files);
+    printf("    \"secs\": %.6f,\n", discover_secs);
+    printf("    \"peak_rss_kib\": %ld\n", discover_rss);
+    printf("  },\n");
+    printf("  \"index\": {\n");
+    printf("    \"n_docs\": %zu,\n", n_docs);
+    printf("    \"n_terms\": %zu,\n", n_terms);
+    printf("    \"bytes\": %zu,\n", n_bytes);
+    printf("    \"secs\": %.6f,\n", index_secs);
+    printf("    \"docs_per_sec\": %.1f,\n", (double) n_docs / index_secs);
+    printf("    \"mib_per_sec\": %.3f,\n", (double) n_bytes / (1024.0 * 1024.0) / index_secs);
+    printf("    \"peak_rss_kib\": %ld,\n", index_rss);
+    printf("    \"freeze_secs\": %.6f\n", freeze_secs);
+    printf("  },\n");
+    printf("  \"query\": {\n");
+    printf("    \"n_queries\": %zu,\n", n_queries);
+    printf("    \"n_invalid\": %zu,\n", n_invalid);
+    printf("    \"repeat\": %zu,\n", args.n_repeat);
+    printf("    \"topk\": %zu,\n", args.topk);
+    printf("    \"secs\": %.6f,\n", query_secs);
+    printf("    \"queries_per_sec\": %.1f,\n", (double) n_runs / query_secs);
+    printf("    \"mean_us\": %.2f,\n", latency_sum / (double) (n_runs ? n_runs : 1) * us);
+    printf("    \"p50_us\": %.2f,\n", percentile(latencies, n_runs, 50.0) * us);
+    printf("    \"p95_us\": %.2f,\n", percentile(latencies, n_runs, 95.0) * us);
+    printf("    \"p99_us\": %.2f,\n", percentile(latencies, n_runs, 99.0) * us);
+    printf("    \"max_us\": %.2f,\n", (n_runs ? latencies[n_runs - 1] : 0.0) * us);
+    printf("    \"cache_hits\": %zu,\n", cstat.hits);
+    printf("    \"cache_misses\": %zu,\n", cstat.misses);
+    printf("    \"peak_rss_kib\": %ld\n", query_rss);
+    printf("  }\n");
+    printf("}\n");
+
+    free(latencies);
+    index_destroy(idx);
+    list_destroy(fpaths, free);
+    list_destroy(queries, free);
+
+    return EXIT_SUCCESS;
+}
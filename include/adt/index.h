@@ -7,9 +7,13 @@
 #define INDEX_H
 
 #include <stddef.h> // for size_t
+#include <stdint.h>
 
 #include "defs.h"
 #include "list.h"
+#include "intern.h"
+#include "cache.h"
+#include "query.h"
 
 /**
  * Type of index. `index_t` is an alias for `struct index_`
@@ -19,12 +23,49 @@ typedef struct index index_t;
 /**
  * Type of query_result produced by a index query.
  * Higher score implies the document is more relevant.
+ * `doc_name` is a copy, in the same allocation as the result itself, so both are freed with `free(result)`.
  */
 typedef struct query_result {
     char *doc_name;
     double score;
 } query_result_t;
 
+/**
+ * @brief Order of results in a list of query results: descending by score
+ */
+int compare_results_by_score(query_result_t *a, query_result_t *b);
+
+/**
+ * Number of documents that match a query. Ranking stops pulling matches once none of the rest could make it
+ * into the top k, unless they are needed anyway (e.g. to be cached). Those left are not counted, so `n` is
+ * then only a lower bound.
+ */
+typedef struct match_count {
+    size_t n;
+    int exact; // 1 if `n` is the number of matching documents, 0 if there are at least `n`
+} match_count_t;
+
+/**
+ * Number of documents that contain a term, as counted by index_query_stats
+ */
+typedef struct term_stat {
+    char *term;
+    uint64_t n_docs;
+} term_stat_t;
+
+/**
+ * The statistics of a collection of documents that BM25 ranks a query by: the number of documents, their
+ * total length, and the number of documents with each term the query is scored by.
+ * A collection split across several indexes (shards) is ranked by the sum of the statistics of each of them,
+ * such that the scores of documents from different shards are comparable.
+ */
+typedef struct index_stats {
+    uint64_t n_docs;
+    uint64_t total_length; // sum of the lengths of all documents, including repeated terms
+    size_t n_terms;
+    term_stat_t *terms; // distinct terms, in ascending (strcmp) order
+} index_stats_t;
+
 /**
  * @brief Create a new index
  * @returns a pointer to the newly allocated index, or NULL on failure
@@ -51,9 +92,216 @@ void index_destroy(index_t *index);
  *
  * The index may utilize these items further, or free them right away. They must be freed by the index at the
  * very latest during index_destroy.
+ *
+ * @note A document replaces any document of the same name already in the index.
  */
 int index_document(index_t *index, char *doc_name, list_t *words);
 
+/**
+ * @brief Same as index_document, except that the strings of `words` are borrowed from the caller
+ *
+ * @param index: pointer to index
+ * @param doc_name: distinct reference to a document or file
+ * @param words: list of words (terms), exactly as they appear in the document
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ *
+ * @note The passed doc_name and list of words is owned by the callee (index) from this point, just as with
+ * index_document. The strings within the list are not, and the index copies any it needs to keep. Intended
+ * for words that are freed in bulk by the caller, such as tokens allocated from an arena.
+ */
+int index_document_borrowed(index_t *index, char *doc_name, list_t *words);
+
+/**
+ * @brief Same as index_document, except that the words are canonical strings of the interner of the index
+ *
+ * @param index: pointer to index
+ * @param doc_name: distinct reference to a document or file
+ * @param words: list of words (terms), each interned with `index_interner(index)`
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ *
+ * @note The passed doc_name and list of words is owned by the callee (index) from this point. The strings
+ * within the list are owned by the interner. As the index never has to copy or free a term, this is the
+ * fastest way to index a document.
+ */
+int index_document_interned(index_t *index, char *doc_name, list_t *words);
+
+/**
+ * @brief Begin adding a document to the index term by term, for documents too large to hold all their terms
+ * in a list at once. Terms are then added with index_add_term, and the document completed with
+ * index_end_document.
+ *
+ * @param index: pointer to index
+ * @param doc_name: distinct reference to a document or file
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ *
+ * @note The passed doc_name is owned by the callee (index) from this point, regardless of status.
+ * @note Only one document may be open at a time. Until it is ended, the index must not be queried, merged or
+ * written to file.
+ */
+int index_begin_document(index_t *index, char *doc_name);
+
+/**
+ * @brief Add the next term of the open document
+ *
+ * @param index: pointer to index
+ * @param term: the term, exactly as it appears in the document. Need not be null-terminated.
+ * @param len: length of term in bytes
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ *
+ * @note term is borrowed, and the index copies it if needed.
+ */
+int index_add_term(index_t *index, const char *term, size_t len);
+
+/**
+ * @brief Same as index_add_term, for a sized key whose hash is already computed (see str_t)
+ *
+ * @param index: pointer to index
+ * @param key: the term, hashed with STR_HASH. Borrowed, and copied by the index if needed.
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ */
+int index_add_key(index_t *index, const str_t *key);
+
+/**
+ * @brief Complete the open document. The terms added so far make up the document, even if the caller ends
+ * it early because of an error.
+ *
+ * @param index: pointer to index
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ */
+int index_end_document(index_t *index);
+
+/**
+ * @brief Get the interner holding the terms of the index. Terms interned with it may be passed to
+ * index_document_interned.
+ * @param index: pointer to index
+ * @returns the interner, owned by the index
+ * @warning the interner is not thread-safe, and must only be used by one thread at a time along with
+ * the index.
+ */
+interner_t *index_interner(index_t *index);
+
+/**
+ * @brief Make the index store the position of each occurrence of a term in a document, which phrase queries
+ * need. Positions are kept apart from the postings, so queries without phrases do not read them.
+ * @param index: pointer to index, with no documents yet
+ * @returns 0 on success, otherwise a negative status code, such as if the index already has documents or is
+ * loaded from a file
+ * @note Positions are saved to and loaded from index files along with the rest of the index.
+ */
+int index_store_positions(index_t *index);
+
+/**
+ * @brief Check whether the index stores positions, and so can answer phrase queries
+ * @param index: pointer to index
+ * @returns 1 if so, otherwise 0
+ */
+int index_has_positions(index_t *index);
+
+/**
+ * @brief Merge a (partial) index into another, as if every document of `src` was indexed by `dst`
+ *
+ * @param dst: pointer to the index to merge into
+ * @param src: pointer to the index to merge from
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ *
+ * @note On success, everything owned by `src` is handed over to `dst`, and `src` is destroyed. On failure,
+ * both indexes are left as they were, such as if only one of them stores positions.
+ * @note Intended for parallel ingestion, where each worker builds its own partial index of distinct
+ * documents.
+ * @note `dst` may be queried concurrently with the merge. Queries either see all of the documents of `src`,
+ * or none of them. Any number of partial indexes may be merged into `dst` at once.
+ */
+int index_merge(index_t *dst, index_t *src);
+
+/**
+ * @brief Replace the document of the given name with a new version, or add it if there is none
+ *
+ * @param index: pointer to index
+ * @param doc_name: distinct reference to a document or file
+ * @param words: list of words (terms), exactly as they appear in the document
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ *
+ * @note Ownership is the same as with index_document.
+ * @note The new version is indexed by itself, then merged in (see index_merge). The index may be queried
+ * concurrently, and queries either see the old version or the new one.
+ */
+int index_update_document(index_t *index, char *doc_name, list_t *words);
+
+/**
+ * @brief Remove a document from the index
+ *
+ * @param index: pointer to index
+ * @param doc_name: name of the document, as given when it was indexed. Borrowed from the caller.
+ * @returns 0 if the document was removed, otherwise a negative status code, such as if there is no such
+ * document
+ *
+ * @note The document is only marked as removed (tombstoned) in the postings, and skipped by queries from this
+ * point. The postings keep taking up space for it until index_compact. Until then, the document still counts
+ * towards the document frequency of its terms when ranking.
+ * @note The index may be queried concurrently, and merged into.
+ */
+int index_remove_document(index_t *index, const char *doc_name);
+
+/**
+ * @brief Remove every document whose name starts with `prefix`, such as all files under a directory
+ * @param index: pointer to index
+ * @param prefix: borrowed from the caller
+ * @returns the number of documents removed
+ * @note Same as calling index_remove_document for each of them, but scans every document of the index.
+ */
+size_t index_remove_prefix(index_t *index, const char *prefix);
+
+/**
+ * @brief Check whether enough of the removed documents are still taking up space in the postings to make it
+ * worth calling index_compact
+ * @param index: pointer to index
+ * @returns 1 if so, otherwise 0
+ */
+int index_needs_compaction(index_t *index);
+
+/**
+ * @brief Reclaim the space taken up by removed documents, rewriting every postings that holds any of them
+ *
+ * @param index: pointer to index
+ * @returns the number of bytes the postings (and positions, if stored) shrunk by
+ *
+ * @note The index may be queried, merged into and have documents removed while it is compacted, as the
+ * postings are rewritten a batch at a time. Each batch holds the same lock as merges, so queries stall for
+ * no longer than it takes to rewrite one batch.
+ * @note Must not be called by more than one thread at a time, or while a document is being added term by
+ * term.
+ */
+size_t index_compact(index_t *index);
+
+/**
+ * Removed documents of an index and its compactions, as reported by `index_compaction_stat`
+ */
+typedef struct compaction_stat {
+    size_t n_unpurged;    // removed documents that still take up space in the postings
+    size_t n_compactions; // calls to index_compact that purged any
+    size_t n_reclaimed;   // bytes the postings (and positions) shrunk by, over all compactions
+} compaction_stat_t;
+
+/**
+ * @brief Get the removed documents not yet compacted, and the compactions so far. All zero for a loaded index.
+ * @param index: pointer to index
+ * @param dst: pointer to struct to write to
+ */
+void index_compaction_stat(index_t *index, compaction_stat_t *dst);
+
+/**
+ * @brief Build the sorted dictionary of the terms, which patterns such as "comput*" are expanded with. Any
+ * terms that start with the same letters are next to each other, so a pattern only looks at the terms that
+ * start with the letters before its first "*".
+ *
+ * @param index: pointer to index
+ *
+ * @note Otherwise built by the first query with a pattern. It is dropped once terms are added or removed,
+ * then built again the same way.
+ * @note Safe to call concurrently with queries, see index_query.
+ */
+void index_build_term_dict(index_t *index);
+
 /**
  * @brief Search the index for documents that match the query
  *
@@ -61,21 +309,160 @@ int index_document(index_t *index, char *doc_name, list_t *words);
  * @param query_tokens: ordered list of strings representing individual query tokens
  * @param errbuf: Caller-provided buffer to write error messages to (min. buffer size = LINE_MAX)
  *
- * @returns NULL if the query was malformed or otherwise invalid, otherwise a list containing 0..n
+ * @returns NULL if the query was malformed or otherwise invalid (such as a phrase, where the index does not
+ * store positions, or a pattern that matches too many terms), otherwise a list containing 0..n
  * `query_result_t` structs, sorted by score in descending order. If the return value is NULL, `errbuf` should
  * be set to a string with reasoning. (e.g. "expected term after <some_token>, found operator <other_token>")
  *
  * @note the index may remove strings from the given list of tokens, as long as they are cleaned up (freed) by
  * the index. The list itself should not be destroyed.
+ * @note Queries do not modify the index, so any number of threads may query it at once. Adding documents to
+ * it, or changing its cache size, must not happen concurrently with queries. Merging other indexes into it,
+ * updating, removing documents and compacting may, see index_merge.
  */
 list_t *index_query(index_t *index, list_t *query_tokens, char *errbuf);
 
 /**
- * @brief Get the number of unique documents and terms that have been indexed
+ * @brief Same as index_query, except that only the `k` highest ranked results are returned
+ *
+ * @param index: pointer to index
+ * @param query_tokens: ordered list of strings representing individual query tokens
+ * @param k: maximum number of results to return. 0 => all matching documents.
+ * @param n_matches: nullable. If present, set to the number of matching documents, which may be more than the
+ * number of results returned. See match_count_t for when it is only a lower bound.
+ * @param errbuf: Caller-provided buffer to write error messages to (min. buffer size = LINE_MAX)
+ *
+ * @returns same as index_query
+ *
+ * @note Documents are ranked by BM25. Finding the top k takes less time than ranking all matches, as a
+ * document is only scored in full if it could make it into the k best.
+ * @note Safe for concurrent queries, see index_query.
+ */
+list_t *index_query_topk(index_t *index, list_t *query_tokens, size_t k, match_count_t *n_matches, char *errbuf);
+
+/**
+ * @brief Same as index_query_topk, except that the query is parsed already, and may be ranked by the
+ * statistics of a larger collection than the index holds
+ *
+ * @param index: pointer to index
+ * @param query: root of the AST of the query, see query_parse. Borrowed from the caller.
+ * @param k: maximum number of results to return. 0 => all matching documents.
+ * @param stats: nullable. If present, the statistics to rank by, such as the sum of those index_query_stats
+ * returns for each shard of a collection. Every term of the query that is in the index must be in `stats`.
+ * Otherwise, the statistics of the index are used.
+ * @param n_matches: nullable. If present, set to the number of matching documents, see index_query_topk.
+ * @param errbuf: Caller-provided buffer to write error messages to (min. buffer size = LINE_MAX)
+ *
+ * @returns same as index_query
+ *
+ * @note Results ranked by given statistics are not cached, though the matches of subqueries are.
+ * @note Safe for concurrent queries, see index_query.
+ */
+list_t *index_query_parsed(
+    index_t *index,
+    query_node_t *query,
+    size_t k,
+    const index_stats_t *stats,
+    match_count_t *n_matches,
+    char *errbuf
+);
+
+/**
+ * @brief Get the statistics of the index that a query would be ranked by. Patterns are expanded to the terms
+ * of the index they match, which are counted one by one.
+ *
+ * @param index: pointer to index
+ * @param query: root of the AST of the query, see query_parse. Borrowed from the caller.
+ * @param errbuf: Caller-provided buffer to write error messages to (min. buffer size = LINE_MAX)
+ *
+ * @returns the statistics, to be destroyed with index_stats_destroy, or NULL if the query cannot be answered
+ * by the index (the same as for index_query), with `errbuf` set to the reason.
+ *
+ * @note Only terms that count towards the score (everything but the right side of "&!") and are in the index
+ * are counted.
+ * @note Safe for concurrent queries, see index_query.
+ */
+index_stats_t *index_query_stats(index_t *index, query_node_t *query, char *errbuf);
+
+/**
+ * @brief Destroy statistics, along with the terms of it
+ * @param stats: pointer to statistics, whose members are allocated with malloc
+ * @note this is safe to call with `stats` == NULL, where it simply returns
+ */
+void index_stats_destroy(index_stats_t *stats);
+
+/**
+ * @brief Enable (or resize) the query cache of the index, or disable it. It is disabled by default.
+ *
+ * The cache keeps the results of recent queries, as well as of every subquery they consist of, by a
+ * canonical form of the query. Queries that only differ in the order of operands to "&&" or "||" share an
+ * entry, and a query that shares a subquery with an earlier one reuses its result.
+ *
+ * @param index: pointer to index
+ * @param max_bytes: memory bound of the cache. 0 => disable caching.
+ * @returns 0 on success, otherwise a negative error code
+ * @note any results cached so far are dropped. Indexing a document also drops them.
+ */
+int index_set_cache_size(index_t *index, size_t max_bytes);
+
+/**
+ * @brief Get the counters and usage of the query cache. All zero if caching is disabled.
+ * @param index: pointer to index
+ * @param dst: pointer to struct to write to
+ * @note every query looks up its ranked results, and on a miss, the results of its subqueries.
+ */
+void index_cache_stat(index_t *index, cache_stat_t *dst);
+
+/**
+ * @brief Get the number of unique documents and terms that have been indexed, not counting removed ones
  * @param n_docs: pointer to size_t - must be set to the number of docs
  * @param n_docs: pointer to size_t - must be set to the number of unique terms
  */
 void index_stat(index_t *index, size_t *n_docs, size_t *n_terms);
 
+/**
+ * @brief Compact the index into a read-only layout for queries, once no more documents will be added to it
+ *
+ * Everything the index holds is laid out in one block of memory, the same way as in an index file (see
+ * index_save): the sorted term dictionary, the postings of every term back to back, and the table of the
+ * names and lengths of the documents. Terms are then found by a minimal perfect hash of the dictionary (see
+ * perfhash.h) rather than by binary search. The maps, sets and strings the index was built with are freed,
+ * and removed documents are left out.
+ *
+ * @param index: pointer to index
+ * @returns 0 on success, otherwise a negative error code, such as if the index is read-only already. On
+ * failure, the index is left as it was.
+ *
+ * @note From this point, the index is the same as one loaded with index_load: it may be queried and saved,
+ * while attempts to add, remove or merge documents fail.
+ * @note Must not be called concurrently with queries, or while a document is being added term by term.
+ */
+int index_freeze(index_t *index);
+
+/**
+ * @brief Write the index to a file, in a versioned binary format that can be loaded with index_load.
+ * Any existing file at `path` is replaced once the new file is completely written.
+ *
+ * @param index: pointer to index
+ * @param path: path to file. The directory is created if it does not exist.
+ * @returns 0 on success, otherwise a negative error code
+ * @note Removed documents are left out of the file, as if they were never indexed.
+ * @note A loaded or frozen index (see index_freeze) is laid out as an index file already, and is written as is.
+ */
+int index_save(index_t *index, const char *path);
+
+/**
+ * @brief Load an index written by index_save.
+ *
+ * The file is mapped into memory and queried in place, so loading takes constant time regardless of its
+ * size, with pages read from disk as queries need them.
+ *
+ * @param path: path to index file
+ * @returns a pointer to the loaded index, or NULL on failure
+ *
+ * @note The loaded index is read-only. Attempts to add documents to it fail.
+ */
+index_t *index_load(const char *path);
+
 
 #endif /* INDEX_H */
@@ -0,0 +1,85 @@
+/**
+ * @brief Bump-allocated memory arena
+ *
+ * @details
+ * Memory is handed out from large chunks by bumping an offset, and is only ever released all at once, either
+ * by `arena_reset` (keeping the chunks for reuse) or `arena_destroy`. This makes allocation close to free,
+ * and is a good fit for many small objects with the same lifetime, such as the tokens of a document.
+ *
+ * Pointers returned by the arena remain valid until the next reset or destroy.
+ *
+ * @note
+ * Like the ADTs, the arena PANICS on failure to allocate memory.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h> // for size_t
+
+/**
+ * Type of arena. `arena_t` is an alias for `struct arena`
+ */
+typedef struct arena arena_t;
+
+/**
+ * @brief Create a new, empty arena
+ * @param chunk_size: size of each chunk of memory, in bytes. 0 => a default size. Allocations larger than
+ * this get a chunk of their own.
+ * @returns A pointer to the newly created arena, or NULL on failure
+ */
+arena_t *arena_create(size_t chunk_size);
+
+/**
+ * @brief Destroy the given arena, freeing all memory allocated from it
+ * @param arena: pointer to arena
+ * @note this is safe to call with `arena` == NULL, where it simply returns
+ */
+void arena_destroy(arena_t *arena);
+
+/**
+ * @brief Release everything allocated from the arena, keeping its chunks for reuse
+ * @param arena: pointer to arena
+ */
+void arena_reset(arena_t *arena);
+
+/**
+ * @brief Allocate `size` bytes, aligned for any type (as with malloc)
+ * @param arena: pointer to arena
+ * @returns pointer to the allocated memory
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * @brief Copy `len` bytes of `str` to the arena as a null-terminated string. Not aligned.
+ * @param arena: pointer to arena
+ * @returns pointer to the copy
+ */
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+
+/**
+ * @brief Get a pointer to at least `size` contiguous, unaligned bytes without allocating them.
+ *
+ * Intended for writing objects of an unknown size up to `size`, e.g. a string while it is being built.
+ * Call `arena_commit` with the final size once done. Until then, the reserved space is handed out again
+ * by the next reserve or allocation.
+ *
+ * @param arena: pointer to arena
+ * @returns pointer to the reserved memory
+ */
+char *arena_reserve(arena_t *arena, size_t size);
+
+/**
+ * @brief Allocate the first `size` bytes of the last reserved space
+ * @param arena: pointer to arena
+ * @param size: number of bytes to keep. Must not exceed the size given to `arena_reserve`.
+ */
+void arena_commit(arena_t *arena, size_t size);
+
+/**
+ * @brief Get the total number of bytes held by the arena, including unused space of its chunks
+ * @param arena: pointer to arena
+ */
+size_t arena_capacity(arena_t *arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,83 @@
+/**
+ * @brief Least recently used (LRU) cache with a memory bound
+ *
+ * @details
+ * Maps string keys to values of a caller-given size. Once the total size of the entries would exceed the
+ * bound, the least recently used entries are evicted until the new entry fits.
+ *
+ * @note
+ * Like the ADTs, the cache PANICS on failure to allocate memory.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h> // for size_t
+
+#include "defs.h"
+
+/**
+ * Type of cache. `cache_t` is an alias for `struct cache`
+ */
+typedef struct cache cache_t;
+
+/**
+ * Counters and usage of a cache, as reported by `cache_stat`
+ */
+typedef struct cache_stat {
+    size_t hits;      // lookups that found an entry
+    size_t misses;    // lookups that did not
+    size_t n_entries; // number of entries currently cached
+    size_t n_bytes;   // total size of the entries currently cached
+    size_t max_bytes; // memory bound of the cache
+} cache_stat_t;
+
+/**
+ * @brief Create a new, empty cache
+ * @param max_bytes: upper bound on the total size of all entries, including their keys and bookkeeping
+ * @param val_freefn: nullable. If present, called on each value as it is evicted or replaced
+ * @returns A pointer to the newly created cache, or NULL on failure
+ */
+cache_t *cache_create(size_t max_bytes, free_fn val_freefn);
+
+/**
+ * @brief Destroy the given cache, freeing all entries
+ * @param cache: pointer to cache
+ * @note this is safe to call with `cache` == NULL, where it simply returns
+ */
+void cache_destroy(cache_t *cache);
+
+/**
+ * @brief Remove all entries. The hit/miss counters are kept.
+ * @param cache: pointer to cache
+ */
+void cache_clear(cache_t *cache);
+
+/**
+ * @brief Look up the value of a key, marking the entry as the most recently used
+ * @param cache: pointer to cache
+ * @param key: null-terminated key
+ * @returns the value if the key is cached, otherwise NULL
+ * @warning the value is borrowed to the caller, and only valid until the next `cache_put` or `cache_clear`,
+ * which may evict it.
+ */
+void *cache_get(cache_t *cache, const char *key);
+
+/**
+ * @brief Insert a value, replacing any value already cached for the key
+ * @param cache: pointer to cache
+ * @param key: null-terminated key. Copied by the cache.
+ * @param val: value, owned by the cache from this point
+ * @param size: size of the value in bytes, counted against the memory bound
+ * @note if the entry cannot fit within the memory bound at all, the value is freed right away
+ */
+void cache_put(cache_t *cache, const char *key, void *val, size_t size);
+
+/**
+ * @brief Get the counters and usage of a cache
+ * @param cache: pointer to cache
+ * @param dst: pointer to struct to write to
+ */
+void cache_stat(cache_t *cache, cache_stat_t *dst);
+
+#endif /* CACHE_H */
@@ -7,6 +7,7 @@
 #define COMMON_H
 
 #include <stdint.h>
+#include <stddef.h> // for size_t
 
 #include "defs.h"
 
@@ -40,6 +41,56 @@ int compare_pointers(const void *a, const void *b);
  */
 uint64_t hash_string_fnv1a64(const void *str);
 
+/**
+ * @brief Same as hash_string_fnv1a64, but for `len` bytes of data that do not need to be null-terminated
+ * @param data: pointer to data
+ * @param len: number of bytes to hash
+ * @returns The 64 bit hash of the data. Equal to `hash_string_fnv1a64` of the same string.
+ */
+uint64_t hash_bytes_fnv1a64(const void *data, size_t len);
+
+/**
+ * @brief Hash `len` bytes of data a word at a time, that do not need to be null-terminated. Words are mixed
+ * in by a 64x64 => 128 bit multiply, folded back to 64 bits, as in wyhash. Up to 16 bytes are read as a few
+ * overlapping words, with no loop, and longer data 16 bytes per step, rather than one byte per step as with
+ * FNV-1a.
+ * @param data: pointer to data
+ * @param len: number of bytes to hash
+ * @returns The 64 bit hash of the data
+ * @note the words are read in the byte order of the machine, so the hash must not be written to files that
+ * may be read elsewhere
+ */
+uint64_t hash_bytes_word64(const void *data, size_t len);
+
+/* SETTING: hash function of sized string keys (see str_t). Either hash_bytes_word64 or hash_bytes_fnv1a64. */
+#define STR_HASH hash_bytes_word64
+
+/**
+ * A sized string key: a string along with its length and hash, such that neither is computed again wherever
+ * the key is passed on to. The string does not need to be null-terminated.
+ */
+typedef struct str {
+    const char *ptr;
+    size_t len;
+    uint64_t hash;
+} str_t;
+
+/**
+ * @brief Create the sized key of the first `len` bytes of `ptr`, hashing them with STR_HASH
+ * @returns the key, which borrows `ptr`
+ */
+static inline str_t str_key(const char *ptr, size_t len) {
+    return (str_t) { .ptr = ptr, .len = len, .hash = STR_HASH(ptr, len) };
+}
+
+/**
+ * @brief Hash a pointer by its memory address. Intended for keys that are compared with `compare_pointers`,
+ * such as interned strings.
+ * @param ptr: pointer
+ * @returns The 64 bit hash of the address
+ */
+uint64_t hash_pointer(const void *ptr);
+
 /**
  * @param c: character-type integer
  * @returns a positive integer if character is a newline, otherwise 0
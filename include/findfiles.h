@@ -11,6 +11,13 @@
 #include "list.h"
 #include "set.h"
 
+/**
+ * @brief Check whether a file would be included by find_files, going by its extension
+ * @param valid_exts: nullable. If present, set of the extensions to include
+ * @returns 1 if the file is included, otherwise 0
+ */
+int has_valid_ext(set_t *valid_exts, const char *path);
+
 /**
  * @brief Recursively find files from the given directory path
  * @param dst: list to add file paths to
@@ -21,4 +28,48 @@
  */
 int find_files(const char *dir_path, list_t *dst, set_t *valid_exts, size_t n_files_max);
 
+/**
+ * @brief Same as find_files, but walks the directories with a pool of `n_threads` threads, including the
+ * calling thread. Subdirectories are spread across the threads by work stealing.
+ * @param dst: list to add file paths to
+ * @param valid_exts: nullable. If present, include only files with a extension in this set
+ * @param n_files_max: if > 0, limit to this number of files. With more than one thread, which files are
+ * included is decided by the order the threads happen to find them in.
+ * @param n_threads: number of threads to walk with. If <= 1, the directories are walked by the calling
+ * thread.
+ * @returns 0 on success, otherwise a negative error code
+ * @note As with find_files, the files found before an error are left in `dst`
+ */
+int find_files_parallel(
+    const char *dir_path,
+    list_t *dst,
+    set_t *valid_exts,
+    size_t n_files_max,
+    size_t n_threads
+);
+
+/**
+ * @brief Called by find_files_each with each file found, possibly from several threads at once
+ * @param path: path of the file, owned by the callee from this point
+ * @param arg: the argument given to find_files_each
+ * @returns 0 to continue, or a negative error code to stop the walk
+ */
+typedef int (*file_fn)(char *path, void *arg);
+
+/**
+ * @brief Same as find_files_parallel, but hands each file to `filefn` as soon as it is found instead of
+ * collecting them in a list. A slow `filefn` slows down the walk accordingly.
+ * @param filefn: called with each file found
+ * @param arg: nullable. Passed as is to `filefn`
+ * @returns 0 on success, otherwise a negative error code, such as the one returned by `filefn`
+ */
+int find_files_each(
+    const char *dir_path,
+    set_t *valid_exts,
+    size_t n_files_max,
+    size_t n_threads,
+    file_fn filefn,
+    void *arg
+);
+
 #endif /* FINDFILES_H */
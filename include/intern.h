@@ -0,0 +1,80 @@
+/**
+ * @brief String interning
+ *
+ * @details
+ * An interner keeps exactly one canonical copy of each distinct string given to it. The first time a string
+ * is interned, it is copied to a bump-allocated arena. Any later occurrence resolves to the same pointer, so
+ * two interned strings (of the same interner) are equal if and only if their pointers are equal.
+ *
+ * The canonical strings live until the interner is destroyed, and must never be modified or freed. Each one
+ * keeps its length and hash (see str_t), so it can be interned elsewhere without hashing it again.
+ *
+ * @note
+ * Like the ADTs, the interner PANICS on failure to allocate memory.
+ */
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h> // for size_t
+
+#include "common.h"
+
+/**
+ * Type of interner. `interner_t` is an alias for `struct interner`
+ */
+typedef struct interner interner_t;
+
+/**
+ * @brief Create a new, empty interner
+ * @returns A pointer to the newly created interner, or NULL on failure
+ */
+interner_t *interner_create();
+
+/**
+ * @brief Destroy the given interner, freeing all canonical strings
+ * @param interner: pointer to interner
+ * @note this is safe to call with `interner` == NULL, where it simply returns
+ */
+void interner_destroy(interner_t *interner);
+
+/**
+ * @brief Get the number of distinct strings held by an interner
+ * @param interner: pointer to interner
+ */
+size_t interner_length(interner_t *interner);
+
+/**
+ * @brief Get the canonical copy of a string, creating it from the first `len` bytes of `str` if there is none
+ * @param interner: pointer to interner
+ * @param str: string to intern. Does not need to be null-terminated.
+ * @param len: length of str, in bytes
+ * @returns the canonical, null-terminated copy of the string
+ */
+char *intern(interner_t *interner, const char *str, size_t len);
+
+/**
+ * @brief Same as intern, for a sized key whose hash is already computed
+ * @param interner: pointer to interner
+ * @param key: the string to intern, hashed with STR_HASH
+ * @returns the canonical, null-terminated copy of the string
+ */
+char *intern_key(interner_t *interner, const str_t *key);
+
+/**
+ * @brief Get the sized key of a canonical string, without reading the string itself
+ * @param canonical: canonical string of any interner
+ * @returns the key, which borrows `canonical`
+ */
+str_t interned_key(const char *canonical);
+
+/**
+ * @brief Get the canonical copy of a string, if there is one. Never creates a new copy.
+ * @param interner: pointer to interner
+ * @param str: string to look up. Does not need to be null-terminated.
+ * @param len: length of str, in bytes
+ * @returns the canonical copy of the string if it has been interned, otherwise NULL
+ */
+char *intern_lookup(interner_t *interner, const char *str, size_t len);
+
+#endif /* INTERN_H */
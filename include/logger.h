@@ -14,9 +14,11 @@ typedef struct logger logger_t;
  * @brief initialize a logger.
  * @param path: path to file. Will be created if it does not exist, along with the directory. Content will be
  * appended if the file exists.
+ * @param flush_ms: if 0, writes go straight to the stream of the file. Otherwise, writes are buffered in a ring
+ * buffer, and written to the file in batches by a background thread at least every `flush_ms` milliseconds.
  * @returns pointer logger on success, otherwise NULL
  */
-logger_t *logger_create(const char *path);
+logger_t *logger_create(const char *path, unsigned flush_ms);
 
 /**
  * @brief write to the logger if one is given.
@@ -24,12 +26,13 @@ logger_t *logger_create(const char *path);
  * @param logger: pointer to logger
  * @returns 0 on success, otherwise -1
  * @note this will attempt to reopen the associated file if the write fails for any reason. If -1 is returned,
- * this means the reopen failed.
+ * this means the reopen failed. An asynchronous logger only returns -1 on a later write, as the failure happens
+ * in the background, and blocks if its buffer is full until the background thread makes room.
  */
 int logger_write_buf(logger_t *logger, const char *buf);
 
 /**
- * @brief Destroy a logger, closing the related stream.
+ * @brief Destroy a logger, closing the related stream. An asynchronous logger first writes everything it buffered.
  * @param logger: pointer to logger
  * @note Does nothing if logger is NULL.
  */
@@ -38,6 +41,7 @@ void logger_destroy(logger_t *logger);
 /**
  * @brief flush the logger, writing any pending
  * @param logger: pointer to logger
+ * @note does nothing for an asynchronous logger, which is flushed by its background thread within its interval.
  */
 void logger_flush(logger_t *logger);
 
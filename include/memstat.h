@@ -0,0 +1,86 @@
+/**
+ * @brief Accounting of the memory held by the ADTs and the index, by category
+ *
+ * @details
+ * Each ADT implementation and the index record the memory they allocate and free, as the number of bytes and
+ * the number of allocated objects (heap blocks) in a category. Comparing the two tells whether a structure
+ * is made of many small objects, each paying the overhead of the allocator, or a few large ones.
+ *
+ * Only the memory a structure holds on to is counted, not short-lived allocations such as iterators or the
+ * entries returned by map_remove. Bytes are as requested from malloc, so the overhead of the allocator itself
+ * is left out. The report compares the total against the resident memory of the process.
+ *
+ * Accounting is compiled in when `MEMSTAT` is defined (see `MEMSTAT` in the Makefile, on by default).
+ * Otherwise, every `MEM_*` macro expands to nothing.
+ *
+ * Recording is thread-safe. Each thread adds up what it records on its own, and only adds it to the totals
+ * (with relaxed atomics) once it amounts to MEM_FLUSH_BYTES in a category, or the thread exits. The report
+ * may therefore lag by that much per thread and category.
+ *
+ * Usage:
+ * ```
+ * list_t *list = malloc(sizeof(list_t));
+ * MEM_ALLOC(MEM_LIST, sizeof(list_t));
+ * ...
+ * MEM_FREE(MEM_LIST, sizeof(list_t));
+ * free(list);
+ * ```
+ */
+
+#ifndef MEMSTAT_H
+#define MEMSTAT_H
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+
+/**
+ * Categories of memory. Order matches the rows of the report.
+ */
+typedef enum mem_category {
+    MEM_MAP = 0,     // tables, nodes and entries of maps
+    MEM_SET,         // nodes or arrays of sets
+    MEM_LIST,        // nodes of lists
+    MEM_ARENA,       // chunks of arenas, which hold the interned terms and the tokens of documents
+    MEM_INTERNER,    // tables of interned strings
+    MEM_DOC_NAMES,   // names of the documents of an index
+    MEM_DOC_TABLE,   // tables of the names and lengths of documents, indexed by id
+    MEM_POSTINGS,    // postings of terms
+    MEM_POSITIONS,   // positions of terms, and their skip entries
+    MEM_CONTAINERS,  // containers of the ids of frequent terms, built from their postings for queries
+    MEM_TERMDICT,    // sorted term dictionaries, for patterns
+    MEM_CACHE,       // cached query results, including their keys
+    MEM_INDEX_FILE,  // index files mapped into memory. Only resident as far as queries have read them.
+    MEM_FROZEN,      // frozen indexes, laid out in memory the same way as index files
+    MEM_TERMHASH,    // perfect hashes of the terms of frozen indexes, and the terms of their slots
+    MEM_N_CATEGORIES,
+} mem_category_t;
+
+/**
+ * @brief Add `bytes` and `objects` to a category. Either may be negative, as memory is freed.
+ */
+void mem_record(mem_category_t category, int64_t bytes, int64_t objects);
+
+/**
+ * @brief Write a human-readable report of all categories, line by line
+ * @param writefn: called with each null-terminated line, including its trailing newline
+ * @param n_docs: number of documents of the index, to report the bytes per document
+ * @param n_terms: number of unique terms of the index, to report the bytes per term. Left out if either is 0.
+ * @note if accounting is compiled out, the report is a single line saying so
+ */
+void mem_report(void (*writefn)(const char *), size_t n_docs, size_t n_terms);
+
+#ifdef MEMSTAT
+#  define MEM_ALLOC(category, bytes)              mem_record(category, (int64_t) (bytes), 1)
+#  define MEM_FREE(category, bytes)               mem_record(category, -(int64_t) (bytes), -1)
+#  define MEM_RESIZE(category, old_bytes, bytes)  \
+    mem_record(category, (int64_t) (bytes) - (int64_t) (old_bytes), 0)
+#  define MEM_RECORD(category, bytes, objects)    mem_record(category, bytes, objects)
+#else
+/* the arguments are still evaluated (without effect), so variables only used for accounting are not unused */
+#  define MEM_ALLOC(category, bytes)              ((void) (category), (void) (bytes))
+#  define MEM_FREE(category, bytes)               ((void) (category), (void) (bytes))
+#  define MEM_RESIZE(category, old_bytes, bytes)  ((void) (category), (void) (old_bytes), (void) (bytes))
+#  define MEM_RECORD(category, bytes, objects)    ((void) (category), (void) (bytes), (void) (objects))
+#endif /* MEMSTAT */
+
+#endif /* MEMSTAT_H */
@@ -0,0 +1,45 @@
+/**
+ * @brief Blocking TCP sockets, for the nodes of a sharded index to talk to each other
+ *
+ * @details
+ * Addresses are given as "host:port", where the host is a name or an IP address (IPv6 addresses in brackets,
+ * e.g. "[::1]:7000"). An address to listen on may leave out the host, as in ":7000" or "7000", to listen on
+ * every interface.
+ *
+ * Failures are printed with pr_error, along with the address.
+ */
+
+#ifndef NET_H
+#define NET_H
+
+#include <stddef.h> // for size_t
+
+/**
+ * @brief Listen for connections on the given address
+ * @param addr: address to listen on, see above
+ * @returns the file descriptor of the listening socket, or -1 on failure
+ */
+int net_listen(const char *addr);
+
+/**
+ * @brief Connect to the given address
+ * @param addr: address to connect to, see above
+ * @returns the file descriptor of the connected socket, or -1 on failure
+ * @note Small writes are sent right away (TCP_NODELAY), as each message waits for a reply.
+ */
+int net_connect(const char *addr);
+
+/**
+ * @brief Read exactly `n` bytes from a socket, retrying on interrupts and short reads
+ * @returns 0 on success, or -1 if the connection is closed or fails first
+ */
+int net_read_full(int fd, void *buf, size_t n);
+
+/**
+ * @brief Write exactly `n` bytes to a socket, retrying on interrupts and short writes
+ * @returns 0 on success, or -1 if the connection is closed or fails first
+ * @note a connection closed by the peer fails with EPIPE, rather than raising SIGPIPE
+ */
+int net_write_full(int fd, const void *buf, size_t n);
+
+#endif /* NET_H */
@@ -0,0 +1,62 @@
+/**
+ * @brief Minimal perfect hash function of a fixed set of distinct string keys
+ *
+ * @details
+ * Maps each of the n keys it is built from to its own slot in [0, n), without any collisions, such that a
+ * table of n entries holds every key at exactly the slot it hashes to. Looking up a key takes one hash and
+ * two memory reads, however many keys there are. The keys themselves are not stored: any other string maps to
+ * some slot as well, so the caller compares the key with the one it keeps at that slot.
+ *
+ * Built with hash and displace (as in CHD): the keys are split into buckets of a few keys each by their hash,
+ * and each bucket is given a displacement that moves all of its keys to slots no other bucket uses. The
+ * function is then just the displacement of each bucket, which takes about 1.3 bytes per key.
+ *
+ * @note
+ * Like the ADTs, the hash PANICS on failure to allocate memory.
+ */
+
+#ifndef PERFHASH_H
+#define PERFHASH_H
+
+#include <stddef.h> // for size_t
+
+#include "common.h" // for str_t
+
+/**
+ * Type of perfect hash. `perfhash_t` is an alias for `struct perfhash`
+ */
+typedef struct perfhash perfhash_t;
+
+/**
+ * @brief Build the perfect hash of the given keys
+ * @param keys: distinct keys, hashed with STR_HASH (see str_key). Only their hashes are read.
+ * @param n: number of keys, at least 1
+ * @returns A pointer to the new perfect hash, or NULL if none was found, such as if two keys have the same
+ * 64-bit hash
+ */
+perfhash_t *perfhash_create(const str_t *keys, size_t n);
+
+/**
+ * @brief Destroy the perfect hash
+ * @param hash: pointer to perfect hash
+ * @note this is safe to call with `hash` == NULL, where it simply returns
+ */
+void perfhash_destroy(perfhash_t *hash);
+
+/**
+ * @brief Get the number of bytes used by the perfect hash
+ * @param hash: pointer to perfect hash
+ */
+size_t perfhash_size(const perfhash_t *hash);
+
+/**
+ * @brief Get the slot of a key
+ * @param hash: pointer to perfect hash
+ * @param key: key hashed with STR_HASH
+ * @returns the slot in [0, n) of the key, if it is one of the keys the hash was built from. Otherwise, the
+ * slot of any one of them.
+ * @note the hash does not change once built, so any number of threads may look up keys at once
+ */
+size_t perfhash_lookup(const perfhash_t *hash, const str_t *key);
+
+#endif /* PERFHASH_H */
@@ -0,0 +1,107 @@
+/**
+ * @brief Pool of fixed-size objects, carved from slabs, for the nodes of a container
+ *
+ * @details
+ * Objects are handed out from slabs, each holding many of them back to back, by bumping a pointer. A freed
+ * object is pushed to a free list, which later allocations take from first. The slabs are only released all
+ * at once, by `pool_release`, so a container may drop all of its nodes without visiting each of them.
+ *
+ * Compared to one malloc per node, this saves the header the allocator puts in front of each block, and
+ * keeps the nodes of a container close together in memory. The first slab is small, and each one after it
+ * is twice as large (up to POOL_SLAB_OBJS_MAX objects), so a pool costs little for a container of a few
+ * nodes.
+ *
+ * A pool is meant to be embedded in the container that owns it. As with the containers themselves, it must
+ * only be used by one thread at a time. The slabs are recorded as memory of the category given to pool_init,
+ * see memstat.h.
+ *
+ * Usage:
+ * ```
+ * pool_t pool;
+ * pool_init(&pool, sizeof(node_t), MEM_LIST);
+ * node_t *node = pool_alloc(&pool);
+ * ...
+ * pool_free(&pool, node); // optional, pool_release frees every object
+ * pool_release(&pool);
+ * ```
+ *
+ * @note
+ * Like the ADTs, the pool PANICS on failure to allocate memory.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h> // for size_t
+
+#include "memstat.h"
+
+/**
+ * Type of pool. Unlike the ADTs, the struct is public, so that it can be embedded and its common paths
+ * inlined. Its members are not to be accessed outside of pool.h and pool.c.
+ */
+typedef struct pool {
+    void *free;             // freed objects, each holding a pointer to the next one
+    char *next;             // first object of the current slab that was never handed out
+    char *end;              // end of the current slab
+    void *slabs;            // every slab of the pool, most recent first
+    size_t obj_size;        // size of each object, rounded up to a multiple of the size of a pointer
+    size_t slab_objs;       // number of objects of the next slab
+    mem_category_t category;
+} pool_t;
+
+/**
+ * @brief Initialize an empty pool. Nothing is allocated until the first object is.
+ * @param pool: pointer to the pool to initialize
+ * @param obj_size: size of each object, in bytes. Objects are aligned to the size of a pointer.
+ * @param category: category the memory of the pool is recorded in
+ */
+void pool_init(pool_t *pool, size_t obj_size, mem_category_t category);
+
+/**
+ * @brief Release every slab of the pool, and with them every object, freed or not.
+ * The pool may be used again afterwards, just as if it was initialized anew.
+ * @param pool: pointer to pool
+ */
+void pool_release(pool_t *pool);
+
+/**
+ * @brief Add a slab to the pool, for pool_alloc once the current slab is used up
+ * @param pool: pointer to pool
+ */
+void pool_grow(pool_t *pool);
+
+/**
+ * @brief Allocate an object from the pool
+ * @param pool: pointer to pool
+ * @returns pointer to the object, which is uninitialized
+ */
+static inline void *pool_alloc(pool_t *pool) {
+    void *obj = pool->free;
+
+    if (obj) {
+        pool->free = *(void **) obj;
+        return obj;
+    }
+
+    if (pool->next == pool->end) {
+        pool_grow(pool);
+    }
+
+    obj = pool->next;
+    pool->next += pool->obj_size;
+
+    return obj;
+}
+
+/**
+ * @brief Give an object back to the pool, for a later pool_alloc to reuse
+ * @param pool: pointer to the pool the object was allocated from
+ * @param obj: pointer to the object
+ */
+static inline void pool_free(pool_t *pool, void *obj) {
+    *(void **) obj = pool->free;
+    pool->free = obj;
+}
+
+#endif /* POOL_H */
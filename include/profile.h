@@ -0,0 +1,94 @@
+/**
+ * @brief Lightweight instrumentation of the hot paths: per-phase timers with latency histograms, and event
+ * counters
+ *
+ * @details
+ * Instrumentation is only compiled in when `PROFILE` is defined (see `PROFILE` in the Makefile, on by default
+ * for debug builds). Otherwise, every `PROF_*` macro expands to nothing, such that release builds pay nothing
+ * for it. `prof_now_ns` is always available.
+ *
+ * All recording is thread-safe, with relaxed atomics. Each phase keeps a histogram of power-of-two buckets of
+ * nanoseconds, from which percentiles are estimated.
+ *
+ * Usage:
+ * ```
+ * PROF_START(t_start);
+ * do_work();
+ * PROF_STOP(PROF_PHASE_WORK, t_start);
+ * ```
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Timed phases. Order matches the rows of the report.
+ */
+typedef enum prof_phase {
+    PROF_FIND_FILES = 0,  // discovering the files to index
+    PROF_READ_FILE,       // reading one document into memory, when ingesting in a pipeline
+    PROF_TOKENIZE_FILE,   // reading and tokenizing one document (only tokenizing, in a pipeline)
+    PROF_INDEX_DOCUMENT,  // adding the terms of one document to the index
+    PROF_QUERY_PARSE,     // parsing one query into an AST
+    PROF_QUERY_EVAL,      // planning, evaluating and ranking one query
+    PROF_PRINT_RESULTS,   // printing the results of one query
+    PROF_N_PHASES,
+} prof_phase_t;
+
+/**
+ * Counted events
+ */
+typedef enum prof_counter {
+    PROF_MAP_GET = 0, // calls to map_get
+    PROF_MAP_PROBES,  // entries/slots compared against the key over all calls to map_get
+    PROF_SET_INSERT,  // calls to set_insert
+    PROF_N_COUNTERS,
+} prof_counter_t;
+
+/**
+ * @brief Read the monotonic clock
+ * @returns the current time in nanoseconds, from an arbitrary starting point
+ */
+static inline uint64_t prof_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * @brief Record that one run of `phase` took `ns` nanoseconds
+ */
+void prof_record(prof_phase_t phase, uint64_t ns);
+
+/**
+ * @brief Add `n` to a counter
+ */
+void prof_count(prof_counter_t counter, uint64_t n);
+
+/**
+ * @brief Reset all phases and counters to zero
+ */
+void prof_reset(void);
+
+/**
+ * @brief Write a human-readable report of all phases and counters, line by line
+ * @param writefn: called with each null-terminated line, including its trailing newline
+ * @note if instrumentation is compiled out, the report is a single line saying so
+ */
+void prof_report(void (*writefn)(const char *));
+
+#ifdef PROFILE
+#  define PROF_START(var)         const uint64_t var = prof_now_ns()
+#  define PROF_STOP(phase, var)   prof_record(phase, prof_now_ns() - (var))
+#  define PROF_COUNT(counter, n)  prof_count(counter, n)
+#else
+#  define PROF_START(var)         ((void) 0)
+#  define PROF_STOP(phase, var)   ((void) 0)
+#  define PROF_COUNT(counter, n)  ((void) 0)
+#endif /* PROFILE */
+
+#endif /* PROFILE_H */
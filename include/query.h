@@ -0,0 +1,77 @@
+/**
+ * @brief Parsing of search queries into an abstract syntax tree (AST)
+ *
+ * @details
+ * Implements a recursive descent parser for the grammar described in `doc/p2.md`:
+ *
+ * ```
+ * query   ::= andterm | andterm "&!" query
+ * andterm ::= orterm | orterm "&&" andterm
+ * orterm  ::= term | term "||" orterm
+ * term    ::= "(" query ")" | phrase | pattern | word
+ * phrase  ::= '"' word { word } '"'
+ * pattern ::= <alphanumeric string with one or more "*">
+ * word    ::= <alphanumeric string>
+ * ```
+ *
+ * A phrase matches documents where its words occur one right after the other, in order. A pattern matches
+ * documents with any term it matches, where each "*" stands for any number of characters, e.g. "comput*".
+ */
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "defs.h"
+#include "list.h"
+
+/**
+ * Type of operation represented by a node in the query AST
+ */
+typedef enum query_op {
+    QUERY_TERM = 0, /* leaf node, `term` is set */
+    QUERY_AND,      /* "&&" */
+    QUERY_OR,       /* "||" */
+    QUERY_ANDNOT,   /* "&!" */
+    QUERY_PHRASE,   /* '"' word word ... '"'. `left` is the first word, `right` the rest of the phrase */
+    QUERY_WILDCARD, /* leaf node, `term` is the pattern, e.g. "comput*" */
+} query_op_t;
+
+/**
+ * Type of query AST node. `query_node_t` is an alias for `struct query_node`
+ */
+typedef struct query_node query_node_t;
+struct query_node {
+    query_op_t op;
+    char *term;          // null-terminated word or pattern if `op` is QUERY_TERM or QUERY_WILDCARD, else NULL
+    query_node_t *left;  // left operand, NULL for leaf nodes
+    query_node_t *right; // right operand, NULL for leaf nodes
+};
+
+/**
+ * @brief Parse a list of query tokens into an AST
+ *
+ * @param tokens: ordered list of strings, as produced by tokenizing the query. Tokens may contain several
+ * words and operators, e.g. "a&&b", which are split by the parser.
+ * @param errbuf: Caller-provided buffer to write error messages to (min. buffer size = LINE_MAX)
+ *
+ * @returns the root of the parsed AST, or NULL if the query was malformed, in which case `errbuf` is set to a
+ * string with reasoning.
+ *
+ * @note the list of tokens is left as-is. The AST holds its own copies of any words.
+ */
+query_node_t *query_parse(list_t *tokens, char *errbuf);
+
+/**
+ * @brief Destroy a query AST, freeing all nodes and words
+ * @param node: root of the AST
+ * @note this is safe to call with `node` == NULL, where it simply returns
+ */
+void query_destroy(query_node_t *node);
+
+/**
+ * @returns the query-syntax representation of an operator, e.g. "&&" for QUERY_AND, '"' for QUERY_PHRASE or
+ * "*" for QUERY_WILDCARD
+ */
+const char *query_op_str(query_op_t op);
+
+#endif /* QUERY_H */
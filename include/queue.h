@@ -0,0 +1,74 @@
+/**
+ * @brief Bounded, blocking multi-producer multi-consumer queue joining the stages of a pipeline
+ *
+ * @details
+ * Each item is pushed with a weight, such as its size in bytes, and the total weight of the queued items is
+ * bounded. A producer pushing to a full queue waits until consumers have made room, which limits how far a
+ * stage may run ahead of the next (backpressure). A consumer waits until there is an item, or every producer
+ * is done.
+ *
+ * An item weighing more than the bound by itself is let through once the queue is empty, so it is delayed
+ * rather than rejected.
+ *
+ * All operations are thread-safe. Like the ADTs, the queue PANICS on failure to allocate memory.
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stddef.h> // for size_t
+
+/**
+ * Type of queue. `queue_t` is an alias for `struct queue`
+ */
+typedef struct queue queue_t;
+
+/**
+ * @brief Create a new, empty queue
+ * @param max_weight: upper bound on the total weight of the queued items
+ * @param n_producers: number of producers that will push to the queue, each calling `queue_producer_done`
+ * once it is done
+ * @returns A pointer to the newly created queue, or NULL on failure
+ */
+queue_t *queue_create(size_t max_weight, size_t n_producers);
+
+/**
+ * @brief Destroy the given queue
+ * @param queue: pointer to queue
+ * @param item_free: nullable. If present, called on any item still queued
+ * @note no thread may be pushing or popping. This is safe to call with `queue` == NULL, where it simply
+ * returns
+ */
+void queue_destroy(queue_t *queue, void (*item_free)(void *));
+
+/**
+ * @brief Add an item last, waiting for room if the queue is full
+ * @param queue: pointer to queue
+ * @param item: non-NULL item
+ * @param weight: weight of the item, counted against the bound of the queue until it is popped
+ * @returns 0 on success, or -1 if the queue is cancelled. The item is then still owned by the caller.
+ */
+int queue_push(queue_t *queue, void *item, size_t weight);
+
+/**
+ * @brief Remove the first item, waiting for one if the queue is empty
+ * @param queue: pointer to queue
+ * @returns the item, or NULL once the queue is empty and every producer is done, or the queue is cancelled
+ */
+void *queue_pop(queue_t *queue);
+
+/**
+ * @brief Signal that one of the producers will not push any more items. Once all producers are done,
+ * consumers waiting on an empty queue are woken up, and get NULL.
+ * @param queue: pointer to queue
+ */
+void queue_producer_done(queue_t *queue);
+
+/**
+ * @brief Cancel the queue: every waiting and future push fails, and every waiting and future pop returns
+ * NULL. The items still queued are left for `queue_destroy`.
+ * @param queue: pointer to queue
+ */
+void queue_cancel(queue_t *queue);
+
+#endif /* QUEUE_H */
@@ -0,0 +1,58 @@
+/**
+ * @brief Serve queries to many clients at once over TCP, with an event loop and a pool of workers
+ *
+ * @details
+ * The protocol is line-based: a client sends one request per line, and gets one reply per request, in the
+ * order the requests were sent. Each reply is the text rendered for its request, followed by an empty line
+ * which ends it. Empty lines are ignored, and get no reply.
+ *
+ * A client may send many requests without waiting for their replies (pipelining). Requests are run by the
+ * workers as soon as they arrive, several of the same connection at a time, and their replies are held back
+ * until those of every earlier request of the connection are sent.
+ *
+ * One thread runs the event loop (epoll), which accepts connections, splits what they send into requests,
+ * and writes the replies, never blocking on any one client. The requests themselves are run by the workers,
+ * through a handler given by the user.
+ *
+ * A connection sending a line that does not fit in LINE_MAX bytes, newline included, is closed once the
+ * replies to its earlier requests are sent.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h> // for size_t
+
+/**
+ * Type of query server. `server_t` is an alias for `struct server`
+ */
+typedef struct server server_t;
+
+/**
+ * Function type of a handler of requests
+ * @param request: the line of the request, without its newline. May be modified by the handler.
+ * @param arg: the argument given to server_start
+ * @returns the null-terminated reply, allocated with malloc. NULL replies with nothing but the empty line.
+ * @note called by several workers at once
+ */
+typedef char *(*server_handler_fn)(char *request, void *arg);
+
+/**
+ * @brief Start serving requests on threads of the server
+ * @param addr: address to listen on, see net.h
+ * @param n_workers: number of workers running requests
+ * @param handler: run for each request, on a worker
+ * @param arg: passed to every call of handler
+ * @returns A pointer to the new server, or NULL on failure
+ */
+server_t *server_start(const char *addr, size_t n_workers, server_handler_fn handler, void *arg);
+
+/**
+ * @brief Stop the server, closing every connection and waiting for requests in progress to finish, then
+ * destroy it
+ * @param server: pointer to server
+ * @note This is safe to call with `server` == NULL, where it simply returns
+ */
+void server_stop(server_t *server);
+
+#endif /* SERVER_H */
@@ -0,0 +1,112 @@
+/**
+ * @brief Serve an index over the network as one shard of a larger collection, and query a set of such shards
+ * as if they were one index
+ *
+ * @details
+ * The documents of a collection are split between the shards, with each document in exactly one of them.
+ * A shard server answers requests for its index over TCP, one thread per connection. The coordinator parses
+ * a query once, then sends the binary form of its AST to every shard in two rounds:
+ * 1. Each shard replies with its statistics for the query (see index_query_stats), which are summed.
+ * 2. Each shard ranks its matches by the summed statistics, and replies with its top k.
+ *
+ * As every shard ranks by the statistics of the whole collection, the scores of their results compare just
+ * as if the collection was one index, and the top k of the collection are the k best of the results of the
+ * shards. Each round is sent to all shards before any reply is read, so the shards work in parallel.
+ *
+ * Messages are framed by their length, and all integers are little-endian:
+ * ```
+ * message ::= u32 length, u8 type, payload           (length counts the type and payload)
+ * string  ::= u16 length, bytes
+ * query   ::= u8 op, (string term | query left, query right)   (a term for QUERY_TERM and QUERY_WILDCARD)
+ * stats   ::= u64 n_docs, u64 total_length, u32 n_terms, n_terms x (string term, u64 n_docs)
+ * ```
+ * Requests and their replies, where any request may instead be replied to with `ERROR string`:
+ * - `STATS query` => `STATS_REPLY stats`
+ * - `SEARCH u64 k, stats, query` => `RESULTS u64 n_matches, u8 exact, u32 n, n x (f64 score, string doc_name)`
+ * - `INFO` => `INFO_REPLY u64 n_docs, u64 n_terms`
+ *
+ * A shard closes any connection that sends a malformed message.
+ */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h> // for size_t
+
+#include "list.h"
+#include "index.h"
+
+/**
+ * Type of shard server. `shard_server_t` is an alias for `struct shard_server`
+ */
+typedef struct shard_server shard_server_t;
+
+/**
+ * Type of coordinator. `coordinator_t` is an alias for `struct coordinator`
+ */
+typedef struct coordinator coordinator_t;
+
+/**
+ * @brief Start serving the index to coordinators, on a thread of the server
+ * @param index: pointer to index. Borrowed until the server is stopped, and queried concurrently.
+ * @param addr: address to listen on, see net.h
+ * @returns A pointer to the new server, or NULL on failure
+ */
+shard_server_t *shard_server_start(index_t *index, const char *addr);
+
+/**
+ * @brief Stop the server, closing every connection and waiting for requests in progress to finish, then
+ * destroy it
+ * @param server: pointer to server
+ * @note This is safe to call with `server` == NULL, where it simply returns
+ */
+void shard_server_stop(shard_server_t *server);
+
+/**
+ * @brief Create a coordinator of the given shards, connecting to each of them once to check that they are up
+ * @param addrs: comma-separated addresses of the shard servers, e.g. "node1:7000,node2:7000"
+ * @returns A pointer to the new coordinator, or NULL on failure
+ * @note Connections are kept open between queries. Concurrent queries each use connections of their own.
+ */
+coordinator_t *coordinator_create(const char *addrs);
+
+/**
+ * @brief Destroy the coordinator, closing its connections
+ * @param coord: pointer to coordinator
+ * @note This is safe to call with `coord` == NULL, where it simply returns
+ */
+void coordinator_destroy(coordinator_t *coord);
+
+/**
+ * @brief Same as index_query_topk, for the collection made up of the documents of every shard
+ *
+ * @param coord: pointer to coordinator
+ * @param query_tokens: ordered list of strings representing individual query tokens
+ * @param k: maximum number of results to return. 0 => all matching documents.
+ * @param n_matches: nullable. If present, set to the total number of matching documents of all shards, which
+ * is a lower bound if it is for any of them (see match_count_t).
+ * @param errbuf: Caller-provided buffer to write error messages to (min. buffer size = LINE_MAX)
+ *
+ * @returns NULL if the query was malformed, any shard rejected it or a shard could not be reached, otherwise
+ * a list of `query_result_t`, just as index_query_topk
+ *
+ * @note Safe for concurrent queries.
+ */
+list_t *coordinator_query_topk(
+    coordinator_t *coord,
+    list_t *query_tokens,
+    size_t k,
+    match_count_t *n_matches,
+    char *errbuf
+);
+
+/**
+ * @brief Get the number of documents of all shards
+ * @param coord: pointer to coordinator
+ * @param n_docs: set to the sum of the number of documents of each shard
+ * @param n_shards: set to the number of shards
+ * @returns 0 on success, or -1 if a shard could not be reached
+ */
+int coordinator_stat(coordinator_t *coord, size_t *n_docs, size_t *n_shards);
+
+#endif /* SHARD_H */
@@ -0,0 +1,76 @@
+/**
+ * @brief Sorted, front-coded dictionary of strings, for prefix lookups
+ *
+ * @details
+ * Holds a fixed set of distinct strings in ascending (strcmp) order, each with a value. Consecutive strings
+ * of a sorted set tend to share a long prefix, so each one is stored as the length of the prefix it shares
+ * with the string before it, followed by the rest of it. Every TERMDICT_BLOCK_SIZE strings, one is stored in
+ * full, such that lookups start at the nearest of these rather than at the first string.
+ *
+ * Finding every string with a given prefix takes a binary search of the full strings, then a scan of the
+ * strings from there, so it costs O(log n + length of prefix + number of matches).
+ *
+ * @note
+ * Like the ADTs, the dictionary PANICS on failure to allocate memory.
+ */
+
+#ifndef TERMDICT_H
+#define TERMDICT_H
+
+#include <stddef.h> // for size_t
+
+/**
+ * Type of dictionary. `termdict_t` is an alias for `struct termdict`
+ */
+typedef struct termdict termdict_t;
+
+/**
+ * @brief Called with each string of a prefix lookup, in ascending order
+ * @param str: the null-terminated string, only valid until the function returns
+ * @param val: the value of the string
+ * @param arg: the argument given to termdict_prefix
+ * @returns 0 to go on to the next string, otherwise the lookup stops
+ */
+typedef int (*termdict_fn)(const char *str, void *val, void *arg);
+
+/**
+ * @brief Create a dictionary of the given strings
+ * @param strs: distinct strings, in ascending strcmp order. Copied into the dictionary.
+ * @param vals: nullable. The value of each string, if present, otherwise each value is NULL.
+ * @param n: number of strings
+ * @returns A pointer to the new dictionary
+ */
+termdict_t *termdict_create(const char **strs, void **vals, size_t n);
+
+/**
+ * @brief Destroy the dictionary. The values are left as they were.
+ * @param dict: pointer to dictionary
+ * @note this is safe to call with `dict` == NULL, where it simply returns
+ */
+void termdict_destroy(termdict_t *dict);
+
+/**
+ * @brief Get the number of strings of the dictionary
+ * @param dict: pointer to dictionary
+ */
+size_t termdict_length(termdict_t *dict);
+
+/**
+ * @brief Get the number of bytes used by the dictionary, including the values
+ * @param dict: pointer to dictionary
+ */
+size_t termdict_size(termdict_t *dict);
+
+/**
+ * @brief Call `fn` with every string of the dictionary that starts with `prefix`, in ascending order
+ * @param dict: pointer to dictionary
+ * @param prefix: string to look up. Does not need to be null-terminated.
+ * @param len: length of prefix, in bytes. 0 => visit every string.
+ * @param fn: called with each string
+ * @param arg: nullable. Passed as is to `fn`
+ * @returns the number of strings `fn` was called with
+ * @note the dictionary does not change once created, so any number of threads may look up strings at once
+ */
+size_t termdict_prefix(termdict_t *dict, const char *prefix, size_t len, termdict_fn fn, void *arg);
+
+#endif /* TERMDICT_H */
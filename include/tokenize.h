@@ -10,10 +10,24 @@
 
 #include "defs.h"
 #include "list.h"
+#include "arena.h"
+#include "intern.h"
 
 /* max size of tokens produced by `tokenize_*`, in bytes */
 #define TOKEN_SIZE_MAX 1024
 
+/* SETTING: bytes read at a time by the streaming tokenizers. Bounds their memory, whatever the file size */
+#define TOKENIZE_CHUNK_SIZE (64 * 1024)
+
+/**
+ * @brief Called by the streaming tokenizer with each token, in the order they appear
+ * @param token: null-terminated token. Only valid for the duration of the call, but may be modified.
+ * @param len: length of token, excluding the null terminator
+ * @param arg: the argument given to the tokenizer
+ * @returns 0 to continue, or a negative error code to stop tokenizing
+ */
+typedef int (*token_fn)(char *token, size_t len, void *arg);
+
 /**
  * @brief Powerful and versatile utility to read, filter, delimit and/or convert strings. Designed to be
  * used with the characters manipulation functions available through `<ctype.h>`. Supports
@@ -51,7 +65,8 @@ int tokenize_string(
  * @brief Powerful and versatile utility to read, filter, delimit and/or convert file content. Designed to be
  * used with the characters manipulation functions available through `<ctype.h>`.
  *
- * Same as tokenize_string, but for reading a stream (file) at the same time.
+ * Same as tokenize_string, but for reading a stream (file) at the same time. The stream is read in chunks of
+ * TOKENIZE_CHUNK_SIZE, never all at once.
  *
  * See
  * [ctype.h docs](https://www.ibm.com/docs/en/aix/7.3?topic=libraries-list-character-manipulation-subroutines)
@@ -72,6 +87,9 @@ int tokenize_string(
  * @returns 0 on success, otherwise a negative error code: -1 = critical, -2 = file exits but read failed
  *
  * @note in the event of an error, the given list is returned to its initial state
+ * @note the file tokenizers have a fast path for `isspace`, `is_ascii_alnum` and `tolower` with a
+ * `min_token_len` of at least 1, which classifies the content 64 bytes at a time (with SSE2/AVX2 where
+ * available) instead of calling the functions on each byte. The tokens are the same.
  */
 int tokenize_file(
     FILE *f,
@@ -82,4 +100,93 @@ int tokenize_file(
     int (*transformfn)(int)
 );
 
+/**
+ * @brief Same as tokenize_file, but hands each token to `emitfn` as soon as it is complete instead of
+ * collecting them in a list. Memory use is constant in the size of the file: one chunk and one token.
+ *
+ * Produces exactly the same tokens as tokenize_file for the same functions. Tokens straddling the boundary
+ * between two chunks are carried over and emitted whole.
+ *
+ * @param fpath: path to file
+ * @param emitfn: called with each token
+ * @param arg [nullable]: passed as is to `emitfn`
+ * @param min_token_len: ommit tokens of a length lower than this
+ * @param splitfn: see tokenize_file
+ * @param filterfn [nullable]: see tokenize_file
+ * @param transformfn [nullable]: see tokenize_file
+ *
+ * @returns 0 on success, otherwise a negative error code: -1 = critical, -2 = failed to open/read the file,
+ * or the error code returned by `emitfn`
+ *
+ * @note tokens emitted before an error are not reverted. It is up to the caller to discard them if needed.
+ */
+int tokenize_file_stream(
+    const char *fpath,
+    token_fn emitfn,
+    void *arg,
+    size_t min_token_len,
+    int (*splitfn)(int),
+    int (*filterfn)(int),
+    int (*transformfn)(int)
+);
+
+/**
+ * @brief Same as tokenize_file_stream, but for content already in memory
+ *
+ * @param buf: content to tokenize. Need not be null-terminated, but a null byte still ends the content.
+ * @param size: size of buf in bytes
+ * @param emitfn: called with each token
+ * @param arg [nullable]: passed as is to `emitfn`
+ * @param min_token_len: ommit tokens of a length lower than this
+ * @param splitfn: see tokenize_file
+ * @param filterfn [nullable]: see tokenize_file
+ * @param transformfn [nullable]: see tokenize_file
+ *
+ * @returns 0 on success, otherwise the error code returned by `emitfn`
+ *
+ * @note tokens emitted before an error are not reverted
+ */
+int tokenize_buffer_stream(
+    const char *buf,
+    size_t size,
+    token_fn emitfn,
+    void *arg,
+    size_t min_token_len,
+    int (*splitfn)(int),
+    int (*filterfn)(int),
+    int (*transformfn)(int)
+);
+
+/**
+ * @brief Same as tokenize_file, but maps the file into memory instead of reading it into a buffer, and
+ * writes the tokens to an arena instead of allocating each of them.
+ *
+ * Produces exactly the same tokens as tokenize_file for the same functions.
+ *
+ * @param fpath: path to file
+ * @param list: pointer to list. Any tokens will be added last to the list, in the order they appear
+ * in the file.
+ * @param arena: pointer to arena. Holds the tokens added to `list`, which must not be freed individually.
+ * @param interner [nullable]: If present, the canonical copy of each token is added to `list` instead, and
+ * `arena` is only used as scratch space while building tokens.
+ * @param min_token_len: ommit tokens of a length lower than this
+ * @param splitfn: see tokenize_file
+ * @param filterfn [nullable]: see tokenize_file
+ * @param transformfn [nullable]: see tokenize_file
+ *
+ * @returns 0 on success, otherwise a negative error code: -1 = critical, -2 = failed to open/map the file
+ *
+ * @note in the event of an error, the given list is returned to its initial state
+ */
+int tokenize_file_mmap(
+    const char *fpath,
+    list_t *list,
+    arena_t *arena,
+    interner_t *interner,
+    size_t min_token_len,
+    int (*splitfn)(int),
+    int (*filterfn)(int),
+    int (*transformfn)(int)
+);
+
 #endif /* TOKENIZE_H */
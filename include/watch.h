@@ -0,0 +1,74 @@
+/**
+ * @brief Watch a directory tree for changes to its files, using inotify
+ *
+ * @details
+ * Every directory of the tree is watched, including those created or moved into it later. Each change to a
+ * file is handed to a callback on a thread of the watcher, one at a time, in the order they happened:
+ * - a file is written to and closed, or moved into the tree: WATCH_FILE_CHANGED
+ * - a file is deleted, or moved out of the tree: WATCH_FILE_REMOVED
+ * - a directory is deleted, or moved out of the tree: WATCH_DIR_REMOVED
+ *
+ * A directory moved into the tree is reported as a change to each of its files, and one moved within it as
+ * the removal of the old directory, then a change to each file at the new path. Files are filtered by
+ * extension just like find_files does.
+ *
+ * Changes are queued by the kernel from the moment the watcher is created, until it is started. If more pile
+ * up than the kernel is willing to queue, the rest are lost with a warning.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "set.h"
+
+/**
+ * Type of watcher. `watch_t` is an alias for `struct watch`
+ */
+typedef struct watch watch_t;
+
+/**
+ * Kind of change to the watched tree
+ */
+typedef enum watch_event {
+    WATCH_FILE_CHANGED,
+    WATCH_FILE_REMOVED,
+    WATCH_DIR_REMOVED,
+} watch_event_t;
+
+/**
+ * @brief Called by the watcher thread with each change to the watched tree
+ * @param path: path of the file or directory, owned by the callee from this point. Paths are formed from the
+ * directory given to watch_create, like those of find_files. Directory paths end with a '/'.
+ * @param arg: the argument given to watch_create
+ */
+typedef void (*watch_fn)(watch_event_t event, char *path, void *arg);
+
+/**
+ * @brief Start watching every directory at `dir_path` for changes. They are not handed to `fn` until
+ * watch_start.
+ * @param valid_exts: nullable. If present, only changes to files with a extension in this set are reported.
+ * Borrowed until the watcher is destroyed.
+ * @param fn: called with each change
+ * @param arg: nullable. Passed as is to `fn`
+ * @returns A pointer to the new watcher, or NULL on failure
+ * @note Directories that cannot be watched, such as once the limit of watches of the user is reached, are
+ * skipped with a warning.
+ */
+watch_t *watch_create(const char *dir_path, set_t *valid_exts, watch_fn fn, void *arg);
+
+/**
+ * @brief Start the thread that hands changes to the callback of the watcher
+ * @param watch: pointer to watcher
+ * @returns 0 on success, otherwise a negative error code
+ */
+int watch_start(watch_t *watch);
+
+/**
+ * @brief Stop the watcher, waiting for the callback to return if it is running, then destroy it. Changes not
+ * yet handed to the callback are dropped.
+ * @param watch: pointer to watcher
+ * @note This is safe to call with `watch` == NULL, where it simply returns
+ */
+void watch_destroy(watch_t *watch);
+
+#endif /* WATCH_H */
@@ -6,6 +6,10 @@
  * @implements list.h
  *
  * @brief doubly linked list implementation with merge sort
+ *
+ * @details
+ * The nodes of each list are allocated from a pool of its own (see pool.h), and are all released at once by
+ * list_destroy.
  */
 
 #include <stdlib.h>
@@ -13,6 +17,8 @@
 #include "printing.h"
 #include "defs.h"
 #include "list.h"
+#include "memstat.h"
+#include "pool.h"
 
 
 typedef struct lnode lnode_t;
@@ -27,6 +33,7 @@ struct list {
     lnode_t *rightmost;
     size_t length;
     cmp_fn cmpfn;
+    pool_t nodes;
 };
 
 struct list_iter {
@@ -35,12 +42,9 @@ struct list_iter {
 };
 
 
-static lnode_t *newnode(void *item) {
-    lnode_t *node = malloc(sizeof(lnode_t));
-    if (!node) {
-        pr_error("Cannot allocate memory\n");
-        return NULL;
-    }
+static inline lnode_t *newnode(list_t *list, void *item) {
+    lnode_t *node = pool_alloc(&list->nodes);
+
     node->right = NULL;
     node->left = NULL;
     node->item = item;
@@ -54,11 +58,13 @@ list_t *list_create(cmp_fn cmpfn) {
         pr_error("Cannot allocate memory\n");
         return NULL;
     }
+    MEM_ALLOC(MEM_LIST, sizeof(list_t));
 
     list->leftmost = NULL;
     list->rightmost = NULL;
     list->length = 0;
     list->cmpfn = cmpfn;
+    pool_init(&list->nodes, sizeof(lnode_t), MEM_LIST);
 
     return list;
 }
@@ -67,15 +73,16 @@ void list_destroy(list_t *list, free_fn item_free) {
     if (!list) {
         return;
     }
-    while (list->leftmost != NULL) {
-        lnode_t *right = list->leftmost->right;
-        if (item_free) {
-            item_free(list->leftmost->item);
+
+    if (item_free) {
+        for (lnode_t *node = list->leftmost; node != NULL; node = node->right) {
+            item_free(node->item);
         }
-        free(list->leftmost);
-        list->leftmost = right;
     }
 
+    /* every node goes with the slabs of the pool */
+    pool_release(&list->nodes);
+    MEM_FREE(MEM_LIST, sizeof(list_t));
     free(list);
 }
 
@@ -84,10 +91,7 @@ size_t list_length(list_t *list) {
 }
 
 int list_addfirst(list_t *list, void *item) {
-    lnode_t *node = newnode(item);
-    if (node == NULL) {
-        return -1;
-    }
+    lnode_t *node = newnode(list, item);
 
     if (list->leftmost == NULL) {
         list->leftmost = list->rightmost = node;
@@ -102,10 +106,7 @@ int list_addfirst(list_t *list, void *item) {
 }
 
 int list_addlast(list_t *list, void *item) {
-    lnode_t *node = newnode(item);
-    if (node == NULL) {
-        return -1;
-    }
+    lnode_t *node = newnode(list, item);
 
     if (list->leftmost == NULL) {
         list->leftmost = list->rightmost = node;
@@ -137,7 +138,7 @@ void *list_popfirst(list_t *list) {
     }
 
     list->length--;
-    free(tmp);
+    pool_free(&list->nodes, tmp);
 
     return item;
 }
@@ -159,7 +160,7 @@ void *list_poplast(list_t *list) {
     }
 
     list->length--;
-    free(tmp);
+    pool_free(&list->nodes, tmp);
 
     return item;
 }
@@ -197,7 +198,7 @@ void *list_remove(list_t *list, void *item) {
         node->right->left = node->left;
     }
 
-    free(node);
+    pool_free(&list->nodes, node);
 
     return found;
 }
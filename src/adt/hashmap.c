@@ -5,6 +5,11 @@
  * @implements map.h
  * 
  * @brief Hash map with separate chaining.
+ *
+ * @details
+ * Each node holds its entry, and is allocated from a pool of the map (see pool.h), so an insertion takes a
+ * single object from the pool. The nodes are all released at once by map_destroy. An entry that is handed
+ * to the caller, by map_remove or map_insert, is copied to a malloc'ed entry_t of its own.
  */
 
 #include <stdint.h>
@@ -15,6 +20,9 @@
 #include "defs.h"
 #include "common.h"
 #include "map.h"
+#include "profile.h"
+#include "memstat.h"
+#include "pool.h"
 
 
 /* how many buckets each map should start with */
@@ -32,7 +40,7 @@
 
 typedef struct mnode mnode_t;
 struct mnode {
-    entry_t *entry;
+    entry_t entry;
     mnode_t *overflow; // points to overflow entry if a collision occurs
 };
 
@@ -43,6 +51,7 @@ struct map {
     size_t capacity;
     size_t length;
     size_t rehash_threshold;
+    pool_t nodes;
 };
 
 /**
@@ -102,7 +111,7 @@ static inline int map_resize(map_t *map, size_t new_capacity) {
         /* iterate over the node & overflow chain */
         while (node) {
             mnode_t *next = node->overflow; // tmp
-            size_t i_new = map->hashfn(node->entry->key) % new_capacity;
+            size_t i_new = map->hashfn(node->entry.key) % new_capacity;
 
             node->overflow = new_buckets[i_new]; // NULL if no chain
             new_buckets[i_new] = node;           // set as new head of chain
@@ -116,6 +125,7 @@ static inline int map_resize(map_t *map, size_t new_capacity) {
 
     /* free old buckets */
     free(map->buckets);
+    MEM_RESIZE(MEM_MAP, map->capacity * sizeof(mnode_t *), new_capacity * sizeof(mnode_t *));
 
     // pr_info("{ c: %zu, t: %zu }", map->capacity, map->rehash_threshold);
 
@@ -142,11 +152,14 @@ map_t *map_create(cmp_fn cmpfn, hash64_fn hashfn) {
         return NULL;
     }
 
+    MEM_RECORD(MEM_MAP, sizeof(map_t) + N_BUCKETS_INITIAL * sizeof(mnode_t *), 2);
+
     map->cmpfn = cmpfn;
     map->hashfn = hashfn;
     map->length = 0;
     map->capacity = N_BUCKETS_INITIAL;
     map->rehash_threshold = calc_rehash_threshold(N_BUCKETS_INITIAL);
+    pool_init(&map->nodes, sizeof(mnode_t), MEM_MAP);
 
     return map;
 }
@@ -155,71 +168,66 @@ void map_destroy(map_t *map, free_fn key_freefn, free_fn val_freefn) {
     if (!map) {
         return;
     }
-    mnode_t *node;
 
-    /* iterate over all buckets */
-    for (size_t i = 0; i < map->capacity; i++) {
-        node = map->buckets[i];
-
-        /* iterate over the node & overflow chain */
-        while (node) {
-            mnode_t *next = node->overflow;
-
-            if (key_freefn) {
-                key_freefn(node->entry->key);
-            }
-            if (val_freefn) {
-                val_freefn(node->entry->val);
+    /* only visit the nodes if there is something to free, the nodes themselves go with the pool */
+    if (key_freefn || val_freefn) {
+        for (size_t i = 0; i < map->capacity; i++) {
+            for (mnode_t *node = map->buckets[i]; node; node = node->overflow) {
+                if (key_freefn) {
+                    key_freefn(node->entry.key);
+                }
+                if (val_freefn) {
+                    val_freefn(node->entry.val);
+                }
             }
-
-            free(node->entry);
-            free(node);
-
-            node = next;
         }
     }
 
+    pool_release(&map->nodes);
+    MEM_RECORD(MEM_MAP, -(int64_t) (sizeof(map_t) + map->capacity * sizeof(mnode_t *)), -2);
     free(map->buckets);
     free(map);
 }
 
+/**
+ * Copy an entry to a malloc'ed entry_t, to be owned by the caller
+ */
+static entry_t *copy_entry(entry_t *entry) {
+    entry_t *copy = malloc(sizeof(entry_t));
+    if (!copy) {
+        PANIC("Failed to allocate memory\n");
+    }
+    *copy = *entry;
+
+    return copy;
+}
+
 size_t map_length(map_t *map) {
     return map->length;
 }
 
 entry_t *map_insert(map_t *map, void *key, void *val) {
-    /* Allocate a new entry to be inserted */
-    entry_t *entry = malloc(sizeof(entry_t));
-    if (!entry) {
-        PANIC("Failed to allocate memory\n");
-    }
-
-    /* initialize the new entry */
-    entry->key = key;
-    entry->val = val;
-
     size_t bucket_i = map->hashfn(key) % map->capacity;
     mnode_t *head = map->buckets[bucket_i];
     mnode_t *curr = head;
 
     while (curr) {
-        if (map->cmpfn(key, curr->entry->key) == 0) {
-            /* already present, swap entries and return old entry */
-            entry_t *old_entry = curr->entry;
-            curr->entry = entry;
+        if (map->cmpfn(key, curr->entry.key) == 0) {
+            /* already present, hand a copy of the old entry to the caller and replace it */
+            entry_t *old_entry = copy_entry(&curr->entry);
+            curr->entry.key = key;
+            curr->entry.val = val;
 
             return old_entry;
         }
         curr = curr->overflow;
     }
 
-    /* Key is not present in the map. Allocate a new node as well. */
-    mnode_t *new_node = malloc(sizeof(mnode_t));
-    if (new_node == NULL) {
-        PANIC("Failed to allocate memory\n");
-    }
+    /* Key is not present in the map. Allocate a new node for it. */
+    mnode_t *new_node = pool_alloc(&map->nodes);
 
-    new_node->entry = entry;
+    new_node->entry.key = key;
+    new_node->entry.val = val;
     new_node->overflow = head; // NULL if there was no collission
 
     map->buckets[bucket_i] = new_node; // set as new head of chain
@@ -246,7 +254,7 @@ entry_t *map_remove(map_t *map, void *key) {
 
     mnode_t *prev = NULL;
 
-    while (node && (map->cmpfn(node->entry->key, key) != 0)) {
+    while (node && (map->cmpfn(node->entry.key, key) != 0)) {
         prev = node;
         node = node->overflow;
     }
@@ -261,8 +269,8 @@ entry_t *map_remove(map_t *map, void *key) {
         prev->overflow = node->overflow; // fix previous' overflow pointer
     }
 
-    entry_t *entry = node->entry;
-    free(node);
+    entry_t *entry = copy_entry(&node->entry);
+    pool_free(&map->nodes, node);
     map->length--;
 
     return entry;
@@ -272,9 +280,13 @@ entry_t *map_get(map_t *map, void *key) {
     size_t bucket_i = map->hashfn(key) % map->capacity;
     mnode_t *node = map->buckets[bucket_i];
 
+    PROF_COUNT(PROF_MAP_GET, 1);
+
     while (node) {
-        if (map->cmpfn(node->entry->key, key) == 0) {
-            return node->entry;
+        PROF_COUNT(PROF_MAP_PROBES, 1);
+
+        if (map->cmpfn(node->entry.key, key) == 0) {
+            return &node->entry;
         }
         node = node->overflow;
     }
@@ -326,10 +338,9 @@ entry_t *map_next(map_iter_t *iter) {
     }
 
     assert(curr);
-    assert(curr->entry);
 
     iter->next = curr->overflow;
     iter->n_remaining -= 1;
 
-    return curr->entry;
+    return &curr->entry;
 }
@@ -6,9 +6,20 @@
 #define LOG_LEVEL LOG_LEVEL_DEBUG
 
 #include <stdlib.h>
+#include <malloc.h> // for malloc_trim
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
+#include <math.h>
+#include <errno.h>
 #include <limits.h> // for LINE_MAX
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "printing.h"
 #include "index.h"
@@ -16,14 +27,286 @@
 #include "common.h"
 #include "list.h"
 #include "map.h"
-#include "set.h"
+#include "query.h"
+#include "intern.h"
+#include "cache.h"
+#include "termdict.h"
+#include "perfhash.h"
+#include "profile.h"
+#include "memstat.h"
 
 
+/* how many entries the table of documents starts with */
+#define DOCS_CAPACITY_INITIAL 64
+
+/* how many bytes a postings buffer starts with */
+#define POSTINGS_CAPACITY_INITIAL 8
+
+/* max number of bytes of a varint encoded 32-bit integer */
+#define VARINT_MAX_BYTES 5
+
+/**
+ * SETTING: index_needs_compaction once the removed documents still taking up space in the postings amount to
+ * this fraction of the live documents
+ */
+#define INDEX_COMPACT_RATIO 0.1
+
+/* SETTING: number of terms index_compact rewrites per hold of the write lock, which stalls queries */
+#define INDEX_COMPACT_BATCH 1024
+
+/**
+ * SETTING: number of documents between the skip entries of the positions of a term. Lower lets phrase queries
+ * jump closer to the documents they check, at the cost of more memory for each term.
+ */
+#define POSITIONS_SKIP_INTERVAL 64
+
+/**
+ * SETTING: "&&" of two operands merges their blocks when the longer one is at most this many times longer
+ * than the shorter one. Above it, the shorter one leads and the longer one gallops to each of its matches.
+ */
+#define INTERSECT_GALLOP_RATIO 32
+
+/**
+ * SETTING: number of ids each cursor of a query has at hand (see match_cursor_t). A term decodes this many of
+ * its postings at a time, and an operator produces this many matches before its parent reads any of them.
+ */
+#define MATCH_BLOCK_LEN 128
+
+/**
+ * SETTING: most terms a pattern of a query may match. Each is scored as a term of its own, so patterns that
+ * match more, such as "a*", are rejected rather than tying up a query thread.
+ */
+#define WILDCARD_MAX_TERMS 4096
+
+/**
+ * SETTING: terms in at least this many documents also get their ids as containers (see containers_t), which
+ * queries read instead of their postings. A term in fewer documents has no chunk dense enough for a bitmap.
+ */
+#define CONTAINER_MIN_DOCS 4096
+
+/**
+ * Dense document identifier, assigned in the order documents are indexed.
+ * Doubles as the index into the table of document names. Ids of removed documents are never reused.
+ */
+typedef uint32_t docid_t;
+
+/**
+ * Postings of a single term: the strictly ascending ids of all documents containing the term, each followed
+ * by the number of occurrences of the term in that document (term frequency, tf).
+ * The ids are stored as the difference (delta) to the previous id. Both deltas and frequencies are encoded
+ * as varints.
+ */
+typedef struct postings {
+    uint8_t *buf;
+    size_t n_bytes;
+    size_t capacity;
+    size_t n_docs;    // number of ids in buf, i.e. the document frequency of the term
+    docid_t last_id;  // last id in buf, needed to encode the next delta
+    uint32_t last_tf; // tf of the last id, which is always the last varint of buf
+    uint32_t max_tf;  // highest tf of any document
+    struct positions *positions; // NULL unless the index stores positions
+    _Atomic(struct containers *) containers; // NULL until a query needs them, and again once the postings change
+} postings_t;
+
+/**
+ * Entry of the skip list of the positions of a term. Marks where the (delta, tf) pair of a document starts in
+ * the postings, and where its positions start, so that a phrase query can jump there without decoding the
+ * documents before it.
+ */
+typedef struct skip {
+    docid_t last_id; // id of the document before it, which the delta of the pair is relative to
+    uint32_t reserved;
+    uint64_t postings_off;
+    uint64_t positions_off;
+} skip_t;
+
+/**
+ * Positions of a single term: for each document of its postings, in the same order, the position (index
+ * among the terms of the document) of each of its tf occurrences. The first position of a document is
+ * stored as is, the rest as the difference to the one before. All are encoded as varints.
+ *
+ * Kept apart from the postings, so that only phrase queries ever read them. A skip entry is added every
+ * POSITIONS_SKIP_INTERVAL documents, and wherever other positions were appended by a merge.
+ */
+typedef struct positions {
+    uint8_t *buf;
+    size_t n_bytes;
+    size_t capacity;
+    uint32_t last_pos; // last position of the last document, needed to encode the next one
+    skip_t *skips;
+    size_t n_skips;
+    size_t skips_capacity;
+} positions_t;
+
+/**
+ * Read-only view of encoded postings, either of a `postings_t` or of the postings in an index file
+ */
+typedef struct postings_view {
+    const uint8_t *buf;
+    size_t n_bytes;
+    size_t n_docs;
+    uint32_t max_tf;
+    const struct containers *containers; // NULL unless the term is in at least CONTAINER_MIN_DOCS documents
+} postings_view_t;
+
+/**
+ * Read-only view of encoded positions, either of a `positions_t` or of the positions in an index file
+ */
+typedef struct positions_view {
+    const uint8_t *buf;
+    size_t n_bytes;
+    const skip_t *skips;
+    size_t n_skips;
+} positions_view_t;
+
+/**
+ * Strictly ascending array of document ids, in a single allocation. The matches of a query are kept this way
+ * in the query cache.
+ */
+typedef struct cached_docids {
+    size_t len;
+    docid_t ids[];
+} cached_docids_t;
+
+static size_t cached_docids_size(const void *cached) {
+    return sizeof(cached_docids_t) + ((const cached_docids_t *) cached)->len * sizeof(docid_t);
+}
+
+/* describes who owns the terms given to index_terms */
+typedef enum term_owner {
+    TERMS_OWNED = 0, // heap strings owned by the index
+    TERMS_BORROWED,  // strings owned by the caller
+    TERMS_INTERNED,  // canonical strings of the interner of the index
+} term_owner_t;
+
+/* SETTING: version of the index file layout. Bump whenever the layout changes. */
+#define INDEX_FILE_VERSION 3
+
+/* first bytes of any index file */
+static const char index_file_magic[8] = "INDEXER";
+
+/**
+ * Header of an index file. All offsets are in bytes from the start of the file, all integers are in the
+ * native byte order of the machine that wrote the file.
+ *
+ * The file consists of the following sections, each 8-byte aligned:
+ * - `n_terms` x `file_term_t`, sorted by term (strcmp), so a term is found by binary search
+ * - `n_docs` x `file_doc_t`, indexed by docid_t
+ * - the string pool: null-terminated terms and document names
+ * - the postings of all terms back to back, encoded just as in memory
+ *
+ * If the index stores positions, two more sections follow:
+ * - `n_terms` x `file_positions_t`, in the same order as the term dictionary
+ * - the positions of each term, 8-byte aligned: its skip entries, followed by its encoded positions
+ */
+typedef struct file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t file_size;
+    uint64_t n_docs;
+    uint64_t n_terms;
+    uint64_t terms_off;
+    uint64_t docs_off;
+    uint64_t strings_off;
+    uint64_t strings_size;
+    uint64_t postings_off;
+    uint64_t postings_size;
+    uint64_t total_length; // sum of the lengths of all documents
+    uint64_t term_positions_off; // 0 if the index does not store positions
+    uint64_t positions_off;
+    uint64_t positions_size;
+} file_header_t;
+
+/* an entry of the term dictionary of an index file */
+typedef struct file_term {
+    uint64_t str_off;       // offset of the term in the string pool
+    uint64_t postings_off;  // offset of the postings in the postings section
+    uint64_t postings_size; // size of the postings, in bytes
+    uint32_t df;            // document frequency: number of documents containing the term
+    uint32_t max_tf;        // highest term frequency of any document
+} file_term_t;
+
+/* where the positions of a term are in the positions section of an index file */
+typedef struct file_positions {
+    uint64_t off;     // offset of the skip entries, followed by the encoded positions
+    uint64_t n_skips;
+    uint64_t n_bytes; // size of the encoded positions
+} file_positions_t;
+
+/* an entry of the document table of an index file */
+typedef struct file_doc {
+    uint64_t name_off; // offset of the document name in the string pool
+    uint32_t length;   // number of terms in the document, including repeats
+    uint32_t reserved;
+} file_doc_t;
+
 struct index {
-    map_t *terms;
-    set_t *doc_names;
-    size_t number_of_docs;
-    size_t number_of_terms;
+    interner_t *interner;  // owns the strings of all terms
+    map_t *terms;          // interned term (char *) -> postings_t *, compared by pointer
+    char **doc_names;      // table of document names, indexed by docid_t. NULL for a removed document.
+    uint32_t *doc_lengths; // number of terms in each document, including repeats, indexed by docid_t
+    size_t number_of_docs; // rows of the table, including removed documents
+    size_t docs_capacity;
+    uint64_t total_length; // sum of doc_lengths
+    map_t *doc_ids;        // name of each live document -> its docid_t (as uintptr_t)
+
+    /**
+     * A removed document is only marked as such (tombstoned) in the table, as its id may be in any number of
+     * postings. Evaluation skips these ids until index_compact drops them from the postings.
+     */
+    size_t n_removed;     // removed documents
+    size_t n_unpurged;    // removed documents whose ids may still be in postings
+    size_t n_compactions; // see compaction_stat_t
+    size_t n_reclaimed;
+
+    bool store_positions; // the postings of every term have positions, see index_store_positions
+
+    /* document being added term by term, between index_begin_document and index_end_document */
+    docid_t open_doc;
+    uint64_t open_length; // number of terms added to it so far
+    bool doc_open;
+
+    /**
+     * set if the index is loaded from a file, or frozen (see index_freeze) into memory laid out the same way.
+     * It is then read-only, and the structures above are empty, or freed if frozen.
+     */
+    const uint8_t *file;
+    size_t file_size;
+    bool frozen;
+
+    /**
+     * the terms of a frozen index by perfect hash: the position in the term dictionary of the term of each
+     * slot. NULL if the index is not frozen, in which case terms are binary searched for.
+     */
+    perfhash_t *term_hash;
+    uint32_t *term_slots;
+
+    /**
+     * results of recent queries and subqueries, by canonical form. NULL if caching is disabled.
+     * Shared by concurrent queries, so it is only accessed with `cache_lock` held.
+     */
+    cache_t *cache;
+    pthread_mutex_t cache_lock;
+
+    /**
+     * the terms in sorted order, for patterns to expand to. The value of each is its entry in `terms`, which
+     * stays put as long as the set of terms does. Built by the first query with a pattern, and dropped
+     * whenever a term is added or removed. Built and read with `dict_lock` held.
+     */
+    termdict_t *dict;
+    pthread_mutex_t dict_lock;
+
+    /**
+     * the containers of the terms of an index file, in the order of its term dictionary, each NULL until a
+     * query needs them. Those of an in-memory index are kept with their postings. Either is built with
+     * `containers_lock` held.
+     */
+    _Atomic(struct containers *) *file_containers;
+    pthread_mutex_t containers_lock;
+
+    /* held for reading by queries, and for writing while the index is changed concurrently with them */
+    pthread_rwlock_t lock;
 };
 
 /**
@@ -68,110 +351,4439 @@ static void print_list_of_strings(const char *descr, list_t *tokens) {
     list_destroyiter(tokens_iter);
 }
 
-index_t *index_create() {
-    index_t *index = malloc(sizeof(index_t));
-    if (index == NULL) {
-        pr_error("Failed to allocate memory for index\n");
+/* --------------------Varint coding--------------------- */
+
+/**
+ * Encode `val` as a little-endian base 128 varint: 7 bits per byte, with the high bit set on all but the last
+ * byte. Small values (as the deltas of dense postings typically are) take a single byte.
+ * @returns the number of bytes written to dst, at most VARINT_MAX_BYTES
+ */
+static inline size_t varint_encode(uint8_t *dst, uint32_t val) {
+    size_t n = 0;
+
+    while (val >= 0x80) {
+        dst[n++] = (uint8_t) (val | 0x80);
+        val >>= 7;
+    }
+    dst[n++] = (uint8_t) val;
+
+    return n;
+}
+
+/* number of bytes `varint_encode` takes for `val` */
+static inline size_t varint_length(uint32_t val) {
+    size_t n = 1;
+
+    while (val >= 0x80) {
+        val >>= 7;
+        n++;
+    }
+
+    return n;
+}
+
+/**
+ * Decode a varint written by `varint_encode`
+ * @returns the number of bytes read from src
+ */
+static inline size_t varint_decode(const uint8_t *src, uint32_t *val) {
+    uint32_t v = 0;
+    size_t n = 0;
+    int shift = 0;
+
+    while (src[n] & 0x80) {
+        v |= (uint32_t) (src[n++] & 0x7f) << shift;
+        shift += 7;
+    }
+    v |= (uint32_t) src[n++] << shift;
+
+    *val = v;
+    return n;
+}
+
+/* ----------------------Containers----------------------- */
+
+/* ids are split into chunks of CHUNK_IDS, by their upper bits */
+#define CHUNK_BITS 16
+#define CHUNK_IDS (1u << CHUNK_BITS)
+
+/* words of the bitmap of a chunk */
+#define CHUNK_WORDS (CHUNK_IDS / 64)
+
+/* words of a bitmap container per entry of its rank table */
+#define RANK_STRIDE 8
+
+/* highest tf kept with the ids of containers. Higher ones are kept apart, see containers_t. */
+#define TF_OVERFLOW UINT8_MAX
+
+typedef enum container_type {
+    CONTAINER_ARRAY = 0, // the lower bits of each id, ascending (uint16_t)
+    CONTAINER_BITMAP,    // a bit per id of the chunk (CHUNK_WORDS x uint64_t), followed by its rank table
+    CONTAINER_RUNS,      // runs of consecutive ids, ascending (run_t)
+} container_type_t;
+
+/* the ids start..start + len of a chunk */
+typedef struct run {
+    uint16_t start;
+    uint16_t len;
+    uint32_t rank; // number of ids of the container before the run
+} run_t;
+
+/* the ids of a term within one chunk */
+typedef struct container {
+    uint32_t key;    // upper bits of its ids, i.e. id >> CHUNK_BITS
+    uint32_t type;   // container_type_t
+    uint32_t n_ids;
+    uint32_t n_runs; // number of runs of consecutive ids, whichever the type
+    size_t rank;     // number of ids of the term in the containers before it, i.e. where its tfs start
+    size_t off;      // offset of its ids in `data` of the containers, 8-byte aligned
+} container_t;
+
+/* a tf too high for the tfs of containers */
+typedef struct tf_overflow {
+    docid_t id;
+    uint32_t tf;
+} tf_overflow_t;
+
+/**
+ * The ids of the postings of a term, split into containers as in Roaring bitmaps: each chunk of CHUNK_IDS ids
+ * the term is in is kept as whichever of an array, a bitmap or runs of consecutive ids takes the least memory.
+ * That is an array where the term is sparse, a bitmap where it is dense, and runs where it is in nearly every
+ * document. The tf of each id is kept alongside, in the same order, or in `overflow` if it is TF_OVERFLOW or
+ * higher.
+ *
+ * Queries read these instead of decoding the postings of terms in at least CONTAINER_MIN_DOCS documents:
+ * skipping to a document is a lookup in its chunk, and operators on such terms combine their chunks as
+ * bitmaps, a word at a time. Built in a single allocation the first time a query needs them, and dropped as
+ * soon as the postings change.
+ */
+typedef struct containers {
+    size_t size; // of the allocation
+    size_t n_containers;
+    const container_t *containers; // ascending by key
+    const uint8_t *tfs;
+    const tf_overflow_t *overflow; // ascending by id
+    size_t n_overflow;
+    const uint8_t *data;
+} containers_t;
+
+static inline const uint16_t *container_array(const containers_t *cs, const container_t *c) {
+    return (const uint16_t *) (cs->data + c->off);
+}
+
+static inline const uint64_t *container_bitmap(const containers_t *cs, const container_t *c) {
+    return (const uint64_t *) (cs->data + c->off);
+}
+
+/* number of ids of a bitmap container before each RANK_STRIDE words of it */
+static inline const uint16_t *container_ranks(const containers_t *cs, const container_t *c) {
+    return (const uint16_t *) (container_bitmap(cs, c) + CHUNK_WORDS);
+}
+
+static inline const run_t *container_runs(const containers_t *cs, const container_t *c) {
+    return (const run_t *) (cs->data + c->off);
+}
+
+/* pick the smallest type for a container, given its ids and runs. Returns its size in bytes. */
+static size_t container_choose(container_t *c) {
+    size_t array_size = c->n_ids * sizeof(uint16_t);
+    size_t bitmap_size = CHUNK_WORDS * sizeof(uint64_t) + CHUNK_WORDS / RANK_STRIDE * sizeof(uint16_t);
+    size_t runs_size = c->n_runs * sizeof(run_t);
+
+    if (runs_size < array_size && runs_size < bitmap_size) {
+        c->type = CONTAINER_RUNS;
+        return runs_size;
+    }
+    if (array_size <= bitmap_size) {
+        c->type = CONTAINER_ARRAY;
+        return array_size;
+    }
+    c->type = CONTAINER_BITMAP;
+    return bitmap_size;
+}
+
+/**
+ * Split encoded postings into containers. The postings are decoded twice: once to size each container, and
+ * once to fill it in.
+ */
+static containers_t *containers_build(const postings_view_t *postings) {
+    const uint8_t *end = postings->buf + postings->n_bytes;
+    container_t *containers = NULL;
+    size_t n_containers = 0;
+    size_t capacity = 0;
+    size_t n_overflow = 0;
+    size_t n_ids = 0;
+    docid_t id = 0;
+
+    for (const uint8_t *p = postings->buf; p < end; n_ids++) {
+        docid_t delta;
+        uint32_t tf;
+        p += varint_decode(p, &delta);
+        p += varint_decode(p, &tf);
+
+        docid_t prev = id;
+        id += delta;
+
+        if (n_containers == 0 || containers[n_containers - 1].key != id >> CHUNK_BITS) {
+            if (n_containers == capacity) {
+                capacity = capacity ? capacity * 2 : 4;
+                containers = realloc(containers, capacity * sizeof(container_t));
+                if (!containers) {
+                    PANIC("Failed to allocate memory\n");
+                }
+            }
+            containers[n_containers++] = (container_t) { .key = id >> CHUNK_BITS, .rank = n_ids };
+        }
+
+        container_t *c = &containers[n_containers - 1];
+        c->n_runs += (c->n_ids == 0 || id != prev + 1);
+        c->n_ids += 1;
+        n_overflow += (tf >= TF_OVERFLOW);
+    }
+
+    size_t data_size = 0;
+    for (size_t i = 0; i < n_containers; i++) {
+        containers[i].off = data_size;
+        data_size += (container_choose(&containers[i]) + 7) & ~(size_t) 7;
+    }
+
+    size_t containers_off = sizeof(containers_t);
+    size_t overflow_off = containers_off + n_containers * sizeof(container_t);
+    size_t data_off = overflow_off + n_overflow * sizeof(tf_overflow_t);
+    size_t tfs_off = data_off + data_size;
+    size_t size = tfs_off + n_ids;
+
+    containers_t *cs = malloc(size);
+    if (!cs) {
+        PANIC("Failed to allocate memory\n");
+    }
+    MEM_ALLOC(MEM_CONTAINERS, size);
+
+    uint8_t *base = (uint8_t *) cs;
+    container_t *dst = (container_t *) (base + containers_off);
+    tf_overflow_t *overflow = (tf_overflow_t *) (base + overflow_off);
+    uint8_t *data = base + data_off;
+    uint8_t *tfs = base + tfs_off;
+
+    memcpy(dst, containers, n_containers * sizeof(container_t));
+    free(containers);
+
+    container_t *c = dst;
+    size_t n_runs = 0;
+    n_overflow = 0;
+    id = 0;
+
+    const uint8_t *p = postings->buf;
+    for (size_t rank = 0; rank < n_ids; rank++) {
+        docid_t delta;
+        uint32_t tf;
+        p += varint_decode(p, &delta);
+        p += varint_decode(p, &tf);
+
+        docid_t prev = id;
+        id += delta;
+
+        if (c->key != id >> CHUNK_BITS) {
+            c++;
+        }
+
+        uint16_t low = (uint16_t) (id & (CHUNK_IDS - 1));
+        size_t i = rank - c->rank; // index of the id in its container
+
+        switch (c->type) {
+            case CONTAINER_ARRAY:
+                ((uint16_t *) (data + c->off))[i] = low;
+                break;
+            case CONTAINER_BITMAP: {
+                uint64_t *bitmap = (uint64_t *) (data + c->off);
+                if (i == 0) {
+                    memset(bitmap, 0, CHUNK_WORDS * sizeof(uint64_t));
+                }
+                bitmap[low / 64] |= (uint64_t) 1 << (low % 64);
+                break;
+            }
+            case CONTAINER_RUNS: {
+                run_t *runs = (run_t *) (data + c->off);
+                if (i == 0) {
+                    n_runs = 0;
+                }
+                if (i == 0 || id != prev + 1) {
+                    runs[n_runs++] = (run_t) { .start = low, .len = 0, .rank = (uint32_t) i };
+                } else {
+                    runs[n_runs - 1].len++;
+                }
+                break;
+            }
+        }
+
+        tfs[rank] = (tf < TF_OVERFLOW) ? (uint8_t) tf : TF_OVERFLOW;
+        if (tf >= TF_OVERFLOW) {
+            overflow[n_overflow++] = (tf_overflow_t) { .id = id, .tf = tf };
+        }
+    }
+
+    /* the rank table of each bitmap, such that ranking an id takes at most RANK_STRIDE popcounts */
+    for (size_t i = 0; i < n_containers; i++) {
+        if (dst[i].type != CONTAINER_BITMAP) {
+            continue;
+        }
+
+        const uint64_t *bitmap = (const uint64_t *) (data + dst[i].off);
+        uint16_t *ranks = (uint16_t *) (bitmap + CHUNK_WORDS);
+        uint32_t rank = 0;
+
+        for (size_t w = 0; w < CHUNK_WORDS; w++) {
+            if (w % RANK_STRIDE == 0) {
+                ranks[w / RANK_STRIDE] = (uint16_t) rank;
+            }
+            rank += (uint32_t) __builtin_popcountll(bitmap[w]);
+        }
+    }
+
+    cs->size = size;
+    cs->n_containers = n_containers;
+    cs->containers = dst;
+    cs->tfs = tfs;
+    cs->overflow = overflow;
+    cs->n_overflow = n_overflow;
+    cs->data = data;
+
+    return cs;
+}
+
+static void containers_destroy(containers_t *cs) {
+    if (cs) {
+        MEM_FREE(MEM_CONTAINERS, cs->size);
+        free(cs);
+    }
+}
+
+/* index of the first container with a key >= key, from containers[from] on */
+static size_t containers_find(const containers_t *cs, size_t from, uint32_t key) {
+    size_t lo = from;
+    size_t hi = cs->n_containers;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (cs->containers[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/* write the ids of a container as the bitmap of its chunk, CHUNK_WORDS words */
+static void container_to_bitmap(const containers_t *cs, const container_t *c, uint64_t *bits) {
+    if (c->type == CONTAINER_BITMAP) {
+        memcpy(bits, container_bitmap(cs, c), CHUNK_WORDS * sizeof(uint64_t));
+        return;
+    }
+
+    memset(bits, 0, CHUNK_WORDS * sizeof(uint64_t));
+
+    if (c->type == CONTAINER_ARRAY) {
+        const uint16_t *array = container_array(cs, c);
+
+        for (size_t i = 0; i < c->n_ids; i++) {
+            bits[array[i] / 64] |= (uint64_t) 1 << (array[i] % 64);
+        }
+        return;
+    }
+
+    const run_t *runs = container_runs(cs, c);
+
+    for (size_t i = 0; i < c->n_runs; i++) {
+        size_t first = runs[i].start;
+        size_t last = first + runs[i].len;
+
+        /* the bits first..last of the words they span */
+        for (size_t w = first / 64; w <= last / 64; w++) {
+            uint64_t mask = UINT64_MAX;
+            if (w == first / 64) {
+                mask &= UINT64_MAX << (first % 64);
+            }
+            if (w == last / 64) {
+                mask &= UINT64_MAX >> (63 - last % 64);
+            }
+            bits[w] |= mask;
+        }
+    }
+}
+
+static int compare_overflow(const void *a, const void *b) {
+    docid_t ia = ((const tf_overflow_t *) a)->id;
+    docid_t ib = ((const tf_overflow_t *) b)->id;
+
+    return (ia > ib) - (ia < ib);
+}
+
+/**
+ * Where the last lookup in the containers of a term ended, which the next one resumes from. Lookups in
+ * ascending order of id thus read each container about once, however many of its ids they look up.
+ */
+typedef struct container_pos {
+    size_t container; // index of the container
+    size_t i;         // array: index of an id; runs: index of a run; bitmap: index of a word
+    size_t rank;      // bitmap: number of ids of the container in the words before word i
+} container_pos_t;
+
+/**
+ * Look up the tf of a document in the containers of a term
+ * @param pos: where to resume from, which is moved to the document. Lookups out of order are still correct.
+ * @returns the tf, or 0 if the term is not in the document
+ */
+static uint32_t containers_tf(const containers_t *cs, container_pos_t *pos, docid_t id) {
+    uint32_t key = id >> CHUNK_BITS;
+
+    if (pos->container >= cs->n_containers || cs->containers[pos->container].key != key) {
+        size_t from = (pos->container < cs->n_containers && cs->containers[pos->container].key < key)
+            ? pos->container
+            : 0;
+        *pos = (container_pos_t) { .container = containers_find(cs, from, key), .i = 0, .rank = 0 };
+    }
+    if (pos->container == cs->n_containers || cs->containers[pos->container].key != key) {
+        return 0;
+    }
+
+    const container_t *c = &cs->containers[pos->container];
+    uint16_t low = (uint16_t) (id & (CHUNK_IDS - 1));
+    size_t rank;
+
+    switch (c->type) {
+        case CONTAINER_ARRAY: {
+            const uint16_t *array = container_array(cs, c);
+            size_t lo = (pos->i < c->n_ids && array[pos->i] <= low) ? pos->i : 0;
+            size_t hi = lo;
+
+            /* gallop from the last id looked up, then binary search the last step */
+            for (size_t step = 1; hi < c->n_ids && array[hi] < low; step *= 2) {
+                lo = hi + 1;
+                hi += step;
+            }
+            if (hi > c->n_ids) {
+                hi = c->n_ids;
+            }
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+
+                if (array[mid] < low) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+
+            pos->i = lo;
+            if (lo == c->n_ids || array[lo] != low) {
+                return 0;
+            }
+            rank = lo;
+            break;
+        }
+        case CONTAINER_BITMAP: {
+            const uint64_t *bitmap = container_bitmap(cs, c);
+            size_t w = low / 64;
+
+            /* count the words up to that of the id from the last one looked up, if close, or the rank table */
+            if (w < pos->i || w - pos->i > RANK_STRIDE) {
+                pos->i = w - w % RANK_STRIDE;
+                pos->rank = container_ranks(cs, c)[w / RANK_STRIDE];
+            }
+            for (; pos->i < w; pos->i++) {
+                pos->rank += (size_t) __builtin_popcountll(bitmap[pos->i]);
+            }
+
+            if (!(bitmap[w] >> (low % 64) & 1)) {
+                return 0;
+            }
+            rank = pos->rank + (size_t) __builtin_popcountll(bitmap[w] & ~(UINT64_MAX << (low % 64)));
+            break;
+        }
+        default: {
+            const run_t *runs = container_runs(cs, c);
+            size_t r = (pos->i < c->n_runs && runs[pos->i].start <= low) ? pos->i : 0;
+
+            /* the last run that starts at or before the id */
+            while (r + 1 < c->n_runs && runs[r + 1].start <= low) {
+                r++;
+            }
+
+            pos->i = r;
+            if (runs[r].start > low || low > runs[r].start + runs[r].len) {
+                return 0;
+            }
+            rank = runs[r].rank + (size_t) (low - runs[r].start);
+            break;
+        }
+    }
+
+    uint32_t tf = cs->tfs[c->rank + rank];
+    if (tf == TF_OVERFLOW) {
+        tf_overflow_t key_tf = { .id = id, .tf = 0 };
+        const tf_overflow_t *found = bsearch(
+            &key_tf,
+            cs->overflow,
+            cs->n_overflow,
+            sizeof(tf_overflow_t),
+            compare_overflow
+        );
+        tf = found->tf;
+    }
+
+    return tf;
+}
+
+/* -----------------------Postings------------------------ */
+
+/**
+ * Record the memory held by postings, and by their positions if any. Objects are only counted for the buffers
+ * that are allocated, as those of positions are not until the first position is appended.
+ * @param sign: 1 once the postings are created, -1 once they are destroyed
+ */
+static void postings_account(postings_t *postings, int sign) {
+    MEM_RECORD(MEM_POSTINGS, sign * (int64_t) (sizeof(postings_t) + postings->capacity), sign * 2);
+
+    positions_t *positions = postings->positions;
+    if (positions) {
+        size_t n_bytes = sizeof(positions_t) + positions->capacity;
+        n_bytes += positions->skips_capacity * sizeof(skip_t);
+        int64_t n_objects = 1 + (positions->capacity > 0) + (positions->skips_capacity > 0);
+        MEM_RECORD(MEM_POSITIONS, sign * (int64_t) n_bytes, sign * n_objects);
+    }
+}
+
+/* @param with_positions: also keep the positions of each occurrence */
+static postings_t *postings_create(bool with_positions) {
+    postings_t *postings = malloc(sizeof(postings_t));
+    if (!postings) {
         return NULL;
     }
 
-    /**
-     * TODO: Allocate, initialize and set up nescessary structures
-     */
+    postings->buf = malloc(POSTINGS_CAPACITY_INITIAL);
+    postings->positions = with_positions ? calloc(1, sizeof(positions_t)) : NULL;
+    if (!postings->buf || (with_positions && !postings->positions)) {
+        free(postings->buf);
+        free(postings->positions);
+        free(postings);
+        return NULL;
+    }
 
-    return index;
+    postings->capacity = POSTINGS_CAPACITY_INITIAL;
+    postings->n_bytes = 0;
+    postings->n_docs = 0;
+    postings->last_id = 0;
+    postings->last_tf = 0;
+    postings->max_tf = 0;
+    postings->containers = NULL;
+    postings_account(postings, 1);
+
+    return postings;
 }
 
-void index_destroy(index_t *index) {
-    // during development, you can use the following macro to silence "unused variable" errors.
-    UNUSED(index);
+static void postings_destroy(void *postings) {
+    if (postings) {
+        postings_account(postings, -1);
 
-    /**
-     * TODO: Free all memory associated with the index
-     */
+        positions_t *positions = ((postings_t *) postings)->positions;
+        if (positions) {
+            free(positions->buf);
+            free(positions->skips);
+            free(positions);
+        }
+        containers_destroy(((postings_t *) postings)->containers);
+        free(((postings_t *) postings)->buf);
+        free(postings);
+    }
 }
 
-int index_document(index_t *index, char *doc_name, list_t *terms) {
-    /**
-     * TODO: Process document, enabling the terms and subsequent document to be found by index_query
-     *
-     * Note: doc_name and the list of terms is now owned by the index. See the docstring.
-     */
-    
+/* drop the containers of postings that are about to change. Not while queries run, see struct index. */
+static inline void postings_changed(postings_t *postings) {
+    if (postings->containers) {
+        containers_destroy(postings->containers);
+        postings->containers = NULL;
+    }
+}
+
+/* ensure there is room for at least `n_extra` more bytes in the buffer */
+static inline void postings_reserve(postings_t *postings, size_t n_extra) {
+    if (postings->n_bytes + n_extra <= postings->capacity) {
+        return;
+    }
+
+    size_t new_capacity = postings->capacity * 2;
+    while (new_capacity < postings->n_bytes + n_extra) {
+        new_capacity *= 2;
+    }
 
+    uint8_t *new_buf = realloc(postings->buf, new_capacity);
+    if (!new_buf) {
+        PANIC("Failed to allocate memory\n");
+    }
+    MEM_RESIZE(MEM_POSTINGS, postings->capacity, new_capacity);
 
-    list_iter_t *newIterator = list_createiter(terms);
+    postings->buf = new_buf;
+    postings->capacity = new_capacity;
+}
 
+/**
+ * Append one occurrence of the term in a document. Ids must be appended in ascending order. Appending the
+ * last id again (i.e. the term occurs multiple times in the document) increments its tf.
+ */
+static inline void postings_append(postings_t *postings, docid_t id) {
+    postings_changed(postings);
+    postings_reserve(postings, 2 * VARINT_MAX_BYTES);
 
+    if (postings->n_docs && id == postings->last_id) {
+        /* the tf of the last id is the last varint of the buffer, so it is simply written again */
+        postings->n_bytes -= varint_length(postings->last_tf);
+        postings->last_tf += 1;
+    } else {
+        assert(postings->n_docs == 0 || id > postings->last_id);
 
+        docid_t delta = postings->n_docs ? id - postings->last_id : id;
 
+        postings->n_bytes += varint_encode(&postings->buf[postings->n_bytes], delta);
+        postings->n_docs += 1;
+        postings->last_id = id;
+        postings->last_tf = 1;
+    }
 
+    postings->n_bytes += varint_encode(&postings->buf[postings->n_bytes], postings->last_tf);
 
+    if (postings->last_tf > postings->max_tf) {
+        postings->max_tf = postings->last_tf;
+    }
+}
 
-    // index->number_of_docs++;
+/* append an id with a known tf. Ids must be appended in ascending order, and only once. */
+static inline void postings_add(postings_t *postings, docid_t id, uint32_t tf) {
+    postings_changed(postings);
+    postings_reserve(postings, 2 * VARINT_MAX_BYTES);
+    assert(postings->n_docs == 0 || id > postings->last_id);
 
-    // list_iter_t *iter = list_createiter(terms);
-    // if (!iter) {
-    //     list_destroy(terms, free);
-    //     return -1;
-    // }
+    docid_t delta = postings->n_docs ? id - postings->last_id : id;
 
-    // while (list_hasnext(iter)) {
-    //     char *term = list_next(iter);
+    postings->n_bytes += varint_encode(&postings->buf[postings->n_bytes], delta);
+    postings->n_bytes += varint_encode(&postings->buf[postings->n_bytes], tf);
+    postings->n_docs += 1;
+    postings->last_id = id;
+    postings->last_tf = tf;
 
-    //     set_t *doc_set = map_get(index->terms, term);
+    if (tf > postings->max_tf) {
+        postings->max_tf = tf;
+    }
+}
 
-    //     if (!doc_set) {
-    //         doc_set = set_create((cmp_fn) strcmp);
-    //         if (!doc_set) {
-    //             list_destroyiter(iter);
-    //             list_destroy(terms, free);
-    //             return -1;
-    //         }
+/* ensure there is room for at least `n_extra` more bytes of positions */
+static inline void positions_reserve(positions_t *positions, size_t n_extra) {
+    if (positions->n_bytes + n_extra <= positions->capacity) {
+        return;
+    }
 
-    //         // Transfer ownership of the term string to the map
-    //         char *term_key = strdup(term);
-    //         if (!term_key) {
-    //             set_destroy(doc_set, free);
-    //             list_destroyiter(iter);
-    //             list_destroy(terms, free);
-    //             return -1;
-    //         }
+    size_t new_capacity = positions->capacity ? positions->capacity * 2 : POSTINGS_CAPACITY_INITIAL;
+    while (new_capacity < positions->n_bytes + n_extra) {
+        new_capacity *= 2;
+    }
 
-    //         map_put(index->terms, term_key, doc_set);
-    //         index->number_of_terms++;
-    //     }
+    uint8_t *new_buf = realloc(positions->buf, new_capacity);
+    if (!new_buf) {
+        PANIC("Failed to allocate memory\n");
+    }
+    MEM_RECORD(MEM_POSITIONS, (int64_t) (new_capacity - positions->capacity), positions->capacity ? 0 : 1);
 
-    //     set_insert(doc_set, doc_name);
-    // }
+    positions->buf = new_buf;
+    positions->capacity = new_capacity;
+}
 
-    // list_destroyiter(iter);
-    // list_destroy(terms, free); 
+static void positions_add_skip(positions_t *positions, docid_t last_id, size_t postings_off, size_t pos_off) {
+    if (positions->n_skips == positions->skips_capacity) {
+        size_t new_capacity = positions->skips_capacity ? positions->skips_capacity * 2 : 4;
+        skip_t *new_skips = realloc(positions->skips, new_capacity * sizeof(skip_t));
+        if (!new_skips) {
+            PANIC("Failed to allocate memory\n");
+        }
+        MEM_RECORD(
+            MEM_POSITIONS,
+            (int64_t) ((new_capacity - positions->skips_capacity) * sizeof(skip_t)),
+            positions->skips_capacity ? 0 : 1
+        );
+        positions->skips = new_skips;
+        positions->skips_capacity = new_capacity;
+    }
 
-    
-    return 0; // or -x on error
+    positions->skips[positions->n_skips++] = (skip_t) {
+        .last_id = last_id,
+        .reserved = 0,
+        .postings_off = postings_off,
+        .positions_off = pos_off,
+    };
 }
 
-list_t *index_query(index_t *index, list_t *query_tokens, char *errmsg) {
-    print_list_of_strings("query", query_tokens); // remove this if you like
+/**
+ * Append the position of one occurrence of the term in a document to its positions. Must be called right
+ * before appending the occurrence itself with postings_append, with the same id.
+ */
+static inline void positions_append(postings_t *postings, docid_t id, uint32_t pos) {
+    positions_t *positions = postings->positions;
+    positions_reserve(positions, VARINT_MAX_BYTES);
 
-    /**
-     * TODO: perform the search, and return:
-     * query is invalid => write reasoning to errmsg and return NULL
-     * query is valid   => return list with any results (empty if none)
-     *
-     * Tip: `snprintf(errmsg, LINE_MAX, "...")` is a handy way to write to the error message buffer as you
-     * would do with a typical `printf`. `snprintf` does not print anything, rather writing your message to
-     * the buffer.
-     */
+    if (postings->n_docs && id == postings->last_id) {
+        positions->n_bytes += varint_encode(&positions->buf[positions->n_bytes], pos - positions->last_pos);
+    } else {
+        /* a new document, whose pair is about to start at the end of the postings */
+        if (postings->n_docs && postings->n_docs % POSITIONS_SKIP_INTERVAL == 0) {
+            positions_add_skip(positions, postings->last_id, postings->n_bytes, positions->n_bytes);
+        }
+        positions->n_bytes += varint_encode(&positions->buf[positions->n_bytes], pos);
+    }
 
-    return NULL; // TODO: return list of query_result_t objects instead
+    positions->last_pos = pos;
 }
 
-void index_stat(index_t *index, size_t *n_docs, size_t *n_terms) {
-    /**
-     * TODO: fix this
+/* skip `n` varints, such as the positions of a document with a tf of `n` */
+static inline const uint8_t *varints_skip(const uint8_t *p, uint32_t n) {
+    while (n) {
+        n -= !(*p++ & 0x80);
+    }
+    return p;
+}
+
+/**
+ * Append all of `src` to `dst`, adding `offset` to every id of `src`. All ids of `src` must be greater than
+ * those of `dst` after the offset is applied.
+ *
+ * Only the first id of `src` is absolute, so every byte after it is copied as-is.
+ */
+static void postings_append_shifted(postings_t *dst, postings_t *src, docid_t offset) {
+    if (src->n_docs == 0) {
+        return;
+    }
+    postings_changed(dst);
+
+    docid_t first;
+    size_t first_len = varint_decode(src->buf, &first);
+
+    docid_t id = first + offset;
+    assert(dst->n_docs == 0 || id > dst->last_id);
+
+    docid_t delta = dst->n_docs ? id - dst->last_id : id;
+    size_t rest = src->n_bytes - first_len;
+    size_t start = dst->n_bytes; // where the pairs of src start in dst
+
+    postings_reserve(dst, VARINT_MAX_BYTES + rest);
+    dst->n_bytes += varint_encode(&dst->buf[dst->n_bytes], delta);
+
+    if (dst->positions) {
+        positions_t *dst_pos = dst->positions;
+        positions_t *src_pos = src->positions;
+
+        /* every pair of src but the first moves by this much, the first delta having grown by re-encoding */
+        size_t shift = dst->n_bytes - first_len;
+        size_t pos_start = dst_pos->n_bytes;
+
+        /* jump straight to the documents of src, such as those of one partial index among many merged */
+        if (dst->n_docs) {
+            positions_add_skip(dst_pos, dst->last_id, start, pos_start);
+        }
+        for (size_t i = 0; i < src_pos->n_skips; i++) {
+            const skip_t *skip = &src_pos->skips[i];
+            positions_add_skip(
+                dst_pos,
+                skip->last_id + offset,
+                skip->postings_off + shift,
+                skip->positions_off + pos_start
+            );
+        }
+
+        positions_reserve(dst_pos, src_pos->n_bytes);
+        memcpy(&dst_pos->buf[dst_pos->n_bytes], src_pos->buf, src_pos->n_bytes);
+        dst_pos->n_bytes += src_pos->n_bytes;
+        dst_pos->last_pos = src_pos->last_pos;
+    }
+
+    memcpy(&dst->buf[dst->n_bytes], &src->buf[first_len], rest);
+
+    dst->n_bytes += rest;
+    dst->n_docs += src->n_docs;
+    dst->last_id = src->last_id + offset;
+    dst->last_tf = src->last_tf;
+
+    if (src->max_tf > dst->max_tf) {
+        dst->max_tf = src->max_tf;
+    }
+}
+
+/* ------------------------Doc ids------------------------ */
+
+/**
+ * Lower bound of `target` within ids[from, len): probe at exponentially increasing steps from ids[from], then
+ * binary search the last step. Cheap when the result is close to `from`.
+ */
+static inline size_t docids_gallop(const docid_t *ids, size_t len, size_t from, docid_t target) {
+    size_t lo = from;
+    size_t hi = from;
+
+    for (size_t step = 1; hi < len && ids[hi] < target; step *= 2) {
+        lo = hi + 1;
+        hi = from + step;
+    }
+
+    if (hi > len) {
+        hi = len;
+    }
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (ids[mid] < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/* ------------------------Index-------------------------- */
+
+/* bytes of the index and its table of documents, as counted in MEM_DOC_TABLE. 3 objects in all. */
+static inline size_t doc_table_size(index_t *index) {
+    return sizeof(index_t) + index->docs_capacity * (sizeof(char *) + sizeof(uint32_t));
+}
+
+index_t *index_create() {
+    index_t *index = malloc(sizeof(index_t));
+    if (index == NULL) {
+        pr_error("Failed to allocate memory for index\n");
+        return NULL;
+    }
+
+    index->interner = interner_create();
+    index->terms = map_create(compare_pointers, hash_pointer);
+    index->doc_names = malloc(DOCS_CAPACITY_INITIAL * sizeof(char *));
+    index->doc_lengths = malloc(DOCS_CAPACITY_INITIAL * sizeof(uint32_t));
+    index->doc_ids = map_create((cmp_fn) strcmp, hash_string_fnv1a64);
+
+    if (index->interner == NULL || index->terms == NULL || index->doc_names == NULL
+        || index->doc_lengths == NULL || index->doc_ids == NULL) {
+        pr_error("Failed to allocate memory for index structures\n");
+        interner_destroy(index->interner);
+        map_destroy(index->terms, NULL, NULL);
+        map_destroy(index->doc_ids, NULL, NULL);
+        free(index->doc_names);
+        free(index->doc_lengths);
+        free(index);
+        return NULL;
+    }
+
+    index->number_of_docs = 0;
+    index->docs_capacity = DOCS_CAPACITY_INITIAL;
+    index->total_length = 0;
+    index->n_removed = 0;
+    index->n_unpurged = 0;
+    index->n_compactions = 0;
+    index->n_reclaimed = 0;
+    index->store_positions = false;
+    index->open_doc = 0;
+    index->open_length = 0;
+    index->doc_open = false;
+    index->file = NULL;
+    index->file_size = 0;
+    index->frozen = false;
+    index->term_hash = NULL;
+    index->term_slots = NULL;
+    index->cache = NULL;
+    pthread_mutex_init(&index->cache_lock, NULL);
+    index->dict = NULL;
+    pthread_mutex_init(&index->dict_lock, NULL);
+    index->file_containers = NULL;
+    pthread_mutex_init(&index->containers_lock, NULL);
+
+    /* merges are short, but queries may keep coming. Prefer the writer, such that merges are not starved. */
+    pthread_rwlockattr_t lock_attr;
+    pthread_rwlockattr_init(&lock_attr);
+    pthread_rwlockattr_setkind_np(&lock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&index->lock, &lock_attr);
+    pthread_rwlockattr_destroy(&lock_attr);
+
+    MEM_RECORD(MEM_DOC_TABLE, (int64_t) doc_table_size(index), 3);
+
+    return index;
+}
+
+void index_destroy(index_t *index) {
+    if (!index) {
+        return;
+    }
+
+    map_destroy(index->terms, NULL, postings_destroy);
+    map_destroy(index->doc_ids, NULL, NULL);
+    interner_destroy(index->interner);
+
+    /* NULL for removed documents */
+    for (size_t i = 0; i < index->number_of_docs; i++) {
+        if (index->doc_names[i]) {
+            MEM_FREE(MEM_DOC_NAMES, strlen(index->doc_names[i]) + 1);
+        }
+        free(index->doc_names[i]);
+    }
+    /* the tables of a frozen index are freed already, see index_freeze */
+    MEM_RECORD(MEM_DOC_TABLE, -(int64_t) doc_table_size(index), index->frozen ? -1 : -3);
+    free(index->doc_names);
+    free(index->doc_lengths);
+
+    if (index->file) {
+        size_t n_terms = ((const file_header_t *) index->file)->n_terms;
+        for (size_t i = 0; i < n_terms; i++) {
+            containers_destroy(index->file_containers[i]);
+        }
+        MEM_FREE(MEM_CONTAINERS, n_terms * sizeof(containers_t *));
+        free(index->file_containers);
+
+        if (index->term_hash) {
+            MEM_FREE(MEM_TERMHASH, n_terms * sizeof(uint32_t));
+        }
+        perfhash_destroy(index->term_hash);
+        free(index->term_slots);
+
+        MEM_FREE(index->frozen ? MEM_FROZEN : MEM_INDEX_FILE, index->file_size);
+        munmap((void *) index->file, index->file_size);
+    }
+    cache_destroy(index->cache);
+    pthread_mutex_destroy(&index->cache_lock);
+    termdict_destroy(index->dict);
+    pthread_mutex_destroy(&index->dict_lock);
+    pthread_mutex_destroy(&index->containers_lock);
+    pthread_rwlock_destroy(&index->lock);
+    free(index);
+}
+
+/* drop the sorted dictionary, once the set of terms changes. Not while queries run, see struct index. */
+static inline void dict_drop(index_t *index) {
+    termdict_destroy(index->dict);
+    index->dict = NULL;
+}
+
+/* tombstone a live document, see struct index. Its name is freed right away. */
+static void remove_doc(index_t *index, docid_t id) {
+    char *doc_name = index->doc_names[id];
+    assert(doc_name);
+
+    free(map_remove(index->doc_ids, doc_name));
+    MEM_FREE(MEM_DOC_NAMES, strlen(doc_name) + 1);
+    free(doc_name);
+
+    index->doc_names[id] = NULL;
+    index->total_length -= index->doc_lengths[id];
+    index->doc_lengths[id] = 0;
+    index->n_removed++;
+    index->n_unpurged++;
+}
+
+/**
+ * Add a document to the table of documents. It replaces any live document of the same name.
+ * @param doc_name: NULL to add a row for a removed document, as when merging one
+ * @param length: number of terms in the document, including repeats
+ * @returns the id assigned to the document
+ */
+static docid_t add_doc(index_t *index, char *doc_name, uint32_t length) {
+    if (index->number_of_docs >= UINT32_MAX) {
+        PANIC("Exceeded the maximum number of documents\n");
+    }
+
+    if (index->number_of_docs == index->docs_capacity) {
+        size_t new_capacity = index->docs_capacity * 2;
+        char **new_names = realloc(index->doc_names, new_capacity * sizeof(char *));
+        if (new_names) {
+            index->doc_names = new_names;
+        }
+        uint32_t *new_lengths = realloc(index->doc_lengths, new_capacity * sizeof(uint32_t));
+        if (new_lengths) {
+            index->doc_lengths = new_lengths;
+        }
+        if (!new_names || !new_lengths) {
+            PANIC("Failed to allocate memory\n");
+        }
+        MEM_RESIZE(
+            MEM_DOC_TABLE,
+            index->docs_capacity * (sizeof(char *) + sizeof(uint32_t)),
+            new_capacity * (sizeof(char *) + sizeof(uint32_t))
+        );
+        index->docs_capacity = new_capacity;
+    }
+
+    if (doc_name) {
+        entry_t *entry = map_get(index->doc_ids, doc_name);
+        if (entry) {
+            remove_doc(index, (docid_t) (uintptr_t) entry->val);
+        }
+    }
+
+    docid_t id = (docid_t) index->number_of_docs++;
+    index->doc_names[id] = doc_name;
+    index->doc_lengths[id] = length;
+    index->total_length += length;
+
+    if (doc_name) {
+        map_insert(index->doc_ids, doc_name, (void *) (uintptr_t) id);
+    }
+
+    return id;
+}
+
+/* Add an occurrence of an interned term to the open document */
+static int add_term_key(index_t *index, char *key) {
+    entry_t *entry = map_get(index->terms, key);
+    postings_t *postings;
+
+    if (entry) {
+        postings = entry->val;
+    } else {
+        postings = postings_create(index->store_positions);
+        if (!postings) {
+            return -1;
+        }
+        map_insert(index->terms, key, postings);
+        dict_drop(index);
+    }
+
+    if (postings->positions) {
+        uint32_t pos = (index->open_length < UINT32_MAX) ? (uint32_t) index->open_length : UINT32_MAX;
+        positions_append(postings, index->open_doc, pos);
+    }
+    postings_append(postings, index->open_doc);
+    index->open_length++;
+
+    return 0;
+}
+
+static void cache_clear_locked(index_t *index);
+
+int index_begin_document(index_t *index, char *doc_name) {
+    if (index->file) {
+        pr_error("Cannot add documents to an index loaded from file\n");
+        free(doc_name);
+        return -1;
+    }
+    if (index->doc_open) {
+        pr_error("Cannot begin a document before the previous one is ended\n");
+        free(doc_name);
+        return -1;
+    }
+
+    /* any cached result may be missing the new document */
+    cache_clear_locked(index);
+
+    /* the index owns doc_name from this point, so register it before anything can fail */
+    MEM_ALLOC(MEM_DOC_NAMES, strlen(doc_name) + 1);
+    index->open_doc = add_doc(index, doc_name, 0);
+    index->open_length = 0;
+    index->doc_open = true;
+
+    return 0;
+}
+
+int index_add_term(index_t *index, const char *term, size_t len) {
+    if (!index->doc_open) {
+        pr_error("Cannot add a term without an open document\n");
+        return -1;
+    }
+
+    return add_term_key(index, intern(index->interner, term, len));
+}
+
+int index_add_key(index_t *index, const str_t *key) {
+    if (!index->doc_open) {
+        pr_error("Cannot add a term without an open document\n");
+        return -1;
+    }
+
+    return add_term_key(index, intern_key(index->interner, key));
+}
+
+int index_end_document(index_t *index) {
+    if (!index->doc_open) {
+        pr_error("Cannot end a document that was never begun\n");
+        return -1;
+    }
+
+    uint32_t length = (index->open_length > UINT32_MAX) ? UINT32_MAX : (uint32_t) index->open_length;
+
+    index->doc_lengths[index->open_doc] = length;
+    index->total_length += length;
+    index->doc_open = false;
+
+    return 0;
+}
+
+/**
+ * Shared by the index_document* functions.
+ * @param owner: who owns the strings of `terms`, which decides whether they must be interned and/or freed.
+ */
+static int index_terms(index_t *index, char *doc_name, list_t *terms, term_owner_t owner) {
+    if (index_begin_document(index, doc_name) != 0) {
+        list_destroy(terms, (owner == TERMS_OWNED) ? free : NULL);
+        return -1;
+    }
+
+    while (list_length(terms)) {
+        char *term = list_popfirst(terms);
+        char *key = term;
+
+        if (owner != TERMS_INTERNED) {
+            key = intern(index->interner, term, strlen(term));
+            if (owner == TERMS_OWNED) {
+                free(term);
+            }
+        }
+
+        if (add_term_key(index, key) != 0) {
+            list_destroy(terms, (owner == TERMS_OWNED) ? free : NULL);
+            index_end_document(index);
+            return -1;
+        }
+    }
+
+    list_destroy(terms, NULL);
+
+    return index_end_document(index);
+}
+
+int index_document(index_t *index, char *doc_name, list_t *terms) {
+    return index_terms(index, doc_name, terms, TERMS_OWNED);
+}
+
+int index_document_borrowed(index_t *index, char *doc_name, list_t *terms) {
+    return index_terms(index, doc_name, terms, TERMS_BORROWED);
+}
+
+int index_document_interned(index_t *index, char *doc_name, list_t *terms) {
+    return index_terms(index, doc_name, terms, TERMS_INTERNED);
+}
+
+interner_t *index_interner(index_t *index) {
+    return index->interner;
+}
+
+int index_store_positions(index_t *index) {
+    if (index->file) {
+        pr_error("Cannot change an index loaded from file\n");
+        return -1;
+    }
+    if (index->number_of_docs) {
+        pr_error("Positions must be stored from the first document on\n");
+        return -1;
+    }
+
+    index->store_positions = true;
+
+    return 0;
+}
+
+int index_has_positions(index_t *index) {
+    if (index->file) {
+        return ((const file_header_t *) index->file)->term_positions_off != 0;
+    }
+    return index->store_positions;
+}
+
+int index_set_cache_size(index_t *index, size_t max_bytes) {
+    int status = 0;
+
+    pthread_mutex_lock(&index->cache_lock);
+
+    cache_destroy(index->cache);
+    index->cache = NULL;
+
+    if (max_bytes) {
+        /* values are either cached_docids_t or ranking_t, both single allocations */
+        index->cache = cache_create(max_bytes, free);
+        if (!index->cache) {
+            status = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&index->cache_lock);
+
+    return status;
+}
+
+void index_cache_stat(index_t *index, cache_stat_t *dst) {
+    pthread_mutex_lock(&index->cache_lock);
+
+    if (index->cache) {
+        cache_stat(index->cache, dst);
+    } else {
+        *dst = (cache_stat_t) { 0 };
+    }
+
+    pthread_mutex_unlock(&index->cache_lock);
+}
+
+/**
+ * Look up a cached value, copying it out while the lock is held. Once it is released, a concurrent query may
+ * evict the entry.
+ * @param size_of: gives the size of a cached value, in bytes
+ * @returns a copy of the value, to be freed by the caller, or NULL on a miss
+ */
+static void *cache_get_copy(index_t *index, const char *key, size_t (*size_of)(const void *)) {
+    void *cpy = NULL;
+
+    pthread_mutex_lock(&index->cache_lock);
+
+    void *val = cache_get(index->cache, key);
+    if (val) {
+        size_t size = size_of(val);
+        cpy = malloc(size);
+        if (!cpy) {
+            PANIC("Failed to allocate memory\n");
+        }
+        memcpy(cpy, val, size);
+    }
+
+    pthread_mutex_unlock(&index->cache_lock);
+
+    return cpy;
+}
+
+/* drop every cached result, as the index is changed */
+static void cache_clear_locked(index_t *index) {
+    pthread_mutex_lock(&index->cache_lock);
+    if (index->cache) {
+        cache_clear(index->cache);
+    }
+    pthread_mutex_unlock(&index->cache_lock);
+}
+
+/* insert into the cache, which takes ownership of `val` */
+static void cache_put_locked(index_t *index, const char *key, void *val, size_t size) {
+    pthread_mutex_lock(&index->cache_lock);
+    cache_put(index->cache, key, val, size);
+    pthread_mutex_unlock(&index->cache_lock);
+}
+
+int index_merge(index_t *dst, index_t *src) {
+    if (dst->file || src->file) {
+        pr_error("Cannot merge an index loaded from file\n");
+        return -1;
+    }
+    if (dst->doc_open || src->doc_open) {
+        pr_error("Cannot merge an index with a document still open\n");
+        return -1;
+    }
+    if (dst->store_positions != src->store_positions) {
+        pr_error("Cannot merge an index that stores positions with one that does not\n");
+        return -1;
+    }
+
+    map_iter_t *iter = map_createiter(src->terms);
+    if (!iter) {
+        return -1;
+    }
+
+    /* other merges may add documents to dst until the lock is held */
+    pthread_rwlock_wrlock(&dst->lock);
+
+    if (dst->number_of_docs + src->number_of_docs > UINT32_MAX) {
+        pthread_rwlock_unlock(&dst->lock);
+        map_destroyiter(iter);
+        pr_error("Exceeded the maximum number of documents\n");
+        return -1;
+    }
+
+    cache_clear_locked(dst);
+
+    /**
+     * the documents of src are appended to the table of dst, so their ids are shifted by this much. Each
+     * replaces any document of dst with the same name, which queries then stop seeing along with the merge.
+     */
+    docid_t offset = (docid_t) dst->number_of_docs;
+
+    for (size_t i = 0; i < src->number_of_docs; i++) {
+        add_doc(dst, src->doc_names[i], src->doc_lengths[i]);
+    }
+    dst->n_removed += src->n_removed;
+    dst->n_unpurged += src->n_unpurged;
+
+    while (map_hasnext(iter)) {
+        entry_t *entry = map_next(iter);
+        /* the canonical strings of src carry their length and hash, so nothing is hashed again */
+        str_t src_key = interned_key(entry->key);
+        char *key = intern_key(dst->interner, &src_key);
+        entry_t *dst_entry = map_get(dst->terms, key);
+
+        if (!dst_entry) {
+            postings_t *postings = postings_create(dst->store_positions);
+            if (!postings) {
+                PANIC("Failed to allocate memory\n");
+            }
+            map_insert(dst->terms, key, postings);
+            dst_entry = map_get(dst->terms, key);
+            dict_drop(dst);
+        }
+
+        postings_append_shifted(dst_entry->val, entry->val, offset);
+        postings_destroy(entry->val);
+    }
+    map_destroyiter(iter);
+
+    pthread_rwlock_unlock(&dst->lock);
+
+    /* everything in src is now owned (or copied) by dst, so only the containers remain */
+    MEM_RECORD(MEM_DOC_TABLE, -(int64_t) doc_table_size(src), -3);
+    map_destroy(src->terms, NULL, NULL);
+    map_destroy(src->doc_ids, NULL, NULL);
+    interner_destroy(src->interner);
+    free(src->doc_names);
+    free(src->doc_lengths);
+    pthread_mutex_destroy(&src->cache_lock);
+    pthread_rwlock_destroy(&src->lock);
+    cache_destroy(src->cache);
+    termdict_destroy(src->dict);
+    pthread_mutex_destroy(&src->dict_lock);
+    free(src);
+
+    return 0;
+}
+
+int index_update_document(index_t *index, char *doc_name, list_t *words) {
+    index_t *partial = index_create();
+    if (partial && index->store_positions) {
+        index_store_positions(partial);
+    }
+    if (!partial) {
+        free(doc_name);
+        list_destroy(words, free);
+        return -1;
+    }
+
+    /* the merge replaces the old document, all while holding the lock */
+    int status = index_document(partial, doc_name, words);
+    if (status == 0) {
+        status = index_merge(index, partial);
+    }
+    if (status != 0) {
+        index_destroy(partial);
+    }
+
+    return status;
+}
+
+int index_remove_document(index_t *index, const char *doc_name) {
+    if (index->file) {
+        pr_error("Cannot remove documents from an index loaded from file\n");
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&index->lock);
+
+    entry_t *entry = map_get(index->doc_ids, (void *) doc_name);
+    int status = -1;
+
+    /* an open document is still being added */
+    if (entry && !(index->doc_open && (docid_t) (uintptr_t) entry->val == index->open_doc)) {
+        remove_doc(index, (docid_t) (uintptr_t) entry->val);
+        cache_clear_locked(index);
+        status = 0;
+    }
+
+    pthread_rwlock_unlock(&index->lock);
+
+    return status;
+}
+
+size_t index_remove_prefix(index_t *index, const char *prefix) {
+    if (index->file) {
+        pr_error("Cannot remove documents from an index loaded from file\n");
+        return 0;
+    }
+
+    size_t prefix_len = strlen(prefix);
+    size_t n_removed = 0;
+
+    pthread_rwlock_wrlock(&index->lock);
+
+    for (size_t i = 0; i < index->number_of_docs; i++) {
+        const char *doc_name = index->doc_names[i];
+
+        int is_open = index->doc_open && i == index->open_doc;
+
+        if (doc_name && !is_open && strncmp(doc_name, prefix, prefix_len) == 0) {
+            remove_doc(index, (docid_t) i);
+            n_removed++;
+        }
+    }
+
+    if (n_removed) {
+        cache_clear_locked(index);
+    }
+
+    pthread_rwlock_unlock(&index->lock);
+
+    return n_removed;
+}
+
+int index_needs_compaction(index_t *index) {
+    if (index->file) {
+        return 0;
+    }
+
+    pthread_rwlock_rdlock(&index->lock);
+    size_t n_unpurged = index->n_unpurged;
+    size_t n_live = index->number_of_docs - index->n_removed;
+    pthread_rwlock_unlock(&index->lock);
+
+    return n_unpurged && (double) n_unpurged >= INDEX_COMPACT_RATIO * (double) n_live;
+}
+
+/**
+ * give back the memory of a buffer that shrunk to a fraction of its capacity, keeping room to append to it
+ * @param category: MEM_POSTINGS or MEM_POSITIONS, whichever the buffer is counted in
+ */
+static void buf_shrink(uint8_t **buf, size_t *capacity, size_t n_bytes, mem_category_t category) {
+    if (*capacity <= POSTINGS_CAPACITY_INITIAL || n_bytes >= *capacity / 4) {
+        return;
+    }
+
+    size_t new_capacity = POSTINGS_CAPACITY_INITIAL;
+    while (new_capacity < n_bytes + 2 * VARINT_MAX_BYTES) {
+        new_capacity *= 2;
+    }
+
+    uint8_t *new_buf = realloc(*buf, new_capacity);
+    if (new_buf) {
+        MEM_RESIZE(category, *capacity, new_capacity);
+        *buf = new_buf;
+        *capacity = new_capacity;
+    }
+}
+
+/**
+ * Drop the ids of removed documents from the postings, rewriting them in place. A dropped id is folded into
+ * the delta of the next id, which never takes more bytes than the dropped pair and the next delta did, so
+ * the rewritten postings stay behind the ones left to read. The same goes for the positions, if any, whose
+ * skip entries are laid out anew.
+ * @returns the number of bytes the postings (and positions) shrunk by
+ */
+static size_t postings_purge(index_t *index, postings_t *postings) {
+    const uint8_t *p = postings->buf;
+    const uint8_t *end = postings->buf + postings->n_bytes;
+    size_t n_bytes = 0;
+    docid_t id = 0;
+
+    positions_t *positions = postings->positions;
+    const uint8_t *pos = positions ? positions->buf : NULL;
+    size_t pos_bytes = 0;
+
+    size_t old_n_bytes = postings->n_bytes + (positions ? positions->n_bytes : 0);
+    postings_changed(postings);
+    postings->n_docs = 0;
+    postings->max_tf = 0;
+
+    if (positions) {
+        positions->n_skips = 0;
+    }
+
+    while (p < end) {
+        docid_t delta;
+        uint32_t tf;
+        p += varint_decode(p, &delta);
+        p += varint_decode(p, &tf);
+        id += delta;
+
+        const uint8_t *doc_pos = pos;
+        if (positions) {
+            pos = varints_skip(pos, tf);
+        }
+
+        if (!index->doc_names[id]) {
+            continue;
+        }
+
+        if (positions) {
+            if (postings->n_docs && postings->n_docs % POSITIONS_SKIP_INTERVAL == 0) {
+                positions_add_skip(positions, postings->last_id, n_bytes, pos_bytes);
+            }
+            memmove(&positions->buf[pos_bytes], doc_pos, (size_t) (pos - doc_pos));
+            pos_bytes += (size_t) (pos - doc_pos);
+        }
+
+        n_bytes += varint_encode(&postings->buf[n_bytes], postings->n_docs ? id - postings->last_id : id);
+        n_bytes += varint_encode(&postings->buf[n_bytes], tf);
+        postings->n_docs += 1;
+        postings->last_id = id;
+        postings->last_tf = tf;
+
+        if (tf > postings->max_tf) {
+            postings->max_tf = tf;
+        }
+    }
+    postings->n_bytes = n_bytes;
+    buf_shrink(&postings->buf, &postings->capacity, n_bytes, MEM_POSTINGS);
+
+    if (positions) {
+        positions->n_bytes = pos_bytes;
+        buf_shrink(&positions->buf, &positions->capacity, pos_bytes, MEM_POSITIONS);
+        n_bytes += pos_bytes;
+    }
+
+    return old_n_bytes - n_bytes;
+}
+
+size_t index_compact(index_t *index) {
+    if (index->file) {
+        return 0;
+    }
+
+    /* the terms to rewrite are gathered up front, as the map may change while the lock is released */
+    pthread_rwlock_rdlock(&index->lock);
+
+    size_t n_purged = index->n_unpurged;
+    size_t n_keys = 0;
+    char **keys = NULL;
+
+    if (n_purged) {
+        keys = malloc((map_length(index->terms) + 1) * sizeof(char *));
+        map_iter_t *iter = map_createiter(index->terms);
+        if (!keys || !iter) {
+            PANIC("Failed to allocate memory\n");
+        }
+
+        while (map_hasnext(iter)) {
+            keys[n_keys++] = map_next(iter)->key;
+        }
+        map_destroyiter(iter);
+    }
+
+    pthread_rwlock_unlock(&index->lock);
+
+    if (!n_purged) {
+        return 0;
+    }
+
+    size_t n_reclaimed = 0;
+
+    /* queries may run between batches. They skip removed documents either way, so any state is consistent. */
+    for (size_t i = 0; i < n_keys; i += INDEX_COMPACT_BATCH) {
+        pthread_rwlock_wrlock(&index->lock);
+
+        for (size_t j = i; j < n_keys && j < i + INDEX_COMPACT_BATCH; j++) {
+            entry_t *entry = map_get(index->terms, keys[j]);
+            postings_t *postings = entry->val;
+
+            n_reclaimed += postings_purge(index, postings);
+
+            /* a term only found in removed documents is no longer in the index. It stays interned. */
+            if (postings->n_docs == 0) {
+                free(map_remove(index->terms, keys[j]));
+                postings_destroy(postings);
+                dict_drop(index);
+            }
+        }
+
+        pthread_rwlock_unlock(&index->lock);
+    }
+
+    /* documents removed since the terms were gathered may not be purged from all of them */
+    pthread_rwlock_wrlock(&index->lock);
+    index->n_unpurged -= n_purged;
+    index->n_compactions += 1;
+    index->n_reclaimed += n_reclaimed;
+    pthread_rwlock_unlock(&index->lock);
+
+    free(keys);
+
+    return n_reclaimed;
+}
+
+void index_compaction_stat(index_t *index, compaction_stat_t *dst) {
+    if (index->file) {
+        *dst = (compaction_stat_t) { 0 };
+        return;
+    }
+
+    pthread_rwlock_rdlock(&index->lock);
+    dst->n_unpurged = index->n_unpurged;
+    dst->n_compactions = index->n_compactions;
+    dst->n_reclaimed = index->n_reclaimed;
+    pthread_rwlock_unlock(&index->lock);
+}
+
+static inline const file_header_t *file_header(index_t *index) {
+    return (const file_header_t *) index->file;
+}
+
+static inline const char *file_string(index_t *index, uint64_t str_off) {
+    return (const char *) index->file + file_header(index)->strings_off + str_off;
+}
+
+/* find a term in the dictionary of the index file, by perfect hash if frozen, otherwise by binary search */
+static const file_term_t *file_find_term(index_t *index, const char *term) {
+    const file_header_t *hdr = file_header(index);
+    const file_term_t *terms = (const file_term_t *) (index->file + hdr->terms_off);
+
+    /* the slot of a term holds the only term it can be, which is compared once */
+    if (index->term_hash) {
+        str_t key = str_key(term, strlen(term));
+        const file_term_t *ft = &terms[index->term_slots[perfhash_lookup(index->term_hash, &key)]];
+
+        return (strcmp(term, file_string(index, ft->str_off)) == 0) ? ft : NULL;
+    }
+
+    size_t lo = 0;
+    size_t hi = hdr->n_terms;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(term, file_string(index, terms[mid].str_off));
+
+        if (cmp > 0) {
+            lo = mid + 1;
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            return &terms[mid];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * The containers of the postings of a term, which are built by whichever query needs them first. Those of
+ * terms in fewer than CONTAINER_MIN_DOCS documents are not.
+ * @param slot: where the containers of the term are kept
+ * @returns the containers, or NULL
+ */
+static const containers_t *find_containers(
+    index_t *index,
+    _Atomic(containers_t *) *slot,
+    const postings_view_t *postings
+) {
+    if (postings->n_docs < CONTAINER_MIN_DOCS) {
+        return NULL;
+    }
+
+    /* concurrent queries may need them at the same time, and only one builds them */
+    containers_t *cs = atomic_load_explicit(slot, memory_order_acquire);
+    if (!cs) {
+        pthread_mutex_lock(&index->containers_lock);
+        cs = atomic_load_explicit(slot, memory_order_relaxed);
+        if (!cs) {
+            cs = containers_build(postings);
+            atomic_store_explicit(slot, cs, memory_order_release);
+        }
+        pthread_mutex_unlock(&index->containers_lock);
+    }
+
+    return cs;
+}
+
+/**
+ * Find the postings of a term, from memory or the index file, along with its containers
+ * @returns 1 and sets `dst` if the term is in the index, otherwise 0
+ */
+static int find_postings(index_t *index, const char *term, postings_view_t *dst) {
+    if (index->file) {
+        const file_term_t *ft = file_find_term(index, term);
+        if (!ft) {
+            return 0;
+        }
+        dst->buf = index->file + file_header(index)->postings_off + ft->postings_off;
+        dst->n_bytes = ft->postings_size;
+        dst->n_docs = ft->df;
+        dst->max_tf = ft->max_tf;
+
+        /* the containers are in the same order as the term dictionary */
+        size_t i = (size_t) (ft - (const file_term_t *) (index->file + file_header(index)->terms_off));
+        dst->containers = find_containers(index, &index->file_containers[i], dst);
+        return 1;
+    }
+
+    /* a term that was never interned cannot be in the index */
+    char *key = intern_lookup(index->interner, term, strlen(term));
+    entry_t *entry = key ? map_get(index->terms, key) : NULL;
+    if (!entry) {
+        return 0;
+    }
+
+    postings_t *postings = entry->val;
+    dst->buf = postings->buf;
+    dst->n_bytes = postings->n_bytes;
+    dst->n_docs = postings->n_docs;
+    dst->max_tf = postings->max_tf;
+    dst->containers = find_containers(index, &postings->containers, dst);
+    return 1;
+}
+
+/**
+ * Find the positions of a term, from memory or the index file. Only looked up by phrase queries.
+ * @returns 1 and sets `dst` if the term is in the index, and the index stores positions, otherwise 0
+ */
+static int find_positions(index_t *index, const char *term, positions_view_t *dst) {
+    if (index->file) {
+        const file_header_t *hdr = file_header(index);
+        const file_term_t *ft = file_find_term(index, term);
+        if (!ft || !hdr->term_positions_off) {
+            return 0;
+        }
+
+        /* the table of positions is in the same order as the term dictionary */
+        size_t i = (size_t) (ft - (const file_term_t *) (index->file + hdr->terms_off));
+        const file_positions_t *fp = (const file_positions_t *) (index->file + hdr->term_positions_off) + i;
+
+        dst->skips = (const skip_t *) (index->file + hdr->positions_off + fp->off);
+        dst->n_skips = fp->n_skips;
+        dst->buf = (const uint8_t *) (dst->skips + fp->n_skips);
+        dst->n_bytes = fp->n_bytes;
+        return 1;
+    }
+
+    char *key = intern_lookup(index->interner, term, strlen(term));
+    entry_t *entry = key ? map_get(index->terms, key) : NULL;
+    if (!entry || !((postings_t *) entry->val)->positions) {
+        return 0;
+    }
+
+    positions_t *positions = ((postings_t *) entry->val)->positions;
+    dst->buf = positions->buf;
+    dst->n_bytes = positions->n_bytes;
+    dst->skips = positions->skips;
+    dst->n_skips = positions->n_skips;
+    return 1;
+}
+
+static inline const file_doc_t *file_doc(index_t *index, docid_t id) {
+    return (const file_doc_t *) (index->file + file_header(index)->docs_off) + id;
+}
+
+static inline char *doc_name_of(index_t *index, docid_t id) {
+    if (index->file) {
+        return (char *) file_string(index, file_doc(index, id)->name_off);
+    }
+    return index->doc_names[id];
+}
+
+static inline uint32_t doc_length_of(index_t *index, docid_t id) {
+    if (index->file) {
+        return file_doc(index, id)->length;
+    }
+    return index->doc_lengths[id];
+}
+
+/* ---------------------Sorted terms---------------------- */
+
+static int compare_entries_by_key(const void *a, const void *b) {
+    return strcmp((*(entry_t **) a)->key, (*(entry_t **) b)->key);
+}
+
+/* the entries of the term map, sorted by term. NULL on failure to allocate memory. */
+static entry_t **sorted_entries(index_t *index) {
+    size_t n_terms = map_length(index->terms);
+    entry_t **entries = malloc((n_terms + 1) * sizeof(entry_t *));
+    map_iter_t *iter = map_createiter(index->terms);
+
+    if (!entries || !iter) {
+        free(entries);
+        map_destroyiter(iter);
+        return NULL;
+    }
+
+    for (size_t i = 0; map_hasnext(iter); i++) {
+        entries[i] = map_next(iter);
+    }
+    map_destroyiter(iter);
+    qsort(entries, n_terms, sizeof(entry_t *), compare_entries_by_key);
+
+    return entries;
+}
+
+/* the sorted dictionary of the terms, which is built if there is none. Must be held with `dict_lock`. */
+static termdict_t *term_dict(index_t *index) {
+    if (index->dict) {
+        return index->dict;
+    }
+
+    size_t n_terms = map_length(index->terms);
+    entry_t **entries = sorted_entries(index);
+    const char **keys = malloc((n_terms + 1) * sizeof(char *));
+    void **vals = malloc((n_terms + 1) * sizeof(void *));
+    if (!entries || !keys || !vals) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    for (size_t i = 0; i < n_terms; i++) {
+        keys[i] = entries[i]->key;
+        vals[i] = entries[i];
+    }
+    index->dict = termdict_create(keys, vals, n_terms);
+
+    free(entries);
+    free(keys);
+    free(vals);
+
+    return index->dict;
+}
+
+void index_build_term_dict(index_t *index) {
+    if (index->file) {
+        return; // the dictionary of the file is sorted already
+    }
+
+    pthread_rwlock_rdlock(&index->lock);
+    pthread_mutex_lock(&index->dict_lock);
+    term_dict(index);
+    pthread_mutex_unlock(&index->dict_lock);
+    pthread_rwlock_unlock(&index->lock);
+}
+
+/* ------------------------Planner------------------------ */
+
+/**
+ * Node of a query plan: the AST with chains of "&&" and "||" flattened into n-ary nodes, each annotated with
+ * an upper bound on its number of matches. The postings of every term are looked up once, up front.
+ */
+typedef struct plan_node plan_node_t;
+struct plan_node {
+    query_op_t op;
+    size_t cost;              // upper bound on the number of matching documents
+    const char *term;         // QUERY_TERM only. Borrowed from the AST, the index file or the term map.
+    postings_view_t postings; // QUERY_TERM only. Empty if the term is not in the index.
+    positions_view_t positions; // QUERY_TERM of a phrase only. Empty otherwise.
+    size_t n_children;
+    plan_node_t **children;   // operands, ascending by cost. Exactly 2 for QUERY_ANDNOT, in query order.
+    char *key;                // canonical form of the subquery (see plan_key). Only set if caching.
+};
+
+static int compare_plans_by_cost(const void *a, const void *b) {
+    const plan_node_t *pa = *(const plan_node_t **) a;
+    const plan_node_t *pb = *(const plan_node_t **) b;
+
+    return (pa->cost > pb->cost) - (pa->cost < pb->cost);
+}
+
+/* number of operands of the chain of `op` rooted at node, e.g. 3 for "a && b && c" */
+static size_t chain_length(query_node_t *node, query_op_t op) {
+    if (node->op != op) {
+        return 1;
+    }
+    return chain_length(node->left, op) + chain_length(node->right, op);
+}
+
+static plan_node_t *plan_build(index_t *index, query_node_t *node);
+
+static int compare_keys(const void *a, const void *b) {
+    return strcmp(*(const char **) a, *(const char **) b);
+}
+
+/**
+ * Canonical form of a planned subquery, used as its key in the query cache. The form is fully parenthesized,
+ * e.g. "(&! (&& a b) c)". Operands of "&&" and "||" are sorted, and duplicates dropped as both operators are
+ * idempotent, so that e.g. "b && a" and "a && b && a" share a key. Operands of "&!" and the words of a
+ * phrase keep their order.
+ */
+static char *plan_key(plan_node_t *plan, const char *term) {
+    /* a pattern has a "*", so it never has the key of a term */
+    if (plan->op == QUERY_TERM || plan->op == QUERY_WILDCARD) {
+        char *key = strdup(term);
+        if (!key) {
+            PANIC("Failed to allocate memory\n");
+        }
+        return key;
+    }
+
+    const char **keys = malloc(plan->n_children * sizeof(char *));
+    if (!keys) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    const char *op = query_op_str(plan->op);
+    size_t len = strlen("()") + strlen(op);
+    int ordered = (plan->op == QUERY_ANDNOT || plan->op == QUERY_PHRASE);
+
+    for (size_t i = 0; i < plan->n_children; i++) {
+        keys[i] = plan->children[i]->key;
+        len += strlen(" ") + strlen(keys[i]);
+    }
+    if (!ordered) {
+        qsort(keys, plan->n_children, sizeof(char *), compare_keys);
+    }
+
+    char *key = malloc(len + 1);
+    if (!key) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    char *end = stpcpy(stpcpy(key, "("), op);
+    for (size_t i = 0; i < plan->n_children; i++) {
+        if (!ordered && i > 0 && strcmp(keys[i], keys[i - 1]) == 0) {
+            continue;
+        }
+        end = stpcpy(stpcpy(end, " "), keys[i]);
+    }
+    stpcpy(end, ")");
+
+    free(keys);
+
+    return key;
+}
+
+/* 1 if the term matches the pattern, where each "*" matches any number of characters */
+static int wildcard_match(const char *pattern, const char *term) {
+    const char *star = NULL; // the last "*" seen, to backtrack to
+    const char *resume = NULL;
+
+    while (*term) {
+        if (*pattern == '*') {
+            star = pattern++;
+            resume = term;
+        } else if (*pattern == *term) {
+            pattern++;
+            term++;
+        } else if (star) {
+            /* let the last "*" match one more character, and try again from there */
+            pattern = star + 1;
+            term = ++resume;
+        } else {
+            return 0;
+        }
+    }
+
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+/* the terms a pattern expands to, gathered into the children of its plan */
+typedef struct expansion {
+    const char *pattern;
+    plan_node_t *plan;
+    size_t capacity; // of plan->children
+} expansion_t;
+
+/**
+ * Add a term that starts with the literal prefix of the pattern to the expansion, if it matches the pattern
+ * as a whole. Stops (returns 1) once the pattern has matched more than WILDCARD_MAX_TERMS terms, which the
+ * query is then rejected for.
+ * @param term: must outlive the plan
+ */
+static int expand_term(expansion_t *exp, const char *term, const postings_view_t *postings) {
+    plan_node_t *plan = exp->plan;
+
+    if (!wildcard_match(exp->pattern, term)) {
+        return 0;
+    }
+
+    if (plan->n_children == exp->capacity) {
+        exp->capacity = exp->capacity ? exp->capacity * 2 : 8;
+        plan->children = realloc(plan->children, exp->capacity * sizeof(plan_node_t *));
+        if (!plan->children) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+
+    plan_node_t *child = malloc(sizeof(plan_node_t));
+    if (!child) {
+        PANIC("Failed to allocate memory\n");
+    }
+    child->op = QUERY_TERM;
+    child->cost = postings->n_docs;
+    child->term = term;
+    child->postings = *postings;
+    child->positions = (positions_view_t) { .buf = NULL, .n_bytes = 0, .skips = NULL, .n_skips = 0 };
+    child->n_children = 0;
+    child->children = NULL;
+    child->key = NULL; // only the pattern as a whole is cached
+
+    plan->children[plan->n_children++] = child;
+    plan->cost += child->cost;
+
+    return plan->n_children > WILDCARD_MAX_TERMS;
+}
+
+/* termdict_fn of the sorted dictionary of an in-memory index, whose values are entries of the term map */
+static int expand_dict_term(const char *term, void *val, void *arg) {
+    (void) term; // only valid until the function returns, unlike the key of the entry
+
+    entry_t *entry = val;
+    postings_t *postings = entry->val;
+    postings_view_t view = {
+        .buf = postings->buf,
+        .n_bytes = postings->n_bytes,
+        .n_docs = postings->n_docs,
+        .max_tf = postings->max_tf,
+    };
+
+    return expand_term(arg, entry->key, &view);
+}
+
+/**
+ * Plan a pattern as the union of every term it matches. Only the terms that start with the part of the
+ * pattern before its first "*" are looked at, which are next to each other in sorted order.
+ */
+static void plan_expand(index_t *index, plan_node_t *plan, const char *pattern) {
+    size_t prefix_len = strcspn(pattern, "*");
+    expansion_t exp = { .pattern = pattern, .plan = plan, .capacity = 0 };
+
+    plan->cost = 0;
+
+    if (index->file) {
+        const file_header_t *hdr = file_header(index);
+        const file_term_t *terms = (const file_term_t *) (index->file + hdr->terms_off);
+
+        /* the dictionary of the file is sorted, so the first term with the prefix is binary searched for */
+        size_t lo = 0;
+        size_t hi = hdr->n_terms;
+
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (strncmp(file_string(index, terms[mid].str_off), pattern, prefix_len) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        for (size_t i = lo; i < hdr->n_terms; i++) {
+            const char *term = file_string(index, terms[i].str_off);
+            if (strncmp(term, pattern, prefix_len) != 0) {
+                break;
+            }
+
+            postings_view_t view = {
+                .buf = index->file + hdr->postings_off + terms[i].postings_off,
+                .n_bytes = terms[i].postings_size,
+                .n_docs = terms[i].df,
+                .max_tf = terms[i].max_tf,
+            };
+            if (expand_term(&exp, term, &view)) {
+                break;
+            }
+        }
+        return;
+    }
+
+    /**
+     * the dictionary is only ever dropped with the write lock held, which the query holds for reading. So
+     * once built, it can be read without `dict_lock`, along with any other queries.
+     */
+    pthread_mutex_lock(&index->dict_lock);
+    termdict_t *dict = term_dict(index);
+    pthread_mutex_unlock(&index->dict_lock);
+
+    termdict_prefix(dict, pattern, prefix_len, expand_dict_term, &exp);
+}
+
+/* 1 if any pattern of the plan matches more terms than WILDCARD_MAX_TERMS */
+static int plan_too_broad(plan_node_t *plan) {
+    if (plan->op == QUERY_WILDCARD) {
+        return plan->n_children > WILDCARD_MAX_TERMS;
+    }
+    for (size_t i = 0; i < plan->n_children; i++) {
+        if (plan_too_broad(plan->children[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* plan each operand of the chain of `op` rooted at node, appending them to dst */
+static void plan_chain(index_t *index, query_node_t *node, query_op_t op, plan_node_t **dst, size_t *n) {
+    if (node->op != op) {
+        dst[(*n)++] = plan_build(index, node);
+        return;
+    }
+    plan_chain(index, node->left, op, dst, n);
+    plan_chain(index, node->right, op, dst, n);
+}
+
+/**
+ * Build the plan of an AST.
+ *
+ * "&&" and "||" are associative, so any chain of them can be evaluated in whichever order is cheapest. "&!"
+ * is not (the grammar reads "a &! b &! c" as "a &! (b &! c)"), and is kept as a binary node.
+ * The plan borrows the terms of the AST, which must outlive it.
+ */
+static plan_node_t *plan_build(index_t *index, query_node_t *node) {
+    plan_node_t *plan = malloc(sizeof(plan_node_t));
+    if (!plan) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    plan->op = node->op;
+    plan->term = (node->op == QUERY_TERM) ? node->term : NULL;
+    plan->n_children = 0;
+    plan->children = NULL;
+    plan->key = NULL;
+    plan->positions = (positions_view_t) { .buf = NULL, .n_bytes = 0, .skips = NULL, .n_skips = 0 };
+
+    if (node->op == QUERY_TERM) {
+        if (!find_postings(index, node->term, &plan->postings)) {
+            plan->postings = (postings_view_t) {
+                .buf = NULL,
+                .n_bytes = 0,
+                .n_docs = 0,
+                .max_tf = 0,
+                .containers = NULL,
+            };
+        }
+        plan->cost = plan->postings.n_docs;
+
+        if (index->cache) {
+            plan->key = plan_key(plan, node->term);
+        }
+        return plan;
+    }
+
+    if (node->op == QUERY_WILDCARD) {
+        plan_expand(index, plan, node->term);
+
+        if (index->cache) {
+            plan->key = plan_key(plan, node->term);
+        }
+        return plan;
+    }
+
+    size_t n_children = (node->op == QUERY_ANDNOT) ? 2 : chain_length(node, node->op);
+
+    plan->children = malloc(n_children * sizeof(plan_node_t *));
+    if (!plan->children) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    switch (node->op) {
+        case QUERY_AND:
+            plan_chain(index, node, QUERY_AND, plan->children, &plan->n_children);
+            qsort(plan->children, plan->n_children, sizeof(plan_node_t *), compare_plans_by_cost);
+
+            /* can match no more documents than the smallest operand */
+            plan->cost = plan->children[0]->cost;
+            break;
+        case QUERY_OR:
+            plan_chain(index, node, QUERY_OR, plan->children, &plan->n_children);
+            qsort(plan->children, plan->n_children, sizeof(plan_node_t *), compare_plans_by_cost);
+
+            plan->cost = 0;
+            for (size_t i = 0; i < plan->n_children; i++) {
+                plan->cost += plan->children[i]->cost;
+            }
+            break;
+        case QUERY_ANDNOT:
+            plan->children[plan->n_children++] = plan_build(index, node->left);
+            plan->children[plan->n_children++] = plan_build(index, node->right);
+
+            plan->cost = plan->children[0]->cost;
+            break;
+        case QUERY_PHRASE:
+            /* the words keep their order, and are all terms. Only phrases look up their positions. */
+            plan_chain(index, node, QUERY_PHRASE, plan->children, &plan->n_children);
+
+            plan->cost = plan->children[0]->cost;
+            query_node_t *rest = node;
+
+            for (size_t i = 0; i < plan->n_children; i++) {
+                query_node_t *word = (rest->op == QUERY_PHRASE) ? rest->left : rest;
+                find_positions(index, word->term, &plan->children[i]->positions);
+                rest = rest->right;
+
+                if (plan->children[i]->cost < plan->cost) {
+                    plan->cost = plan->children[i]->cost;
+                }
+            }
+            break;
+        default:
+            PANIC("Invalid query node\n");
+    }
+
+    assert(plan->n_children == n_children);
+
+    if (index->cache) {
+        plan->key = plan_key(plan, NULL);
+    }
+
+    return plan;
+}
+
+static void plan_destroy(plan_node_t *plan) {
+    for (size_t i = 0; i < plan->n_children; i++) {
+        plan_destroy(plan->children[i]);
+    }
+    free(plan->children);
+    free(plan->key);
+    free(plan);
+}
+
+/* ------------------------Evaluation--------------------- */
+
+/**
+ * A plan is evaluated by a tree of cursors, one per node, each of which produces the matching documents of its
+ * node one at a time, in ascending order of id. An operator pulls from the cursors of its operands only as far
+ * as it needs to, so no intermediate result is ever allocated. "&&" stops as soon as any operand runs out, and
+ * skips the others ahead to the next document of the operand that is furthest along. The right side of "&!"
+ * is only read up to the last document of the left side.
+ */
+
+/* walks the ids of one postings, as kept in the heap of the cursor of a pattern */
+typedef struct id_cursor {
+    const uint8_t *p; // next (delta, tf) pair
+    const uint8_t *end;
+    docid_t id;       // current id
+} id_cursor_t;
+
+/* move the cursor to the next id. Returns 0 if there is none. */
+static inline int id_cursor_next(id_cursor_t *cur) {
+    if (cur->p == cur->end) {
+        return 0;
+    }
+
+    docid_t delta;
+    uint32_t tf;
+    cur->p += varint_decode(cur->p, &delta);
+    cur->p += varint_decode(cur->p, &tf);
+    cur->id += delta;
+
+    return 1;
+}
+
+/* min-heap of cursors by current id */
+static void id_heap_sift_down(id_cursor_t *heap, size_t len, size_t i) {
+    while (1) {
+        size_t lowest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+
+        if (left < len && heap[left].id < heap[lowest].id) {
+            lowest = left;
+        }
+        if (right < len && heap[right].id < heap[lowest].id) {
+            lowest = right;
+        }
+        if (lowest == i) {
+            break;
+        }
+
+        id_cursor_t tmp = heap[i];
+        heap[i] = heap[lowest];
+        heap[lowest] = tmp;
+        i = lowest;
+    }
+}
+
+/**
+ * Walks the postings and positions of one word of a phrase, in step with the candidate documents. These are
+ * visited in ascending order, and all contain the word.
+ */
+typedef struct phrase_cursor {
+    const uint8_t *postings; // start of the postings, which the offsets of the skip entries are relative to
+    const uint8_t *p;        // next (delta, tf) pair
+    const uint8_t *pos;      // positions of the current document
+    docid_t id;              // current document, i.e. that of the last pair read
+    uint32_t tf;             // tf of the current document, which is the number of its positions
+    const positions_view_t *positions;
+    size_t next_skip; // first skip entry not yet passed
+} phrase_cursor_t;
+
+static void cursor_init(phrase_cursor_t *cur, plan_node_t *word) {
+    cur->postings = word->postings.buf;
+    cur->p = word->postings.buf;
+    cur->pos = word->positions.buf;
+    cur->id = 0; // the first delta is relative to 0
+    cur->tf = 0;
+    cur->positions = &word->positions;
+    cur->next_skip = 0;
+}
+
+/**
+ * Move the cursor to document `target`, which must be in its postings. If a skip entry lies between the
+ * cursor and the target, the cursor jumps to the last of them, rather than decoding every document up to it.
+ * @returns the tf of the word in `target`
+ */
+static uint32_t cursor_seek(phrase_cursor_t *cur, docid_t target) {
+    const positions_view_t *positions = cur->positions;
+
+    /* the last skip entry that starts before target, by binary search among those not yet passed */
+    size_t lo = cur->next_skip;
+    size_t hi = positions->n_skips;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (positions->skips[mid].last_id < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo > cur->next_skip) {
+        const skip_t *skip = &positions->skips[lo - 1];
+
+        if (cur->postings + skip->postings_off > cur->p) {
+            cur->p = cur->postings + skip->postings_off;
+            cur->pos = positions->buf + skip->positions_off;
+            cur->id = skip->last_id;
+            cur->tf = 0;
+        }
+        cur->next_skip = lo;
+    }
+
+    do {
+        cur->pos = varints_skip(cur->pos, cur->tf);
+
+        docid_t delta;
+        cur->p += varint_decode(cur->p, &delta);
+        cur->p += varint_decode(cur->p, &cur->tf);
+        cur->id += delta;
+    } while (cur->id < target);
+
+    assert(cur->id == target);
+
+    return cur->tf;
+}
+
+/**
+ * Where the phrase would start if the word at `offset` of it is at each of its positions in the current
+ * document of the cursor. Positions too close to the start of the document for that are left out.
+ * @returns the number of starts written to dst, which must have room for the tf of the document
+ */
+static size_t phrase_starts(phrase_cursor_t *cur, uint32_t offset, uint32_t *dst) {
+    const uint8_t *p = cur->pos;
+    uint32_t pos = 0;
+    size_t n = 0;
+
+    for (uint32_t i = 0; i < cur->tf; i++) {
+        uint32_t delta;
+        p += varint_decode(p, &delta);
+        pos += delta;
+
+        if (pos >= offset) {
+            dst[n++] = pos - offset;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * Keep only the starts of the phrase where the word at `offset` of it follows, by merging them with the
+ * positions of the word in the current document of the cursor. Both are ascending.
+ * @returns the number of starts kept
+ */
+static size_t phrase_filter(phrase_cursor_t *cur, uint32_t offset, uint32_t *starts, size_t n_starts) {
+    const uint8_t *p = cur->pos;
+    uint64_t pos = 0;
+    uint32_t i = 0; // positions decoded so far, the last of which is pos
+    size_t n_kept = 0;
+
+    for (size_t s = 0; s < n_starts; s++) {
+        uint64_t target = (uint64_t) starts[s] + offset;
+
+        while (i < cur->tf && (i == 0 || pos < target)) {
+            uint32_t delta;
+            p += varint_decode(p, &delta);
+            pos = (i == 0) ? delta : pos + delta;
+            i++;
+        }
+
+        if (pos == target) {
+            starts[n_kept++] = starts[s];
+        } else if (pos < target) {
+            break; // past the last position, as are the starts after this one
+        }
+    }
+
+    return n_kept;
+}
+
+/**
+ * Cursor over the matches of a plan node. Only the members of its kind of node are used.
+ *
+ * A cursor is always on its current match, from when it is opened until it is exhausted. It has a block of
+ * matches at hand, from the current one on: a term decodes its postings a block at a time, and an operator
+ * fills its block by running on the cursors of its operands. A cursor over cached matches has all of them as
+ * its block. Moving to the next match is then usually just moving to the next id of the block, and skipping
+ * ahead within it is a gallop.
+ *
+ * A bitwise node (see plan_bitwise) takes its matches from the bitmap of one chunk of ids at a time instead,
+ * which it computes from the containers of its terms with word-wise operations.
+ */
+typedef struct match_cursor match_cursor_t;
+struct match_cursor {
+    query_op_t op;
+    size_t cost;   // upper bound on the number of matches, as planned
+    int exhausted; // 1 once there are no more matches. Nothing else is valid then.
+    int drained;   // 1 once the node has nothing more to add to the block
+    char **tombstones; // QUERY_TERM and QUERY_WILDCARD. Names by id, NULL if removed (see struct index).
+
+    /* matches at hand, of which block[i_block] is the current one */
+    const docid_t *block;
+    size_t i_block;
+    size_t n_block;
+    docid_t decoded[MATCH_BLOCK_LEN];
+
+    /* an operator whose matches were cached by an earlier query reads them instead of its operands */
+    cached_docids_t *cached;
+
+    /* QUERY_TERM */
+    const uint8_t *p; // next (delta, tf) pair
+    const uint8_t *end;
+    docid_t last_id;  // last id decoded, which the next delta is relative to
+
+    /* QUERY_AND, QUERY_OR, QUERY_ANDNOT and QUERY_PHRASE. For a phrase, its words ascending by cost. */
+    match_cursor_t **children;
+    size_t n_children;
+
+    /* QUERY_WILDCARD */
+    id_cursor_t *heap;
+    size_t heap_len;
+
+    /* a bitwise node. The bitmap of the current chunk is followed by room for computing it, see bits_load. */
+    plan_node_t *plan;
+    uint64_t *bits;
+    uint32_t key;      // current chunk
+    uint32_t next_key; // chunk to load once the current one is used up
+    uint32_t n_keys;   // chunks the ids of the index span
+    size_t word;       // the words of the chunk before it are used up, and so are the bits cleared from it
+
+    /* QUERY_PHRASE. The positions of its words, in the order of the phrase. */
+    phrase_cursor_t *words;
+    size_t n_words;
+    uint32_t *starts;
+    size_t starts_capacity;
+};
+
+static int match_refill(match_cursor_t *cur);
+static int match_skip(match_cursor_t *cur, docid_t target);
+
+/* id of the current match */
+static inline docid_t match_id(const match_cursor_t *cur) {
+    return cur->block[cur->i_block];
+}
+
+/**
+ * Move the cursor to its next match
+ * @returns 1 if there is one, otherwise 0
+ */
+static inline int match_next(match_cursor_t *cur) {
+    return ++cur->i_block < cur->n_block || match_refill(cur);
+}
+
+/**
+ * Move the cursor to its first match >= target. A cursor already there stays where it is.
+ * @returns 1 if there is one, otherwise 0
+ */
+static inline int match_advance(match_cursor_t *cur, docid_t target) {
+    if (cur->exhausted) {
+        return 0;
+    }
+    if (match_id(cur) >= target) {
+        return 1;
+    }
+    if (cur->block[cur->n_block - 1] >= target) {
+        cur->i_block = docids_gallop(cur->block, cur->n_block, cur->i_block + 1, target);
+        return 1;
+    }
+    return match_skip(cur, target);
+}
+
+/* there are no more matches. Returns 0. */
+static inline int match_end(match_cursor_t *cur) {
+    cur->exhausted = 1;
+    return 0;
+}
+
+/* upper bound on the number of matches of a plan */
+static size_t max_matches(index_t *index, plan_node_t *plan) {
+    size_t n_ids = index->file ? file_header(index)->n_docs : index->number_of_docs;
+
+    return (plan->cost < n_ids) ? plan->cost : n_ids;
+}
+
+/**
+ * Decode the next block of ids of the postings of a term, leaving out removed documents
+ * @returns the number of ids decoded, which is only 0 at the end of the postings
+ */
+static size_t term_decode(match_cursor_t *cur) {
+    const uint8_t *p = cur->p;
+    char **tombstones = cur->tombstones;
+    docid_t id = cur->last_id;
+    size_t n = 0;
+
+    while (n < MATCH_BLOCK_LEN && p < cur->end) {
+        docid_t delta;
+        uint32_t tf;
+        p += varint_decode(p, &delta);
+        p += varint_decode(p, &tf);
+        id += delta;
+
+        cur->decoded[n] = id;
+        n += !tombstones || tombstones[id];
+    }
+
+    cur->p = p;
+    cur->last_id = id;
+    cur->drained = (p == cur->end);
+    cur->i_block = 0;
+    cur->n_block = n;
+
+    return n;
+}
+
+/**
+ * Move the operands of "&&" (or a phrase) forward until they are all on the same document, starting from the
+ * current document of the first (and shortest) one. Whenever an operand skips past the document, the first
+ * operand catches up to it, and the others are checked anew.
+ * @returns 1 if they are, or 0 once any operand runs out
+ */
+static int and_align(match_cursor_t *cur) {
+    match_cursor_t *lead = cur->children[0];
+    docid_t candidate = match_id(lead);
+    size_t i = 1;
+
+    while (i < cur->n_children) {
+        match_cursor_t *operand = cur->children[i];
+
+        if (!match_advance(operand, candidate)) {
+            return 0;
+        }
+        if (match_id(operand) == candidate) {
+            i++;
+            continue;
+        }
+
+        if (!match_advance(lead, match_id(operand))) {
+            return 0;
+        }
+        candidate = match_id(lead);
+        i = 1;
+    }
+
+    return 1;
+}
+
+/**
+ * Whether the words of the phrase are right after each other, in order, in document `id` (which has all of
+ * them). The positions of the word with the fewest occurrences give where the phrase may start, which the
+ * positions of every other word then narrow down.
+ */
+static int phrase_check(match_cursor_t *cur, docid_t id) {
+    phrase_cursor_t *words = cur->words;
+    size_t rarest = 0;
+
+    for (size_t i = 0; i < cur->n_words; i++) {
+        if (cursor_seek(&words[i], id) < words[rarest].tf) {
+            rarest = i;
+        }
+    }
+
+    if (words[rarest].tf > cur->starts_capacity) {
+        cur->starts_capacity = words[rarest].tf;
+        free(cur->starts);
+        cur->starts = malloc(cur->starts_capacity * sizeof(uint32_t));
+        if (!cur->starts) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+
+    size_t n_starts = phrase_starts(&words[rarest], (uint32_t) rarest, cur->starts);
+
+    for (size_t i = 0; i < cur->n_words && n_starts; i++) {
+        if (i != rarest) {
+            n_starts = phrase_filter(&words[i], (uint32_t) i, cur->starts, n_starts);
+        }
+    }
+
+    return n_starts != 0;
+}
+
+/**
+ * Documents with both operands of "&&", by merging their blocks without branching on which is lower
+ * @returns the number of documents added to the block, from the n already in it
+ */
+static size_t and_merge(match_cursor_t *cur, size_t n) {
+    match_cursor_t *a = cur->children[0];
+    match_cursor_t *b = cur->children[1];
+
+    while (n < MATCH_BLOCK_LEN && !a->exhausted && !b->exhausted) {
+        const docid_t *a_ids = a->block;
+        const docid_t *b_ids = b->block;
+        size_t i = a->i_block;
+        size_t j = b->i_block;
+
+        while (n < MATCH_BLOCK_LEN && i < a->n_block && j < b->n_block) {
+            docid_t x = a_ids[i];
+            docid_t y = b_ids[j];
+
+            cur->decoded[n] = x;
+            n += (x == y);
+            i += (x <= y);
+            j += (y <= x);
+        }
+
+        /* an operand that used up its block moves on to its next one */
+        a->i_block = i;
+        b->i_block = j;
+        if (i == a->n_block) {
+            match_refill(a);
+        }
+        if (j == b->n_block) {
+            match_refill(b);
+        }
+    }
+
+    if (a->exhausted || b->exhausted) {
+        cur->drained = 1;
+    }
+
+    return n;
+}
+
+/* documents with all of the operands, which for a phrase must also have its words in order */
+static size_t and_fill(match_cursor_t *cur) {
+    match_cursor_t *lead = cur->children[0];
+    size_t n = 0;
+
+    if (cur->n_children == 2 && !cur->words && cur->children[1]->cost / INTERSECT_GALLOP_RATIO < lead->cost) {
+        return and_merge(cur, n);
+    }
+
+    while (n < MATCH_BLOCK_LEN) {
+        if (lead->exhausted || !and_align(cur)) {
+            cur->drained = 1;
+            break;
+        }
+
+        docid_t id = match_id(lead);
+        if (!cur->words || phrase_check(cur, id)) {
+            cur->decoded[n++] = id;
+        }
+        match_next(lead);
+    }
+
+    return n;
+}
+
+/**
+ * Documents of any of the operands. The blocks of two operands are merged directly, without branching on
+ * which is lower. Otherwise, each step takes the lowest current document of the operands, and moves every
+ * operand on it past it, so that it is only produced once.
+ */
+static size_t or_fill(match_cursor_t *cur) {
+    size_t n = 0;
+
+    while (n < MATCH_BLOCK_LEN) {
+        if (cur->n_children == 2 && !cur->children[0]->exhausted && !cur->children[1]->exhausted) {
+            match_cursor_t *a = cur->children[0];
+            match_cursor_t *b = cur->children[1];
+            const docid_t *a_ids = a->block;
+            const docid_t *b_ids = b->block;
+            size_t i = a->i_block;
+            size_t j = b->i_block;
+
+            while (n < MATCH_BLOCK_LEN && i < a->n_block && j < b->n_block) {
+                docid_t x = a_ids[i];
+                docid_t y = b_ids[j];
+
+                cur->decoded[n++] = (x < y) ? x : y;
+                i += (x <= y);
+                j += (y <= x);
+            }
+
+            /* an operand that used up its block moves on to its next one */
+            a->i_block = i;
+            b->i_block = j;
+            if (i == a->n_block) {
+                match_refill(a);
+            }
+            if (j == b->n_block) {
+                match_refill(b);
+            }
+            continue;
+        }
+
+        int found = 0;
+        docid_t lowest = 0;
+
+        for (size_t i = 0; i < cur->n_children; i++) {
+            match_cursor_t *operand = cur->children[i];
+
+            if (!operand->exhausted && (!found || match_id(operand) < lowest)) {
+                lowest = match_id(operand);
+                found = 1;
+            }
+        }
+
+        if (!found) {
+            cur->drained = 1;
+            break;
+        }
+
+        cur->decoded[n++] = lowest;
+
+        for (size_t i = 0; i < cur->n_children; i++) {
+            match_cursor_t *operand = cur->children[i];
+
+            if (!operand->exhausted && match_id(operand) == lowest) {
+                match_next(operand);
+            }
+        }
+    }
+
+    return n;
+}
+
+/* documents of the left operand of "&!" that the right one does not have */
+static size_t andnot_fill(match_cursor_t *cur) {
+    match_cursor_t *left = cur->children[0];
+    match_cursor_t *right = (cur->n_children == 2) ? cur->children[1] : NULL;
+    size_t n = 0;
+
+    while (n < MATCH_BLOCK_LEN) {
+        if (left->exhausted) {
+            cur->drained = 1;
+            break;
+        }
+
+        docid_t id = match_id(left);
+        if (!right || !match_advance(right, id) || match_id(right) != id) {
+            cur->decoded[n++] = id;
+        }
+        match_next(left);
+    }
+
+    return n;
+}
+
+/**
+ * Union of the postings of every term a pattern expanded to, merged in one pass over all of them rather than
+ * one union after another. A min-heap holds a cursor per postings, so the ids come out in ascending order,
+ * where an id found in several postings is only produced once.
+ */
+static size_t wildcard_fill(match_cursor_t *cur) {
+    size_t n = 0;
+
+    while (n < MATCH_BLOCK_LEN) {
+        if (cur->heap_len == 0) {
+            cur->drained = 1;
+            break;
+        }
+
+        docid_t id = cur->heap[0].id;
+
+        if (!id_cursor_next(&cur->heap[0])) {
+            cur->heap[0] = cur->heap[--cur->heap_len];
+        }
+        id_heap_sift_down(cur->heap, cur->heap_len, 0);
+
+        /* the last id produced is either in this block, or the last of the one before */
+        int repeated = (n > 0) ? (cur->decoded[n - 1] == id) : (cur->last_id == id && cur->n_block > 0);
+
+        if (!repeated && (!cur->tombstones || cur->tombstones[id])) {
+            cur->decoded[n++] = id;
+        }
+    }
+
+    if (n > 0) {
+        cur->last_id = cur->decoded[n - 1];
+    }
+
+    return n;
+}
+
+/**
+ * Fill the block of an operator with its next matches, replacing the one used up. Except for the last block of
+ * the node, the block is full.
+ * @returns the number of matches, which is only 0 once the node has no more
+ */
+static size_t op_fill(match_cursor_t *cur) {
+    size_t n;
+
+    switch (cur->op) {
+        case QUERY_AND:
+        case QUERY_PHRASE:
+            n = and_fill(cur);
+            break;
+        case QUERY_OR:
+            n = or_fill(cur);
+            break;
+        case QUERY_ANDNOT:
+            n = andnot_fill(cur);
+            break;
+        case QUERY_WILDCARD:
+            n = wildcard_fill(cur);
+            break;
+        default:
+            PANIC("Invalid query node\n");
+    }
+
+    cur->i_block = 0;
+    cur->n_block = n;
+
+    return n;
+}
+
+/**
+ * Whether a node can be evaluated as bitmaps: a term with containers, or "&&", "||" or "&!" of such nodes only.
+ * Phrases need the positions of each document, and patterns are left to merge their many terms.
+ */
+static int plan_bitwise(const plan_node_t *plan) {
+    switch (plan->op) {
+        case QUERY_TERM:
+            return plan->postings.containers != NULL;
+        case QUERY_AND:
+        case QUERY_OR:
+        case QUERY_ANDNOT:
+            for (size_t i = 0; i < plan->n_children; i++) {
+                if (!plan_bitwise(plan->children[i])) {
+                    return 0;
+                }
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* number of bitmaps bits_load needs besides the one it computes, i.e. the depth of the operators of a plan */
+static size_t bits_depth(const plan_node_t *plan) {
+    size_t depth = 0;
+
+    for (size_t i = 0; i < plan->n_children; i++) {
+        size_t child = bits_depth(plan->children[i]) + 1;
+        depth = (child > depth) ? child : depth;
+    }
+
+    return depth;
+}
+
+/* dst &= src, a word at a time. Returns whether any id is left. */
+static inline int bits_and(uint64_t *restrict dst, const uint64_t *restrict src) {
+    uint64_t any = 0;
+
+    for (size_t w = 0; w < CHUNK_WORDS; w++) {
+        dst[w] &= src[w];
+        any |= dst[w];
+    }
+
+    return any != 0;
+}
+
+/* dst |= src, a word at a time */
+static inline void bits_or(uint64_t *restrict dst, const uint64_t *restrict src) {
+    for (size_t w = 0; w < CHUNK_WORDS; w++) {
+        dst[w] |= src[w];
+    }
+}
+
+/* dst &= ~src, a word at a time. Returns whether any id is left. */
+static inline int bits_andnot(uint64_t *restrict dst, const uint64_t *restrict src) {
+    uint64_t any = 0;
+
+    for (size_t w = 0; w < CHUNK_WORDS; w++) {
+        dst[w] &= ~src[w];
+        any |= dst[w];
+    }
+
+    return any != 0;
+}
+
+/**
+ * Compute the matches of a bitwise node within a chunk, as its bitmap. The first operand of each operator is
+ * computed into `dst`, and every other one into the first bitmap of `scratch` before it is combined with it.
+ * @param scratch: room for bits_depth(plan) bitmaps
+ * @returns 1 if the node has any match in the chunk, otherwise 0, leaving `dst` undefined
+ */
+static int bits_load(const plan_node_t *plan, uint32_t key, uint64_t *dst, uint64_t *scratch) {
+    uint64_t *next = scratch + CHUNK_WORDS;
+
+    switch (plan->op) {
+        case QUERY_TERM: {
+            const containers_t *cs = plan->postings.containers;
+            size_t i = containers_find(cs, 0, key);
+
+            if (i == cs->n_containers || cs->containers[i].key != key) {
+                return 0;
+            }
+            container_to_bitmap(cs, &cs->containers[i], dst);
+            return 1;
+        }
+        case QUERY_AND:
+            if (!bits_load(plan->children[0], key, dst, scratch)) {
+                return 0;
+            }
+            for (size_t i = 1; i < plan->n_children; i++) {
+                if (!bits_load(plan->children[i], key, scratch, next) || !bits_and(dst, scratch)) {
+                    return 0;
+                }
+            }
+            return 1;
+        case QUERY_OR: {
+            int any = 0;
+
+            for (size_t i = 0; i < plan->n_children; i++) {
+                if (!any) {
+                    any = bits_load(plan->children[i], key, dst, scratch);
+                } else if (bits_load(plan->children[i], key, scratch, next)) {
+                    bits_or(dst, scratch);
+                }
+            }
+            return any;
+        }
+        case QUERY_ANDNOT:
+            if (!bits_load(plan->children[0], key, dst, scratch)) {
+                return 0;
+            }
+            if (bits_load(plan->children[1], key, scratch, next)) {
+                return bits_andnot(dst, scratch);
+            }
+            return 1;
+        default:
+            PANIC("Invalid query node\n");
+    }
+}
+
+/* move a bitwise node to the next chunk it has matches in. Returns 0 if there is none. */
+static int bits_next_chunk(match_cursor_t *cur) {
+    while (cur->next_key < cur->n_keys) {
+        uint32_t key = cur->next_key++;
+
+        if (bits_load(cur->plan, key, cur->bits, cur->bits + CHUNK_WORDS)) {
+            cur->key = key;
+            cur->word = 0;
+            return 1;
+        }
+    }
+
+    cur->word = CHUNK_WORDS;
+    return 0;
+}
+
+/**
+ * Fill the block of a bitwise node with the next ids of its bitmap, leaving out removed documents, and moving
+ * on to the next chunk once it is used up
+ * @param max_ids: most ids to take, at most MATCH_BLOCK_LEN
+ * @returns the number of ids, which is only 0 once the node has no more
+ */
+static size_t bits_fill(match_cursor_t *cur, size_t max_ids) {
+    char **tombstones = cur->tombstones;
+    size_t n = 0;
+
+    while (n < max_ids) {
+        if (cur->word == CHUNK_WORDS && !bits_next_chunk(cur)) {
+            cur->drained = 1;
+            break;
+        }
+
+        uint64_t bits = cur->bits[cur->word];
+        docid_t base = ((docid_t) cur->key << CHUNK_BITS) + (docid_t) cur->word * 64;
+
+        while (bits && n < max_ids) {
+            docid_t id = base + (docid_t) __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            cur->decoded[n] = id;
+            n += !tombstones || tombstones[id];
+        }
+
+        cur->bits[cur->word] = bits;
+        cur->word += (bits == 0);
+    }
+
+    cur->i_block = 0;
+    cur->n_block = n;
+
+    return n;
+}
+
+/* leave out the ids of a bitwise node before target. Chunks before that of target are never loaded. */
+static void bits_seek(match_cursor_t *cur, docid_t target) {
+    uint32_t key = target >> CHUNK_BITS;
+
+    if (key >= cur->next_key) {
+        cur->next_key = key;
+        if (!bits_next_chunk(cur)) {
+            return;
+        }
+    }
+    if (key != cur->key || cur->word == CHUNK_WORDS) {
+        return; // target is in a chunk before the current one, or the current one is used up
+    }
+
+    size_t word = (target & (CHUNK_IDS - 1)) / 64;
+    if (word >= cur->word) {
+        cur->word = word;
+        cur->bits[word] &= UINT64_MAX << (target % 64);
+    }
+}
+
+/* slow path of match_next, for when the block is used up */
+static int match_refill(match_cursor_t *cur) {
+    if (cur->drained) {
+        return match_end(cur);
+    }
+
+    size_t n;
+    if (cur->bits) {
+        n = bits_fill(cur, MATCH_BLOCK_LEN);
+    } else if (cur->op == QUERY_TERM) {
+        n = term_decode(cur);
+    } else {
+        n = op_fill(cur);
+    }
+
+    return n ? 1 : match_end(cur);
+}
+
+/**
+ * Slow path of match_advance, for when the block ends before target. A term decodes its postings block by
+ * block up to target, and an operator moves its operands there before filling its block anew. A bitwise node
+ * jumps straight to target within its bitmaps, and only takes the first id from there: it is most likely
+ * skipped again by an operand with fewer matches, and otherwise the block is filled by the next refill.
+ */
+static int match_skip(match_cursor_t *cur, docid_t target) {
+    while (cur->block[cur->n_block - 1] < target) {
+        if (cur->drained) {
+            return match_end(cur);
+        }
+
+        if (cur->bits) {
+            bits_seek(cur, target);
+            if (!bits_fill(cur, 1)) {
+                return match_end(cur);
+            }
+            continue;
+        }
+
+        if (cur->op == QUERY_TERM) {
+            if (!term_decode(cur)) {
+                return match_end(cur);
+            }
+            continue;
+        }
+
+        switch (cur->op) {
+            case QUERY_AND:
+            case QUERY_PHRASE:
+                match_advance(cur->children[0], target);
+                break;
+            case QUERY_OR:
+                for (size_t i = 0; i < cur->n_children; i++) {
+                    match_advance(cur->children[i], target);
+                }
+                break;
+            case QUERY_ANDNOT:
+                match_advance(cur->children[0], target);
+                break;
+            default:
+                /* the postings of a pattern are merged one id at a time, so fill blocks up to target */
+                break;
+        }
+
+        if (!op_fill(cur)) {
+            return match_end(cur);
+        }
+    }
+
+    cur->i_block = docids_gallop(cur->block, cur->n_block, cur->i_block, target);
+
+    return 1;
+}
+
+static match_cursor_t *match_open(index_t *index, plan_node_t *plan) {
+    match_cursor_t *cur = calloc(1, sizeof(match_cursor_t));
+    if (!cur) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    cur->op = plan->op;
+    cur->cost = plan->cost;
+    cur->block = cur->decoded;
+
+    /* an index loaded from file never has any removed documents */
+    cur->tombstones = index->n_unpurged ? index->doc_names : NULL;
+
+    if (plan->op == QUERY_TERM && !plan->postings.containers) {
+        cur->p = plan->postings.buf;
+        cur->end = plan->postings.buf + plan->postings.n_bytes;
+        match_refill(cur);
+        return cur;
+    }
+
+    if (plan->op != QUERY_TERM && index->cache) {
+        cur->cached = cache_get_copy(index, plan->key, cached_docids_size);
+        if (cur->cached) {
+            cur->block = cur->cached->ids;
+            cur->n_block = cur->cached->len;
+            cur->drained = 1;
+            cur->exhausted = (cur->n_block == 0);
+            return cur;
+        }
+    }
+
+    /* at least one operand matches nothing, so neither does the node */
+    if (plan->cost == 0) {
+        cur->drained = 1;
+        cur->exhausted = 1;
+        return cur;
+    }
+
+    if (plan_bitwise(plan)) {
+        size_t n_ids = index->file ? file_header(index)->n_docs : index->number_of_docs;
+
+        cur->plan = plan;
+        cur->bits = malloc((1 + bits_depth(plan)) * CHUNK_WORDS * sizeof(uint64_t));
+        if (!cur->bits) {
+            PANIC("Failed to allocate memory\n");
+        }
+        cur->n_keys = (uint32_t) ((n_ids + CHUNK_IDS - 1) >> CHUNK_BITS);
+        cur->word = CHUNK_WORDS; // no chunk is loaded yet
+
+        match_refill(cur);
+        return cur;
+    }
+
+    if (plan->op == QUERY_WILDCARD) {
+        cur->heap = malloc((plan->n_children + 1) * sizeof(id_cursor_t));
+        if (!cur->heap) {
+            PANIC("Failed to allocate memory\n");
+        }
+
+        for (size_t i = 0; i < plan->n_children; i++) {
+            postings_view_t *postings = &plan->children[i]->postings;
+            id_cursor_t *heap = cur->heap;
+
+            heap[cur->heap_len] = (id_cursor_t) {
+                .p = postings->buf,
+                .end = postings->buf + postings->n_bytes,
+                .id = 0,
+            };
+            cur->heap_len += id_cursor_next(&heap[cur->heap_len]);
+        }
+        for (size_t i = cur->heap_len / 2; i-- > 0;) {
+            id_heap_sift_down(cur->heap, cur->heap_len, i);
+        }
+
+        match_refill(cur);
+        return cur;
+    }
+
+    cur->children = malloc(plan->n_children * sizeof(match_cursor_t *));
+    if (!cur->children) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    plan_node_t **operands = plan->children;
+
+    if (plan->op == QUERY_PHRASE) {
+        /* the candidates are found just like for "&&", which leads with the rarest word */
+        operands = malloc(plan->n_children * sizeof(plan_node_t *));
+        cur->words = malloc(plan->n_children * sizeof(phrase_cursor_t));
+        if (!operands || !cur->words) {
+            PANIC("Failed to allocate memory\n");
+        }
+
+        memcpy(operands, plan->children, plan->n_children * sizeof(plan_node_t *));
+        qsort(operands, plan->n_children, sizeof(plan_node_t *), compare_plans_by_cost);
+
+        for (size_t i = 0; i < plan->n_children; i++) {
+            cursor_init(&cur->words[i], plan->children[i]);
+        }
+        cur->n_words = plan->n_children;
+    }
+
+    for (size_t i = 0; i < plan->n_children; i++) {
+        /* an operand of "||" or the right side of "&!" that matches nothing may as well be left out */
+        if (operands[i]->cost == 0 && (plan->op == QUERY_OR || plan->op == QUERY_ANDNOT)) {
+            continue;
+        }
+        cur->children[cur->n_children++] = match_open(index, operands[i]);
+    }
+
+    if (operands != plan->children) {
+        free(operands);
+    }
+
+    match_refill(cur);
+    return cur;
+}
+
+static void match_close(match_cursor_t *cur) {
+    for (size_t i = 0; i < cur->n_children; i++) {
+        match_close(cur->children[i]);
+    }
+    free(cur->children);
+    free(cur->cached);
+    free(cur->heap);
+    free(cur->bits);
+    free(cur->words);
+    free(cur->starts);
+    free(cur);
+}
+
+/* ------------------------Ranking------------------------ */
+
+/* number of live documents of the index, and the sum of their lengths */
+static void collection_stats(index_t *index, uint64_t *n_docs, uint64_t *total_length) {
+    if (index->file) {
+        *n_docs = file_header(index)->n_docs;
+        *total_length = file_header(index)->total_length;
+    } else {
+        *n_docs = index->number_of_docs - index->n_removed;
+        *total_length = index->total_length;
+    }
+}
+
+/* SETTING: BM25 parameters. K1 controls how quickly repeats of a term saturate, B how much the length of a
+ * document is taken into account. */
+#define BM25_K1 1.2
+#define BM25_B  0.75
+
+/* a matching document and its score, as kept in the top-k heap */
+typedef struct scored_doc {
+    double score;
+    docid_t id;
+} scored_doc_t;
+
+/* the top-k of a query, best first, as kept in the query cache */
+typedef struct ranking {
+    match_count_t n_matches; // matching documents, of which `docs` are the top-k
+    size_t len;
+    scored_doc_t docs[];
+} ranking_t;
+
+static size_t ranking_size(const void *ranking) {
+    return sizeof(ranking_t) + ((const ranking_t *) ranking)->len * sizeof(scored_doc_t);
+}
+
+/**
+ * Scores the documents containing one term of the query, walking its postings in step with the matching
+ * documents (which are visited in ascending order).
+ */
+typedef struct term_scorer {
+    const containers_t *containers; // the containers of the term, if any, which are looked up instead
+    container_pos_t pos;            // where the last lookup in them ended
+    const uint8_t *postings; // start of the postings, which identifies the term
+    const uint8_t *p;        // next (delta, tf) pair of the postings
+    const uint8_t *end;
+    docid_t id;  // current document. Only valid if the scorer is not exhausted.
+    uint32_t tf; // tf of the current document
+    int exhausted;
+    double idf;
+    double max_score; // upper bound of what the term contributes to the score of any document
+} term_scorer_t;
+
+/* BM25 score of a term for one document. `norm` is the length normalization of the document. */
+static inline double bm25(double idf, uint32_t tf, double norm) {
+    return idf * ((double) tf * (BM25_K1 + 1.0)) / ((double) tf + norm);
+}
+
+/* move the scorer to the next document of its postings */
+static inline void scorer_next(term_scorer_t *scorer) {
+    if (scorer->p == scorer->end) {
+        scorer->exhausted = 1;
+        return;
+    }
+
+    docid_t delta;
+    scorer->p += varint_decode(scorer->p, &delta);
+    scorer->p += varint_decode(scorer->p, &scorer->tf);
+    scorer->id += delta;
+}
+
+/**
+ * @param n_docs: number of documents of the collection ranked by, which may hold more than the index
+ * @param avg_length: average length of the documents of the collection ranked by
+ * @param df: number of documents of the collection that contain the term
+ */
+static void scorer_init(
+    term_scorer_t *scorer,
+    postings_view_t *postings,
+    uint64_t n_docs,
+    double avg_length,
+    uint64_t df
+) {
+    scorer->containers = postings->containers;
+    scorer->pos = (container_pos_t) { .container = 0, .i = 0, .rank = 0 };
+    scorer->postings = postings->buf;
+    scorer->p = postings->buf;
+    scorer->end = postings->buf + postings->n_bytes;
+    scorer->id = 0; // the first delta is relative to 0
+    scorer->exhausted = 0;
+    scorer->idf = log(1.0 + ((double) n_docs - (double) df + 0.5) / ((double) df + 0.5));
+
+    /**
+     * the score shrinks with the length of the document, which is at least its tf as repeats are counted. At
+     * length = tf, it grows with tf. So no document scores higher than one of max_tf repeats of the term alone.
+     */
+    double norm = BM25_K1 * (1.0 - BM25_B + BM25_B * (double) postings->max_tf / avg_length);
+    scorer->max_score = bm25(scorer->idf, postings->max_tf, norm);
+
+    scorer_next(scorer);
+}
+
+/**
+ * Move the scorer to the first document >= target. A term with containers only looks up target in them.
+ * @returns 1 if the term is in document `target`, otherwise 0
+ */
+static inline int scorer_advance(term_scorer_t *scorer, docid_t target) {
+    if (scorer->containers) {
+        scorer->tf = containers_tf(scorer->containers, &scorer->pos, target);
+        return scorer->tf != 0;
+    }
+
+    while (!scorer->exhausted && scorer->id < target) {
+        scorer_next(scorer);
+    }
+
+    return !scorer->exhausted && scorer->id == target;
+}
+
+static int compare_scorers_by_max_score(const void *a, const void *b) {
+    const term_scorer_t *sa = a;
+    const term_scorer_t *sb = b;
+
+    return (sa->max_score < sb->max_score) - (sa->max_score > sb->max_score);
+}
+
+/* number of term nodes in the plan that count towards the score: everything but the right side of "&!" */
+static size_t count_scored_terms(plan_node_t *plan) {
+    if (plan->op == QUERY_TERM) {
+        return 1;
+    }
+
+    size_t n_scored = (plan->op == QUERY_ANDNOT) ? 1 : plan->n_children;
+    size_t n = 0;
+
+    for (size_t i = 0; i < n_scored; i++) {
+        n += count_scored_terms(plan->children[i]);
+    }
+    return n;
+}
+
+static int compare_term_stats(const void *a, const void *b) {
+    return strcmp(((const term_stat_t *) a)->term, ((const term_stat_t *) b)->term);
+}
+
+/* number of documents with the term in the collection of `stats`, otherwise those of the index */
+static uint64_t term_df(const index_stats_t *stats, const plan_node_t *plan) {
+    if (stats) {
+        term_stat_t key = { .term = (char *) plan->term };
+        term_stat_t *found = bsearch(
+            &key,
+            stats->terms,
+            stats->n_terms,
+            sizeof(term_stat_t),
+            compare_term_stats
+        );
+        if (found) {
+            return found->n_docs;
+        }
+    }
+    return plan->postings.n_docs;
+}
+
+/* set up a scorer for every distinct term in the plan that counts towards the score, and is in the index */
+static void collect_scorers(
+    plan_node_t *plan,
+    const index_stats_t *stats,
+    uint64_t n_docs,
+    double avg_length,
+    term_scorer_t *dst,
+    size_t *n
+) {
+    if (plan->op == QUERY_TERM) {
+        if (plan->postings.n_docs == 0) {
+            return;
+        }
+
+        /* a term that occurs several times in a query is only scored once */
+        for (size_t i = 0; i < *n; i++) {
+            if (dst[i].postings == plan->postings.buf) {
+                return;
+            }
+        }
+
+        scorer_init(&dst[(*n)++], &plan->postings, n_docs, avg_length, term_df(stats, plan));
+        return;
+    }
+
+    size_t n_scored = (plan->op == QUERY_ANDNOT) ? 1 : plan->n_children;
+
+    for (size_t i = 0; i < n_scored; i++) {
+        collect_scorers(plan->children[i], stats, n_docs, avg_length, dst, n);
+    }
+}
+
+/* ordering of the top-k heap: 1 if a ranks below b, i.e. it has a lower score, or the same score and a
+ * higher id */
+static inline int ranks_below(const scored_doc_t *a, const scored_doc_t *b) {
+    return a->score < b->score || (a->score == b->score && a->id > b->id);
+}
+
+/* min-heap, where heap[0] is the lowest ranked of the documents kept */
+static void heap_sift_up(scored_doc_t *heap, size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!ranks_below(&heap[i], &heap[parent])) {
+            break;
+        }
+
+        scored_doc_t tmp = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = tmp;
+        i = parent;
+    }
+}
+
+static void heap_sift_down(scored_doc_t *heap, size_t len, size_t i) {
+    while (1) {
+        size_t lowest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+
+        if (left < len && ranks_below(&heap[left], &heap[lowest])) {
+            lowest = left;
+        }
+        if (right < len && ranks_below(&heap[right], &heap[lowest])) {
+            lowest = right;
+        }
+        if (lowest == i) {
+            break;
+        }
+
+        scored_doc_t tmp = heap[i];
+        heap[i] = heap[lowest];
+        heap[lowest] = tmp;
+        i = lowest;
+    }
+}
+
+/**
+ * Score the matching documents with BM25, and rank the (at most) `k` best ones.
+ *
+ * Only a heap of the best k documents so far is kept. Once it is full, the document at its root sets the
+ * score any other document must beat. The terms are scored in descending order of their maximum score, and
+ * scoring a document stops as soon as even the maximum scores of its remaining terms cannot lift it above
+ * this threshold (MaxScore). Documents are visited in ascending order of id, so a document that would only
+ * tie the threshold ranks below it, and is dropped as well.
+ *
+ * Once not even the maximum scores of all terms together can beat the threshold, no later document can make it
+ * into the top-k, and no more matches are pulled from the cursor. Only a term knows how many matches it has
+ * left, so the number of matches of any other query is then a lower bound. When the matches are recorded
+ * for the cache, every one of them is still pulled, and the number is exact.
+ *
+ * @param matches: cursor over the matches of `plan`, which are pulled from it a block at a time
+ * @param stats: nullable. The statistics of the collection to rank by, otherwise those of the index.
+ * @param record: nullable. If present, every match is appended to it, which must have room for all of them.
+ */
+static ranking_t *rank_matches(
+    index_t *index,
+    plan_node_t *plan,
+    match_cursor_t *matches,
+    size_t k,
+    const index_stats_t *stats,
+    cached_docids_t *record
+) {
+    uint64_t n_docs, total_length;
+
+    if (stats) {
+        n_docs = stats->n_docs;
+        total_length = stats->total_length;
+    } else {
+        collection_stats(index, &n_docs, &total_length);
+    }
+    double avg_length = (n_docs && total_length) ? (double) total_length / (double) n_docs : 1.0;
+
+    size_t bound = max_matches(index, plan);
+    size_t capacity = (k && k < bound) ? k : bound;
+    size_t max_terms = count_scored_terms(plan);
+    size_t n_terms = 0;
+
+    scored_doc_t *heap = malloc((capacity + 1) * sizeof(scored_doc_t));
+    term_scorer_t *scorers = malloc((max_terms + 1) * sizeof(term_scorer_t));
+    double *rest = malloc((max_terms + 1) * sizeof(double));
+    if (!heap || !scorers || !rest) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    collect_scorers(plan, stats, n_docs, avg_length, scorers, &n_terms);
+    qsort(scorers, n_terms, sizeof(term_scorer_t), compare_scorers_by_max_score);
+
+    /* rest[i] = the highest score terms i..n can add to any document */
+    rest[n_terms] = 0.0;
+    for (size_t i = n_terms; i > 0; i--) {
+        rest[i - 1] = rest[i] + scorers[i - 1].max_score;
+    }
+
+    size_t heap_len = 0;
+    size_t n_matches = 0;
+    int exact = 1;
+
+    /* the matches are taken a block at a time, as a plain array */
+    while (!matches->exhausted) {
+        const docid_t *ids = matches->block + matches->i_block;
+        size_t n_ids = matches->n_block - matches->i_block;
+
+        n_matches += n_ids;
+        if (record) {
+            memcpy(record->ids + record->len, ids, n_ids * sizeof(docid_t));
+            record->len += n_ids;
+        }
+
+        /* once the top-k is settled, the remaining matches are only counted, if they are needed at all */
+        if (heap_len == capacity && rest[0] <= heap[0].score) {
+            if (!record) {
+                exact = matches->drained; // the block at hand is the last one
+                break;
+            }
+            n_ids = 0;
+        }
+
+        for (size_t m = 0; m < n_ids; m++) {
+            docid_t id = ids[m];
+            double norm = BM25_K1 * (1.0 - BM25_B + BM25_B * (double) doc_length_of(index, id) / avg_length);
+            scored_doc_t doc = { .score = 0.0, .id = id };
+            size_t i = 0;
+
+            for (; i < n_terms; i++) {
+                if (heap_len == capacity && doc.score + rest[i] <= heap[0].score) {
+                    break; // cannot make it into the top-k
+                }
+                if (scorer_advance(&scorers[i], id)) {
+                    doc.score += bm25(scorers[i].idf, scorers[i].tf, norm);
+                }
+            }
+            if (i < n_terms) {
+                continue;
+            }
+
+            if (heap_len < capacity) {
+                heap[heap_len++] = doc;
+                heap_sift_up(heap, heap_len - 1);
+            } else if (ranks_below(&heap[0], &doc)) {
+                heap[0] = doc;
+                heap_sift_down(heap, heap_len, 0);
+            }
+        }
+
+        matches->i_block = matches->n_block - 1;
+        match_next(matches);
+    }
+
+    ranking_t *ranking = malloc(sizeof(ranking_t) + heap_len * sizeof(scored_doc_t));
+    if (!ranking) {
+        PANIC("Failed to allocate memory\n");
+    }
+    ranking->n_matches = (match_count_t) { .n = n_matches, .exact = exact };
+    ranking->len = heap_len;
+
+    /* the postings of a term hold exactly its matches, unless some of them are of removed documents */
+    if (!exact && plan->op == QUERY_TERM && !index->n_unpurged) {
+        ranking->n_matches = (match_count_t) { .n = plan->postings.n_docs, .exact = 1 };
+    }
+
+    /* popping the heap yields the lowest ranked first, so fill in the ranking from the back */
+    for (size_t n = heap_len; n > 0; n--) {
+        ranking->docs[n - 1] = heap[0];
+        heap[0] = heap[n - 1];
+        heap_sift_down(heap, n - 1, 0);
+    }
+
+    free(rest);
+    free(scorers);
+    free(heap);
+
+    return ranking;
+}
+
+static int has_phrase(query_node_t *node) {
+    if (node->op == QUERY_TERM || node->op == QUERY_WILDCARD) {
+        return 0;
+    }
+    return node->op == QUERY_PHRASE || has_phrase(node->left) || has_phrase(node->right);
+}
+
+/**
+ * Evaluate and rank a planned query.
+ *
+ * The matches of a query are cached by its canonical form, so any later query that has it as a subquery
+ * reads them rather than evaluating it again. Terms are not cached, as their matches are already at hand in
+ * the postings.
+ */
+static ranking_t *run_plan(index_t *index, plan_node_t *plan, size_t k, const index_stats_t *stats) {
+    match_cursor_t *matches = match_open(index, plan);
+    cached_docids_t *record = NULL;
+
+    if (index->cache && plan->op != QUERY_TERM && !matches->cached) {
+        record = malloc(sizeof(cached_docids_t) + max_matches(index, plan) * sizeof(docid_t));
+        if (!record) {
+            PANIC("Failed to allocate memory\n");
+        }
+        record->len = 0;
+    }
+
+    ranking_t *ranking = rank_matches(index, plan, matches, k, stats, record);
+    match_close(matches);
+
+    if (record) {
+        /* give back the room reserved for matches that did not turn up */
+        cached_docids_t *shrunk = realloc(record, cached_docids_size(record));
+        record = shrunk ? shrunk : record;
+        cache_put_locked(index, plan->key, record, cached_docids_size(record));
+    }
+
+    return ranking;
+}
+
+/**
+ * Plan a query, or reject it if the index cannot answer it. Must be called with the lock held for reading.
+ * @returns the plan, or NULL with `errmsg` set
+ */
+static plan_node_t *plan_query(index_t *index, query_node_t *root, char *errmsg) {
+    if (has_phrase(root) && !index_has_positions(index)) {
+        snprintf(errmsg, LINE_MAX, "phrases need an index that stores the positions of terms");
+        return NULL;
+    }
+
+    plan_node_t *plan = plan_build(index, root);
+
+    if (plan_too_broad(plan)) {
+        snprintf(
+            errmsg,
+            LINE_MAX,
+            "a pattern matches more than %d terms, try a longer one",
+            WILDCARD_MAX_TERMS
+        );
+        plan_destroy(plan);
+        return NULL;
+    }
+
+    return plan;
+}
+
+list_t *index_query_parsed(
+    index_t *index,
+    query_node_t *query,
+    size_t k,
+    const index_stats_t *stats,
+    match_count_t *n_matches,
+    char *errmsg
+) {
+    PROF_START(t_eval);
+
+    list_t *results = list_create((cmp_fn) compare_results_by_score);
+    if (!results) {
+        snprintf(errmsg, LINE_MAX, "out of memory");
+        return NULL;
+    }
+
+    pthread_rwlock_rdlock(&index->lock);
+
+    plan_node_t *plan = plan_query(index, query, errmsg);
+    if (!plan) {
+        pthread_rwlock_unlock(&index->lock);
+        list_destroy(results, NULL);
+        return NULL;
+    }
+
+    /**
+     * the ranking of the query as a whole is cached separately from its matches, as it depends on k. It also
+     * depends on the statistics, which are only those of the index if none are given.
+     */
+    char *ranking_key = NULL;
+    ranking_t *ranking = NULL;
+    int use_cache = (index->cache && !stats);
+
+    if (use_cache) {
+        if (asprintf(&ranking_key, "top %zu %s", k, plan->key) < 0) {
+            PANIC("Failed to allocate memory\n");
+        }
+        ranking = cache_get_copy(index, ranking_key, ranking_size);
+    }
+
+    int cached = (ranking != NULL);
+    if (!cached) {
+        ranking = run_plan(index, plan, k, stats);
+    }
+    plan_destroy(plan);
+
+    for (size_t i = 0; i < ranking->len; i++) {
+        /* the name is copied into the result, as the document may be removed once the lock is released */
+        const char *doc_name = doc_name_of(index, ranking->docs[i].id);
+        size_t name_size = strlen(doc_name) + 1;
+
+        query_result_t *res = malloc(sizeof(query_result_t) + name_size);
+        if (!res) {
+            PANIC("Failed to allocate memory\n");
+        }
+        res->doc_name = memcpy(res + 1, doc_name, name_size);
+        res->score = ranking->docs[i].score;
+
+        if (list_addlast(results, res) < 0) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+
+    if (n_matches) {
+        *n_matches = ranking->n_matches;
+    }
+
+    if (use_cache && !cached) {
+        cache_put_locked(index, ranking_key, ranking, ranking_size(ranking));
+    } else {
+        free(ranking);
+    }
+    free(ranking_key);
+
+    pthread_rwlock_unlock(&index->lock);
+
+    PROF_STOP(PROF_QUERY_EVAL, t_eval);
+
+    return results;
+}
+
+list_t *index_query_topk(index_t *index, list_t *query_tokens, size_t k, match_count_t *n_matches, char *errmsg) {
+    PROF_START(t_parse);
+    query_node_t *root = query_parse(query_tokens, errmsg);
+    PROF_STOP(PROF_QUERY_PARSE, t_parse);
+
+    if (!root) {
+        return NULL;
+    }
+
+    list_t *results = index_query_parsed(index, root, k, NULL, n_matches, errmsg);
+    query_destroy(root);
+
+    return results;
+}
+
+/* append the statistics of every term in the plan that counts towards the score, and is in the index */
+static void collect_term_stats(plan_node_t *plan, index_stats_t *dst) {
+    if (plan->op == QUERY_TERM) {
+        if (plan->postings.n_docs > 0) {
+            char *term = strdup(plan->term);
+            if (!term) {
+                PANIC("Failed to allocate memory\n");
+            }
+            dst->terms[dst->n_terms++] = (term_stat_t) { .term = term, .n_docs = plan->postings.n_docs };
+        }
+        return;
+    }
+
+    size_t n_scored = (plan->op == QUERY_ANDNOT) ? 1 : plan->n_children;
+
+    for (size_t i = 0; i < n_scored; i++) {
+        collect_term_stats(plan->children[i], dst);
+    }
+}
+
+index_stats_t *index_query_stats(index_t *index, query_node_t *query, char *errmsg) {
+    index_stats_t *stats = malloc(sizeof(index_stats_t));
+    if (!stats) {
+        snprintf(errmsg, LINE_MAX, "out of memory");
+        return NULL;
+    }
+
+    pthread_rwlock_rdlock(&index->lock);
+
+    plan_node_t *plan = plan_query(index, query, errmsg);
+    if (!plan) {
+        pthread_rwlock_unlock(&index->lock);
+        free(stats);
+        return NULL;
+    }
+
+    stats->n_terms = 0;
+    stats->terms = malloc((count_scored_terms(plan) + 1) * sizeof(term_stat_t));
+    if (!stats->terms) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    collection_stats(index, &stats->n_docs, &stats->total_length);
+    collect_term_stats(plan, stats);
+    plan_destroy(plan);
+
+    pthread_rwlock_unlock(&index->lock);
+
+    /* a term that occurs several times in a query is only counted once */
+    qsort(stats->terms, stats->n_terms, sizeof(term_stat_t), compare_term_stats);
+
+    size_t n_distinct = 0;
+    for (size_t i = 0; i < stats->n_terms; i++) {
+        if (n_distinct > 0 && strcmp(stats->terms[i].term, stats->terms[n_distinct - 1].term) == 0) {
+            free(stats->terms[i].term);
+        } else {
+            stats->terms[n_distinct++] = stats->terms[i];
+        }
+    }
+    stats->n_terms = n_distinct;
+
+    return stats;
+}
+
+void index_stats_destroy(index_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    for (size_t i = 0; i < stats->n_terms; i++) {
+        free(stats->terms[i].term);
+    }
+    free(stats->terms);
+    free(stats);
+}
+
+list_t *index_query(index_t *index, list_t *query_tokens, char *errmsg) {
+    return index_query_topk(index, query_tokens, 0, NULL, errmsg);
+}
+
+void index_stat(index_t *index, size_t *n_docs, size_t *n_terms) {
+    if (index->file) {
+        *n_docs = file_header(index)->n_docs;
+        *n_terms = file_header(index)->n_terms;
+        return;
+    }
+
+    pthread_rwlock_rdlock(&index->lock);
+    *n_docs = index->number_of_docs - index->n_removed;
+    *n_terms = map_length(index->terms);
+    pthread_rwlock_unlock(&index->lock);
+}
+
+/* ----------------------Index file----------------------- */
+
+static inline uint64_t align8(uint64_t off) {
+    return (off + 7) & ~(uint64_t) 7;
+}
+
+/* write `size` bytes at the current position, followed by zero padding up to `padded_size` */
+static int write_padded(FILE *f, const void *buf, size_t size, size_t padded_size) {
+    static const uint8_t zeros[8] = {0};
+
+    if (size && fwrite(buf, 1, size, f) != size) {
+        return -1;
+    }
+    if (padded_size > size && fwrite(zeros, 1, padded_size - size, f) != padded_size - size) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Copy of the postings without the ids of removed documents, where every other id is mapped by `new_ids`.
+ * Positions, if any, are copied along with them.
+ */
+static postings_t *postings_renumber(index_t *index, postings_t *src, const docid_t *new_ids) {
+    postings_t *dst = postings_create(src->positions != NULL);
+    if (!dst) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    const uint8_t *p = src->buf;
+    const uint8_t *end = src->buf + src->n_bytes;
+    const uint8_t *pos = src->positions ? src->positions->buf : NULL;
+    docid_t id = 0;
+
+    while (p < end) {
+        docid_t delta;
+        uint32_t tf;
+        p += varint_decode(p, &delta);
+        p += varint_decode(p, &tf);
+        id += delta;
+
+        const uint8_t *doc_pos = pos;
+        if (pos) {
+            pos = varints_skip(pos, tf);
+        }
+
+        if (!index->doc_names[id]) {
+            continue;
+        }
+
+        if (dst->positions) {
+            positions_t *positions = dst->positions;
+            size_t n_pos_bytes = (size_t) (pos - doc_pos);
+
+            if (dst->n_docs && dst->n_docs % POSITIONS_SKIP_INTERVAL == 0) {
+                positions_add_skip(positions, dst->last_id, dst->n_bytes, positions->n_bytes);
+            }
+            positions_reserve(positions, n_pos_bytes);
+            memcpy(&positions->buf[positions->n_bytes], doc_pos, n_pos_bytes);
+            positions->n_bytes += n_pos_bytes;
+        }
+        postings_add(dst, new_ids[id], tf);
+    }
+
+    return dst;
+}
+
+/**
+ * Where everything of an index goes in an index file, and the postings it is written from. Laid out by
+ * layout_build, then written by layout_write, either to a file (index_save) or to memory (index_freeze).
+ */
+typedef struct file_layout {
+    file_header_t hdr;
+    size_t n_terms;
+    entry_t **entries;       // entries of the term map, sorted by term, less those only in removed documents
+    postings_t **renumbered; // postings with the ids of the file, by entry. NULL unless documents are removed.
+    docid_t *new_ids;        // id in the file of each document. NULL unless documents are removed.
+    file_term_t *terms;
+    file_doc_t *docs;
+    file_positions_t *term_positions; // NULL unless the index stores positions
+} file_layout_t;
+
+static void layout_destroy(file_layout_t *layout) {
+    for (size_t i = 0; layout->renumbered && i < layout->n_terms; i++) {
+        postings_destroy(layout->renumbered[i]);
+    }
+    free(layout->renumbered);
+    free(layout->term_positions);
+    free(layout->new_ids);
+    free(layout->entries);
+    free(layout->terms);
+    free(layout->docs);
+}
+
+/**
+ * Lay out the index file of an in-memory index
+ * @returns 0 on success, otherwise a negative error code, with nothing left to destroy
+ */
+static int layout_build(index_t *index, file_layout_t *layout) {
+    size_t n_terms = map_length(index->terms);
+    size_t n_docs = index->number_of_docs - index->n_removed;
+
+    *layout = (file_layout_t) {0};
+
+    /* the dictionary of the file is sorted by term */
+    layout->entries = sorted_entries(index);
+    layout->terms = malloc((n_terms + 1) * sizeof(file_term_t));
+    layout->docs = malloc((n_docs + 1) * sizeof(file_doc_t));
+
+    if (!layout->entries || !layout->terms || !layout->docs) {
+        pr_error("Failed to allocate memory\n");
+        layout_destroy(layout);
+        return -1;
+    }
+
+    entry_t **entries = layout->entries;
+    file_term_t *terms = layout->terms;
+    file_doc_t *docs = layout->docs;
+
+    /**
+     * removed documents are left out of the file, which shifts down the ids of the documents after them. The
+     * postings are then encoded anew with the shifted ids, dropping any term only found in removed documents.
      */
-    *n_docs = 0;
-    *n_terms = 0;
+    if (index->n_removed) {
+        layout->new_ids = malloc((index->number_of_docs + 1) * sizeof(docid_t));
+        layout->renumbered = malloc((n_terms + 1) * sizeof(postings_t *));
+        if (!layout->new_ids || !layout->renumbered) {
+            PANIC("Failed to allocate memory\n");
+        }
+
+        docid_t next_id = 0;
+        for (size_t i = 0; i < index->number_of_docs; i++) {
+            layout->new_ids[i] = next_id;
+            next_id += (index->doc_names[i] != NULL);
+        }
+
+        size_t n_kept = 0;
+        for (size_t i = 0; i < n_terms; i++) {
+            postings_t *postings = postings_renumber(index, entries[i]->val, layout->new_ids);
+
+            if (postings->n_docs == 0) {
+                postings_destroy(postings);
+                continue;
+            }
+            entries[n_kept] = entries[i];
+            layout->renumbered[n_kept++] = postings;
+        }
+        n_terms = n_kept;
+    }
+    layout->n_terms = n_terms;
+
+    /* lay out the string pool and postings section */
+    uint64_t strings_size = 0;
+    uint64_t postings_size = 0;
+
+    for (size_t i = 0; i < n_terms; i++) {
+        postings_t *postings = layout->renumbered ? layout->renumbered[i] : entries[i]->val;
+
+        terms[i].str_off = strings_size;
+        terms[i].postings_off = postings_size;
+        terms[i].postings_size = postings->n_bytes;
+        terms[i].df = (uint32_t) postings->n_docs;
+        terms[i].max_tf = postings->max_tf;
+
+        strings_size += strlen(entries[i]->key) + 1;
+        postings_size += postings->n_bytes;
+    }
+    /* the positions of each term start 8-byte aligned, so that its skip entries can be read in place */
+    uint64_t positions_size = 0;
+
+    if (index->store_positions) {
+        layout->term_positions = malloc((n_terms + 1) * sizeof(file_positions_t));
+        if (!layout->term_positions) {
+            PANIC("Failed to allocate memory\n");
+        }
+
+        for (size_t i = 0; i < n_terms; i++) {
+            postings_t *postings = layout->renumbered ? layout->renumbered[i] : entries[i]->val;
+            positions_t *positions = postings->positions;
+
+            layout->term_positions[i].off = positions_size;
+            layout->term_positions[i].n_skips = positions->n_skips;
+            layout->term_positions[i].n_bytes = positions->n_bytes;
+
+            positions_size += align8(positions->n_skips * sizeof(skip_t) + positions->n_bytes);
+        }
+    }
+    for (size_t i = 0, j = 0; i < index->number_of_docs; i++) {
+        if (!index->doc_names[i]) {
+            continue;
+        }
+        docs[j].name_off = strings_size;
+        docs[j].length = index->doc_lengths[i];
+        docs[j].reserved = 0;
+        strings_size += strlen(index->doc_names[i]) + 1;
+        j++;
+    }
+
+    file_header_t *hdr = &layout->hdr;
+    memcpy(hdr->magic, index_file_magic, sizeof(hdr->magic));
+    hdr->version = INDEX_FILE_VERSION;
+    hdr->n_docs = n_docs;
+    hdr->n_terms = n_terms;
+    hdr->terms_off = align8(sizeof(file_header_t));
+    hdr->docs_off = align8(hdr->terms_off + n_terms * sizeof(file_term_t));
+    hdr->strings_off = align8(hdr->docs_off + n_docs * sizeof(file_doc_t));
+    hdr->strings_size = strings_size;
+    hdr->postings_off = align8(hdr->strings_off + strings_size);
+    hdr->postings_size = postings_size;
+    hdr->total_length = index->total_length;
+    hdr->file_size = hdr->postings_off + postings_size;
+
+    if (layout->term_positions) {
+        hdr->term_positions_off = align8(hdr->file_size);
+        hdr->positions_off = align8(hdr->term_positions_off + n_terms * sizeof(file_positions_t));
+        hdr->positions_size = positions_size;
+        hdr->file_size = hdr->positions_off + positions_size;
+    }
+
+    return 0;
+}
+
+/**
+ * Write the index file laid out by layout_build, from start to end
+ * @returns 0 on success, or -1 on failure to write, with errno set
+ */
+static int layout_write(index_t *index, const file_layout_t *layout, FILE *f) {
+    const file_header_t *hdr = &layout->hdr;
+    size_t n_terms = layout->n_terms;
+
+    size_t terms_size = n_terms * sizeof(file_term_t);
+    size_t docs_size = hdr->n_docs * sizeof(file_doc_t);
+
+    if (write_padded(f, hdr, sizeof(*hdr), hdr->terms_off) != 0
+        || write_padded(f, layout->terms, terms_size, hdr->docs_off - hdr->terms_off) != 0
+        || write_padded(f, layout->docs, docs_size, hdr->strings_off - hdr->docs_off) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < n_terms; i++) {
+        const char *term = layout->entries[i]->key;
+        if (write_padded(f, term, strlen(term) + 1, 0) != 0) {
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < index->number_of_docs; i++) {
+        const char *doc_name = index->doc_names[i];
+        if (doc_name && write_padded(f, doc_name, strlen(doc_name) + 1, 0) != 0) {
+            return -1;
+        }
+    }
+    if (write_padded(f, NULL, 0, hdr->postings_off - (hdr->strings_off + hdr->strings_size)) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < n_terms; i++) {
+        postings_t *postings = layout->renumbered ? layout->renumbered[i] : layout->entries[i]->val;
+        if (write_padded(f, postings->buf, postings->n_bytes, 0) != 0) {
+            return -1;
+        }
+    }
+
+    if (layout->term_positions) {
+        uint64_t postings_end = hdr->postings_off + hdr->postings_size;
+
+        if (write_padded(f, NULL, 0, hdr->term_positions_off - postings_end) != 0
+            || write_padded(f, layout->term_positions, n_terms * sizeof(file_positions_t),
+                            hdr->positions_off - hdr->term_positions_off) != 0) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < n_terms; i++) {
+            postings_t *postings = layout->renumbered ? layout->renumbered[i] : layout->entries[i]->val;
+            positions_t *positions = postings->positions;
+            size_t skips_size = positions->n_skips * sizeof(skip_t);
+
+            if (write_padded(f, positions->skips, skips_size, 0) != 0
+                || write_padded(f, positions->buf, positions->n_bytes,
+                                align8(skips_size + positions->n_bytes) - skips_size) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int index_save(index_t *index, const char *path) {
+    file_layout_t layout;
+
+    /* a loaded or frozen index is laid out as an index file already, and is written as it is */
+    if (!index->file && layout_build(index, &layout) != 0) {
+        return -1;
+    }
+
+    /* write to a temporary file first, so an existing index file is only replaced by a complete one */
+    char tmp_path[PATH_MAX];
+    int status = -1;
+    FILE *f = NULL;
+
+    if (snprintf(tmp_path, PATH_MAX, "%s.tmp", path) >= PATH_MAX) {
+        pr_error("Path to index file \"%s\" is too long\n", path);
+        goto end;
+    }
+    if (mkdir_if_needed(path) < 0) {
+        goto end;
+    }
+
+    f = fopen(tmp_path, "wb");
+    if (!f) {
+        pr_error("Failed to open %s: %s\n", tmp_path, strerror(errno));
+        goto end;
+    }
+
+    if (index->file ? write_padded(f, index->file, index->file_size, 0) : layout_write(index, &layout, f)) {
+        goto write_error;
+    }
+
+    if (fclose(f) != 0) {
+        f = NULL;
+        goto write_error;
+    }
+    f = NULL;
+
+    if (rename(tmp_path, path) != 0) {
+        pr_error("Failed to move %s to %s: %s\n", tmp_path, path, strerror(errno));
+        unlink(tmp_path);
+        goto end;
+    }
+
+    status = 0;
+    goto end;
+
+write_error:
+    pr_error("Failed to write index file %s: %s\n", tmp_path, strerror(errno));
+    if (f) {
+        fclose(f);
+    }
+    unlink(tmp_path);
+
+end:
+    if (!index->file) {
+        layout_destroy(&layout);
+    }
+
+    return status;
+}
+
+/* whether `n` entries of `size` bytes from `off` end within `limit` bytes. Written such that it cannot overflow. */
+static inline bool file_fits(uint64_t off, uint64_t n, uint64_t size, uint64_t limit) {
+    return off <= limit && n <= (limit - off) / size;
+}
+
+/* verify that the header describes a complete file, and that every section is within its bounds */
+static int validate_file_header(const file_header_t *hdr, size_t file_size) {
+    if (file_size < sizeof(file_header_t) || memcmp(hdr->magic, index_file_magic, sizeof(hdr->magic)) != 0) {
+        pr_error("Not an index file\n");
+        return -1;
+    }
+    if (hdr->version != INDEX_FILE_VERSION) {
+        pr_error("Unsupported index file version %u (expected %u)\n", hdr->version, INDEX_FILE_VERSION);
+        return -1;
+    }
+    if (hdr->file_size != file_size) {
+        pr_error("Index file is truncated or corrupt\n");
+        return -1;
+    }
+    if (hdr->n_docs > UINT32_MAX || hdr->terms_off < sizeof(file_header_t)
+        || !file_fits(hdr->terms_off, hdr->n_terms, sizeof(file_term_t), hdr->docs_off)
+        || !file_fits(hdr->docs_off, hdr->n_docs, sizeof(file_doc_t), hdr->strings_off)
+        || !file_fits(hdr->strings_off, hdr->strings_size, 1, hdr->postings_off)
+        || !file_fits(hdr->postings_off, hdr->postings_size, 1, file_size)) {
+        pr_error("Index file is corrupt\n");
+        return -1;
+    }
+    if (hdr->term_positions_off
+        && (hdr->term_positions_off < hdr->postings_off + hdr->postings_size
+            || !file_fits(hdr->term_positions_off, hdr->n_terms, sizeof(file_positions_t), hdr->positions_off)
+            || !file_fits(hdr->positions_off, hdr->positions_size, 1, file_size))) {
+        pr_error("Index file is corrupt\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* whether `str_off` is the start of a null-terminated string within the string pool */
+static inline bool file_string_valid(const uint8_t *file, const file_header_t *hdr, uint64_t str_off) {
+    return str_off < hdr->strings_size
+        && memchr(file + hdr->strings_off + str_off, '\0', hdr->strings_size - str_off) != NULL;
+}
+
+/**
+ * Verify that the positions of a term are within their section, and that each of its skip entries points
+ * within its positions and postings
+ */
+static bool file_positions_valid(
+    const uint8_t *file,
+    const file_header_t *hdr,
+    const file_positions_t *fp,
+    const file_term_t *ft
+) {
+    if (fp->off % _Alignof(skip_t) != 0 || !file_fits(fp->off, fp->n_skips, sizeof(skip_t), hdr->positions_size)
+        || !file_fits(fp->off + fp->n_skips * sizeof(skip_t), fp->n_bytes, 1, hdr->positions_size)) {
+        return false;
+    }
+
+    const skip_t *skips = (const skip_t *) (file + hdr->positions_off + fp->off);
+    for (uint64_t i = 0; i < fp->n_skips; i++) {
+        if (skips[i].positions_off > fp->n_bytes || skips[i].postings_off > ft->postings_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Verify that every offset of the term dictionary, the document table and the table of positions is within
+ * its section, and that every string they refer to ends within the string pool. The header must be valid.
+ * Reads each entry of the tables once, but neither the postings nor the positions themselves.
+ */
+static int validate_file_tables(const uint8_t *file) {
+    const file_header_t *hdr = (const file_header_t *) file;
+    const file_term_t *terms = (const file_term_t *) (file + hdr->terms_off);
+    const file_doc_t *docs = (const file_doc_t *) (file + hdr->docs_off);
+    const file_positions_t *term_positions = (const file_positions_t *) (file + hdr->term_positions_off);
+
+    for (uint64_t i = 0; i < hdr->n_terms; i++) {
+        if (!file_string_valid(file, hdr, terms[i].str_off)
+            || !file_fits(terms[i].postings_off, terms[i].postings_size, 1, hdr->postings_size)) {
+            pr_error("Index file is corrupt\n");
+            return -1;
+        }
+        if (hdr->term_positions_off && !file_positions_valid(file, hdr, &term_positions[i], &terms[i])) {
+            pr_error("Index file is corrupt\n");
+            return -1;
+        }
+    }
+
+    for (uint64_t i = 0; i < hdr->n_docs; i++) {
+        if (!file_string_valid(file, hdr, docs[i].name_off)) {
+            pr_error("Index file is corrupt\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+index_t *index_load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        pr_error("Failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        pr_error("Failed to stat %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    size_t file_size = (size_t) st.st_size;
+    if (file_size < sizeof(file_header_t)) {
+        pr_error("%s is not an index file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    /* pages are only read from disk once a query touches them */
+    void *file = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (file == MAP_FAILED) {
+        pr_error("Failed to map %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    if (validate_file_header(file, file_size) != 0 || validate_file_tables(file) != 0) {
+        munmap(file, file_size);
+        return NULL;
+    }
+
+    /* lookups jump around the dictionary and postings, so read-ahead would mostly be wasted */
+    madvise(file, file_size, MADV_RANDOM);
+
+    index_t *index = index_create();
+    if (!index) {
+        munmap(file, file_size);
+        return NULL;
+    }
+
+    index->file_containers = calloc(((const file_header_t *) file)->n_terms, sizeof(*index->file_containers));
+    if (!index->file_containers) {
+        PANIC("Failed to allocate memory\n");
+    }
+    MEM_ALLOC(MEM_CONTAINERS, ((const file_header_t *) file)->n_terms * sizeof(containers_t *));
+
+    index->file = file;
+    index->file_size = file_size;
+    MEM_ALLOC(MEM_INDEX_FILE, file_size);
+
+    return index;
+}
+
+/* ---------------------Frozen index---------------------- */
+
+/* build the perfect hash of the terms of a frozen index. Without one, terms are binary searched for instead. */
+static void build_term_hash(index_t *index) {
+    const file_header_t *hdr = file_header(index);
+    const file_term_t *terms = (const file_term_t *) (index->file + hdr->terms_off);
+    size_t n_terms = hdr->n_terms;
+
+    if (n_terms == 0 || n_terms > UINT32_MAX) {
+        return;
+    }
+
+    str_t *keys = malloc(n_terms * sizeof(str_t));
+    if (!keys) {
+        PANIC("Failed to allocate memory\n");
+    }
+    for (size_t i = 0; i < n_terms; i++) {
+        const char *term = file_string(index, terms[i].str_off);
+        keys[i] = str_key(term, strlen(term));
+    }
+
+    index->term_hash = perfhash_create(keys, n_terms);
+    if (index->term_hash) {
+        index->term_slots = malloc(n_terms * sizeof(uint32_t));
+        if (!index->term_slots) {
+            PANIC("Failed to allocate memory\n");
+        }
+        MEM_ALLOC(MEM_TERMHASH, n_terms * sizeof(uint32_t));
+
+        for (size_t i = 0; i < n_terms; i++) {
+            index->term_slots[perfhash_lookup(index->term_hash, &keys[i])] = (uint32_t) i;
+        }
+    }
+
+    free(keys);
+}
+
+int index_freeze(index_t *index) {
+    if (index->file) {
+        pr_error("Index is read-only already\n");
+        return -1;
+    }
+    if (index->doc_open) {
+        pr_error("Cannot freeze an index with a document open\n");
+        return -1;
+    }
+
+    file_layout_t layout;
+    if (layout_build(index, &layout) != 0) {
+        return -1;
+    }
+
+    /* the index is written to memory just as index_save writes it to a file */
+    size_t size = layout.hdr.file_size;
+    uint8_t *image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (image == MAP_FAILED) {
+        pr_error("Failed to map memory for the frozen index: %s\n", strerror(errno));
+        layout_destroy(&layout);
+        return -1;
+    }
+
+    FILE *f = fmemopen(image, size, "w");
+    int status = (f && layout_write(index, &layout, f) == 0 && ftell(f) == (long) size) ? 0 : -1;
+    if (f && fclose(f) != 0) {
+        status = -1;
+    }
+    layout_destroy(&layout);
+
+    if (status != 0) {
+        pr_error("Failed to freeze index: %s\n", strerror(errno));
+        munmap(image, size);
+        return -1;
+    }
+    mprotect(image, size, PROT_READ);
+
+#ifndef NDEBUG
+    /* the image is laid out by the same code as index files, so it is held to the same checks */
+    assert(validate_file_header((const file_header_t *) image, size) == 0 && validate_file_tables(image) == 0);
+#endif
+
+    /* from here on, the index is queried as if loaded from a file, and the structures it was built with go */
+    map_destroy(index->terms, NULL, postings_destroy);
+    map_destroy(index->doc_ids, NULL, NULL);
+    interner_destroy(index->interner);
+    index->terms = NULL;
+    index->doc_ids = NULL;
+    index->interner = NULL;
+
+    for (size_t i = 0; i < index->number_of_docs; i++) {
+        if (index->doc_names[i]) {
+            MEM_FREE(MEM_DOC_NAMES, strlen(index->doc_names[i]) + 1);
+        }
+        free(index->doc_names[i]);
+    }
+    MEM_RECORD(MEM_DOC_TABLE, -(int64_t) (index->docs_capacity * (sizeof(char *) + sizeof(uint32_t))), -2);
+    free(index->doc_names);
+    free(index->doc_lengths);
+    index->doc_names = NULL;
+    index->doc_lengths = NULL;
+    index->number_of_docs = 0;
+    index->docs_capacity = 0;
+    index->total_length = 0;
+    index->n_removed = 0;
+    index->n_unpurged = 0;
+    dict_drop(index);
+
+    /* cached matches are by document id, and the ids past any removed document are shifted down */
+    cache_clear_locked(index);
+
+    size_t n_terms = ((const file_header_t *) image)->n_terms;
+    index->file_containers = calloc(n_terms, sizeof(*index->file_containers));
+    if (!index->file_containers) {
+        PANIC("Failed to allocate memory\n");
+    }
+    MEM_ALLOC(MEM_CONTAINERS, n_terms * sizeof(containers_t *));
+
+    index->file = image;
+    index->file_size = size;
+    index->frozen = true;
+    MEM_ALLOC(MEM_FROZEN, size);
+
+    build_term_hash(index);
+
+    /* the heap is left full of holes where the structures were, which are returned to the system */
+    malloc_trim(0);
+
+    return 0;
 }
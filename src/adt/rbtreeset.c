@@ -4,11 +4,14 @@
  *
  * @implements set.h
  *
- * @brief Set implementation using red-black binary search tree, in-order morris iterator.
+ * @brief Set implementation using red-black binary search tree, with an in-order iterator that follows parent
+ * pointers.
+ *
+ * The nodes of each set are allocated from a pool of its own (see pool.h), and are all released at once by
+ * set_destroy.
  *
  * For more info, see:
  * Red Black Tree Properties: https://en.wikipedia.org/wiki/Red%E2%80%93black_tree#Properties
- * Morris Traversal: https://en.wikipedia.org/wiki/Tree_traversal#Morris_in-order_traversal_using_threading
  */
 
 #include <stdbool.h>
@@ -20,6 +23,9 @@
 #include "common.h"
 #include "list.h"
 #include "set.h"
+#include "profile.h"
+#include "memstat.h"
+#include "pool.h"
 
 typedef enum tnode_color {
     RED = 0,
@@ -39,6 +45,7 @@ struct set {
     tnode_t *root;
     cmp_fn cmpfn;
     size_t length;
+    pool_t nodes;
 };
 
 static tnode_t sentinel = {.color = BLACK};
@@ -105,10 +112,12 @@ set_t *set_create(cmp_fn cmpfn) {
         pr_error("Malloc failed @set_create\n");
         return NULL;
     }
+    MEM_ALLOC(MEM_SET, sizeof(set_t));
 
     set->root = NIL;
     set->cmpfn = cmpfn;
     set->length = 0;
+    pool_init(&set->nodes, sizeof(tnode_t), MEM_SET);
 
     return set;
 }
@@ -118,33 +127,28 @@ size_t set_length(set_t *set) {
 }
 
 /**
- * @brief Recursive part of set_destroy. Probably some neat way to this without the overhead of recursion,
- * but whatever.
+ * @brief Recursive part of set_destroy. Only visits the nodes to free their elements, as the nodes themselves
+ * are released with the pool.
  */
-static void rec_postorder_destroy(set_t *set, tnode_t *node, free_fn elem_freefn) {
+static void rec_free_elems(tnode_t *node, free_fn elem_freefn) {
     if (node == NIL) {
         return;
     }
 
-    rec_postorder_destroy(set, node->left, elem_freefn);
-    rec_postorder_destroy(set, node->right, elem_freefn);
-
-    /**
-     * Free self when returned from the recursive call stack. At this point, any children are also freed.
-     * This results in the entire tree being freed in a bottom-up (postorder) manner, so that no nodes depend
-     * on freed nodes for traversal a freed node depend on this node for traversal free self when returned
-     */
-    if (elem_freefn) {
-        elem_freefn(node->elem);
-    }
-    free(node);
+    rec_free_elems(node->left, elem_freefn);
+    rec_free_elems(node->right, elem_freefn);
+    elem_freefn(node->elem);
 }
 
 void set_destroy(set_t *set, free_fn elem_freefn) {
     if (!set) {
         return;
     }
-    rec_postorder_destroy(set, set->root, elem_freefn);
+    if (elem_freefn) {
+        rec_free_elems(set->root, elem_freefn);
+    }
+    pool_release(&set->nodes);
+    MEM_FREE(MEM_SET, sizeof(set_t));
     free(set);
 }
 
@@ -247,11 +251,10 @@ static inline void post_insert_balance(set_t *set, tnode_t *added_node) {
 }
 
 void *set_insert(set_t *set, void *elem) {
+    PROF_COUNT(PROF_SET_INSERT, 1);
+
     if (set->root == NIL) {
-        set->root = malloc(sizeof(tnode_t));
-        if (!set->root) {
-            PANIC("Out of memory\n");
-        }
+        set->root = pool_alloc(&set->nodes);
 
         /* only time we insert a black node */
         set->root->color = BLACK;
@@ -291,10 +294,7 @@ void *set_insert(set_t *set, void *elem) {
         }
     }
 
-    tnode_t *node = malloc(sizeof(tnode_t));
-    if (!node) {
-        PANIC("Out of memory\n");
-    }
+    tnode_t *node = pool_alloc(&set->nodes);
 
     node->color = RED;
     node->elem = elem;
@@ -310,7 +310,9 @@ void *set_insert(set_t *set, void *elem) {
     set->length += 1;
     post_insert_balance(set, node);
 
-    validate_rbtree(set); // perform extensive validation after each insertion
+#ifndef NDEBUG
+    validate_rbtree(set); // perform extensive validation after each insertion. Walks the whole tree.
+#endif
 
     return NULL;
 }
@@ -352,22 +354,19 @@ void *set_get(set_t *set, void *elem) {
  * Recursive part of set_copy. Highly optimized.
  * Copies each node with no comparisons.
  */
-static tnode_t *rec_set_copy(tnode_t *orig_node, tnode_t *parent) {
+static tnode_t *rec_set_copy(pool_t *pool, tnode_t *orig_node, tnode_t *parent) {
     if (orig_node == NIL) {
         return NIL;
     }
 
-    tnode_t *new_node = malloc(sizeof(tnode_t));
-    if (!new_node) {
-        PANIC("Failed to allocate memory during set copy\n");
-    }
+    tnode_t *new_node = pool_alloc(pool);
 
     new_node->color = orig_node->color;
     new_node->elem = orig_node->elem;
     new_node->parent = parent;
 
-    new_node->left = rec_set_copy(orig_node->left, new_node);
-    new_node->right = rec_set_copy(orig_node->right, new_node);
+    new_node->left = rec_set_copy(pool, orig_node->left, new_node);
+    new_node->right = rec_set_copy(pool, orig_node->right, new_node);
 
     return new_node;
 }
@@ -379,7 +378,7 @@ static set_t *set_copy(set_t *set) {
     }
 
     set_cpy->length = set->length;
-    set_cpy->root = rec_set_copy(set->root, NIL);
+    set_cpy->root = rec_set_copy(&set_cpy->nodes, set->root, NIL);
 
     return set_cpy;
 }
@@ -505,47 +504,38 @@ typedef struct set_iter {
     tnode_t *head;
 } set_iter_t;
 
+/* leftmost (smallest) node of the subtree rooted at `node` */
+static inline tnode_t *leftmost_node(tnode_t *node) {
+    if (node == NIL) {
+        return NIL;
+    }
+
+    while (node->left != NIL) {
+        node = node->left;
+    }
+
+    return node;
+}
+
 /**
- * @brief In-order morris traversal implementation.
- *
- * Temporarily alters the tree structure to form a in-order sequence, using the freely available pointers at
- * leaf nodes.
+ * @brief In-order successor of a node, following parent pointers.
  *
- * @note
- * This implementation is extremely efficient, but makes insertions to the tree during active iteration
- * potentially catastrophic (although unlikely for a large set, as it only affects one node at any given
- * point). However; As a safety measure, I attached a check for this at the insertion stage,
- * where a warning is printed.
+ * Amortized O(1) per step over a full traversal, and the tree is left untouched. Any number of iterators may
+ * therefore traverse the same set at once, e.g. from several threads, as long as it is not modified.
  */
-static tnode_t *next_node_inorder(set_iter_t *iter) {
-    tnode_t *next = iter->head;
-
-    while (next != NIL) {
-        if (next->left == NIL) {
-            /* no left subtree, visit current node and move right */
-            iter->head = next->right;
-            return next;
-        }
-
-        /* find the in-order predecessor */
-        tnode_t *pre = next->left;
-        while (pre->right != NIL && pre->right != next) {
-            pre = pre->right;
-        }
+static tnode_t *next_node_inorder(tnode_t *node) {
+    if (node->right != NIL) {
+        return leftmost_node(node->right);
+    }
 
-        if (pre->right == NIL) {
-            /* create temporary link to return after left subtree traversal */
-            pre->right = next;
-            next = next->left;
-        } else {
-            /* restore tree structure, visit current node, move right */
-            pre->right = NIL;
-            iter->head = next->right;
-            return next;
-        }
+    /* climb until we arrive from a left subtree. The parent of the root is NIL. */
+    tnode_t *parent = node->parent;
+    while (parent != NIL && node == parent->right) {
+        node = parent;
+        parent = parent->parent;
     }
 
-    return NIL;
+    return parent;
 }
 
 set_iter_t *set_createiter(set_t *set) {
@@ -560,7 +550,7 @@ set_iter_t *set_createiter(set_t *set) {
     }
 
     iter->set = set;
-    iter->head = set->root;
+    iter->head = leftmost_node(set->root);
 
     return iter;
 }
@@ -570,16 +560,16 @@ int set_hasnext(set_iter_t *iter) {
 }
 
 void set_destroyiter(set_iter_t *iter) {
-    while (set_hasnext(iter)) {
-        // finish the morris iterator process to avoid leaving any mutated leaves
-        next_node_inorder(iter);
-    }
-
     free(iter);
 }
 
 void *set_next(set_iter_t *iter) {
-    tnode_t *curr = next_node_inorder(iter);
-    /* if end of tree is reached, curr->elem will be NULL */
+    tnode_t *curr = iter->head;
+    if (curr == NIL) {
+        return NULL;
+    }
+
+    iter->head = next_node_inorder(curr);
+
     return curr->elem;
 }
@@ -0,0 +1,341 @@
+/**
+ * @implements map.h
+ *
+ * @brief Hash map with open addressing and Robin Hood probing.
+ *
+ * @details
+ * All entries live in one flat array of slots, so neither insertion nor lookup allocates or chases pointers.
+ * Each slot stores its distance from its home slot, and the upper 32 bits of the hash of its key as a
+ * fingerprint. A probe only calls `cmpfn` when the fingerprints match, which is almost always a hit.
+ *
+ * On insertion, an entry that has probed further than the occupant of a slot takes the slot, and the
+ * occupant moves on instead ("robbing the rich"). This keeps probe distances short and even, and lets a
+ * lookup stop as soon as it reaches a slot that is closer to home than the probe itself. Removal shifts the
+ * following entries back by one slot rather than leaving tombstones.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "common.h"
+#include "map.h"
+#include "profile.h"
+#include "memstat.h"
+
+
+/* how many slots each map should start with. Must be a power of 2. */
+#define N_SLOTS_INITIAL 16
+
+/**
+ * Double the number of slots when an insertion would bring the load factor above this threshold.
+ * Robin Hood probing keeps lookups short at a far higher load than linear probing otherwise would.
+ */
+#define LF_GROW 0.85
+
+
+typedef struct slot {
+    entry_t entry;
+    uint32_t fingerprint; // upper 32 bits of the hash of entry.key
+    uint32_t dist;        // 1 + distance from the home slot of the entry. 0 => the slot is empty.
+} slot_t;
+
+struct map {
+    cmp_fn cmpfn;
+    hash64_fn hashfn;
+    slot_t *slots;
+    size_t capacity; // number of slots, always a power of 2
+    size_t length;
+    size_t grow_threshold;
+};
+
+/**
+ * Calculate the length threshold where the map will grow before insertion
+ */
+static inline size_t calc_grow_threshold(size_t capacity) {
+    return (size_t) ((double) capacity * (double) LF_GROW);
+}
+
+static inline uint32_t fingerprint_of(uint64_t hash) {
+    return (uint32_t) (hash >> 32);
+}
+
+/**
+ * Place `carry` in the table, starting at its home slot. The key must not already be present, and there
+ * must be at least one empty slot.
+ */
+static inline void place_entry(slot_t *slots, size_t mask, slot_t carry, size_t i) {
+    while (1) {
+        slot_t *slot = &slots[i];
+
+        if (slot->dist == 0) {
+            *slot = carry;
+            return;
+        }
+
+        /* the occupant is closer to home than `carry`, so it gives up its slot */
+        if (slot->dist < carry.dist) {
+            slot_t tmp = *slot;
+            *slot = carry;
+            carry = tmp;
+        }
+
+        i = (i + 1) & mask;
+        carry.dist++;
+    }
+}
+
+/**
+ * Resize the table and re-place all entries. Only the upper bits of each hash are stored, so the keys are
+ * hashed again.
+ */
+static inline int map_resize(map_t *map, size_t new_capacity) {
+    slot_t *new_slots = calloc(new_capacity, sizeof(slot_t));
+    if (new_slots == NULL) {
+        return -1;
+    }
+
+    size_t mask = new_capacity - 1;
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        slot_t slot = map->slots[i];
+        if (slot.dist == 0) {
+            continue;
+        }
+
+        slot.dist = 1;
+        place_entry(new_slots, mask, slot, map->hashfn(slot.entry.key) & mask);
+    }
+
+    free(map->slots);
+    MEM_RESIZE(MEM_MAP, map->capacity * sizeof(slot_t), new_capacity * sizeof(slot_t));
+
+    map->slots = new_slots;
+    map->capacity = new_capacity;
+    map->grow_threshold = calc_grow_threshold(new_capacity);
+
+    return 0;
+}
+
+/**
+ * Find the slot holding `key`, or NULL if it is not present
+ */
+static inline slot_t *find_slot(map_t *map, const void *key, uint64_t hash) {
+    size_t mask = map->capacity - 1;
+    size_t i = hash & mask;
+    uint32_t fingerprint = fingerprint_of(hash);
+
+    for (uint32_t dist = 1;; dist++) {
+        slot_t *slot = &map->slots[i];
+
+        /**
+         * Had the key been present, it would have taken this slot when it was inserted. This also covers
+         * empty slots, as their distance is 0.
+         */
+        if (slot->dist < dist) {
+            return NULL;
+        }
+        if (slot->fingerprint == fingerprint && map->cmpfn(slot->entry.key, key) == 0) {
+            return slot;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+/* allocate a copy of an entry, to be returned to (and freed by) the caller */
+static inline entry_t *entry_copy(entry_t *entry) {
+    entry_t *cpy = malloc(sizeof(entry_t));
+    if (!cpy) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    *cpy = *entry;
+
+    return cpy;
+}
+
+map_t *map_create(cmp_fn cmpfn, hash64_fn hashfn) {
+    map_t *map = malloc(sizeof(map_t));
+    if (map == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    map->slots = calloc(N_SLOTS_INITIAL, sizeof(slot_t));
+    if (map->slots == NULL) {
+        pr_error("Failed to allocate memory\n");
+        free(map);
+        return NULL;
+    }
+
+    MEM_RECORD(MEM_MAP, sizeof(map_t) + N_SLOTS_INITIAL * sizeof(slot_t), 2);
+
+    map->cmpfn = cmpfn;
+    map->hashfn = hashfn;
+    map->length = 0;
+    map->capacity = N_SLOTS_INITIAL;
+    map->grow_threshold = calc_grow_threshold(N_SLOTS_INITIAL);
+
+    return map;
+}
+
+void map_destroy(map_t *map, free_fn key_freefn, free_fn val_freefn) {
+    if (!map) {
+        return;
+    }
+
+    if (key_freefn || val_freefn) {
+        for (size_t i = 0; i < map->capacity; i++) {
+            slot_t *slot = &map->slots[i];
+            if (slot->dist == 0) {
+                continue;
+            }
+
+            if (key_freefn) {
+                key_freefn(slot->entry.key);
+            }
+            if (val_freefn) {
+                val_freefn(slot->entry.val);
+            }
+        }
+    }
+
+    MEM_RECORD(MEM_MAP, -(int64_t) (sizeof(map_t) + map->capacity * sizeof(slot_t)), -2);
+    free(map->slots);
+    free(map);
+}
+
+size_t map_length(map_t *map) {
+    return map->length;
+}
+
+entry_t *map_insert(map_t *map, void *key, void *val) {
+    uint64_t hash = map->hashfn(key);
+    slot_t *slot = find_slot(map, key, hash);
+
+    if (slot) {
+        /* already present, replace the entry and return the old one */
+        entry_t *old_entry = entry_copy(&slot->entry);
+        slot->entry.key = key;
+        slot->entry.val = val;
+
+        return old_entry;
+    }
+
+    if (map->length + 1 > map->grow_threshold) {
+        if (map_resize(map, map->capacity * 2) != 0) {
+            PANIC("Failed to rehash\n");
+        }
+    }
+
+    size_t mask = map->capacity - 1;
+    slot_t carry = {
+        .entry = { .key = key, .val = val },
+        .fingerprint = fingerprint_of(hash),
+        .dist = 1,
+    };
+
+    place_entry(map->slots, mask, carry, hash & mask);
+    map->length++;
+
+    return NULL;
+}
+
+entry_t *map_remove(map_t *map, void *key) {
+    slot_t *slot = find_slot(map, key, map->hashfn(key));
+
+    if (!slot) {
+        return NULL;
+    }
+
+    entry_t *entry = entry_copy(&slot->entry);
+
+    /* shift the following entries back by one, until one is in its home slot or the slot is empty */
+    size_t mask = map->capacity - 1;
+    size_t i = (size_t) (slot - map->slots);
+
+    while (1) {
+        size_t next = (i + 1) & mask;
+
+        if (map->slots[next].dist <= 1) {
+            map->slots[i].dist = 0;
+            break;
+        }
+
+        map->slots[i] = map->slots[next];
+        map->slots[i].dist--;
+        i = next;
+    }
+
+    map->length--;
+
+    return entry;
+}
+
+entry_t *map_get(map_t *map, void *key) {
+    uint64_t hash = map->hashfn(key);
+    slot_t *slot = find_slot(map, key, hash);
+
+#ifdef PROFILE
+    /* a hit probed as far as the distance stored in its slot, a miss until the first slot closer to home */
+    size_t n_probes = 1;
+    if (slot) {
+        n_probes = slot->dist;
+    } else {
+        size_t mask = map->capacity - 1;
+        for (size_t i = hash & mask; map->slots[i].dist >= n_probes; i = (i + 1) & mask) {
+            n_probes++;
+        }
+    }
+    PROF_COUNT(PROF_MAP_GET, 1);
+    PROF_COUNT(PROF_MAP_PROBES, n_probes);
+#endif /* PROFILE */
+
+    return slot ? &slot->entry : NULL;
+}
+
+
+struct map_iter {
+    slot_t *slots;
+    size_t i_next_slot;
+    size_t n_remaining;
+};
+
+map_iter_t *map_createiter(map_t *map) {
+    map_iter_t *iter = malloc(sizeof(map_iter_t));
+    if (iter == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    iter->slots = map->slots;
+    iter->i_next_slot = 0;
+    iter->n_remaining = map->length;
+
+    return iter;
+}
+
+void map_destroyiter(map_iter_t *iter) {
+    free(iter);
+}
+
+int map_hasnext(map_iter_t *iter) {
+    return iter->n_remaining != 0;
+}
+
+entry_t *map_next(map_iter_t *iter) {
+    if (iter->n_remaining == 0) {
+        return NULL;
+    }
+
+    while (iter->slots[iter->i_next_slot].dist == 0) {
+        iter->i_next_slot++;
+    }
+
+    iter->n_remaining--;
+
+    return &iter->slots[iter->i_next_slot++].entry;
+}
@@ -0,0 +1,383 @@
+/**
+ * @implements set.h
+ *
+ * @brief Set as a contiguous array of elements, sorted by the comparison function of the set.
+ *
+ * @details
+ * Lookups are binary searches, and union/intersection/difference are linear merges of two sorted arrays that
+ * produce a sorted array right away, with no per-element allocation. When one operand is much smaller than
+ * the other, intersection and difference instead gallop (exponential search) through the larger one, which
+ * takes O(m log(n/m)) comparisons rather than O(n + m).
+ *
+ * Insertion in sorted order (such as from the iterator of another set) is an O(1) append, while insertion at
+ * any other position has to shift the elements after it.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "common.h"
+#include "set.h"
+#include "profile.h"
+#include "memstat.h"
+
+
+/* how many elements a set has room for when it is first inserted into */
+#define CAPACITY_INITIAL 16
+
+/**
+ * Gallop through the larger operand when it is at least this many times longer than the smaller one.
+ * Below it, the plain merge touches fewer elements overall.
+ */
+#define GALLOP_RATIO 16
+
+
+struct set {
+    cmp_fn cmpfn;
+    void **elems; // sorted by cmpfn, without duplicates
+    size_t length;
+    size_t capacity;
+};
+
+
+/* create a set with room for at least `capacity` elements */
+static set_t *set_create_capacity(cmp_fn cmpfn, size_t capacity) {
+    set_t *set = malloc(sizeof(set_t));
+    if (!set) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    set->cmpfn = cmpfn;
+    set->length = 0;
+    set->capacity = capacity;
+    set->elems = NULL;
+
+    if (capacity) {
+        set->elems = malloc(capacity * sizeof(void *));
+        if (!set->elems) {
+            pr_error("Failed to allocate memory\n");
+            free(set);
+            return NULL;
+        }
+    }
+    MEM_RECORD(MEM_SET, sizeof(set_t) + capacity * sizeof(void *), capacity ? 2 : 1);
+
+    return set;
+}
+
+set_t *set_create(cmp_fn cmpfn) {
+    return set_create_capacity(cmpfn, 0);
+}
+
+void set_destroy(set_t *set, free_fn elem_freefn) {
+    if (!set) {
+        return;
+    }
+
+    if (elem_freefn) {
+        for (size_t i = 0; i < set->length; i++) {
+            elem_freefn(set->elems[i]);
+        }
+    }
+
+    MEM_RECORD(MEM_SET, -(int64_t) (sizeof(set_t) + set->capacity * sizeof(void *)), set->capacity ? -2 : -1);
+    free(set->elems);
+    free(set);
+}
+
+size_t set_length(set_t *set) {
+    return set->length;
+}
+
+/**
+ * Binary search for `elem` within elems[lo, hi).
+ * @returns the index of the first element that is not less than `elem`, which is `hi` if there is none
+ */
+static inline size_t lower_bound(set_t *set, void *elem, size_t lo, size_t hi) {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (set->cmpfn(set->elems[mid], elem) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * Same as lower_bound over elems[from, length), but probes from elems[from] at exponentially increasing
+ * steps first. Cheap when the result is close to `from`, as is the case when walking a larger set in step
+ * with a smaller one.
+ */
+static inline size_t gallop(set_t *set, void *elem, size_t from) {
+    size_t step = 1;
+    size_t lo = from;
+    size_t hi = from;
+
+    while (hi < set->length && set->cmpfn(set->elems[hi], elem) < 0) {
+        lo = hi + 1;
+        hi = from + step;
+        step *= 2;
+    }
+
+    if (hi > set->length) {
+        hi = set->length;
+    }
+
+    return lower_bound(set, elem, lo, hi);
+}
+
+static inline void set_reserve(set_t *set, size_t n_extra) {
+    if (set->length + n_extra <= set->capacity) {
+        return;
+    }
+
+    size_t new_capacity = set->capacity ? set->capacity : CAPACITY_INITIAL;
+    while (new_capacity < set->length + n_extra) {
+        new_capacity *= 2;
+    }
+
+    void **new_elems = realloc(set->elems, new_capacity * sizeof(void *));
+    if (!new_elems) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    /* the first insertion into an empty set allocates its array */
+    MEM_RECORD(MEM_SET, (int64_t) ((new_capacity - set->capacity) * sizeof(void *)), set->capacity ? 0 : 1);
+
+    set->elems = new_elems;
+    set->capacity = new_capacity;
+}
+
+void *set_insert(set_t *set, void *elem) {
+    size_t i;
+
+    PROF_COUNT(PROF_SET_INSERT, 1);
+
+    /* fast path for ascending insertion */
+    if (set->length == 0 || set->cmpfn(set->elems[set->length - 1], elem) < 0) {
+        i = set->length;
+    } else {
+        i = lower_bound(set, elem, 0, set->length);
+
+        if (set->cmpfn(set->elems[i], elem) == 0) {
+            void *replaced = set->elems[i];
+            set->elems[i] = elem;
+
+            return replaced;
+        }
+    }
+
+    set_reserve(set, 1);
+
+    memmove(&set->elems[i + 1], &set->elems[i], (set->length - i) * sizeof(void *));
+    set->elems[i] = elem;
+    set->length++;
+
+    return NULL;
+}
+
+void *set_get(set_t *set, void *elem) {
+    size_t i = lower_bound(set, elem, 0, set->length);
+
+    if (i < set->length && set->cmpfn(set->elems[i], elem) == 0) {
+        return set->elems[i];
+    }
+
+    return NULL;
+}
+
+/* shallow copy of a set, elements included */
+static set_t *set_copy(set_t *set) {
+    set_t *cpy = set_create_capacity(set->cmpfn, set->length);
+    if (!cpy) {
+        return NULL;
+    }
+
+    if (set->length) {
+        memcpy(cpy->elems, set->elems, set->length * sizeof(void *));
+    }
+    cpy->length = set->length;
+
+    return cpy;
+}
+
+set_t *set_union(set_t *a, set_t *b) {
+    /* if a is b, c == a || b, so simply copy 'a' */
+    if (a == b) {
+        return set_copy(a);
+    }
+
+    set_t *c = set_create_capacity(a->cmpfn, a->length + b->length);
+    if (!c) {
+        pr_error("Not enough memory to perform set union\n");
+        return NULL;
+    }
+
+    size_t i = 0, j = 0;
+
+    while (i < a->length && j < b->length) {
+        int cmp = a->cmpfn(a->elems[i], b->elems[j]);
+
+        if (cmp < 0) {
+            c->elems[c->length++] = a->elems[i++];
+        } else if (cmp > 0) {
+            c->elems[c->length++] = b->elems[j++];
+        } else {
+            c->elems[c->length++] = a->elems[i];
+            i++;
+            j++;
+        }
+    }
+    while (i < a->length) {
+        c->elems[c->length++] = a->elems[i++];
+    }
+    while (j < b->length) {
+        c->elems[c->length++] = b->elems[j++];
+    }
+
+    return c;
+}
+
+set_t *set_intersection(set_t *a, set_t *b) {
+    /* if a is b, c == a || b, so simply copy 'a' */
+    if (a == b) {
+        return set_copy(a);
+    }
+
+    size_t min_length = (a->length < b->length) ? a->length : b->length;
+
+    set_t *c = set_create_capacity(a->cmpfn, min_length);
+    if (!c) {
+        return NULL;
+    }
+
+    if (b->length / GALLOP_RATIO >= a->length) {
+        /* a is much smaller, gallop through b */
+        size_t j = 0;
+
+        for (size_t i = 0; i < a->length && j < b->length; i++) {
+            j = gallop(b, a->elems[i], j);
+
+            if (j < b->length && a->cmpfn(a->elems[i], b->elems[j]) == 0) {
+                c->elems[c->length++] = a->elems[i];
+                j++;
+            }
+        }
+    } else if (a->length / GALLOP_RATIO >= b->length) {
+        /* b is much smaller, gallop through a */
+        size_t i = 0;
+
+        for (size_t j = 0; j < b->length && i < a->length; j++) {
+            i = gallop(a, b->elems[j], i);
+
+            if (i < a->length && a->cmpfn(a->elems[i], b->elems[j]) == 0) {
+                c->elems[c->length++] = a->elems[i];
+                i++;
+            }
+        }
+    } else {
+        size_t i = 0, j = 0;
+
+        while (i < a->length && j < b->length) {
+            int cmp = a->cmpfn(a->elems[i], b->elems[j]);
+
+            if (cmp < 0) {
+                i++;
+            } else if (cmp > 0) {
+                j++;
+            } else {
+                c->elems[c->length++] = a->elems[i];
+                i++;
+                j++;
+            }
+        }
+    }
+
+    return c;
+}
+
+set_t *set_difference(set_t *a, set_t *b) {
+    /* if a is b, c == { Ø }, so no point in merging. Return empty set. */
+    if (a == b) {
+        return set_create(a->cmpfn);
+    }
+
+    set_t *c = set_create_capacity(a->cmpfn, a->length);
+    if (!c) {
+        return NULL;
+    }
+
+    size_t j = 0;
+    bool gallop_b = (b->length / GALLOP_RATIO >= a->length);
+
+    for (size_t i = 0; i < a->length; i++) {
+        if (j < b->length) {
+            /* move j to the first element of b that is not less than a[i] */
+            if (gallop_b) {
+                j = gallop(b, a->elems[i], j);
+            } else {
+                while (j < b->length && a->cmpfn(b->elems[j], a->elems[i]) < 0) {
+                    j++;
+                }
+            }
+
+            if (j < b->length && a->cmpfn(a->elems[i], b->elems[j]) == 0) {
+                j++;
+                continue;
+            }
+        }
+
+        c->elems[c->length++] = a->elems[i];
+    }
+
+    return c;
+}
+
+
+/* -----------------------Iteration----------------------- */
+
+typedef struct set_iter {
+    set_t *set;
+    size_t i_next;
+} set_iter_t;
+
+set_iter_t *set_createiter(set_t *set) {
+    if (!set) {
+        PANIC("Attempt to create iterator for set=NULL\n");
+    }
+
+    set_iter_t *iter = malloc(sizeof(set_iter_t));
+    if (iter == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    iter->set = set;
+    iter->i_next = 0;
+
+    return iter;
+}
+
+int set_hasnext(set_iter_t *iter) {
+    return iter->i_next < iter->set->length;
+}
+
+void set_destroyiter(set_iter_t *iter) {
+    free(iter);
+}
+
+void *set_next(set_iter_t *iter) {
+    if (iter->i_next >= iter->set->length) {
+        return NULL;
+    }
+
+    return iter->set->elems[iter->i_next++];
+}
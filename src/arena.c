@@ -0,0 +1,160 @@
+/**
+ * @implements arena.h
+ *
+ * @brief Arena as a singly linked list of chunks. Chunks are kept on reset, and filled again front to back.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "arena.h"
+#include "memstat.h"
+
+
+/* default size of each chunk, when none is given to arena_create */
+#define CHUNK_SIZE_DEFAULT (64 * 1024)
+
+typedef struct chunk chunk_t;
+struct chunk {
+    chunk_t *next;
+    size_t capacity;
+    size_t used;
+    max_align_t data[]; // typed for alignment, used as bytes
+};
+
+struct arena {
+    chunk_t *first;
+    chunk_t *curr; // chunk currently allocated from. Any chunks after it are unused.
+    size_t chunk_size;
+    size_t total_capacity;
+};
+
+
+static chunk_t *chunk_create(size_t capacity) {
+    chunk_t *chunk = malloc(sizeof(chunk_t) + capacity);
+    if (!chunk) {
+        PANIC("Failed to allocate memory\n");
+    }
+    MEM_ALLOC(MEM_ARENA, sizeof(chunk_t) + capacity);
+
+    chunk->next = NULL;
+    chunk->capacity = capacity;
+    chunk->used = 0;
+
+    return chunk;
+}
+
+arena_t *arena_create(size_t chunk_size) {
+    arena_t *arena = malloc(sizeof(arena_t));
+    if (!arena) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+    MEM_ALLOC(MEM_ARENA, sizeof(arena_t));
+
+    arena->chunk_size = chunk_size ? chunk_size : CHUNK_SIZE_DEFAULT;
+    arena->first = arena->curr = chunk_create(arena->chunk_size);
+    arena->total_capacity = arena->chunk_size;
+
+    return arena;
+}
+
+void arena_destroy(arena_t *arena) {
+    if (!arena) {
+        return;
+    }
+
+    chunk_t *chunk = arena->first;
+    while (chunk) {
+        chunk_t *next = chunk->next;
+        MEM_FREE(MEM_ARENA, sizeof(chunk_t) + chunk->capacity);
+        free(chunk);
+        chunk = next;
+    }
+
+    MEM_FREE(MEM_ARENA, sizeof(arena_t));
+    free(arena);
+}
+
+void arena_reset(arena_t *arena) {
+    for (chunk_t *chunk = arena->first; chunk; chunk = chunk->next) {
+        chunk->used = 0;
+    }
+    arena->curr = arena->first;
+}
+
+size_t arena_capacity(arena_t *arena) {
+    return arena->total_capacity;
+}
+
+/**
+ * Move to a chunk with at least `size` free bytes, reusing the next chunk in line if it is large enough,
+ * otherwise inserting a new one after the current.
+ */
+static chunk_t *next_chunk(arena_t *arena, size_t size) {
+    chunk_t *curr = arena->curr;
+
+    if (curr->next && curr->next->capacity >= size) {
+        curr = curr->next;
+        curr->used = 0;
+    } else {
+        size_t capacity = (size > arena->chunk_size) ? size : arena->chunk_size;
+        chunk_t *chunk = chunk_create(capacity);
+
+        chunk->next = curr->next;
+        curr->next = chunk;
+        curr = chunk;
+        arena->total_capacity += capacity;
+    }
+
+    arena->curr = curr;
+    return curr;
+}
+
+char *arena_reserve(arena_t *arena, size_t size) {
+    chunk_t *chunk = arena->curr;
+
+    if (chunk->capacity - chunk->used < size) {
+        chunk = next_chunk(arena, size);
+    }
+
+    return (char *) chunk->data + chunk->used;
+}
+
+void arena_commit(arena_t *arena, size_t size) {
+    assert(arena->curr->used + size <= arena->curr->capacity);
+    arena->curr->used += size;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    static const size_t align = sizeof(max_align_t);
+
+    /* pad the current offset up to the alignment. The data of each chunk is itself aligned. */
+    chunk_t *chunk = arena->curr;
+    size_t padding = (align - (chunk->used % align)) % align;
+
+    if (chunk->capacity - chunk->used < size + padding) {
+        chunk = next_chunk(arena, size);
+        padding = 0;
+    }
+
+    chunk->used += padding;
+    void *ptr = (char *) chunk->data + chunk->used;
+    chunk->used += size;
+
+    return ptr;
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t len) {
+    char *cpy = arena_reserve(arena, len + 1);
+
+    memcpy(cpy, str, len);
+    cpy[len] = '\0';
+    arena_commit(arena, len + 1);
+
+    return cpy;
+}
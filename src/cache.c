@@ -0,0 +1,193 @@
+/**
+ * @implements cache.h
+ *
+ * @brief Map of keys to the nodes of a doubly linked list, ordered from most to least recently used.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "common.h"
+#include "map.h"
+#include "cache.h"
+#include "memstat.h"
+
+
+typedef struct cache_node cache_node_t;
+struct cache_node {
+    char *key;
+    void *val;
+    size_t size; // bytes counted against the bound: the value, key and this node
+    cache_node_t *prev;
+    cache_node_t *next;
+};
+
+struct cache {
+    map_t *nodes;       // key -> cache_node_t *
+    cache_node_t *head; // most recently used
+    cache_node_t *tail; // least recently used, evicted first
+    size_t n_bytes;
+    size_t max_bytes;
+    size_t hits;
+    size_t misses;
+    free_fn val_freefn;
+};
+
+
+cache_t *cache_create(size_t max_bytes, free_fn val_freefn) {
+    cache_t *cache = malloc(sizeof(cache_t));
+    if (!cache) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    cache->nodes = map_create((cmp_fn) strcmp, hash_string_fnv1a64);
+    if (!cache->nodes) {
+        free(cache);
+        return NULL;
+    }
+
+    cache->head = cache->tail = NULL;
+    cache->n_bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->val_freefn = val_freefn;
+
+    return cache;
+}
+
+static void node_destroy(cache_t *cache, cache_node_t *node) {
+    if (cache->val_freefn) {
+        cache->val_freefn(node->val);
+    }
+    MEM_RECORD(MEM_CACHE, -(int64_t) node->size, -3);
+    free(node->key);
+    free(node);
+}
+
+void cache_clear(cache_t *cache) {
+    cache_node_t *node = cache->head;
+
+    while (node) {
+        cache_node_t *next = node->next;
+        free(map_remove(cache->nodes, node->key));
+        node_destroy(cache, node);
+        node = next;
+    }
+
+    cache->head = cache->tail = NULL;
+    cache->n_bytes = 0;
+}
+
+void cache_destroy(cache_t *cache) {
+    if (!cache) {
+        return;
+    }
+
+    cache_clear(cache);
+    map_destroy(cache->nodes, NULL, NULL);
+    free(cache);
+}
+
+static inline void list_unlink(cache_t *cache, cache_node_t *node) {
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        cache->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        cache->tail = node->prev;
+    }
+}
+
+static inline void list_push_front(cache_t *cache, cache_node_t *node) {
+    node->prev = NULL;
+    node->next = cache->head;
+
+    if (cache->head) {
+        cache->head->prev = node;
+    } else {
+        cache->tail = node;
+    }
+    cache->head = node;
+}
+
+/* remove an entry entirely */
+static void evict(cache_t *cache, cache_node_t *node) {
+    list_unlink(cache, node);
+    free(map_remove(cache->nodes, node->key));
+    cache->n_bytes -= node->size;
+    node_destroy(cache, node);
+}
+
+void *cache_get(cache_t *cache, const char *key) {
+    entry_t *entry = map_get(cache->nodes, (void *) key);
+
+    if (!entry) {
+        cache->misses++;
+        return NULL;
+    }
+
+    cache_node_t *node = entry->val;
+    cache->hits++;
+
+    if (node != cache->head) {
+        list_unlink(cache, node);
+        list_push_front(cache, node);
+    }
+
+    return node->val;
+}
+
+void cache_put(cache_t *cache, const char *key, void *val, size_t size) {
+    size_t key_len = strlen(key);
+    size_t total_size = size + key_len + 1 + sizeof(cache_node_t);
+
+    /* any value already cached for the key is replaced */
+    entry_t *entry = map_get(cache->nodes, (void *) key);
+    if (entry) {
+        evict(cache, entry->val);
+    }
+
+    if (total_size > cache->max_bytes) {
+        if (cache->val_freefn) {
+            cache->val_freefn(val);
+        }
+        return;
+    }
+
+    while (cache->n_bytes + total_size > cache->max_bytes) {
+        evict(cache, cache->tail);
+    }
+
+    cache_node_t *node = malloc(sizeof(cache_node_t));
+    char *key_cpy = malloc(key_len + 1);
+    if (!node || !key_cpy) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    memcpy(key_cpy, key, key_len + 1);
+    node->key = key_cpy;
+    node->val = val;
+    node->size = total_size;
+
+    list_push_front(cache, node);
+    map_insert(cache->nodes, node->key, node);
+    cache->n_bytes += total_size;
+
+    /* the value, the copy of its key and the node */
+    MEM_RECORD(MEM_CACHE, (int64_t) total_size, 3);
+}
+
+void cache_stat(cache_t *cache, cache_stat_t *dst) {
+    dst->hits = cache->hits;
+    dst->misses = cache->misses;
+    dst->n_entries = map_length(cache->nodes);
+    dst->n_bytes = cache->n_bytes;
+    dst->max_bytes = cache->max_bytes;
+}
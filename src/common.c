@@ -65,6 +65,93 @@ uint64_t hash_string_fnv1a64(const void *str) {
     return hash;
 }
 
+uint64_t hash_bytes_fnv1a64(const void *data, size_t len) {
+    static const uint64_t FNV_offset_basis = 0xcbf29ce484222325;
+    static const uint64_t FNV_prime = 0x100000001b3;
+
+    uint64_t hash = FNV_offset_basis;
+    const uint8_t *p = (const uint8_t *) data;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint64_t) p[i];
+        hash *= FNV_prime;
+    }
+
+    return hash;
+}
+
+/* multiply a and b into 128 bits, and fold the upper half onto the lower */
+static inline uint64_t mum_fold(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static inline uint64_t read_u64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read_u32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t hash_bytes_word64(const void *data, size_t len) {
+    /* the constants of wyhash, odd and with an even mix of set bits */
+    static const uint64_t K0 = 0xa0761d6478bd642f;
+    static const uint64_t K1 = 0xe7037ed1a0b428db;
+
+    const uint8_t *p = (const uint8_t *) data;
+    uint64_t seed = K0;
+    uint64_t a, b;
+
+    /**
+     * Short strings, such as most terms, are read as (up to four) overlapping words of fixed size rather than
+     * byte by byte, so there is no loop or variable-length copy. Overlapping bytes are unambiguous, as the
+     * length is mixed in at the end.
+     */
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t mid = (len >> 3) << 2; // 4 if len >= 8, otherwise 0
+            a = (read_u32(p) << 32) | read_u32(p + mid);
+            b = (read_u32(p + len - 4) << 32) | read_u32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        size_t i = len;
+        while (i > 16) {
+            seed = mum_fold(read_u64(p) ^ K1, read_u64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        /* the last 16 bytes, overlapping the ones before if need be */
+        a = read_u64(p + i - 16);
+        b = read_u64(p + i - 8);
+    }
+
+    return mum_fold(K1 ^ (uint64_t) len, mum_fold(a ^ K1, b ^ seed));
+}
+
+uint64_t hash_pointer(const void *ptr) {
+    /* finalizer of MurmurHash3, spreading the (typically aligned, clustered) address bits over the hash */
+    uint64_t x = (uint64_t) (uintptr_t) ptr;
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53;
+    x ^= x >> 33;
+
+    return x;
+}
+
 /* -- character control -- */
 
 int is_newline(int c) {
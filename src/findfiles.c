@@ -1,13 +1,22 @@
 /**
  * @authors
  * Odin Bjerke <odin.bjerke@uit.no>
+ *
+ * @brief Directories are walked by a pool of workers. Each worker owns a deque of directories left to walk:
+ * it pushes the subdirectories it finds to the back, and pops from the back, such that it walks depth-first.
+ * A worker that runs out of directories steals from the front of the deque of another, where the oldest (and
+ * likely largest) subtrees are.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <sys/stat.h>
 
@@ -15,81 +24,438 @@
 #include "defs.h"
 #include "list.h"
 #include "set.h"
+#include "findfiles.h"
 
 
-int find_files(const char *dir_path, list_t *dst, set_t *valid_exts, size_t n_files_max) {
-    DIR *dir = opendir(dir_path);
+/* state shared by all walkers */
+typedef struct walk {
+    set_t *valid_exts;
+    size_t n_files_max;
+    file_fn filefn; // nullable. If present, files are handed to it as they are found
+    void *file_arg;
+    atomic_size_t n_claimed; // files found so far, including any in dst before the walk
+    atomic_size_t n_pending; // directories that are queued or being walked
+    atomic_size_t n_queued;  // directories that are queued
+    atomic_size_t n_idle;    // walkers waiting for a directory to be queued
+    atomic_int stop;         // set once the limit is reached, or on error
+    int status;              // 0, or the first error. Protected by idle_lock.
+    pthread_mutex_t idle_lock;
+    pthread_cond_t work_available;
+    struct walker *walkers;
+    size_t n_walkers;
+} walk_t;
+
+typedef struct walker {
+    pthread_t thread;
+    walk_t *walk;
+    size_t id;
+    pthread_mutex_t lock; // protects dirs
+    list_t *dirs;         // paths of directories left to walk. The owner pops last, thieves pop first.
+    list_t *files;        // files found by this walker in the order found, unless they are handed to filefn
+} walker_t;
+
+
+/* stop all walkers, recording the status if it is the first error */
+static void walk_stop(walk_t *walk, int status) {
+    pthread_mutex_lock(&walk->idle_lock);
+
+    if (walk->status == 0) {
+        walk->status = status;
+    }
+    atomic_store(&walk->stop, 1);
+    pthread_cond_broadcast(&walk->work_available);
+
+    pthread_mutex_unlock(&walk->idle_lock);
+}
+
+/* queue a directory to be walked by `walker`, or by whoever steals it. The path is owned by the walk. */
+static int push_dir(walker_t *walker, char *path) {
+    walk_t *walk = walker->walk;
+
+    atomic_fetch_add(&walk->n_pending, 1);
+
+    pthread_mutex_lock(&walker->lock);
+    int status = list_addlast(walker->dirs, path);
+    if (status == 0) {
+        atomic_fetch_add(&walk->n_queued, 1);
+    }
+    pthread_mutex_unlock(&walker->lock);
+
+    if (status < 0) {
+        free(path);
+        atomic_fetch_sub(&walk->n_pending, 1);
+        return -1;
+    }
+
+    /* wake an idle walker to steal it. Pairs with the check of n_queued in wait_for_work. */
+    if (atomic_load(&walk->n_idle)) {
+        pthread_mutex_lock(&walk->idle_lock);
+        pthread_cond_signal(&walk->work_available);
+        pthread_mutex_unlock(&walk->idle_lock);
+    }
+
+    return 0;
+}
+
+/* pop a directory from the back (own) or front (stolen) of the deque of `victim` */
+static char *pop_dir(walker_t *victim, int steal) {
+    char *path = NULL;
+
+    pthread_mutex_lock(&victim->lock);
+    if (list_length(victim->dirs)) {
+        path = steal ? list_popfirst(victim->dirs) : list_poplast(victim->dirs);
+        atomic_fetch_sub(&victim->walk->n_queued, 1);
+    }
+    pthread_mutex_unlock(&victim->lock);
+
+    return path;
+}
+
+/* get the next directory to walk, from the own deque first, then from the others in turn */
+static char *next_dir(walker_t *walker) {
+    walk_t *walk = walker->walk;
+
+    char *path = pop_dir(walker, 0);
+
+    for (size_t i = 1; !path && i < walk->n_walkers; i++) {
+        path = pop_dir(&walk->walkers[(walker->id + i) % walk->n_walkers], 1);
+    }
+
+    return path;
+}
+
+/**
+ * Wait until a directory is queued for anyone to steal, or the walk is done
+ * @returns 1 if there may be a directory to steal, 0 if the walk is done
+ */
+static int wait_for_work(walk_t *walk) {
+    pthread_mutex_lock(&walk->idle_lock);
+    atomic_fetch_add(&walk->n_idle, 1);
+
+    while (!atomic_load(&walk->stop) && atomic_load(&walk->n_pending) && !atomic_load(&walk->n_queued)) {
+        pthread_cond_wait(&walk->work_available, &walk->idle_lock);
+    }
+
+    atomic_fetch_sub(&walk->n_idle, 1);
+    int go_on = !atomic_load(&walk->stop) && atomic_load(&walk->n_pending);
+    pthread_mutex_unlock(&walk->idle_lock);
+
+    return go_on;
+}
+
+/* mark a directory as walked. The last one wakes any idle walkers, such that they see the walk is done. */
+static void done_dir(walk_t *walk) {
+    if (atomic_fetch_sub(&walk->n_pending, 1) == 1) {
+        pthread_mutex_lock(&walk->idle_lock);
+        pthread_cond_broadcast(&walk->work_available);
+        pthread_mutex_unlock(&walk->idle_lock);
+    }
+}
+
+int has_valid_ext(set_t *valid_exts, const char *path) {
+    if (!valid_exts) {
+        return 1;
+    }
+
+    /* pointer to last occurance of '.' in path, or NULL if not present */
+    const char *ext = strrchr(path, '.');
+
+    return ext && ext[1] != '\0' && set_get(valid_exts, (void *) (ext + 1));
+}
+
+/**
+ * Find the files of one directory, and queue its subdirectories.
+ * @param subdirs: empty list to hold the paths of the subdirectories until they are queued
+ * @returns 0 on success, otherwise a negative error code
+ */
+static int walk_dir(walker_t *walker, const char *dir_path, list_t *subdirs) {
+    walk_t *walk = walker->walk;
+
+    int fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = (fd < 0) ? NULL : fdopendir(fd);
     if (!dir) {
         pr_error("Failed to open directory \"%s\": %s\n", dir_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
         return -1;
     }
 
-    struct stat path_stat;
+    /* the path of each entry is the path of the directory, a '/' separator and the name of the entry */
     char full_path[PATH_MAX];
-    full_path[0] = '\0';
+    size_t dir_len = strlen(dir_path);
     int status = 0;
 
-    while (status == 0) {
-        /* check if we reached file limit */
-        if (n_files_max && (list_length(dst) >= n_files_max)) {
-            break;
-        }
+    if (dir_len + 2 < PATH_MAX) {
+        memcpy(full_path, dir_path, dir_len);
+        full_path[dir_len] = '/';
+    }
 
+    while (status == 0 && !atomic_load_explicit(&walk->stop, memory_order_relaxed)) {
         /* get the next entry from this directory */
         struct dirent *entry = readdir(dir);
         if (!entry) {
             break; // failed, or no more entries. Either way, break out.
         }
 
-        /* don't follow symlinks */
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
             continue;
         }
 
-        /* Copy directory path */
-        size_t dir_len = strlen(dir_path);
-        if (dir_len + 2 + strlen(entry->d_name) >= PATH_MAX) {
-            pr_warn("Path length exceeded maximum limit. Ignoring entry: %s/%s\n", dir_path, entry->d_name);
+        size_t name_len = strlen(name);
+        if (dir_len + 2 + name_len >= PATH_MAX) {
+            pr_warn("Path length exceeded maximum limit. Ignoring entry: %s/%s\n", dir_path, name);
             continue;
         }
-        /* we already checked length, so no need to do strncpy here */
-        strcpy(full_path, dir_path);
-        full_path[dir_len] = '/';                       // Add '/' separator
-        strcpy(full_path + dir_len + 1, entry->d_name); // Copy file name
-
-        /* might occur if we don't have read access, etc */
-        if (stat(full_path, &path_stat) == -1) {
-            pr_warn("Failed to access path %s (err: %s). Ignoring.\n", full_path, strerror(errno));
-            continue;
+        memcpy(full_path + dir_len + 1, name, name_len + 1);
+
+        /* the type is known from the entry itself on most filesystems. Symlinks are followed. */
+        unsigned char type = entry->d_type;
+
+        if (type == DT_LNK || type == DT_UNKNOWN) {
+            struct stat path_stat;
+
+            /* might occur if we don't have read access, etc */
+            if (fstatat(fd, name, &path_stat, 0) == -1) {
+                pr_warn("Failed to access path %s (err: %s). Ignoring.\n", full_path, strerror(errno));
+                continue;
+            }
+            type = S_ISDIR(path_stat.st_mode) ? DT_DIR : S_ISREG(path_stat.st_mode) ? DT_REG : DT_UNKNOWN;
         }
 
-        if (S_ISDIR(path_stat.st_mode)) {
-            /* for dirs: recursive call */
-            status = find_files(full_path, dst, valid_exts, n_files_max);
-        } else if (S_ISREG(path_stat.st_mode)) {
-            /* for files: check if we should include this file extension */
-            if (valid_exts) {
-                /* pointer to last occurance of '.' in path, or NULL if not present */
-                char *ext = strrchr(full_path, '.');
-
-                /* continue on ext == NULL. Otherw */
-                if (!ext || (*(++ext) == '\0') || !set_get(valid_exts, ext)) {
-                    continue;
-                }
+        if (type == DT_DIR) {
+            char *path_cpy = strdup(full_path);
+            if (!path_cpy) {
+                pr_error("Malloc failed (in strdup)\n");
+                status = -1;
+                break;
+            }
+
+            status = list_addlast(subdirs, path_cpy);
+            if (status < 0) {
+                free(path_cpy);
+            }
+        } else if (type == DT_REG && has_valid_ext(walk->valid_exts, full_path)) {
+            /* claim a place among the files before adding it, such that the limit is never exceeded */
+            if (walk->n_files_max && atomic_fetch_add(&walk->n_claimed, 1) >= walk->n_files_max) {
+                walk_stop(walk, 0);
+                break;
             }
 
             char *path_cpy = strdup(full_path);
             if (!path_cpy) {
                 pr_error("Malloc failed (in strdup)\n");
-                return -1;
+                status = -1;
+                break;
             }
 
-            /* since we're doing tail recursion, insert first to organize as files appear in the folder */
-            status = list_addfirst(dst, path_cpy);
+            if (walk->filefn) {
+                status = walk->filefn(path_cpy, walk->file_arg);
+            } else if ((status = list_addlast(walker->files, path_cpy)) < 0) {
+                free(path_cpy);
+            }
         }
     }
 
     closedir(dir);
 
+    /**
+     * queue the subdirectories in reverse, such that the owner pops them in the order they appear in the
+     * directory, just as a recursive walk would visit them
+     */
+    while (list_length(subdirs)) {
+        char *path = list_poplast(subdirs);
+
+        if (status == 0) {
+            status = push_dir(walker, path);
+        } else {
+            free(path);
+        }
+    }
+
     return status;
 }
+
+/* thread routine: walk directories until there are none left to walk or steal */
+static void *walker_run(void *arg) {
+    walker_t *walker = arg;
+    walk_t *walk = walker->walk;
+
+    list_t *subdirs = list_create((cmp_fn) strcmp);
+    if (!subdirs) {
+        walk_stop(walk, -1);
+        return NULL;
+    }
+
+    while (!atomic_load(&walk->stop)) {
+        char *dir_path = next_dir(walker);
+
+        if (!dir_path) {
+            if (!wait_for_work(walk)) {
+                break;
+            }
+            continue;
+        }
+
+        int status = walk_dir(walker, dir_path, subdirs);
+        free(dir_path);
+
+        if (status < 0) {
+            walk_stop(walk, status);
+        }
+        done_dir(walk);
+    }
+
+    list_destroy(subdirs, NULL);
+
+    return NULL;
+}
+
+/**
+ * Shared by the find_files* functions. Files are either handed to filefn or added to dst.
+ * @param n_found: number of files already found, counted against the limit
+ */
+static int walk_tree(
+    const char *dir_path,
+    list_t *dst,
+    set_t *valid_exts,
+    size_t n_files_max,
+    size_t n_found,
+    size_t n_threads,
+    file_fn filefn,
+    void *file_arg
+) {
+    if (n_files_max && n_found >= n_files_max) {
+        return 0;
+    }
+    if (n_threads < 1) {
+        n_threads = 1;
+    }
+
+    walk_t walk = {
+        .valid_exts = valid_exts,
+        .n_files_max = n_files_max,
+        .filefn = filefn,
+        .file_arg = file_arg,
+        .n_claimed = n_found,
+        .n_pending = 0,
+        .n_queued = 0,
+        .n_idle = 0,
+        .stop = 0,
+        .status = 0,
+        .walkers = calloc(n_threads, sizeof(walker_t)),
+        .n_walkers = 0,
+    };
+    if (!walk.walkers) {
+        pr_error("Malloc failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_init(&walk.idle_lock, NULL);
+    pthread_cond_init(&walk.work_available, NULL);
+
+    int status = 0;
+
+    for (; walk.n_walkers < n_threads; walk.n_walkers++) {
+        walker_t *walker = &walk.walkers[walk.n_walkers];
+        walker->walk = &walk;
+        walker->id = walk.n_walkers;
+        walker->dirs = list_create((cmp_fn) strcmp);
+        walker->files = list_create((cmp_fn) strcmp);
+
+        if (!walker->dirs || !walker->files) {
+            list_destroy(walker->dirs, NULL);
+            list_destroy(walker->files, NULL);
+            status = -1;
+            break;
+        }
+        pthread_mutex_init(&walker->lock, NULL);
+    }
+
+    char *root = (status == 0) ? strdup(dir_path) : NULL;
+    if (status == 0 && (!root || push_dir(&walk.walkers[0], root) < 0)) {
+        pr_error("Malloc failed (in strdup)\n");
+        status = -1;
+    }
+
+    /* the calling thread is the first walker, and helps the others for as long as they are walking */
+    size_t n_started = 1;
+
+    for (; status == 0 && n_started < walk.n_walkers; n_started++) {
+        int err = pthread_create(&walk.walkers[n_started].thread, NULL, walker_run, &walk.walkers[n_started]);
+        if (err != 0) {
+            pr_warn("Failed to create thread: %s. Walking with %zu threads\n", strerror(err), n_started);
+            break;
+        }
+    }
+
+    if (status == 0) {
+        walker_run(&walk.walkers[0]);
+    }
+
+    for (size_t i = 1; i < n_started; i++) {
+        pthread_join(walk.walkers[i].thread, NULL);
+    }
+
+    if (status == 0) {
+        status = walk.status;
+    }
+
+    /**
+     * hand the files over to dst, even on error. As with a recursive walk inserting first, the files end up
+     * in the reverse order they were found in.
+     */
+    int hand_over_status = 0;
+
+    for (size_t i = 0; i < walk.n_walkers; i++) {
+        walker_t *walker = &walk.walkers[i];
+
+        while (list_length(walker->files)) {
+            char *path = list_popfirst(walker->files);
+
+            if (hand_over_status == 0 && dst) {
+                hand_over_status = list_addfirst(dst, path);
+            }
+            if (hand_over_status != 0) {
+                free(path);
+            }
+        }
+
+        /* any directories left are those not walked because of an error or the limit */
+        list_destroy(walker->dirs, free);
+        list_destroy(walker->files, free);
+        pthread_mutex_destroy(&walker->lock);
+    }
+
+    pthread_cond_destroy(&walk.work_available);
+    pthread_mutex_destroy(&walk.idle_lock);
+    free(walk.walkers);
+
+    return (status != 0) ? status : hand_over_status;
+}
+
+int find_files_parallel(
+    const char *dir_path,
+    list_t *dst,
+    set_t *valid_exts,
+    size_t n_files_max,
+    size_t n_threads
+) {
+    return walk_tree(dir_path, dst, valid_exts, n_files_max, list_length(dst), n_threads, NULL, NULL);
+}
+
+int find_files(const char *dir_path, list_t *dst, set_t *valid_exts, size_t n_files_max) {
+    return find_files_parallel(dir_path, dst, valid_exts, n_files_max, 1);
+}
+
+int find_files_each(
+    const char *dir_path,
+    set_t *valid_exts,
+    size_t n_files_max,
+    size_t n_threads,
+    file_fn filefn,
+    void *arg
+) {
+    return walk_tree(dir_path, NULL, valid_exts, n_files_max, 0, n_threads, filefn, arg);
+}
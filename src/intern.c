@@ -0,0 +1,190 @@
+/**
+ * @implements intern.h
+ *
+ * @brief Open addressing (linear probing) table of canonical strings, which are allocated from an arena.
+ *
+ * Each canonical string is preceded in the arena by its length and hash (unaligned, see header_t), such that
+ * the sized key of a canonical string is had without looking at its bytes. The slots of the table only hold
+ * the hash and a pointer to the string, and the length is read from the header once the hashes match.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "common.h"
+#include "arena.h"
+#include "intern.h"
+#include "memstat.h"
+
+
+/* how many slots the table starts with. Must be a power of 2. */
+#define N_SLOTS_INITIAL 1024
+
+/* double the number of slots when the load factor reaches this threshold */
+#define LF_GROW 0.5
+
+typedef struct slot {
+    uint64_t hash;
+    char *str; // NULL if the slot is empty
+} slot_t;
+
+/* written right in front of each canonical string */
+typedef struct header {
+    size_t len;
+    uint64_t hash;
+} header_t;
+
+struct interner {
+    arena_t *strings;
+    slot_t *slots;
+    size_t capacity; // number of slots, always a power of 2
+    size_t length;
+    size_t grow_threshold;
+};
+
+
+interner_t *interner_create() {
+    interner_t *interner = malloc(sizeof(interner_t));
+    if (!interner) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    interner->strings = arena_create(0);
+    interner->slots = calloc(N_SLOTS_INITIAL, sizeof(slot_t));
+
+    if (!interner->strings || !interner->slots) {
+        pr_error("Failed to allocate memory\n");
+        arena_destroy(interner->strings);
+        free(interner->slots);
+        free(interner);
+        return NULL;
+    }
+
+    MEM_RECORD(MEM_INTERNER, sizeof(interner_t) + N_SLOTS_INITIAL * sizeof(slot_t), 2);
+
+    interner->capacity = N_SLOTS_INITIAL;
+    interner->length = 0;
+    interner->grow_threshold = (size_t) (N_SLOTS_INITIAL * LF_GROW);
+
+    return interner;
+}
+
+void interner_destroy(interner_t *interner) {
+    if (!interner) {
+        return;
+    }
+    MEM_RECORD(MEM_INTERNER, -(int64_t) (sizeof(interner_t) + interner->capacity * sizeof(slot_t)), -2);
+    arena_destroy(interner->strings);
+    free(interner->slots);
+    free(interner);
+}
+
+size_t interner_length(interner_t *interner) {
+    return interner->length;
+}
+
+/* grow the table, re-inserting by the stored hashes. The strings themselves stay where they are. */
+static void interner_grow(interner_t *interner) {
+    size_t new_capacity = interner->capacity * 2;
+    slot_t *new_slots = calloc(new_capacity, sizeof(slot_t));
+    if (!new_slots) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    size_t mask = new_capacity - 1;
+
+    for (size_t i = 0; i < interner->capacity; i++) {
+        slot_t *slot = &interner->slots[i];
+        if (!slot->str) {
+            continue;
+        }
+
+        size_t j = slot->hash & mask;
+        while (new_slots[j].str) {
+            j = (j + 1) & mask;
+        }
+        new_slots[j] = *slot;
+    }
+
+    free(interner->slots);
+    MEM_RESIZE(MEM_INTERNER, interner->capacity * sizeof(slot_t), new_capacity * sizeof(slot_t));
+    interner->slots = new_slots;
+    interner->capacity = new_capacity;
+    interner->grow_threshold = (size_t) ((double) new_capacity * LF_GROW);
+}
+
+/* read the header in front of a canonical string */
+static inline header_t read_header(const char *canonical) {
+    header_t header;
+    memcpy(&header, canonical - sizeof(header_t), sizeof(header_t));
+    return header;
+}
+
+/* find the slot holding the string of `key`, or the empty slot where it belongs */
+static inline slot_t *find_slot(interner_t *interner, const str_t *key) {
+    size_t mask = interner->capacity - 1;
+    size_t i = key->hash & mask;
+
+    while (1) {
+        slot_t *slot = &interner->slots[i];
+
+        if (!slot->str) {
+            return slot;
+        }
+        if (slot->hash == key->hash && read_header(slot->str).len == key->len
+            && memcmp(slot->str, key->ptr, key->len) == 0) {
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+char *intern_key(interner_t *interner, const str_t *key) {
+    slot_t *slot = find_slot(interner, key);
+
+    if (slot->str) {
+        return slot->str;
+    }
+
+    /* the header, then the string, unaligned */
+    header_t header = { .len = key->len, .hash = key->hash };
+    char *copy = arena_reserve(interner->strings, sizeof(header_t) + key->len + 1);
+    memcpy(copy, &header, sizeof(header_t));
+    memcpy(copy + sizeof(header_t), key->ptr, key->len);
+    copy[sizeof(header_t) + key->len] = '\0';
+    arena_commit(interner->strings, sizeof(header_t) + key->len + 1);
+
+    slot->hash = key->hash;
+    slot->str = copy + sizeof(header_t);
+    interner->length++;
+
+    char *canonical = slot->str;
+
+    if (interner->length >= interner->grow_threshold) {
+        interner_grow(interner);
+    }
+
+    return canonical;
+}
+
+char *intern(interner_t *interner, const char *str, size_t len) {
+    str_t key = str_key(str, len);
+
+    return intern_key(interner, &key);
+}
+
+char *intern_lookup(interner_t *interner, const char *str, size_t len) {
+    str_t key = str_key(str, len);
+
+    return find_slot(interner, &key)->str;
+}
+
+str_t interned_key(const char *canonical) {
+    header_t header = read_header(canonical);
+
+    return (str_t) { .ptr = canonical, .len = header.len, .hash = header.hash };
+}
@@ -1,17 +1,47 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <errno.h>
 #include <string.h>
 #include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+
+#include <sys/uio.h>
+#include <sys/eventfd.h>
 
 #include "common.h"
 #include "printing.h"
 #include "defs.h"
 #include "logger.h"
 
+/* SETTING: bytes of the ring buffer of an asynchronous logger. Must be a power of two. */
+#define LOGGER_RING_SIZE (1u << 20)
+
+/**
+ * An asynchronous logger copies what is written into a ring buffer, which a writer thread drains into the file.
+ * There is a single producer (the thread writing to the logger) and a single consumer (the writer thread), so
+ * the ring is lock-free: each only advances its own position, and reads the other's.
+ */
 struct logger {
     FILE *f;
     char *path;
-    int status;
+    int status; // -1 once the writer thread fails to write to the file, after which the logger is abandoned
+
+    /* the rest is only used if asynchronous */
+    int async;
+    unsigned flush_ms;
+    char *ring;
+    atomic_size_t head; // bytes written to the ring so far, by the producer
+    atomic_size_t tail; // bytes drained from the ring so far, by the writer thread
+    atomic_int failed;  // set by the writer thread, see `status`
+    atomic_int waiting; // set by the producer while it waits for room in the ring
+    atomic_int stop;    // set once the writer thread should drain the ring a last time, and exit
+    int wake_fd;        // eventfd, written to wake the writer thread before its interval is up
+    int room_fd;        // eventfd, written by the writer thread once it made room for a waiting producer
+    pthread_t writer;
 };
 
 /* Opens the logfile at logfile_pathbuf. Returns 0 on success, -1 on failure. */
@@ -55,10 +85,208 @@ static int write_with_retry(logger_t *logger, const char *buf) {
     return -1;
 }
 
+/* add 1 to an eventfd, waking whoever polls or reads it */
+static void eventfd_signal(int fd) {
+    uint64_t one = 1;
+    ssize_t n = write(fd, &one, sizeof(one));
+    (void) n; // can only fail if the counter overflows, in which case it is signalled anyway
+}
+
+/**
+ * Write all of iov to the file, with as few writev calls as it takes. The stream of the file is never
+ * written to in asynchronous mode, so the file descriptor is written to directly.
+ * @returns 0 on success, or -1 on failure
+ */
+static int writev_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        /* skip what was written, which may end partway into a buffer */
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= (ssize_t) iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= (size_t) n;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Write everything in the ring to the file at once. It is at most two buffers, as the bytes in the ring may
+ * wrap around its end. Reopens the file once if writing fails, like write_with_retry.
+ */
+static void ring_drain(logger_t *logger) {
+    size_t tail = atomic_load_explicit(&logger->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&logger->head, memory_order_acquire);
+
+    if (head == tail) {
+        return;
+    }
+
+    size_t start = tail % LOGGER_RING_SIZE;
+    size_t len = head - tail;
+    size_t first = (start + len <= LOGGER_RING_SIZE) ? len : LOGGER_RING_SIZE - start;
+
+    struct iovec iov[2] = {
+        { .iov_base = logger->ring + start, .iov_len = first },
+        { .iov_base = logger->ring, .iov_len = len - first },
+    };
+    int iovcnt = (len > first) ? 2 : 1;
+
+    if (!atomic_load_explicit(&logger->failed, memory_order_relaxed)
+        && writev_all(fileno(logger->f), iov, iovcnt) != 0) {
+        pr_error("Failed to write to logfile: %s. Attempting to reopen.\n", strerror(errno));
+
+        /* what was partly written is written again in full, rather than lost */
+        iov[0] = (struct iovec) { .iov_base = logger->ring + start, .iov_len = first };
+        iov[1] = (struct iovec) { .iov_base = logger->ring, .iov_len = len - first };
+
+        if (logfile_open_from_pathbuf(logger) != 0 || writev_all(fileno(logger->f), iov, iovcnt) != 0) {
+            pr_error("Failed to write to logfile after reopening: %s\n", strerror(errno));
+            atomic_store_explicit(&logger->failed, 1, memory_order_relaxed);
+        }
+    }
+
+    /* once failed, the ring is still drained, such that the producer never waits for room in vain */
+    atomic_store_explicit(&logger->tail, head, memory_order_release);
+
+    if (atomic_exchange_explicit(&logger->waiting, 0, memory_order_acq_rel)) {
+        eventfd_signal(logger->room_fd);
+    }
+}
+
+/* drains the ring every flush interval, or sooner if woken, until stopped */
+static void *writer_run(void *arg) {
+    logger_t *logger = arg;
+    struct pollfd pfd = { .fd = logger->wake_fd, .events = POLLIN };
+
+    while (1) {
+        /* everything written before the stop is drained below, so it is checked first */
+        int stop = atomic_load_explicit(&logger->stop, memory_order_acquire);
+
+        ring_drain(logger);
+        if (stop) {
+            break;
+        }
+
+        if (poll(&pfd, 1, (int) logger->flush_ms) > 0) {
+            uint64_t n_wakes;
+            ssize_t n = read(logger->wake_fd, &n_wakes, sizeof(n_wakes));
+            (void) n;
+        }
+    }
+
+    return NULL;
+}
+
+/* copy buf into the ring, waiting for the writer thread to make room whenever it is full */
+static void ring_write(logger_t *logger, const char *buf, size_t len) {
+    size_t head = atomic_load_explicit(&logger->head, memory_order_relaxed);
+
+    while (len > 0) {
+        size_t tail = atomic_load_explicit(&logger->tail, memory_order_acquire);
+        size_t room = LOGGER_RING_SIZE - (head - tail);
+
+        if (room == 0) {
+            /* the writer may drain the ring between the check above and setting the flag, so check again */
+            atomic_store_explicit(&logger->waiting, 1, memory_order_seq_cst);
+            eventfd_signal(logger->wake_fd);
+
+            if (atomic_load_explicit(&logger->tail, memory_order_seq_cst) == tail) {
+                uint64_t n_rooms;
+                ssize_t n = read(logger->room_fd, &n_rooms, sizeof(n_rooms));
+                (void) n;
+            }
+            continue;
+        }
+
+        size_t n = (len < room) ? len : room;
+        size_t start = head % LOGGER_RING_SIZE;
+        size_t first = (start + n <= LOGGER_RING_SIZE) ? n : LOGGER_RING_SIZE - start;
+
+        memcpy(logger->ring + start, buf, first);
+        memcpy(logger->ring, buf + first, n - first);
+
+        head += n;
+        buf += n;
+        len -= n;
+        atomic_store_explicit(&logger->head, head, memory_order_release);
+    }
+
+    /* no need to wait out the interval with the ring half full, as it is better drained before it fills up */
+    size_t tail = atomic_load_explicit(&logger->tail, memory_order_relaxed);
+    if (head - tail > LOGGER_RING_SIZE / 2) {
+        eventfd_signal(logger->wake_fd);
+    }
+}
+
+/* start the writer thread of an asynchronous logger. Returns 0 on success, -1 on failure. */
+static int logger_start(logger_t *logger) {
+    logger->ring = malloc(LOGGER_RING_SIZE);
+    logger->wake_fd = eventfd(0, EFD_CLOEXEC);
+    logger->room_fd = eventfd(0, EFD_CLOEXEC);
+
+    if (!logger->ring || logger->wake_fd < 0 || logger->room_fd < 0) {
+        pr_error("Failed to set up asynchronous logging: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    atomic_init(&logger->head, 0);
+    atomic_init(&logger->tail, 0);
+    atomic_init(&logger->failed, 0);
+    atomic_init(&logger->waiting, 0);
+    atomic_init(&logger->stop, 0);
+
+    /* signals are left to the threads of the program that handle them */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&logger->writer, NULL, writer_run, logger);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err) {
+        pr_error("Failed to start the logfile writer: %s\n", strerror(err));
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    free(logger->ring);
+    if (logger->wake_fd >= 0) {
+        close(logger->wake_fd);
+    }
+    if (logger->room_fd >= 0) {
+        close(logger->room_fd);
+    }
+    return -1;
+}
+
 void logger_destroy(logger_t *logger) {
     if (!logger) {
         return;
     }
+    if (logger->async) {
+        /* nothing written is lost: the writer drains the ring once more before it exits */
+        atomic_store_explicit(&logger->stop, 1, memory_order_release);
+        eventfd_signal(logger->wake_fd);
+        pthread_join(logger->writer, NULL);
+
+        close(logger->wake_fd);
+        close(logger->room_fd);
+        free(logger->ring);
+    }
     if (logger->f) {
         fclose(logger->f);
     }
@@ -66,7 +294,7 @@ void logger_destroy(logger_t *logger) {
     free(logger);
 }
 
-logger_t *logger_create(const char *path) {
+logger_t *logger_create(const char *path, unsigned flush_ms) {
     logger_t *logger = malloc(sizeof(logger_t));
     if (!logger) {
         pr_error("Malloc failed: %s\n", strerror(errno));
@@ -86,8 +314,11 @@ logger_t *logger_create(const char *path) {
         return NULL;
     }
 
+    logger->f = NULL;
     logger->status = 0;
     logger->path = strdup(path);
+    logger->async = (flush_ms > 0);
+    logger->flush_ms = flush_ms;
 
     if (logfile_open_from_pathbuf(logger) < 0) {
         free(logger->path);
@@ -95,13 +326,32 @@ logger_t *logger_create(const char *path) {
         return NULL;
     }
 
+    if (logger->async && logger_start(logger) < 0) {
+        fclose(logger->f);
+        free(logger->path);
+        free(logger);
+        return NULL;
+    }
+
     return logger;
 }
 
 void logger_flush(logger_t *logger) {
-    fflush(logger->f);
+    if (!logger->async) {
+        fflush(logger->f);
+    }
 }
 
 int logger_write_buf(logger_t *logger, const char *buf) {
-    return write_with_retry(logger, buf);
+    if (!logger->async) {
+        return write_with_retry(logger, buf);
+    }
+
+    if (atomic_load_explicit(&logger->failed, memory_order_relaxed)) {
+        logger->status = -1;
+        return -1;
+    }
+
+    ring_write(logger, buf, strlen(buf));
+    return 0;
 }
@@ -16,8 +16,10 @@
 #include <limits.h>
 #include <unistd.h>
 #include <signal.h>
-#include <sys/time.h>
-#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
 
 #include "printing.h"
 #include "findfiles.h"
@@ -28,11 +30,55 @@
 #include "index.h"
 #include "set.h"
 #include "logger.h"
+#include "arena.h"
+#include "profile.h"
+#include "memstat.h"
+#include "queue.h"
+#include "watch.h"
+#include "shard.h"
+#include "server.h"
 
 
 /* SETTING: limit the maximum number of results printed for queries. 0=unlimited. */
 #define MAX_RESULT_TABLE_ROWS 20
 
+/* SETTING: default memory bound of the query result cache, in MiB. 0=disable. */
+#define QUERY_CACHE_SIZE_MIB 64
+
+/**
+ * SETTING: max number of queries that batch workers may run ahead of the query being printed.
+ * Bounds the memory held by rendered, but not yet printed, results.
+ */
+#define BATCH_WINDOW 4096
+
+/**
+ * SETTING: files of at least this many bytes are streamed into the index in chunks, term by term, rather than
+ * tokenized into a list first. Bounds the memory used per file, at the cost of some speed.
+ */
+#define STREAM_FILE_SIZE_MIN (16 * 1024 * 1024)
+
+/* SETTING: max number of paths found by the walk that may wait to be read, when ingesting in a pipeline */
+#define PIPELINE_PATHS_MAX 4096
+
+/**
+ * SETTING: max MiB of file contents that may wait to be tokenized, and of terms that may wait to be indexed,
+ * when ingesting in a pipeline. Bounds the memory used by documents between stages.
+ */
+#define PIPELINE_QUEUE_MIB 16
+
+/**
+ * SETTING: number of documents each indexer thread of the pipeline collects in its partial index, before
+ * merging them into the shared index during --background ingestion. Lower makes documents searchable sooner,
+ * at the cost of more (and slower) merges. Otherwise, each partial index is only merged once it is complete.
+ */
+#define PIPELINE_MERGE_INTERVAL 1024
+
+/**
+ * SETTING: default interval in ms at which the result log of --outfile is written to the file, in batches, by a
+ * background thread. 0=write synchronously, as each query is printed.
+ */
+#define OUTFILE_FLUSH_MS 100
+
 /* SETTING: Update 'Processing document # n / N' output every 'x' files. 0=disable */
 #define PRINT_PROGRESS_INTERVAL 100
 
@@ -41,17 +87,83 @@
 #define CLI_COMMAND_AUTOCLEAR ".autoclear"
 #define CLI_COMMAND_INFO      ".info"
 #define CLI_COMMAND_STAT      ".stat"
+#define CLI_COMMAND_PROFILE   ".profile"
+#define CLI_COMMAND_MEMORY    ".mem"
 
 /* these are pointers instead of definitions as we want to refer other pointers to them */
 static const char *type_arg = "--type";
 static const char *limit_arg = "--limit";
 static const char *stderr_arg = "--stderr";
 static const char *outfile_arg = "--outfile";
+static const char *outfile_flush_arg = "--outfile-flush";
+static const char *threads_arg = "--threads";
+static const char *query_threads_arg = "--query-threads";
+static const char *save_index_arg = "--save-index";
+static const char *load_index_arg = "--load-index";
+static const char *topk_arg = "--topk";
+static const char *cache_arg = "--cache";
+static const char *background_arg = "--background";
+static const char *watch_arg = "--watch";
+static const char *positions_arg = "--positions";
+static const char *shard_arg = "--shard";
+static const char *shard_serve_arg = "--shard-serve";
+static const char *shards_arg = "--shards";
+static const char *serve_arg = "--serve";
 static const char *help_arg = "--help";
 
 /* will be set to a logger if the optional --outfile argument is present */
 static logger_t *result_logger = NULL;
 
+/* path of the result log, and the interval at which it is written to. Set by --outfile / --outfile-flush */
+static const char *outfile_path = NULL;
+static unsigned outfile_flush_ms = OUTFILE_FLUSH_MS;
+
+/* number of worker threads used to build the index. 1 => single-threaded. Set by the --threads argument */
+static size_t n_ingest_threads = 1;
+
+/* number of worker threads used to run piped queries. 1 => one after another. Set by --query-threads */
+static size_t n_query_threads = 1;
+
+/* directory of data files, the extensions to include, and the max number of files. Set by process_args. */
+static char *data_dir_path = NULL;
+static set_t *valid_exts = NULL;
+static size_t max_n_files = 0;
+
+/* ingest documents while the interpreter runs, rather than before. Set by the --background argument */
+static int background_ingest = 0;
+
+/* keep the index up to date with changes to the files while the interpreter runs. Set by --watch */
+static int watch_files = 0;
+
+/* store the positions of terms in the index, which phrase queries need. Set by --positions */
+static int store_positions = 0;
+
+/* paths to write the built index to / load the index from. Set by --save-index / --load-index */
+static const char *save_index_path = NULL;
+static const char *load_index_path = NULL;
+
+/* index only the slice `shard_id` of `n_shards` of the documents. 0 shards => all. Set by --shard */
+static size_t shard_id = 0;
+static size_t n_shards = 0;
+
+/* address to serve the index on as a shard, instead of running the interpreter. Set by --shard-serve */
+static const char *shard_serve_addr = NULL;
+
+/* address to serve queries to clients on, instead of running the interpreter. Set by --serve */
+static const char *serve_addr = NULL;
+
+/* comma-separated addresses of the shards to query, instead of an index of our own. Set by --shards */
+static const char *shard_addrs = NULL;
+
+/* coordinator of the shards at shard_addrs, which queries are run with if present */
+static coordinator_t *coordinator = NULL;
+
+/* number of highest ranked results gathered for each query. 0 => all. Set by the --topk argument */
+static size_t n_topk = MAX_RESULT_TABLE_ROWS;
+
+/* memory bound of the query result cache, in MiB. 0 => no caching. Set by the --cache argument */
+static size_t query_cache_mib = QUERY_CACHE_SIZE_MIB;
+
 /* write to the result logger, if it exists */
 static void log_result(const char *buf) {
     if (result_logger) {
@@ -77,9 +189,12 @@ static void cli_pr_input(const char *input) {
     }
 }
 
+/* write a error message to the given stream */
+#define cli_fpr_error(stream, prefix, fmt, ...) \
+    fprintf(stream, ANSI_COLOR_RED_B prefix ANSI_COLOR_RESET ": " fmt, ##__VA_ARGS__)
+
 /* write a error message to stdout */
-#define cli_pr_error(prefix, fmt, ...) \
-    printf(ANSI_COLOR_RED_B prefix ANSI_COLOR_RESET ": " fmt, ##__VA_ARGS__)
+#define cli_pr_error(prefix, fmt, ...) cli_fpr_error(stdout, prefix, fmt, ##__VA_ARGS__)
 
 
 static void print_command_list() {
@@ -88,7 +203,9 @@ static void print_command_list() {
     printf("%-*s - %s\n", col_w, CLI_COMMAND_EXIT, "Exit the application");
     printf("%-*s - %s\n", col_w, CLI_COMMAND_CLEAR, "Clear the terminal once");
     printf("%-*s - %s\n", col_w, CLI_COMMAND_AUTOCLEAR, "Toggle clearing the terminal on each new query");
-    printf("%-*s - %s\n", col_w, CLI_COMMAND_STAT, "Print the number indexed documents and unique terms");
+    printf("%-*s - %s\n", col_w, CLI_COMMAND_STAT, "Print index size and query cache usage");
+    printf("%-*s - %s\n", col_w, CLI_COMMAND_PROFILE, "Print time spent per phase and ADT counters");
+    printf("%-*s - %s\n", col_w, CLI_COMMAND_MEMORY, "Print memory held by each kind of structure");
     printf("%-*s - %s\n", col_w, CLI_COMMAND_INFO, "Print this message");
     printf("Note: Clearing the terminal only works in ANSI/POSIX terminal emulators\n");
 }
@@ -99,14 +216,30 @@ static void print_arg_usage(int col_w, const char *arg, const char *val, const c
 }
 
 static void print_usage(char **argv) {
-    static const int col_w = 22;
+    static const int col_w = 24;
     fprintf(stderr, "\nUsage: \"%s <data-dir> [...optional args>]\"\n", basename(argv[0]));
+    fprintf(stderr, "   or: \"%s %s <fpath> [...optional args>]\"\n", basename(argv[0]), load_index_arg);
+    fprintf(stderr, "   or: \"%s %s <addr:port,...> [...optional args>]\"\n", basename(argv[0]), shards_arg);
     fprintf(stderr, "Required Arguments:\n");
     fprintf(stderr, "%-*s - %s\n", col_w + 2, "<data-dir>", "Path to directory of files to index");
     fprintf(stderr, "Optional Arguments:\n");
     print_arg_usage(col_w, type_arg, "<1...n>", "Filter included data files by extension");
     print_arg_usage(col_w, limit_arg, "<n>", "Limit number of included data files");
+    print_arg_usage(col_w, threads_arg, "<n>", "Index with n threads per stage (0 = one per core)");
+    print_arg_usage(col_w, background_arg, "", "Start the interpreter while documents are still indexed");
+    print_arg_usage(col_w, watch_arg, "", "Apply changes to the files to the index as they happen");
+    print_arg_usage(col_w, positions_arg, "", "Store positions of terms, to allow \"phrase\" queries");
+    print_arg_usage(col_w, query_threads_arg, "<n>", "Run piped queries using n threads (0 = one per core)");
+    print_arg_usage(col_w, save_index_arg, "<fpath>", "Write the built index to a file");
+    print_arg_usage(col_w, load_index_arg, "<fpath>", "Load a saved index instead of building one");
+    print_arg_usage(col_w, shard_arg, "<i>/<n>", "Only index slice i of n of the files (0 <= i < n)");
+    print_arg_usage(col_w, shard_serve_arg, "<addr:port>", "Serve the index to a coordinator of shards");
+    print_arg_usage(col_w, shards_arg, "<addr:port,...>", "Query the given shards instead of an index");
+    print_arg_usage(col_w, serve_arg, "<addr:port>", "Serve queries to clients, one per line");
+    print_arg_usage(col_w, topk_arg, "<k>", "Rank and show the k best results (0 = all)");
+    print_arg_usage(col_w, cache_arg, "<MiB>", "Bound memory used to cache query results (0 = disable)");
     print_arg_usage(col_w, outfile_arg, "<fpath>", "Log succesful queries / results to a file");
+    print_arg_usage(col_w, outfile_flush_arg, "<ms>", "Write the log in batches every ms (0 = synchronous)");
     print_arg_usage(col_w, stderr_arg, "<fpath | tty>", "Redirect stderr to file or terminal");
 }
 
@@ -139,41 +272,39 @@ int is_operator_part(int c) {
  * @returns 1 if character should be included in a query, otherise 0
  */
 int is_valid_query_char(int c) {
-    if (is_operator_part(c)) {
+    /* quotes delimit phrases, and are split from the words by the query parser. "*" is part of patterns. */
+    if (is_operator_part(c) || c == '"' || c == '*') {
         return 1;
     }
     /* not a special char, filter normally as ascii alphanumeric */
     return is_ascii_alnum(c);
 }
 
-static void process_query_results(list_t *results, const char *input, long double t_secs) {
-    char result_buf[LINE_MAX];
-    size_t n_results = list_length(results);
+/**
+ * @brief Render the results of a query
+ * @param out: stream to render to
+ * @param n_matches: number of matching documents, of which `results` holds the highest ranked
+ */
+static void process_query_results(FILE *out, list_t *results, match_count_t n_matches, long double t_secs) {
     int n_decimals = (t_secs > 1.0E-3) ? 4 : 6; // 6 decimals if less than 1ms, otherwise 4
+    size_t n_results = n_matches.n;
+    const char *at_least = n_matches.exact ? "" : "at least ";
 
-    if (result_logger) {
-        /* write the query itself to the logfile */
-        snprintf(result_buf, LINE_MAX, "\n>>> %s\n", input);
-        log_result(result_buf);
-    }
-
-    snprintf(
-        result_buf,
-        LINE_MAX,
-        "=== Found %zu result%s in %.*Lfs ===\n",
+    fprintf(
+        out,
+        "=== Found %s%zu result%s in %.*Lfs ===\n",
+        at_least,
         n_results,
         (n_results == 1) ? "" : "s",
         n_decimals,
         t_secs
     );
-    output_result(result_buf);
 
     if (!results) {
         return;
     }
 
-    snprintf(result_buf, LINE_MAX, "%-10s %s\n", "Score", "Document");
-    output_result(result_buf);
+    fprintf(out, "%-10s %s\n", "Score", "Document");
 
     size_t n_printed = 0;
 
@@ -185,30 +316,27 @@ static void process_query_results(list_t *results, const char *input, long doubl
         assert(res->doc_name != NULL);
         assertf(res->doc_name[0] != '\0', "result doc_name cannot be an empty string\n");
 
-        snprintf(result_buf, LINE_MAX, "%-10.3f %s\n", res->score, res->doc_name);
-        output_result(result_buf);
+        fprintf(out, "%-10.3f %s\n", res->score, res->doc_name);
 
         n_printed += 1;
         free(res); // free the result we just popped
 
-        if (MAX_RESULT_TABLE_ROWS) {
-            if (n_printed >= MAX_RESULT_TABLE_ROWS && list_length(results)) {
-                snprintf(result_buf, LINE_MAX, " ... and %zu more\n", list_length(results));
-                output_result(result_buf);
-                break;
-            }
+        if (MAX_RESULT_TABLE_ROWS && n_printed >= MAX_RESULT_TABLE_ROWS) {
+            break;
         }
     }
 
-    if (result_logger) {
-        logger_flush(result_logger);
+    /* the rest are either beyond the table limit, or were never ranked (see --topk) */
+    if (n_printed < n_results) {
+        fprintf(out, " ... and %s%zu more\n", at_least, n_results - n_printed);
     }
 }
 
-static list_t *tokenize_query(char *query) {
+/* @param out: stream to write any error to */
+static list_t *tokenize_query(char *query, FILE *out) {
     list_t *tokens = list_create((cmp_fn) strcmp);
     if (!tokens) {
-        cli_pr_error("Query error", "Likely out of memory\n");
+        cli_fpr_error(out, "Query error", "Likely out of memory\n");
         return NULL;
     }
 
@@ -219,7 +347,7 @@ static list_t *tokenize_query(char *query) {
      */
     int status = tokenize_string(query, tokens, 1, is_space_or_par, is_valid_query_char, tolower);
     if (status < 0) {
-        cli_pr_error("Query error", "Failed to tokenize query\n");
+        cli_fpr_error(out, "Query error", "Failed to tokenize query\n");
         list_destroy(tokens, free);
         return NULL;
     }
@@ -227,34 +355,197 @@ static list_t *tokenize_query(char *query) {
     return tokens;
 }
 
-/* execute a query with the index and print results (if any) or error message */
-static void execute_query(index_t *idx, list_t *tokens, const char *input) {
-    pr_debug("input = \"%s\"\n", input);
-
-    struct timeval t_start, t_end;
+/**
+ * @brief Execute a query with the index and render its results (if any) or error message
+ * @param out: stream to render to
+ * @returns 1 if results were rendered, otherwise 0
+ * @note safe to call from several threads at once, as long as the index is not modified
+ */
+static int execute_query(index_t *idx, list_t *tokens, FILE *out) {
     char errmsg_buf[LINE_MAX];
     memset(errmsg_buf, 0, LINE_MAX);
 
     /* run the query, timing the time it takes */
-    gettimeofday(&t_start, NULL);
-    list_t *results = index_query(idx, tokens, errmsg_buf);
-    gettimeofday(&t_end, NULL);
+    match_count_t n_matches = { .n = 0, .exact = 1 };
 
-    long double t_secs = (long double) (t_end.tv_sec - t_start.tv_sec);    // difference in seconds
-    t_secs += (long double) (t_end.tv_usec - t_start.tv_usec) / 1000000.0; // convert µs part to secs & add
+    uint64_t t_start = prof_now_ns();
+    list_t *results;
+    if (coordinator) {
+        results = coordinator_query_topk(coordinator, tokens, n_topk, &n_matches, errmsg_buf);
+    } else {
+        results = index_query_topk(idx, tokens, n_topk, &n_matches, errmsg_buf);
+    }
+    long double t_secs = (long double) (prof_now_ns() - t_start) / 1.0E9;
 
     if (results) {
-        process_query_results(results, input, t_secs);
+        PROF_START(t_print);
+        process_query_results(out, results, n_matches, t_secs);
+        PROF_STOP(PROF_PRINT_RESULTS, t_print);
 
         /* destroy the list of results and any result_t objects in it */
         list_destroy(results, free);
-    } else if (*errmsg_buf) {
-        cli_pr_error("Invalid query", "%s\n", errmsg_buf);
+        return 1;
+    }
+
+    if (*errmsg_buf) {
+        cli_fpr_error(out, "Invalid query", "%s\n", errmsg_buf);
+    } else {
+        cli_fpr_error(out, "Index error", "Index returned no results or error message\n");
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Run a (trimmed, non-command) line of input as a query, rendering the output to a buffer
+ * @param dst: set to the null-terminated output, to be freed by the caller
+ * @returns 1 if the output holds results, 0 if not, or -1 on a critical error
+ */
+static int run_query(index_t *idx, char *input, char **dst) {
+    size_t len;
+    FILE *out = open_memstream(dst, &len);
+    if (!out) {
+        PANIC("open_memstream failed: %s\n", strerror(errno));
+    }
+
+    int status = -1;
+
+    pr_debug("input = \"%s\"\n", input);
+
+    /* transform the input into a list of tokens */
+    list_t *tokens = tokenize_query(input, out);
+
+    if (tokens) {
+        if (list_length(tokens)) {
+            status = execute_query(idx, tokens, out);
+        } else {
+            fprintf(out, "Found no usable characters in the query\n");
+            status = 0;
+        }
+
+        list_destroy(tokens, free);
+    }
+
+    fclose(out);
+
+    return status;
+}
+
+/* write the output of a query to stdout, and to the result logger if it holds results */
+static void output_query(const char *input, const char *output, int has_results) {
+    fputs(output, stdout);
+
+    if (has_results && result_logger) {
+        /* write the query itself to the logfile, then the results */
+        log_result("\n>>> ");
+        log_result(input);
+        log_result("\n");
+        log_result(output);
+
+        if (result_logger) {
+            logger_flush(result_logger);
+        }
+    }
+}
+
+/* render the statistics of the index, or of the shards, as printed by the .stat command */
+static void render_stat(index_t *idx, FILE *out) {
+    if (coordinator) {
+        size_t n_docs, n_nodes;
+        if (coordinator_stat(coordinator, &n_docs, &n_nodes) == 0) {
+            fprintf(out, "Index consists of %zu documents across %zu shards\n", n_docs, n_nodes);
+        } else {
+            cli_fpr_error(out, "Shard error", "Failed to reach every shard\n");
+        }
+        return;
+    }
+
+    size_t n_docs, n_terms;
+    index_stat(idx, &n_docs, &n_terms);
+    fprintf(out, "Index consists of %zu documents and %zu unique terms\n", n_docs, n_terms);
+
+    compaction_stat_t compaction;
+    index_compaction_stat(idx, &compaction);
+    fprintf(out, "Removed documents: %zu not yet compacted, %zu compactions reclaiming %.2f MiB\n",
+            compaction.n_unpurged, compaction.n_compactions, (double) compaction.n_reclaimed / (1024 * 1024));
+
+    cache_stat_t cstat;
+    index_cache_stat(idx, &cstat);
+    fprintf(out, "Query cache: %zu hits, %zu misses, %zu entries using %.2f / %.2f MiB\n",
+            cstat.hits, cstat.misses, cstat.n_entries,
+            (double) cstat.n_bytes / (1024 * 1024), (double) cstat.max_bytes / (1024 * 1024));
+}
+
+/**
+ * @brief Handle an interpreter command, i.e. a line starting with '.'
+ * @param auto_clear: state of the autoclear command. 1 => on, -1 => off.
+ * @returns 0 if the command is to exit, otherwise 1
+ */
+static int handle_command(index_t *idx, const char *input, int *auto_clear) {
+    if (strcmp(input, CLI_COMMAND_EXIT) == 0) {
+        return 0;
+    } else if (strcmp(input, CLI_COMMAND_CLEAR) == 0) {
+        printf(ANSI_CLEAR_TERM);
+    } else if (strcmp(input, CLI_COMMAND_AUTOCLEAR) == 0) {
+        *auto_clear *= -1;
+        printf("autoclear toggled %s\n", (*auto_clear == 1) ? "on" : "off");
+    } else if (strcmp(input, CLI_COMMAND_STAT) == 0) {
+        render_stat(idx, stdout);
+    } else if (strcmp(input, CLI_COMMAND_PROFILE) == 0) {
+        log_result("\n>>> " CLI_COMMAND_PROFILE "\n");
+        prof_report(output_result);
+        if (result_logger) {
+            logger_flush(result_logger);
+        }
+    } else if (strcmp(input, CLI_COMMAND_MEMORY) == 0) {
+        /* a coordinator holds no documents of its own */
+        size_t n_docs = 0, n_terms = 0;
+        if (idx) {
+            index_stat(idx, &n_docs, &n_terms);
+        }
+
+        log_result("\n>>> " CLI_COMMAND_MEMORY "\n");
+        mem_report(output_result, n_docs, n_terms);
+        if (result_logger) {
+            logger_flush(result_logger);
+        }
+    } else if (strcmp(input, CLI_COMMAND_INFO) == 0) {
+        print_command_list();
     } else {
-        cli_pr_error("Index error", "Index returned no results or error message\n");
+        cli_pr_error("Unrecognized command", "\"%s\"\n", input);
+        printf("Enter \"%s\" for a list of all available commands.\n", CLI_COMMAND_INFO);
     }
+
+    return 1;
 }
 
+/**
+ * @brief Print the output of a line of input. Shared by the sequential and batch interpreter.
+ * @param input: trimmed line of input
+ * @param output: rendered output of the query, if the input is not a command
+ * @param status: return value of `run_query`, if the input is not a command
+ * @returns 0 if the interpreter is to exit, -1 on a critical error, otherwise 1
+ */
+static int print_line(index_t *idx, const char *input, const char *output, int status, int *auto_clear) {
+    if (*input == '\0') {
+        return 1; // ignore empty query
+    }
+
+    /* check if command, handle if so */
+    if (*input == '.') {
+        return handle_command(idx, input, auto_clear);
+    }
+
+    /* Clear window now if set to do so */
+    if (*auto_clear == 1) {
+        printf(ANSI_CLEAR_TERM);
+        cli_pr_input(input);
+    }
+
+    output_query(input, output, status == 1);
+
+    return (status < 0) ? -1 : 1;
+}
 
 /**
  * @brief Run the interpreter
@@ -297,69 +588,208 @@ static int run_interpreter(index_t *idx, list_t *piped_input) {
         }
 
         trim(input); // remove any leading and trailing whitespace, as well as newline
-        if (*input == '\0') {
-            continue; // ignore empty query
+
+        char *output = NULL;
+        int query_status = 0;
+
+        if (*input != '\0' && *input != '.') {
+            query_status = run_query(idx, input, &output);
         }
 
-        /* check if command, handle if so */
-        if (*input == '.') {
-            if (strcmp(input, CLI_COMMAND_EXIT) == 0) {
-                return 0;
-            } else if (strcmp(input, CLI_COMMAND_CLEAR) == 0) {
-                printf(ANSI_CLEAR_TERM);
-            } else if (strcmp(input, CLI_COMMAND_AUTOCLEAR) == 0) {
-                auto_clear *= -1;
-                printf("autoclear toggled %s\n", (auto_clear == 1) ? "on" : "off");
-            } else if (strcmp(input, CLI_COMMAND_STAT) == 0) {
-                size_t n_docs, n_terms;
-                index_stat(idx, &n_docs, &n_terms);
-                printf("Index consists of %zu documents and %zu unique terms\n", n_docs, n_terms);
-            } else if (strcmp(input, CLI_COMMAND_INFO) == 0) {
-                print_command_list();
-            } else {
-                cli_pr_error("Unrecognized command", "\"%s\"\n", input);
-                printf("Enter \"%s\" for a list of all available commands.\n", CLI_COMMAND_INFO);
-            }
+        int status = print_line(idx, input, output, query_status, &auto_clear);
+        free(output);
 
-            continue;
+        if (status <= 0) {
+            return status;
         }
+    }
+}
+
+/* one line of piped input, in the batch interpreter */
+typedef struct batch_line {
+    char *input;          // the line, as popped from the piped input
+    char *output;         // rendered output if it is a query, otherwise NULL
+    int status;           // return value of `run_query` if it is a query
+    int done;             // set once a worker is done with the line
+} batch_line_t;
+
+/* state shared by the batch workers and the printing thread. Access to all members is protected by `lock`. */
+typedef struct batch {
+    pthread_mutex_t lock;
+    pthread_cond_t line_done;    // signalled once the line at `i_print` is done
+    pthread_cond_t print_moved;  // signalled once `i_print` moves on, or `stop` is set
+    index_t *idx;
+    batch_line_t *lines;
+    size_t n_lines;
+    size_t i_claim; // next line to be claimed by a worker
+    size_t i_print; // next line to be printed
+    int stop;       // set if printing stops before all lines are printed
+} batch_t;
+
+/* thread routine: claim lines in order, and run the queries among them */
+static void *batch_worker_run(void *arg) {
+    batch_t *batch = arg;
+
+    pthread_mutex_lock(&batch->lock);
 
-        /* Clear window now if set to do so, before any potential query-related errors */
-        if (auto_clear == 1) {
-            printf(ANSI_CLEAR_TERM);
-            cli_pr_input(input);
+    while (1) {
+        /* don't run too far ahead of the printer */
+        while (!batch->stop && batch->i_claim < batch->n_lines
+               && batch->i_claim >= batch->i_print + BATCH_WINDOW) {
+            pthread_cond_wait(&batch->print_moved, &batch->lock);
         }
 
-        /* transform the input into a list of tokens */
-        list_t *tokens = tokenize_query(input);
-        if (!tokens) {
-            return -1;
+        if (batch->stop || batch->i_claim >= batch->n_lines) {
+            break;
         }
 
-        if (list_length(tokens)) {
-            execute_query(idx, tokens, input);
-        } else {
-            printf("Found no usable characters in the query\n");
+        size_t i = batch->i_claim++;
+        batch_line_t *line = &batch->lines[i];
+
+        pthread_mutex_unlock(&batch->lock);
+
+        /**
+         * Commands are handled by the printer, in order with the queries. The line is left untrimmed for the
+         * printer to echo, which the tokenizer of the query does not mind.
+         */
+        const char *start = line->input;
+        while (isspace(*start)) {
+            start++;
         }
 
-        list_destroy(tokens, free);
+        if (*start != '\0' && *start != '.') {
+            line->status = run_query(batch->idx, line->input, &line->output);
+        }
+
+        pthread_mutex_lock(&batch->lock);
+
+        line->done = 1;
+        if (i == batch->i_print) {
+            pthread_cond_signal(&batch->line_done);
+        }
     }
+
+    pthread_mutex_unlock(&batch->lock);
+
+    return NULL;
 }
 
 /**
- * Process an individual file, reading it anc converting to tokens (words)
+ * @brief Run the piped input with a pool of `n_threads` workers, printing the output in the order of input
+ * @returns 0 on success, otherwise a negative error code
  */
-static list_t *read_file_terms(char *fpath) {
-    FILE *infile = fopen(fpath, "r");
-    if (infile == NULL) {
-        pr_error("Failed to open %s: %s\n", fpath, strerror(errno));
-        return NULL;
+static int run_batch_interpreter(index_t *idx, list_t *piped_input, size_t n_threads) {
+    pr_debug("Starting batch interpreter with %zu threads\n", n_threads);
+    printf("\n");
+
+    batch_t batch = {
+        .idx = idx,
+        .n_lines = list_length(piped_input),
+        .i_claim = 0,
+        .i_print = 0,
+        .stop = 0,
+    };
+
+    batch.lines = calloc(batch.n_lines, sizeof(batch_line_t));
+    pthread_t *threads = calloc(n_threads, sizeof(pthread_t));
+    if (!batch.lines || !threads) {
+        pr_error("Malloc failed: %s\n", strerror(errno));
+        free(batch.lines);
+        free(threads);
+        return -1;
+    }
+
+    for (size_t i = 0; i < batch.n_lines; i++) {
+        batch.lines[i].input = list_popfirst(piped_input);
+    }
+
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.line_done, NULL);
+    pthread_cond_init(&batch.print_moved, NULL);
+
+    size_t n_started = 0;
+
+    for (; n_started < n_threads; n_started++) {
+        int err = pthread_create(&threads[n_started], NULL, batch_worker_run, &batch);
+        if (err != 0) {
+            pr_error("Failed to create thread: %s\n", strerror(err));
+            break;
+        }
+    }
+
+    if (n_started < n_threads) {
+        pr_warn("Started %zu / %zu query threads\n", n_started, n_threads);
+    }
+
+    int status = (n_started == 0) ? -1 : 0;
+    int auto_clear = -1;
+
+    for (size_t i = 0; i < batch.n_lines && status == 0; i++) {
+        batch_line_t *line = &batch.lines[i];
+
+        pthread_mutex_lock(&batch.lock);
+        while (!line->done) {
+            pthread_cond_wait(&batch.line_done, &batch.lock);
+        }
+        pthread_mutex_unlock(&batch.lock);
+
+        cli_pr_input(line->input); // simulate actual input
+
+        trim(line->input);
+        int line_status = print_line(idx, line->input, line->output, line->status, &auto_clear);
+
+        free(line->output);
+        line->output = NULL;
+
+        if (line_status <= 0) {
+            status = line_status;
+            break;
+        }
+
+        pthread_mutex_lock(&batch.lock);
+        batch.i_print++;
+        pthread_cond_broadcast(&batch.print_moved);
+        pthread_mutex_unlock(&batch.lock);
+    }
+
+    if (status == 0 && batch.n_lines && batch.i_print == batch.n_lines) {
+        pr_info("Executed all piped queries\n");
+    }
+
+    /* wake any waiting workers, such that they can exit */
+    pthread_mutex_lock(&batch.lock);
+    batch.stop = 1;
+    pthread_cond_broadcast(&batch.print_moved);
+    pthread_mutex_unlock(&batch.lock);
+
+    for (size_t i = 0; i < n_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* the output of lines that were run, but never printed */
+    for (size_t i = 0; i < batch.n_lines; i++) {
+        free(batch.lines[i].input);
+        free(batch.lines[i].output);
     }
 
+    pthread_cond_destroy(&batch.print_moved);
+    pthread_cond_destroy(&batch.line_done);
+    pthread_mutex_destroy(&batch.lock);
+    free(batch.lines);
+    free(threads);
+
+    return status;
+}
+
+/**
+ * Process an individual file, reading it anc converting to tokens (words)
+ * @param arena: scratch arena for building the tokens
+ * @param interner: interner the tokens are resolved with. The list holds the canonical copies.
+ */
+static list_t *read_file_terms(char *fpath, arena_t *arena, interner_t *interner) {
     list_t *terms = list_create((cmp_fn) strcmp);
     if (terms == NULL) {
         pr_error("Failed to create list (likely out of memory)\n");
-        fclose(infile);
         return NULL;
     }
 
@@ -370,12 +800,13 @@ static list_t *read_file_terms(char *fpath) {
      * - include only alphanumeric ascii chars,
      * - convert to lowercase
      */
-    int status = tokenize_file(infile, terms, 1, isspace, is_ascii_alnum, tolower);
-    fclose(infile);
+    PROF_START(t_start);
+    int status = tokenize_file_mmap(fpath, terms, arena, interner, 1, isspace, is_ascii_alnum, tolower);
+    PROF_STOP(PROF_TOKENIZE_FILE, t_start);
 
     if (status < 0) {
         pr_error("Failed to tokenize file '%s'\n", fpath);
-        list_destroy(terms, free);
+        list_destroy(terms, NULL);
         return NULL;
     }
 
@@ -383,135 +814,808 @@ static list_t *read_file_terms(char *fpath) {
 }
 
 /**
- * @param fpaths: list of 1..n paths
- * @returns the created index if succesful, otherwise NULL
+ * @brief Check whether the file at `path` belongs to the slice of the documents indexed by this shard, see
+ * --shard. Files are assigned by a hash of their path below data_dir_path, such that every node assigns them
+ * the same way, wherever it keeps the files.
+ * @returns 1 if so, or if the documents are not sharded, otherwise 0
  */
-static index_t *build_index(list_t *fpaths) {
-    pr_debug("Building index\n");
-
-    index_t *idx = index_create();
-    if (idx == NULL) {
-        pr_error("Failed to create index\n");
-        return NULL;
+static int in_shard(const char *path) {
+    if (n_shards == 0) {
+        return 1;
     }
+    return hash_string_fnv1a64(path + strlen(data_dir_path)) % n_shards == shard_id;
+}
 
-    const size_t files_total = list_length(fpaths);
-    size_t i = 0;
+/* print 'Processing document # i / n' if 'i' is at a progress interval */
+static void print_progress(size_t i, size_t files_total) {
+    if (PRINT_PROGRESS_INTERVAL && (i % PRINT_PROGRESS_INTERVAL == 0 || i == 1 || i == files_total)) {
+        printf("\rProcessing document # %zu / %zu", i, files_total);
+        fflush(stdout);
+    }
+}
 
-    while (list_length(fpaths)) {
-        i++;
-        if (PRINT_PROGRESS_INTERVAL && (i % PRINT_PROGRESS_INTERVAL == 0 || i == 1 || i == files_total)) {
-            printf("\rProcessing document # %zu / %zu", i, files_total);
-            fflush(stdout);
-        }
+/* token_fn of stream_document: add each token to the open document of the index */
+static int emit_term(char *token, size_t len, void *idx) {
+    return index_add_term(idx, token, len);
+}
 
-        char *path = list_popfirst(fpaths);
-        assert(path);
+/**
+ * @brief Tokenize a file straight into the index, without ever holding more than a chunk of it in memory.
+ * Time is profiled as indexing, as tokenizing and indexing are interleaved.
+ * @note on failure to read the file, the terms read up to that point are kept as the document
+ */
+static void stream_document(index_t *idx, char *path) {
+    PROF_START(t_start);
 
-        list_t *terms = read_file_terms(path);
+    if (index_begin_document(idx, path) != 0) {
+        PANIC("\nindex_begin_document failed!\n");
+    }
 
-        if (terms == NULL) {
-            pr_error("\nFailed to process document.. Ignoring this path and continuing.");
-            free(path);
-        } else {
-            /**
-             * Process document with the index.
-             * index owns 'path' and 'terms' from this point, regardless of status
-             */
-            int status = index_document(idx, path, terms);
+    /* same tokens as read_file_terms */
+    int status = tokenize_file_stream(path, emit_term, idx, 1, isspace, is_ascii_alnum, tolower);
 
-            if (status != 0) {
-                PANIC("\nindex_document failed!\n");
-            }
-        }
+    if (index_end_document(idx) != 0 || status == -1) {
+        PANIC("\nFailed to stream document into the index!\n");
     }
-
-    /* send a newline as the progress print uses carriage return printing */
-    if (PRINT_PROGRESS_INTERVAL) {
-        printf("\n");
+    if (status < 0) {
+        pr_error("\nFailed to read all of '%s'. Keeping the terms read so far and continuing.", path);
     }
 
-    return idx;
+    PROF_STOP(PROF_INDEX_DOCUMENT, t_start);
 }
 
-/* helper for process_args */
-static int insert_valid_ext(char *arg, set_t *valid_exts) {
-    if (!is_ascii_alpha_string(arg)) {
-        pr_error("Invalid file extension \"%s\"\n", arg);
-        return -1;
-    }
+/**
+ * @brief Read the terms of a file and index it. Files of at least STREAM_FILE_SIZE_MIN bytes are streamed.
+ * On failure to read the file, the path is ignored (and freed) with an error message.
+ * @param arena: scratch arena for tokenizing the file
+ */
+static void ingest_document(index_t *idx, char *path, arena_t *arena) {
+    struct stat st;
 
-    /* copy the argument */
-    char *arg_cpy = strdup(arg);
-    if (!arg_cpy) {
-        pr_error("Malloc failed (in strdup): %s\n", strerror(errno));
-        return -1;
+    if (stat(path, &st) == 0 && st.st_size >= STREAM_FILE_SIZE_MIN) {
+        stream_document(idx, path);
+        return;
     }
 
-    /* insert into set of extensions */
-    char *old = set_insert(valid_exts, arg_cpy);
+    list_t *terms = read_file_terms(path, arena, index_interner(idx));
 
-    if (old) {
-        pr_warn("Extension \"%s\" is specified multiple times. Ignoring the duplicate\n", old);
-        free(old);
-    } else {
-        pr_debug("Including \".%s\" files\n", arg_cpy);
+    if (terms == NULL) {
+        pr_error("\nFailed to process document.. Ignoring this path and continuing.");
+        free(path);
+        return;
     }
 
-    return 0;
+    /**
+     * Process document with the index.
+     * index owns 'path' and 'terms' from this point, regardless of status. The strings of 'terms' are
+     * interned with the interner of the index, so they are never copied or freed.
+     */
+    PROF_START(t_start);
+    int status = index_document_interned(idx, path, terms);
+    PROF_STOP(PROF_INDEX_DOCUMENT, t_start);
+
+    if (status != 0) {
+        PANIC("\nindex_document failed!\n");
+    }
 }
 
+/* a document on its way through the ingestion pipeline */
+typedef struct ingest_doc {
+    char *path;
+    char *buf;   // contents of the file once read, replaced by its terms once tokenized
+    size_t size; // bytes used of buf
+    str_t *keys; // sized key of each term in buf, once tokenized
+    size_t n_keys;
+    int stream;  // the file is too large to read into buf, and is streamed into the index instead
+} ingest_doc_t;
+
 /**
- * @brief Parse arguments and populate the `fpaths` list.
- * @param fpaths: list to populate with data file paths
+ * State shared by the threads of the ingestion pipeline:
+ * walk -> [paths] -> read -> [contents] -> tokenize -> [terms] -> index
  *
- * @note This function is long and ugly. However, it gets the job done and provides feedback on
- * malformed/misused arguments. Not sure how to split it up, as it would just result in passing a very large
- * number of parameters around, which i doubt will improve readability much.
+ * Each stage has its own threads, and the queues between them are bounded, so a stage that runs ahead of the
+ * next ends up waiting for it rather than filling up memory.
  */
-static int process_args(int argc, char **argv, list_t *fpaths) {
-    /* scan for help argument first */
-    for (int i = 0; i < argc; i++) {
-        if (strcmp(argv[i], help_arg) == 0) {
-            return -10;
-        }
-    }
+typedef struct pipeline {
+    index_t *idx;          // the index each indexer thread merges its partial index into
+    size_t n_threads;      // threads per stage
+    int background;        // ingestion runs alongside the interpreter. Progress is not printed.
+    queue_t *paths;        // documents with only a path
+    queue_t *contents;     // documents with the contents of the file, or marked to be streamed
+    queue_t *terms;        // documents with their terms, one after another, and the key of each
+    atomic_size_t n_found;    // files found by the walk
+    atomic_size_t n_indexed;  // documents indexed, or streamed into a partial index
+    atomic_size_t n_indexing; // indexer threads not yet done
+    atomic_int cancelled;
+    int walk_status;          // set by the walk thread before it is done with paths
+    pthread_t *threads;
+    size_t n_started;
+} pipeline_t;
+
+/* the running pipeline, if --background is given. Cancelled once the interpreter exits. */
+static pipeline_t *background_pipeline = NULL;
+
+/* the watcher of the files, if --watch is given. Stopped once the interpreter exits. */
+static watch_t *file_watcher = NULL;
+
+static void ingest_doc_destroy(ingest_doc_t *doc) {
+    free(doc->path);
+    free(doc->buf);
+    free(doc->keys);
+    free(doc);
+}
 
-    // first argument: directory of data files
-    if (argc < 2) {
-        pr_error("Missing required positional argument: <data-dir>\n");
-        return -1;
+/* file_fn of the walk: queue each path found to be read */
+static int pipeline_add_path(char *path, void *arg) {
+    pipeline_t *pl = arg;
+
+    if (!in_shard(path)) {
+        free(path);
+        return 0;
     }
-    char *dir_path = argv[1];
 
-    /* if there is a trailing right slash, remove it */
-    char *dir_path_end = &dir_path[strlen(dir_path) - 1];
-    if (*dir_path_end == '/') {
-        *dir_path_end = '\0'; // strings in argv are indeed modifiable
+    ingest_doc_t *doc = calloc(1, sizeof(ingest_doc_t));
+    if (!doc) {
+        pr_error("Malloc failed: %s\n", strerror(errno));
+        free(path);
+        return -1;
     }
+    doc->path = path;
 
-    /* verify that dir_path exists and is a directory */
-    if (!dir_exists(dir_path)) {
-        pr_error("<data-dir>: The directory \"%s\" does not exist\n", dir_path);
+    /* only fails once the pipeline is cancelled, which stops the walk */
+    if (queue_push(pl->paths, doc, 1) != 0) {
+        ingest_doc_destroy(doc);
         return -1;
     }
 
-    const char *parsing = NULL; // argument currently being parsed
-    int parsed_values = 0;      // values parsed for the argument we're parsing
+    atomic_fetch_add(&pl->n_found, 1);
 
-    size_t max_n_files = 0;                         // limit to n files, 0 => no limit
-    set_t *valid_exts = NULL;                       // temporary set of file extensions to include
-    set_t *completed = set_create((cmp_fn) strcmp); // arguments that are already parsed
+    return 0;
+}
 
-    if (!completed) {
-        return -1; // failed to create set
-    }
+/* thread routine of the walk stage. The walk itself is split over n_threads walkers. */
+static void *walk_stage_run(void *arg) {
+    pipeline_t *pl = arg;
 
-    /* for the optional arguments, default to error (see the end label) */
-    int status = -1;
+    PROF_START(t_find);
+    pl->walk_status =
+        find_files_each(data_dir_path, valid_exts, max_n_files, pl->n_threads, pipeline_add_path, pl);
+    PROF_STOP(PROF_FIND_FILES, t_find);
+
+    queue_producer_done(pl->paths);
+
+    return NULL;
+}
+
+/**
+ * @brief Read the whole file of a document into its buffer, or mark it to be streamed if it is at least
+ * STREAM_FILE_SIZE_MIN bytes
+ * @returns 0 on success, otherwise -1
+ */
+static int read_document(ingest_doc_t *doc) {
+    int fd = open(doc->path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size >= STREAM_FILE_SIZE_MIN) {
+        doc->stream = 1;
+        close(fd);
+        return 0;
+    }
+
+    /* one extra byte, as malloc(0) may return NULL */
+    size_t size = (size_t) st.st_size;
+    doc->buf = malloc(size + 1);
+    if (!doc->buf) {
+        close(fd);
+        return -1;
+    }
+
+    /* the file may shrink while reading it, in which case the rest is simply never read */
+    size_t n_read = 0;
+    while (n_read < size) {
+        ssize_t n = read(fd, doc->buf + n_read, size - n_read);
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            return -1;
+        }
+        n_read += (size_t) n;
+    }
+
+    doc->size = n_read;
+    close(fd);
+
+    return 0;
+}
+
+/* thread routine of the read stage */
+static void *read_stage_run(void *arg) {
+    pipeline_t *pl = arg;
+    ingest_doc_t *doc;
+
+    while ((doc = queue_pop(pl->paths))) {
+        PROF_START(t_start);
+        int status = read_document(doc);
+        PROF_STOP(PROF_READ_FILE, t_start);
+
+        if (status != 0) {
+            pr_error("\nFailed to read file '%s'.. Ignoring this path and continuing.", doc->path);
+            ingest_doc_destroy(doc);
+            continue;
+        }
+
+        if (queue_push(pl->contents, doc, doc->size) != 0) {
+            ingest_doc_destroy(doc);
+            break;
+        }
+    }
+
+    queue_producer_done(pl->contents);
+
+    return NULL;
+}
+
+/**
+ * terms of a document, written one after another, and the sized key of each. The keys are hashed here, so
+ * the indexer threads take each term as is.
+ */
+typedef struct term_buf {
+    char *terms;
+    size_t len;
+    size_t capacity;
+    str_t *keys;
+    size_t n_keys;
+    size_t keys_capacity;
+} term_buf_t;
+
+/* token_fn of the tokenize stage */
+static int emit_term_buf(char *token, size_t len, void *arg) {
+    term_buf_t *tb = arg;
+
+    /* cannot happen, as the terms are never longer than the content they came from */
+    if (len > tb->capacity - tb->len) {
+        return -1;
+    }
+
+    if (tb->n_keys == tb->keys_capacity) {
+        tb->keys_capacity *= 2;
+        tb->keys = realloc(tb->keys, tb->keys_capacity * sizeof(str_t));
+        if (!tb->keys) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+
+    /* terms is never moved, so the keys may point into it */
+    memcpy(&tb->terms[tb->len], token, len);
+    tb->keys[tb->n_keys++] = str_key(&tb->terms[tb->len], len);
+    tb->len += len;
+
+    return 0;
+}
+
+/**
+ * @brief Replace the contents of a document by its terms
+ * @returns 0 on success, otherwise a negative error code
+ */
+static int tokenize_document(ingest_doc_t *doc) {
+    /**
+     * the terms are made of the bytes of the contents, less the separators. The keys are sized for terms of
+     * 3 bytes and a separator on average, such that they rarely need to grow.
+     */
+    size_t keys_capacity = doc->size / 4 + 1;
+    term_buf_t tb = {
+        .terms = malloc(doc->size + 1), .capacity = doc->size + 1,
+        .keys = malloc(keys_capacity * sizeof(str_t)), .keys_capacity = keys_capacity,
+    };
+    if (!tb.terms || !tb.keys) {
+        free(tb.terms);
+        free(tb.keys);
+        return -1;
+    }
+
+    /* same tokens as read_file_terms */
+    int status = tokenize_buffer_stream(
+        doc->buf, doc->size, emit_term_buf, &tb, 1, isspace, is_ascii_alnum, tolower
+    );
+
+    if (status != 0) {
+        free(tb.terms);
+        free(tb.keys);
+        return status;
+    }
+
+    free(doc->buf);
+    doc->buf = tb.terms;
+    doc->size = tb.len;
+    doc->keys = tb.keys;
+    doc->n_keys = tb.n_keys;
+
+    return 0;
+}
+
+/* thread routine of the tokenize stage */
+static void *tokenize_stage_run(void *arg) {
+    pipeline_t *pl = arg;
+    ingest_doc_t *doc;
+
+    while ((doc = queue_pop(pl->contents))) {
+        if (!doc->stream) {
+            PROF_START(t_start);
+            int status = tokenize_document(doc);
+            PROF_STOP(PROF_TOKENIZE_FILE, t_start);
+
+            if (status != 0) {
+                pr_error("\nFailed to tokenize file '%s'.. Ignoring this path and continuing.", doc->path);
+                ingest_doc_destroy(doc);
+                continue;
+            }
+        }
+
+        if (queue_push(pl->terms, doc, doc->size + doc->n_keys * sizeof(str_t)) != 0) {
+            ingest_doc_destroy(doc);
+            break;
+        }
+    }
+
+    queue_producer_done(pl->terms);
+
+    return NULL;
+}
+
+/* add the terms of a tokenized document to the index. The index owns the path from this point. */
+static void index_document_terms(index_t *idx, ingest_doc_t *doc) {
+    PROF_START(t_start);
+
+    if (index_begin_document(idx, doc->path) != 0) {
+        PANIC("\nindex_begin_document failed!\n");
+    }
+
+    for (size_t i = 0; i < doc->n_keys; i++) {
+        if (index_add_key(idx, &doc->keys[i]) != 0) {
+            PANIC("\nindex_add_key failed!\n");
+        }
+    }
+
+    if (index_end_document(idx) != 0) {
+        PANIC("\nindex_end_document failed!\n");
+    }
+
+    PROF_STOP(PROF_INDEX_DOCUMENT, t_start);
+
+    doc->path = NULL;
+}
+
+/* a new partial index to merge into `idx`, which stores positions if `idx` does */
+static index_t *create_partial(index_t *idx) {
+    index_t *partial = index_create();
+
+    if (partial && index_has_positions(idx) && index_store_positions(partial) != 0) {
+        index_destroy(partial);
+        return NULL;
+    }
+
+    return partial;
+}
+
+/* merge a partial index into the shared one, making its documents searchable */
+static void merge_partial(pipeline_t *pl, index_t *partial) {
+    if (index_merge(pl->idx, partial) != 0) {
+        PANIC("index_merge failed!\n");
+    }
+}
+
+/**
+ * Thread routine of the index stage. Documents are indexed into a partial index of the thread, which is
+ * merged into the shared index once the thread is done, and in the background every PIPELINE_MERGE_INTERVAL
+ * documents.
+ */
+static void *index_stage_run(void *arg) {
+    pipeline_t *pl = arg;
+    ingest_doc_t *doc;
+
+    index_t *partial = create_partial(pl->idx);
+    if (!partial) {
+        PANIC("Failed to create index\n");
+    }
+
+    size_t n_partial = 0; // documents in the partial index
+
+    while ((doc = queue_pop(pl->terms))) {
+        if (doc->stream) {
+            stream_document(partial, doc->path);
+            doc->path = NULL;
+        } else {
+            index_document_terms(partial, doc);
+        }
+        ingest_doc_destroy(doc);
+
+        size_t i = atomic_fetch_add(&pl->n_indexed, 1) + 1;
+        if (!pl->background) {
+            print_progress(i, atomic_load(&pl->n_found));
+        }
+
+        if (pl->background && ++n_partial == PIPELINE_MERGE_INTERVAL) {
+            merge_partial(pl, partial);
+
+            partial = create_partial(pl->idx);
+            if (!partial) {
+                PANIC("Failed to create index\n");
+            }
+            n_partial = 0;
+        }
+    }
+
+    merge_partial(pl, partial);
+
+    /* the last indexer to finish reports on ingestion, which is otherwise silent in the background */
+    if (atomic_fetch_sub(&pl->n_indexing, 1) == 1 && pl->background && !atomic_load(&pl->cancelled)) {
+        pr_debug("Indexed %zu documents in the background\n", atomic_load(&pl->n_indexed));
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Start `n` threads of a stage. If some fail to start, the stage carries on without them.
+ * @param out: nullable. The queue the stage pushes to, which is told that the threads not started are done.
+ * @returns the number of threads started
+ */
+static size_t start_stage(pipeline_t *pl, size_t n, void *(*run)(void *), queue_t *out) {
+    size_t n_started = 0;
+
+    for (; n_started < n; n_started++) {
+        int err = pthread_create(&pl->threads[pl->n_started], NULL, run, pl);
+        if (err != 0) {
+            pr_error("Failed to create thread: %s\n", strerror(err));
+            break;
+        }
+        pl->n_started++;
+    }
+
+    for (size_t i = n_started; out && i < n; i++) {
+        queue_producer_done(out);
+    }
+
+    return n_started;
+}
+
+/* stop every stage as soon as possible. Documents not yet indexed are dropped. */
+static void pipeline_cancel(pipeline_t *pl) {
+    atomic_store(&pl->cancelled, 1);
+    queue_cancel(pl->paths);
+    queue_cancel(pl->contents);
+    queue_cancel(pl->terms);
+}
+
+/**
+ * @brief Wait for every thread of the pipeline, then destroy it
+ * @param n_found: nullable. Set to the number of files found by the walk.
+ * @returns the status of the walk
+ */
+static int pipeline_join(pipeline_t *pl, size_t *n_found) {
+    for (size_t i = 0; i < pl->n_started; i++) {
+        pthread_join(pl->threads[i], NULL);
+    }
+
+    int status = pl->walk_status;
+    if (n_found) {
+        *n_found = atomic_load(&pl->n_found);
+    }
+
+    queue_destroy(pl->paths, (void (*)(void *)) ingest_doc_destroy);
+    queue_destroy(pl->contents, (void (*)(void *)) ingest_doc_destroy);
+    queue_destroy(pl->terms, (void (*)(void *)) ingest_doc_destroy);
+    free(pl->threads);
+    free(pl);
+
+    return status;
+}
+
+/**
+ * @brief Start ingesting the files at data_dir_path into `idx`, through a pipeline of `n_threads` threads
+ * per stage. With `background` set, `idx` may be queried while ingestion runs.
+ * @returns the running pipeline, or NULL on failure
+ */
+static pipeline_t *pipeline_start(index_t *idx, size_t n_threads, int background) {
+    pipeline_t *pl = calloc(1, sizeof(pipeline_t));
+    if (!pl) {
+        pr_error("Malloc failed: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    pl->idx = idx;
+    pl->n_threads = n_threads;
+    pl->background = background;
+    pl->paths = queue_create(PIPELINE_PATHS_MAX, 1);
+    pl->contents = queue_create(PIPELINE_QUEUE_MIB * 1024 * 1024, n_threads);
+    pl->terms = queue_create(PIPELINE_QUEUE_MIB * 1024 * 1024, n_threads);
+    atomic_init(&pl->n_found, 0);
+    atomic_init(&pl->n_indexed, 0);
+    atomic_init(&pl->n_indexing, n_threads);
+    atomic_init(&pl->cancelled, 0);
+    pl->threads = malloc((3 * n_threads + 1) * sizeof(pthread_t));
+
+    if (!pl->paths || !pl->contents || !pl->terms || !pl->threads) {
+        pr_error("Failed to create ingestion pipeline\n");
+        queue_destroy(pl->paths, NULL);
+        queue_destroy(pl->contents, NULL);
+        queue_destroy(pl->terms, NULL);
+        free(pl->threads);
+        free(pl);
+        return NULL;
+    }
+
+    /* start from the end, so every stage has someone to hand documents to */
+    size_t n_indexers = start_stage(pl, n_threads, index_stage_run, NULL);
+    atomic_fetch_sub(&pl->n_indexing, n_threads - n_indexers);
+
+    size_t n_tokenizers = start_stage(pl, n_threads, tokenize_stage_run, pl->terms);
+    size_t n_readers = start_stage(pl, n_threads, read_stage_run, pl->contents);
+    size_t n_walkers = start_stage(pl, 1, walk_stage_run, pl->paths);
+
+    /* a stage without threads would stall the pipeline, so stop it and let the threads that did start exit */
+    if (!n_indexers || !n_tokenizers || !n_readers || !n_walkers) {
+        pipeline_cancel(pl);
+        pl->walk_status = -1;
+        pipeline_join(pl, NULL);
+        return NULL;
+    }
+
+    if (n_indexers < n_threads || n_tokenizers < n_threads || n_readers < n_threads) {
+        pr_warn("Started only some of the ingestion threads\n");
+    }
+
+    return pl;
+}
+
+/**
+ * @brief watch_fn of the watcher started by --watch: apply one change to the files at data_dir_path to the
+ * index given as `arg`
+ * @note a changed file is indexed by itself, then merged in, replacing the old version of it
+ */
+static void apply_change(watch_event_t event, char *path, void *arg) {
+    index_t *idx = arg;
+
+    if (event != WATCH_DIR_REMOVED && !in_shard(path)) {
+        free(path);
+        return; // indexed by another shard
+    }
+
+    if (event == WATCH_FILE_CHANGED) {
+        index_t *partial = create_partial(idx);
+        arena_t *arena = arena_create(0);
+
+        if (partial && arena) {
+            ingest_document(partial, path, arena); // owns path from here
+
+            /* once merged, the partial index is owned (and destroyed) by idx */
+            if (index_merge(idx, partial) == 0) {
+                partial = NULL;
+            } else {
+                pr_error("Failed to apply a change to the index\n");
+            }
+        } else {
+            pr_error("Failed to create index or arena. Ignoring the change to \"%s\"\n", path);
+            free(path);
+        }
+
+        index_destroy(partial);
+        arena_destroy(arena);
+    } else {
+        /* files that were never indexed, such as those left out by --limit, are not found. This is fine. */
+        if (event == WATCH_FILE_REMOVED) {
+            index_remove_document(idx, path);
+        } else {
+            index_remove_prefix(idx, path);
+        }
+        free(path);
+    }
+
+    /* the old version of a changed file is removed as well, so edits alone also call for compaction */
+    if (index_needs_compaction(idx)) {
+        size_t n_bytes = index_compact(idx);
+        pr_debug("Compacted the index, reclaiming %zu bytes\n", n_bytes);
+        UNUSED(n_bytes); // only printed by debug builds
+    }
+}
+
+/* find every file up front, then index them one by one on the calling thread */
+static int build_index_sequential(index_t *idx, size_t *n_found) {
+    list_t *fpaths = list_create((cmp_fn) strcmp);
+    arena_t *arena = arena_create(0);
+
+    if (!fpaths || !arena) {
+        pr_error("Failed to create list or arena\n");
+        list_destroy(fpaths, NULL);
+        arena_destroy(arena);
+        return -1;
+    }
+
+    PROF_START(t_find);
+    int status = find_files(data_dir_path, fpaths, valid_exts, max_n_files);
+    PROF_STOP(PROF_FIND_FILES, t_find);
+
+    /* leave out the files of other shards. --limit applies to the files found, before they are split. */
+    for (size_t n = list_length(fpaths); n > 0 && n_shards; n--) {
+        char *path = list_popfirst(fpaths);
+
+        if (!in_shard(path)) {
+            free(path);
+        } else if (list_addlast(fpaths, path) < 0) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+
+    const size_t files_total = list_length(fpaths);
+    *n_found = files_total;
+
+    size_t i = 0;
+
+    while (status == 0 && list_length(fpaths)) {
+        i++;
+        print_progress(i, files_total);
+
+        char *path = list_popfirst(fpaths);
+        assert(path);
+
+        ingest_document(idx, path, arena);
+    }
+
+    arena_destroy(arena);
+    list_destroy(fpaths, free);
+
+    return status;
+}
+
+/**
+ * @brief Index the files at data_dir_path. Single-threaded, the files are found up front and indexed one by
+ * one. Otherwise, they are ingested through a pipeline of `n_threads` threads per stage.
+ * @returns 0 on success, otherwise a negative error code
+ */
+static int build_index(index_t *idx, size_t n_threads) {
+    pr_debug("Building index\n");
+
+    size_t n_found = 0;
+    int status;
+
+    if (n_threads > 1) {
+        pr_debug("Indexing with %zu threads per stage\n", n_threads);
+
+        pipeline_t *pl = pipeline_start(idx, n_threads, 0);
+        if (!pl) {
+            return -1;
+        }
+        status = pipeline_join(pl, &n_found);
+    } else {
+        status = build_index_sequential(idx, &n_found);
+    }
+
+    /* send a newline as the progress print uses carriage return printing */
+    if (PRINT_PROGRESS_INTERVAL && n_found) {
+        printf("\n");
+    }
+
+    if (status < 0) {
+        pr_error("<data-dir>: Failed to find files at \"%s\"\n", data_dir_path);
+        return -1;
+    }
+
+    /* verify that we found at least one path to a file */
+    if (n_found == 0) {
+        pr_error("<data-dir>: Found no valid files to index at \"%s\"\n", data_dir_path);
+        return -1;
+    }
+
+    pr_debug("Indexed %zu files from directory \"%s\"\n", n_found, data_dir_path);
+
+    /* unless changes to the files are applied to it, the index is done changing, and is compacted for queries */
+    if (!file_watcher) {
+        if (index_freeze(idx) == 0) {
+            pr_debug("Froze index\n");
+            return 0;
+        }
+        pr_warn("Failed to freeze index, it is queried as built\n");
+    }
+
+    /* now rather than in the first query with a pattern */
+    index_build_term_dict(idx);
+
+    return 0;
+}
+
+/* helper for process_args */
+static int insert_valid_ext(char *arg, set_t *valid_exts) {
+    if (!is_ascii_alpha_string(arg)) {
+        pr_error("Invalid file extension \"%s\"\n", arg);
+        return -1;
+    }
+
+    /* copy the argument */
+    char *arg_cpy = strdup(arg);
+    if (!arg_cpy) {
+        pr_error("Malloc failed (in strdup): %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* insert into set of extensions */
+    char *old = set_insert(valid_exts, arg_cpy);
+
+    if (old) {
+        pr_warn("Extension \"%s\" is specified multiple times. Ignoring the duplicate\n", old);
+        free(old);
+    } else {
+        pr_debug("Including \".%s\" files\n", arg_cpy);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Parse arguments, setting the corresponding static variables.
+ *
+ * @note This function is long and ugly. However, it gets the job done and provides feedback on
+ * malformed/misused arguments. Not sure how to split it up, as it would just result in passing a very large
+ * number of parameters around, which i doubt will improve readability much.
+ */
+static int process_args(int argc, char **argv) {
+    /* scan for help argument first */
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], help_arg) == 0) {
+            return -10;
+        }
+    }
+
+    /**
+     * first argument: directory of data files.
+     * It may only be left out if the index is loaded from file, which is verified once all are parsed.
+     */
+    char *dir_path = NULL;
+    int i_optional = 1; // index of the first optional argument
+
+    if (argc >= 2 && strncmp(argv[1], "--", sizeof("--") - 1) != 0) {
+        dir_path = argv[1];
+        i_optional = 2;
+
+        /* if there is a trailing right slash, remove it */
+        char *dir_path_end = &dir_path[strlen(dir_path) - 1];
+        if (*dir_path_end == '/') {
+            *dir_path_end = '\0'; // strings in argv are indeed modifiable
+        }
+
+        /* verify that dir_path exists and is a directory */
+        if (!dir_exists(dir_path)) {
+            pr_error("<data-dir>: The directory \"%s\" does not exist\n", dir_path);
+            return -1;
+        }
+    }
+
+    const char *parsing = NULL; // argument currently being parsed
+    int parsed_values = 0;      // values parsed for the argument we're parsing
+
+    set_t *completed = set_create((cmp_fn) strcmp); // arguments that are already parsed
+
+    if (!completed) {
+        return -1; // failed to create set
+    }
+
+    /* for the optional arguments, default to error (see the end label) */
+    int status = -1;
 
     /* parse optional arguments/values one by one */
-    for (int i = 2; i < argc; i++) {
+    for (int i = i_optional; i < argc; i++) {
         char *arg = argv[i];
 
         /* this will capture anything starting with --, so we detect arguments missing values */
@@ -524,6 +1628,8 @@ static int process_args(int argc, char **argv, list_t *fpaths) {
             /* determine which arg was entered */
             if (!strcmp(arg, outfile_arg)) {
                 parsing = outfile_arg;
+            } else if (!strcmp(arg, outfile_flush_arg)) {
+                parsing = outfile_flush_arg;
             } else if (!strcmp(arg, stderr_arg)) {
                 parsing = stderr_arg;
             } else if (!strcmp(arg, type_arg)) {
@@ -535,6 +1641,32 @@ static int process_args(int argc, char **argv, list_t *fpaths) {
                 parsing = type_arg;
             } else if (!strcmp(arg, limit_arg)) {
                 parsing = limit_arg;
+            } else if (!strcmp(arg, threads_arg)) {
+                parsing = threads_arg;
+            } else if (!strcmp(arg, query_threads_arg)) {
+                parsing = query_threads_arg;
+            } else if (!strcmp(arg, save_index_arg)) {
+                parsing = save_index_arg;
+            } else if (!strcmp(arg, load_index_arg)) {
+                parsing = load_index_arg;
+            } else if (!strcmp(arg, topk_arg)) {
+                parsing = topk_arg;
+            } else if (!strcmp(arg, cache_arg)) {
+                parsing = cache_arg;
+            } else if (!strcmp(arg, background_arg)) {
+                parsing = background_arg;
+            } else if (!strcmp(arg, watch_arg)) {
+                parsing = watch_arg;
+            } else if (!strcmp(arg, positions_arg)) {
+                parsing = positions_arg;
+            } else if (!strcmp(arg, shard_arg)) {
+                parsing = shard_arg;
+            } else if (!strcmp(arg, shard_serve_arg)) {
+                parsing = shard_serve_arg;
+            } else if (!strcmp(arg, shards_arg)) {
+                parsing = shards_arg;
+            } else if (!strcmp(arg, serve_arg)) {
+                parsing = serve_arg;
             } else {
                 pr_error("Unrecognized argument: \"%s\"\n", arg);
                 goto end;
@@ -548,6 +1680,19 @@ static int process_args(int argc, char **argv, list_t *fpaths) {
 
             parsed_values = 0; // parsed_values 0 of the current argument
 
+            /* flags, which have no values */
+            if (parsing == background_arg || parsing == watch_arg || parsing == positions_arg) {
+                if (parsing == background_arg) {
+                    background_ingest = 1;
+                } else if (parsing == watch_arg) {
+                    watch_files = 1;
+                } else {
+                    store_positions = 1;
+                }
+                parsing = NULL;
+                parsed_values = 1;
+            }
+
             /* continue to the following value */
             continue;
         }
@@ -563,12 +1708,14 @@ static int process_args(int argc, char **argv, list_t *fpaths) {
 
         /* these arguments only have 1 value */
         if (parsing == outfile_arg) {
-            result_logger = logger_create(arg);
-
-            if (result_logger == NULL) {
-                pr_error("Failed to create result_logger\n");
+            /* created once all are parsed, as it depends on --outfile-flush */
+            outfile_path = arg;
+        } else if (parsing == outfile_flush_arg) {
+            if (!is_digit_string(arg)) {
+                pr_error("Expected integer value following %s, found \"%s\"\n", outfile_flush_arg, arg);
                 goto end;
             }
+            outfile_flush_ms = (unsigned) strtoul(arg, NULL, 10);
         } else if (parsing == stderr_arg) {
             if (redirect_stderr(arg) < 0) {
                 goto end;
@@ -580,6 +1727,70 @@ static int process_args(int argc, char **argv, list_t *fpaths) {
                 goto end;
             }
             max_n_files = strtoul(arg, NULL, 10);
+        } else if (parsing == threads_arg) {
+            if (!is_digit_string(arg)) {
+                pr_error("Expected integer value following %s, found \"%s\"\n", threads_arg, arg);
+                goto end;
+            }
+            n_ingest_threads = strtoul(arg, NULL, 10);
+
+            if (n_ingest_threads == 0) {
+                long n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+                n_ingest_threads = (n_cores > 0) ? (size_t) n_cores : 1;
+            }
+        } else if (parsing == query_threads_arg) {
+            if (!is_digit_string(arg)) {
+                pr_error("Expected integer value following %s, found \"%s\"\n", query_threads_arg, arg);
+                goto end;
+            }
+            n_query_threads = strtoul(arg, NULL, 10);
+
+            if (n_query_threads == 0) {
+                long n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+                n_query_threads = (n_cores > 0) ? (size_t) n_cores : 1;
+            }
+        } else if (parsing == save_index_arg) {
+            save_index_path = arg;
+        } else if (parsing == load_index_arg) {
+            load_index_path = arg;
+        } else if (parsing == topk_arg) {
+            if (!is_digit_string(arg)) {
+                pr_error("Expected integer value following %s, found \"%s\"\n", topk_arg, arg);
+                goto end;
+            }
+            n_topk = strtoul(arg, NULL, 10);
+        } else if (parsing == cache_arg) {
+            if (!is_digit_string(arg)) {
+                pr_error("Expected integer value following %s, found \"%s\"\n", cache_arg, arg);
+                goto end;
+            }
+            query_cache_mib = strtoul(arg, NULL, 10);
+        } else if (parsing == shard_arg) {
+            char *slash = strchr(arg, '/');
+            int valid = 0;
+
+            if (slash && slash != arg && slash[1] != '\0') {
+                *slash = '\0'; // split in two, for the check of each
+                valid = is_digit_string(arg) && is_digit_string(slash + 1);
+                *slash = '/';
+            }
+            if (!valid) {
+                pr_error("Expected <i>/<n> following %s, found \"%s\"\n", shard_arg, arg);
+                goto end;
+            }
+            shard_id = strtoul(arg, NULL, 10);
+            n_shards = strtoul(slash + 1, NULL, 10);
+
+            if (shard_id >= n_shards) {
+                pr_error("%s: expected 0 <= i < n, found %zu/%zu\n", shard_arg, shard_id, n_shards);
+                goto end;
+            }
+        } else if (parsing == shard_serve_arg) {
+            shard_serve_addr = arg;
+        } else if (parsing == shards_arg) {
+            shard_addrs = arg;
+        } else if (parsing == serve_arg) {
+            serve_addr = arg;
         } else {
             pr_error("Unrecognized or misplaced argument: \"%s\"\n", arg);
             goto end;
@@ -595,28 +1806,103 @@ static int process_args(int argc, char **argv, list_t *fpaths) {
         goto end;
     }
 
-    /* find the files at dir_path */
-    if (find_files(dir_path, fpaths, valid_exts, max_n_files) < 0) {
-        pr_error("<data-dir>: Failed to find files at \"%s\"\n", dir_path);
+    if (!outfile_path && set_get(completed, (void *) outfile_flush_arg)) {
+        pr_error("%s requires %s\n", outfile_flush_arg, outfile_arg);
         goto end;
     }
 
-    /* verify that we found at least one path to a file */
-    if (list_length(fpaths) == 0) {
-        pr_error("<data-dir>: Found no valid files to index at \"%s\"\n", dir_path);
+    if (serve_addr) {
+        /* the results go to the clients, so there is nothing to log, and no interpreter to serve */
+        if (shard_serve_addr) {
+            pr_error("%s cannot be combined with %s\n", shard_serve_arg, serve_arg);
+            goto end;
+        }
+        if (outfile_path) {
+            pr_error("%s cannot be combined with %s\n", outfile_arg, serve_arg);
+            goto end;
+        }
+
+        /* many clients may query at once, so use every core unless told otherwise */
+        if (!set_get(completed, (void *) query_threads_arg)) {
+            long n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+            n_query_threads = (n_cores > 0) ? (size_t) n_cores : 1;
+        }
+    }
+
+    if (shard_addrs) {
+        /* the shards hold the documents, so there is no index of our own */
+        const char *conflicting[] = {
+            load_index_arg,
+            save_index_arg,
+            background_arg,
+            watch_arg,
+            positions_arg,
+            shard_arg,
+            shard_serve_arg,
+        };
+        const char *conflict = dir_path ? "<data-dir>" : NULL;
+
+        for (size_t i = 0; i < sizeof(conflicting) / sizeof(*conflicting) && !conflict; i++) {
+            if (set_get(completed, (void *) conflicting[i])) {
+                conflict = conflicting[i];
+            }
+        }
+
+        if (conflict) {
+            pr_error("%s cannot be combined with %s\n", conflict, shards_arg);
+        } else {
+            status = 0;
+        }
         goto end;
     }
 
-    /* being here means that everything went OK */
-    pr_debug("Discovered %zu files in directory \"%s\"\n", list_length(fpaths), dir_path);
+    if (load_index_path) {
+        /* nothing to discover, the index is loaded as-is */
+        if (dir_path) {
+            pr_error("<data-dir> cannot be combined with %s\n", load_index_arg);
+        } else if (n_shards) {
+            pr_error("%s cannot be combined with %s\n", shard_arg, load_index_arg);
+        } else if (save_index_path) {
+            pr_error("%s cannot be combined with %s\n", save_index_arg, load_index_arg);
+        } else if (background_ingest) {
+            pr_error("%s cannot be combined with %s\n", background_arg, load_index_arg);
+        } else if (watch_files) {
+            pr_error("%s cannot be combined with %s\n", watch_arg, load_index_arg);
+        } else {
+            status = 0;
+        }
+        goto end;
+    }
+
+    if (!dir_path) {
+        pr_error("Missing required positional argument: <data-dir>\n");
+        goto end;
+    }
+
+    /* the index is incomplete until the interpreter exits, so there is nothing to save */
+    if (background_ingest && save_index_path) {
+        pr_error("%s cannot be combined with %s\n", background_arg, save_index_arg);
+        goto end;
+    }
+
+    /* being here means that everything went OK. The files are found while the index is built. */
+    data_dir_path = dir_path;
     status = 0;
 
     /* continue to cleanup */
 
 end:
 
-    /* clean up any temporary data structures and return */
-    set_destroy(valid_exts, free);
+    if (status == 0 && outfile_path) {
+        result_logger = logger_create(outfile_path, outfile_flush_ms);
+
+        if (result_logger == NULL) {
+            pr_error("Failed to create result_logger\n");
+            status = -1;
+        }
+    }
+
+    /* clean up any temporary data structures and return. valid_exts is kept for building the index. */
     set_destroy(completed, NULL);
 
     return status;
@@ -627,34 +1913,51 @@ end:
  * @returns NULL on error; otherwise a list of the input, line for line. Newline characters are removed.
  */
 static list_t *read_piped_lines() {
-    int bytes_ready = 0;
-
-    /* determine size of piped input */
-    if (ioctl(STDIN_FILENO, FIONREAD, &bytes_ready) == -1) {
-        pr_error("ioctl failed: %s\n", strerror(errno));
-        return NULL;
-    }
-
-    if (bytes_ready == 0) {
-        pr_error("Expected input from pipe\n");
-        return NULL;
-    }
+    size_t capacity = 1 << 16;
+    size_t n_read = 0;
 
     /* temp. buffer to hold the piped input */
-    char *content_buf = malloc((size_t) bytes_ready + 1);
+    char *content_buf = malloc(capacity + 1);
     if (!content_buf) {
         pr_error("Malloc failed: %s\n", strerror(errno));
         return NULL;
     }
 
-    /* read all bytes to the buffer */
-    if (read(STDIN_FILENO, content_buf, bytes_ready) != bytes_ready) {
-        pr_error("Failed to read from stdin: %s\n", strerror(errno));
+    /* read all bytes to the buffer, until EOF. A pipe holds only a fraction of a large input at a time. */
+    while (1) {
+        if (n_read == capacity) {
+            capacity *= 2;
+            char *new_buf = realloc(content_buf, capacity + 1);
+            if (!new_buf) {
+                pr_error("Malloc failed: %s\n", strerror(errno));
+                free(content_buf);
+                return NULL;
+            }
+            content_buf = new_buf;
+        }
+
+        ssize_t n = read(STDIN_FILENO, content_buf + n_read, capacity - n_read);
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            pr_error("Failed to read from stdin: %s\n", strerror(errno));
+            free(content_buf);
+            return NULL;
+        }
+        n_read += (size_t) n;
+    }
+
+    if (n_read == 0) {
+        pr_error("Expected input from pipe\n");
         free(content_buf);
         return NULL;
     }
 
-    content_buf[bytes_ready] = '\0';
+    content_buf[n_read] = '\0';
     trim(content_buf);
 
     /* list to hold each line */
@@ -689,45 +1992,230 @@ static list_t *read_piped_lines() {
     return piped;
 }
 
+/**
+ * @brief Serve the index as a shard (see --shard-serve), until the process is interrupted or terminated
+ * @param stop_signals: the signals to stop at, which must be blocked in every thread
+ * @returns 0 on success, otherwise a negative error code
+ */
+static int serve_shard(index_t *idx, const sigset_t *stop_signals) {
+    shard_server_t *server = shard_server_start(idx, shard_serve_addr);
+    if (!server) {
+        return -1;
+    }
+
+    pr_info("Serving the index as a shard on \"%s\". Stop with Ctrl+C.\n", shard_serve_addr);
+
+    int sig;
+    sigwait(stop_signals, &sig);
+
+    pr_info("Stopping the shard server\n");
+    shard_server_stop(server);
+
+    return 0;
+}
+
+/* stream the lines of a report are written to, on the thread writing it. See write_report_line. */
+static _Thread_local FILE *report_stream = NULL;
+
+/* write a line of a report to report_stream, for prof_report and mem_report */
+static void write_report_line(const char *line) {
+    fputs(line, report_stream);
+}
+
+/**
+ * @brief Handle a request of a client of the query server (see --serve). Like a line of the interpreter, it is
+ * either a query or a command, though only the commands that report on the index are served.
+ * @param request: the line sent by the client
+ * @param arg: pointer to the index, or NULL if queries are run with the coordinator
+ * @returns the rendered reply
+ */
+static char *serve_request(char *request, void *arg) {
+    index_t *idx = arg;
+
+    trim(request);
+
+    if (*request != '.') {
+        char *output = NULL;
+        if (run_query(idx, request, &output) < 0) {
+            pr_error("Failed to run query \"%s\"\n", request);
+        }
+        return output;
+    }
+
+    char *output = NULL;
+    size_t len;
+    FILE *out = open_memstream(&output, &len);
+    if (!out) {
+        PANIC("open_memstream failed: %s\n", strerror(errno));
+    }
+
+    if (strcmp(request, CLI_COMMAND_STAT) == 0) {
+        render_stat(idx, out);
+    } else if (strcmp(request, CLI_COMMAND_PROFILE) == 0) {
+        report_stream = out;
+        prof_report(write_report_line);
+    } else if (strcmp(request, CLI_COMMAND_MEMORY) == 0) {
+        size_t n_docs = 0, n_terms = 0;
+        if (idx) {
+            index_stat(idx, &n_docs, &n_terms);
+        }
+        report_stream = out;
+        mem_report(write_report_line, n_docs, n_terms);
+    } else {
+        cli_fpr_error(out, "Unrecognized command", "\"%s\". Served commands are %s, %s and %s.\n", request,
+                      CLI_COMMAND_STAT, CLI_COMMAND_PROFILE, CLI_COMMAND_MEMORY);
+    }
+
+    fclose(out);
+
+    return output;
+}
+
+/**
+ * @brief Serve queries to clients (see --serve), until the process is interrupted or terminated
+ * @param stop_signals: the signals to stop at, which must be blocked in every thread
+ * @returns 0 on success, otherwise a negative error code
+ */
+static int serve_queries(index_t *idx, const sigset_t *stop_signals) {
+    server_t *server = server_start(serve_addr, n_query_threads, serve_request, idx);
+    if (!server) {
+        return -1;
+    }
+
+    pr_info("Serving queries on \"%s\" with %zu threads. Stop with Ctrl+C.\n", serve_addr, n_query_threads);
+
+    int sig;
+    sigwait(stop_signals, &sig);
+
+    pr_info("Stopping the query server\n");
+    server_stop(server);
+
+    return 0;
+}
+
 int main(int argc, char **argv) {
     int exit_code = EXIT_FAILURE; // default to failure
     list_t *piped_input = NULL;
 
-    /* If the descriptor of stdin is not a terminal, get the piped input. */
-    if (isatty(STDIN_FILENO) == 0) {
+    /* named 'idx' as 'index' collides with a function from <string.h> */
+    index_t *idx = NULL;
+
+    int arg_status = process_args(argc, argv);
+
+    /* If the descriptor of stdin is not a terminal, get the piped input. A server reads no input. */
+    if (arg_status == 0 && !shard_serve_addr && !serve_addr && isatty(STDIN_FILENO) == 0) {
         piped_input = read_piped_lines();
 
         if (piped_input == NULL) {
+            set_destroy(valid_exts, free);
+            logger_destroy(result_logger);
             return EXIT_FAILURE;
         }
     }
 
-    /* named 'idx' as 'index' collides with a function from <string.h> */
-    index_t *idx = NULL;
+    /* a server runs until stopped by a signal, which the main thread waits for. Blocked before any other
+     * thread starts, as each inherits the mask. */
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
 
-    /* create a list to populate with paths */
-    list_t *fpaths = list_create((cmp_fn) strcmp);
+    if (arg_status == 0 && (shard_serve_addr || serve_addr)) {
+        pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+    }
+
+    if (arg_status == 0) {
+        if (shard_addrs) {
+            pr_debug("Connecting to shards \"%s\"\n", shard_addrs);
+            coordinator = coordinator_create(shard_addrs);
+        } else if (load_index_path) {
+            pr_debug("Loading index from \"%s\"\n", load_index_path);
+            idx = index_load(load_index_path);
+        } else {
+            idx = index_create();
+            if (!idx) {
+                pr_error("Failed to create index\n");
+            } else if (store_positions && index_store_positions(idx) != 0) {
+                pr_error("Failed to make the index store positions\n");
+            }
+        }
+
+        /* not critical, queries simply go uncached. Set before ingesting, which may run alongside queries. */
+        if (idx && index_set_cache_size(idx, query_cache_mib * 1024 * 1024) != 0) {
+            pr_error("Failed to create query cache\n");
+        }
+
+        /* watch before ingesting, so that changes made while the files are read are not missed */
+        if (idx && watch_files) {
+            file_watcher = watch_create(data_dir_path, valid_exts, apply_change, idx);
+            if (!file_watcher) {
+                index_destroy(idx);
+                idx = NULL;
+            }
+        }
+
+        if (idx && !load_index_path && background_ingest) {
+            pr_debug("Indexing in the background with %zu threads per stage\n", n_ingest_threads);
 
-    int arg_status = process_args(argc, argv, fpaths);
+            background_pipeline = pipeline_start(idx, n_ingest_threads, 1);
+            if (!background_pipeline) {
+                index_destroy(idx);
+                idx = NULL;
+            }
+        } else if (idx && !load_index_path && build_index(idx, n_ingest_threads) != 0) {
+            index_destroy(idx);
+            idx = NULL;
+        }
+
+        /* failing to save is not critical, the index is still usable */
+        if (idx && save_index_path) {
+            if (index_save(idx, save_index_path) == 0) {
+                pr_debug("Saved index to \"%s\"\n", save_index_path);
+            } else {
+                pr_error("Failed to save index to \"%s\"\n", save_index_path);
+            }
+        }
+
+        /* changes made until now (and while saving) are applied on top of the documents already ingested */
+        if (idx && file_watcher && watch_start(file_watcher) != 0) {
+            watch_destroy(file_watcher);
+            file_watcher = NULL;
+            pr_warn("Changes to the files will not be applied to the index\n");
+        }
 
-    if (fpaths != NULL && arg_status == 0) {
-        idx = build_index(fpaths);
+        /* hand over control to the interpreter, or one of the servers */
+        int interpreter_status = -1;
+        if (idx && shard_serve_addr) {
+            interpreter_status = serve_shard(idx, &stop_signals);
+        } else if ((idx || coordinator) && serve_addr) {
+            interpreter_status = serve_queries(idx, &stop_signals);
+        } else if ((idx || coordinator) && piped_input && n_query_threads > 1) {
+            interpreter_status = run_batch_interpreter(idx, piped_input, n_query_threads);
+        } else if (idx || coordinator) {
+            interpreter_status = run_interpreter(idx, piped_input);
+        }
 
-        /* hand over control to the interpreter */
-        if (idx && run_interpreter(idx, piped_input) == 0) {
+        if (interpreter_status == 0) {
             exit_code = EXIT_SUCCESS; // interpreter exited OK
         }
         /* continue to cleanup */
     }
 
+    /* changes not yet applied are dropped, as are documents not yet indexed */
+    watch_destroy(file_watcher);
+
+    if (background_pipeline) {
+        pipeline_cancel(background_pipeline);
+        pipeline_join(background_pipeline, NULL);
+    }
+
     if (idx) {
         pr_debug("Destroying index\n");
         index_destroy(idx);
-    } else {
-        /* if there is an index, this list will have been destroyed by it */
-        list_destroy(fpaths, free);
     }
+    coordinator_destroy(coordinator);
 
+    set_destroy(valid_exts, free);
     list_destroy(piped_input, free); // empty list if interpreting went ok
     logger_destroy(result_logger);
 
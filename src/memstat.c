@@ -0,0 +1,234 @@
+/**
+ * @implements memstat.h
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "defs.h"
+#include "memstat.h"
+
+
+#ifdef MEMSTAT
+
+/**
+ * SETTING: bytes a thread records on its own before adding them to the totals of a category. Keeps the
+ * atomics off the hot paths (one list node per token), at the cost of the report lagging by up to this much
+ * per thread and category.
+ */
+#define MEM_FLUSH_BYTES 65536
+
+typedef struct mem_stat {
+    atomic_int_fast64_t bytes;
+    atomic_int_fast64_t objects;
+    atomic_int_fast64_t peak_bytes;
+} mem_stat_t;
+
+static mem_stat_t categories[MEM_N_CATEGORIES];
+
+/* what the calling thread recorded since it last added to the totals */
+typedef struct mem_delta {
+    int64_t bytes;
+    int64_t objects;
+} mem_delta_t;
+
+static _Thread_local mem_delta_t deltas[MEM_N_CATEGORIES];
+static _Thread_local bool registered;
+
+/* flushes the deltas of a thread as it exits, see register_thread */
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static const char *category_names[MEM_N_CATEGORIES] = {
+    [MEM_MAP] = "maps",
+    [MEM_SET] = "sets",
+    [MEM_LIST] = "lists",
+    [MEM_ARENA] = "arenas",
+    [MEM_INTERNER] = "interner",
+    [MEM_DOC_NAMES] = "document names",
+    [MEM_DOC_TABLE] = "document table",
+    [MEM_POSTINGS] = "postings",
+    [MEM_POSITIONS] = "positions",
+    [MEM_CONTAINERS] = "containers",
+    [MEM_TERMDICT] = "term dictionary",
+    [MEM_CACHE] = "query cache",
+    [MEM_INDEX_FILE] = "index file",
+    [MEM_FROZEN] = "frozen index",
+    [MEM_TERMHASH] = "term hash",
+};
+
+
+/* add what the calling thread recorded in a category to its totals */
+static void flush_delta(mem_category_t category) {
+    mem_stat_t *stat = &categories[category];
+    mem_delta_t *delta = &deltas[category];
+
+    int_fast64_t old = atomic_fetch_add_explicit(&stat->bytes, delta->bytes, memory_order_relaxed);
+    int_fast64_t now = old + delta->bytes;
+    atomic_fetch_add_explicit(&stat->objects, delta->objects, memory_order_relaxed);
+    delta->bytes = 0;
+    delta->objects = 0;
+
+    int_fast64_t peak = atomic_load_explicit(&stat->peak_bytes, memory_order_relaxed);
+    while (now > peak) {
+        if (atomic_compare_exchange_weak_explicit(
+                &stat->peak_bytes, &peak, now, memory_order_relaxed, memory_order_relaxed
+            )) {
+            break;
+        }
+    }
+}
+
+static void flush_deltas(void *arg) {
+    UNUSED(arg);
+
+    for (size_t i = 0; i < MEM_N_CATEGORIES; i++) {
+        if (deltas[i].bytes || deltas[i].objects) {
+            flush_delta((mem_category_t) i);
+        }
+    }
+}
+
+static void create_exit_key(void) {
+    pthread_key_create(&exit_key, flush_deltas);
+}
+
+/* make sure what the calling thread has yet to flush is not lost once it exits */
+static void register_thread(void) {
+    pthread_once(&exit_key_once, create_exit_key);
+    pthread_setspecific(exit_key, (void *) 1); // the destructor only runs for a non-NULL value
+    registered = true;
+}
+
+void mem_record(mem_category_t category, int64_t bytes, int64_t objects) {
+    mem_delta_t *delta = &deltas[category];
+
+    if (!registered) {
+        register_thread();
+    }
+
+    delta->bytes += bytes;
+    delta->objects += objects;
+
+    if (delta->bytes >= MEM_FLUSH_BYTES || delta->bytes <= -MEM_FLUSH_BYTES) {
+        flush_delta(category);
+    }
+}
+
+/**
+ * Read the resident set size of the process from /proc
+ * @returns the size in bytes, or 0 if it is not available
+ */
+static size_t resident_bytes(void) {
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp) {
+        return 0;
+    }
+
+    unsigned long long n_pages, n_resident;
+    int n = fscanf(fp, "%llu %llu", &n_pages, &n_resident);
+    fclose(fp);
+
+    return (n == 2) ? (size_t) n_resident * (size_t) sysconf(_SC_PAGESIZE) : 0;
+}
+
+static inline double to_mib(double bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+void mem_report(void (*writefn)(const char *), size_t n_docs, size_t n_terms) {
+    char buf[LINE_MAX];
+    int64_t total_bytes = 0;
+    int64_t total_objects = 0;
+
+    flush_deltas(NULL);
+
+    snprintf(
+        buf,
+        LINE_MAX,
+        "%-16s %12s %12s %10s %12s %12s\n",
+        "Category",
+        "objects",
+        "MiB",
+        "share",
+        "bytes/object",
+        "peak (MiB)"
+    );
+    writefn(buf);
+
+    for (size_t i = 0; i < MEM_N_CATEGORIES; i++) {
+        total_bytes += atomic_load_explicit(&categories[i].bytes, memory_order_relaxed);
+        total_objects += atomic_load_explicit(&categories[i].objects, memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < MEM_N_CATEGORIES; i++) {
+        mem_stat_t *stat = &categories[i];
+        int64_t bytes = atomic_load_explicit(&stat->bytes, memory_order_relaxed);
+        int64_t objects = atomic_load_explicit(&stat->objects, memory_order_relaxed);
+
+        snprintf(
+            buf,
+            LINE_MAX,
+            "%-16s %12lld %12.2f %9.1f%% %12.1f %12.2f\n",
+            category_names[i],
+            (long long) objects,
+            to_mib((double) bytes),
+            total_bytes ? 100.0 * (double) bytes / (double) total_bytes : 0.0,
+            objects ? (double) bytes / (double) objects : 0.0,
+            to_mib((double) atomic_load_explicit(&stat->peak_bytes, memory_order_relaxed))
+        );
+        writefn(buf);
+    }
+
+    snprintf(
+        buf,
+        LINE_MAX,
+        "%-16s %12lld %12.2f\n",
+        "total",
+        (long long) total_objects,
+        to_mib((double) total_bytes)
+    );
+    writefn(buf);
+
+    /* sizing a host is a matter of how the total grows with the collection */
+    if (n_docs && n_terms) {
+        snprintf(
+            buf,
+            LINE_MAX,
+            "(%.1f bytes per document, %.1f bytes per unique term)\n",
+            (double) total_bytes / (double) n_docs,
+            (double) total_bytes / (double) n_terms
+        );
+        writefn(buf);
+    }
+
+    /* the difference is the overhead of the allocator, stacks, code and any memory not accounted for */
+    size_t resident = resident_bytes();
+    if (resident) {
+        snprintf(buf, LINE_MAX, "Resident memory of the process: %.2f MiB\n", to_mib((double) resident));
+        writefn(buf);
+    }
+}
+
+#else
+
+/* compiled out, see memstat.h */
+
+void mem_record(mem_category_t category, int64_t bytes, int64_t objects) {
+    UNUSED(category);
+    UNUSED(bytes);
+    UNUSED(objects);
+}
+
+void mem_report(void (*writefn)(const char *), size_t n_docs, size_t n_terms) {
+    UNUSED(n_docs);
+    UNUSED(n_terms);
+    writefn("Memory accounting is compiled out of this build. Rebuild with `make MEMSTAT=1` to enable it.\n");
+}
+
+#endif /* MEMSTAT */
@@ -0,0 +1,188 @@
+/**
+ * @implements net.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "net.h"
+
+
+/* SETTING: max number of connections waiting to be accepted by a listening socket */
+#define NET_LISTEN_BACKLOG 128
+
+/**
+ * Split an address into its host and port, which are copied to `host` and `port`.
+ * @returns 0 on success, otherwise -1. `host` is set to the empty string if there is none.
+ */
+static int split_addr(const char *addr, char *host, char *port) {
+    const char *colon = strrchr(addr, ':');
+    const char *port_str = colon ? colon + 1 : addr;
+    size_t host_len = colon ? (size_t) (colon - addr) : 0;
+
+    /* IPv6 addresses hold colons of their own, so they are given in brackets */
+    if (host_len >= 2 && addr[0] == '[' && addr[host_len - 1] == ']') {
+        addr++;
+        host_len -= 2;
+    }
+
+    if (host_len >= NI_MAXHOST || strlen(port_str) >= NI_MAXSERV || *port_str == '\0') {
+        return -1;
+    }
+
+    memcpy(host, addr, host_len);
+    host[host_len] = '\0';
+    strcpy(port, port_str);
+
+    return 0;
+}
+
+/**
+ * Resolve an address of a TCP socket
+ * @param passive: resolve an address to listen on, rather than to connect to
+ * @returns the list of addresses, to be freed with freeaddrinfo, or NULL on failure
+ */
+static struct addrinfo *resolve(const char *addr, int passive) {
+    char host[NI_MAXHOST];
+    char port[NI_MAXSERV];
+
+    if (split_addr(addr, host, port) < 0 || (!passive && *host == '\0')) {
+        pr_error("Invalid address \"%s\", expected <host>:<port>\n", addr);
+        return NULL;
+    }
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = passive ? AI_PASSIVE : 0,
+    };
+    struct addrinfo *res = NULL;
+
+    int status = getaddrinfo(*host ? host : NULL, port, &hints, &res);
+    if (status != 0) {
+        pr_error("Failed to resolve address \"%s\": %s\n", addr, gai_strerror(status));
+        return NULL;
+    }
+
+    return res;
+}
+
+int net_listen(const char *addr) {
+    struct addrinfo *res = resolve(addr, 1);
+    if (!res) {
+        return -1;
+    }
+
+    int fd = -1;
+    int err = 0;
+
+    /* take the first of the resolved addresses that can be bound */
+    for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+
+        /* so the address may be listened on again right away, once the server is restarted */
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) < 0 || listen(fd, NET_LISTEN_BACKLOG) < 0) {
+            err = errno;
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+        pr_error("Failed to listen on \"%s\": %s\n", addr, strerror(err));
+    }
+
+    return fd;
+}
+
+int net_connect(const char *addr) {
+    struct addrinfo *res = resolve(addr, 0);
+    if (!res) {
+        return -1;
+    }
+
+    int fd = -1;
+    int err = 0;
+
+    for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            err = errno;
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+        pr_error("Failed to connect to \"%s\": %s\n", addr, strerror(err));
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return fd;
+}
+
+int net_read_full(int fd, void *buf, size_t n) {
+    char *p = buf;
+
+    while (n > 0) {
+        ssize_t n_read = recv(fd, p, n, 0);
+        if (n_read == 0) {
+            return -1; // closed by the peer
+        }
+        if (n_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n_read;
+        n -= (size_t) n_read;
+    }
+
+    return 0;
+}
+
+int net_write_full(int fd, const void *buf, size_t n) {
+    const char *p = buf;
+
+    while (n > 0) {
+        ssize_t n_written = send(fd, p, n, MSG_NOSIGNAL);
+        if (n_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n_written;
+        n -= (size_t) n_written;
+    }
+
+    return 0;
+}
@@ -0,0 +1,235 @@
+/**
+ * @implements perfhash.h
+ *
+ * @brief The hash of a key (see str_t) is mixed with a seed, then split in two: the high bits pick its bucket,
+ * and the whole of it, mixed with the displacement of the bucket, its slot. Buckets are placed largest first,
+ * while most slots are free, each with the lowest displacement whose slots are all free. Should a bucket find
+ * none, the keys are placed again from scratch with the next seed.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "perfhash.h"
+#include "memstat.h"
+
+
+/* SETTING: average number of keys per bucket. Higher takes less memory, but longer to place the buckets. */
+#define PERFHASH_BUCKET_SIZE 3
+
+/* SETTING: displacements tried for a bucket, before the keys are placed again with another seed */
+#define PERFHASH_DISPLACEMENTS_MAX (1u << 24)
+
+/* SETTING: seeds tried before giving up */
+#define PERFHASH_SEEDS_MAX 8
+
+struct perfhash {
+    uint64_t seed;
+    size_t n_keys;
+    size_t n_buckets;
+    uint32_t *displacements; // of each bucket
+};
+
+/* the finalizer of splitmix64, such that every bit of the result depends on every bit of x */
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111eb;
+    x ^= x >> 31;
+    return x;
+}
+
+/* map a 64-bit hash onto [0, n), by its high bits, without a division */
+static inline size_t reduce(uint64_t h, size_t n) {
+    return (size_t) (((unsigned __int128) h * n) >> 64);
+}
+
+static inline uint64_t seeded_hash(const perfhash_t *hash, const str_t *key) {
+    return mix64(key->hash ^ hash->seed);
+}
+
+static inline size_t bucket_of(const perfhash_t *hash, uint64_t h) {
+    return reduce(h, hash->n_buckets);
+}
+
+static inline size_t slot_of(const perfhash_t *hash, uint64_t h, uint32_t displacement) {
+    return reduce(mix64(h + displacement * 0x9e3779b97f4a7c15), hash->n_keys);
+}
+
+/**
+ * Place every bucket with the current seed, setting its displacement.
+ * @param hashes: scratch of n_keys entries, for the seeded hashes, grouped by bucket
+ * @param starts: scratch of n_buckets + 1 entries, for where each bucket starts in `hashes`
+ * @param order: scratch of n_buckets entries, for the buckets, largest first
+ * @param taken: scratch bitmap of n_keys bits, for the slots in use
+ * @returns 0 on success, or -1 if a bucket could not be placed
+ */
+static int place_buckets(
+    perfhash_t *hash,
+    const str_t *keys,
+    uint64_t *hashes,
+    size_t *starts,
+    size_t *order,
+    uint64_t *taken
+) {
+    size_t n_buckets = hash->n_buckets;
+
+    /* group the hashes by bucket, counting the keys of each first */
+    memset(starts, 0, (n_buckets + 1) * sizeof(size_t));
+    for (size_t i = 0; i < hash->n_keys; i++) {
+        starts[bucket_of(hash, seeded_hash(hash, &keys[i])) + 1]++;
+    }
+
+    size_t max_size = 0;
+    for (size_t b = 0; b < n_buckets; b++) {
+        if (starts[b + 1] > max_size) {
+            max_size = starts[b + 1];
+        }
+        starts[b + 1] += starts[b];
+    }
+    for (size_t i = 0; i < hash->n_keys; i++) {
+        uint64_t h = seeded_hash(hash, &keys[i]);
+        size_t b = bucket_of(hash, h);
+
+        /* starts[b] is advanced past each hash of the bucket, then moved back below */
+        hashes[starts[b]++] = h;
+    }
+    memmove(&starts[1], &starts[0], n_buckets * sizeof(size_t));
+    starts[0] = 0;
+
+    /* order the buckets by size, largest first, with a counting sort */
+    size_t *by_size = calloc(max_size + 2, sizeof(size_t));
+    size_t *slots = malloc((max_size + 1) * sizeof(size_t));
+    if (!by_size || !slots) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    for (size_t b = 0; b < n_buckets; b++) {
+        by_size[max_size - (starts[b + 1] - starts[b]) + 1]++;
+    }
+    for (size_t s = 0; s <= max_size; s++) {
+        by_size[s + 1] += by_size[s];
+    }
+    for (size_t b = 0; b < n_buckets; b++) {
+        order[by_size[max_size - (starts[b + 1] - starts[b])]++] = b;
+    }
+
+    memset(taken, 0, (hash->n_keys / 64 + 1) * sizeof(uint64_t));
+    memset(hash->displacements, 0, n_buckets * sizeof(uint32_t));
+    int status = 0;
+
+    for (size_t i = 0; i < n_buckets; i++) {
+        size_t b = order[i];
+        size_t size = starts[b + 1] - starts[b];
+        uint32_t d = 0;
+
+        if (size == 0) {
+            break; // so are the rest
+        }
+
+        for (; d < PERFHASH_DISPLACEMENTS_MAX; d++) {
+            size_t j = 0;
+
+            /* every key of the bucket must land on a free slot, and on a different one than the others */
+            for (; j < size; j++) {
+                size_t slot = slot_of(hash, hashes[starts[b] + j], d);
+                if (taken[slot / 64] & ((uint64_t) 1 << (slot % 64))) {
+                    break;
+                }
+
+                size_t k = 0;
+                while (k < j && slots[k] != slot) {
+                    k++;
+                }
+                if (k < j) {
+                    break;
+                }
+                slots[j] = slot;
+            }
+
+            if (j == size) {
+                break;
+            }
+        }
+
+        if (d == PERFHASH_DISPLACEMENTS_MAX) {
+            status = -1;
+            break;
+        }
+
+        hash->displacements[b] = d;
+        for (size_t j = 0; j < size; j++) {
+            taken[slots[j] / 64] |= (uint64_t) 1 << (slots[j] % 64);
+        }
+    }
+
+    free(by_size);
+    free(slots);
+
+    return status;
+}
+
+perfhash_t *perfhash_create(const str_t *keys, size_t n) {
+    perfhash_t *hash = malloc(sizeof(perfhash_t));
+    if (!hash) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    hash->n_keys = n;
+    hash->n_buckets = n / PERFHASH_BUCKET_SIZE + 1;
+    hash->displacements = malloc(hash->n_buckets * sizeof(uint32_t));
+
+    uint64_t *hashes = malloc((n + 1) * sizeof(uint64_t));
+    size_t *starts = malloc((hash->n_buckets + 1) * sizeof(size_t));
+    size_t *order = malloc(hash->n_buckets * sizeof(size_t));
+    uint64_t *taken = malloc((n / 64 + 1) * sizeof(uint64_t));
+
+    if (!hash->displacements || !hashes || !starts || !order || !taken) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    int status = -1;
+    for (uint64_t i = 0; i < PERFHASH_SEEDS_MAX && status != 0; i++) {
+        hash->seed = mix64(i + 1);
+        status = place_buckets(hash, keys, hashes, starts, order, taken);
+    }
+
+    free(hashes);
+    free(starts);
+    free(order);
+    free(taken);
+
+    if (status != 0) {
+        pr_error("Found no perfect hash of %zu keys\n", n);
+        free(hash->displacements);
+        free(hash);
+        return NULL;
+    }
+
+    MEM_RECORD(MEM_TERMHASH, (int64_t) perfhash_size(hash), 2);
+
+    return hash;
+}
+
+void perfhash_destroy(perfhash_t *hash) {
+    if (!hash) {
+        return;
+    }
+    MEM_RECORD(MEM_TERMHASH, -(int64_t) perfhash_size(hash), -2);
+    free(hash->displacements);
+    free(hash);
+}
+
+size_t perfhash_size(const perfhash_t *hash) {
+    return sizeof(perfhash_t) + hash->n_buckets * sizeof(uint32_t);
+}
+
+size_t perfhash_lookup(const perfhash_t *hash, const str_t *key) {
+    uint64_t h = seeded_hash(hash, key);
+
+    return slot_of(hash, h, hash->displacements[bucket_of(hash, h)]);
+}
@@ -0,0 +1,78 @@
+/**
+ * @implements pool.h
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "memstat.h"
+#include "pool.h"
+
+
+/* number of objects of the first slab of a pool */
+#define POOL_SLAB_OBJS_MIN 8
+
+/**
+ * SETTING: most objects of any slab. Slabs double in size up to this, so a pool of n objects takes
+ * O(log n) slabs, and wastes at most one slab of this size on objects that are never allocated.
+ */
+#define POOL_SLAB_OBJS_MAX 4096
+
+/* header of a slab, followed by its objects */
+typedef struct slab slab_t;
+struct slab {
+    slab_t *next;
+    size_t n_bytes; // including this header
+    max_align_t objs[]; // typed for alignment, used as bytes
+};
+
+
+void pool_init(pool_t *pool, size_t obj_size, mem_category_t category) {
+    /* a freed object holds a pointer to the next one */
+    if (obj_size < sizeof(void *)) {
+        obj_size = sizeof(void *);
+    }
+
+    pool->free = NULL;
+    pool->next = NULL;
+    pool->end = NULL;
+    pool->slabs = NULL;
+    pool->obj_size = (obj_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    pool->slab_objs = POOL_SLAB_OBJS_MIN;
+    pool->category = category;
+}
+
+void pool_release(pool_t *pool) {
+    slab_t *slab = pool->slabs;
+
+    while (slab) {
+        slab_t *next = slab->next;
+        MEM_FREE(pool->category, slab->n_bytes);
+        free(slab);
+        slab = next;
+    }
+
+    pool_init(pool, pool->obj_size, pool->category);
+}
+
+void pool_grow(pool_t *pool) {
+    size_t n_bytes = sizeof(slab_t) + pool->slab_objs * pool->obj_size;
+
+    slab_t *slab = malloc(n_bytes);
+    if (!slab) {
+        PANIC("Failed to allocate memory\n");
+    }
+    MEM_ALLOC(pool->category, n_bytes);
+
+    slab->next = pool->slabs;
+    slab->n_bytes = n_bytes;
+    pool->slabs = slab;
+    pool->next = (char *) slab->objs;
+    pool->end = pool->next + pool->slab_objs * pool->obj_size;
+
+    if (pool->slab_objs < POOL_SLAB_OBJS_MAX) {
+        pool->slab_objs *= 2;
+    }
+}
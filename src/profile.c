@@ -0,0 +1,204 @@
+/**
+ * @implements profile.h
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <limits.h>
+
+#include "defs.h"
+#include "profile.h"
+
+
+#ifdef PROFILE
+
+/* histogram bucket i counts durations in [2^i, 2^(i+1)) ns, bucket 0 also counts 0. 2^40 ns is ~18 min. */
+#define N_BUCKETS 41
+
+typedef struct phase_stat {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t total_ns;
+    atomic_uint_fast64_t max_ns;
+    atomic_uint_fast64_t buckets[N_BUCKETS];
+} phase_stat_t;
+
+static phase_stat_t phases[PROF_N_PHASES];
+static atomic_uint_fast64_t counters[PROF_N_COUNTERS];
+
+static const char *phase_names[PROF_N_PHASES] = {
+    [PROF_FIND_FILES] = "find_files",
+    [PROF_READ_FILE] = "read_file",
+    [PROF_TOKENIZE_FILE] = "tokenize_file",
+    [PROF_INDEX_DOCUMENT] = "index_document",
+    [PROF_QUERY_PARSE] = "query_parse",
+    [PROF_QUERY_EVAL] = "query_eval",
+    [PROF_PRINT_RESULTS] = "print_results",
+};
+
+static const char *counter_names[PROF_N_COUNTERS] = {
+    [PROF_MAP_GET] = "map_get",
+    [PROF_MAP_PROBES] = "map_get probes",
+    [PROF_SET_INSERT] = "set_insert",
+};
+
+
+static inline size_t bucket_of(uint64_t ns) {
+    size_t i = ns ? (size_t) (63 - __builtin_clzll(ns)) : 0;
+
+    return (i < N_BUCKETS) ? i : N_BUCKETS - 1;
+}
+
+void prof_record(prof_phase_t phase, uint64_t ns) {
+    phase_stat_t *stat = &phases[phase];
+
+    atomic_fetch_add_explicit(&stat->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stat->total_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stat->buckets[bucket_of(ns)], 1, memory_order_relaxed);
+
+    uint_fast64_t max = atomic_load_explicit(&stat->max_ns, memory_order_relaxed);
+    while (ns > max) {
+        if (atomic_compare_exchange_weak_explicit(
+                &stat->max_ns, &max, ns, memory_order_relaxed, memory_order_relaxed
+            )) {
+            break;
+        }
+    }
+}
+
+void prof_count(prof_counter_t counter, uint64_t n) {
+    atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed);
+}
+
+void prof_reset(void) {
+    for (size_t i = 0; i < PROF_N_PHASES; i++) {
+        atomic_store(&phases[i].count, 0);
+        atomic_store(&phases[i].total_ns, 0);
+        atomic_store(&phases[i].max_ns, 0);
+
+        for (size_t j = 0; j < N_BUCKETS; j++) {
+            atomic_store(&phases[i].buckets[j], 0);
+        }
+    }
+
+    for (size_t i = 0; i < PROF_N_COUNTERS; i++) {
+        atomic_store(&counters[i], 0);
+    }
+}
+
+/**
+ * Estimate the p'th percentile of a phase from its histogram, as the upper bound of the bucket it falls in.
+ * Never more than twice the true value, and capped to the max.
+ */
+static uint64_t phase_percentile(phase_stat_t *stat, uint64_t count, double p) {
+    uint64_t rank = (uint64_t) (p / 100.0 * (double) count + 0.5);
+    uint64_t cumulative = 0;
+
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    for (size_t i = 0; i < N_BUCKETS; i++) {
+        cumulative += atomic_load_explicit(&stat->buckets[i], memory_order_relaxed);
+
+        if (cumulative >= rank) {
+            uint64_t upper = (2ull << i) - 1;
+            uint64_t max = atomic_load_explicit(&stat->max_ns, memory_order_relaxed);
+
+            return (upper < max) ? upper : max;
+        }
+    }
+
+    return atomic_load_explicit(&stat->max_ns, memory_order_relaxed);
+}
+
+void prof_report(void (*writefn)(const char *)) {
+    char buf[LINE_MAX];
+
+    /* durations are printed in µs, except for the total */
+    snprintf(
+        buf,
+        LINE_MAX,
+        "%-16s %10s %12s %10s %10s %10s %10s %10s\n",
+        "Phase",
+        "count",
+        "total (ms)",
+        "mean (us)",
+        "p50 (us)",
+        "p95 (us)",
+        "p99 (us)",
+        "max (us)"
+    );
+    writefn(buf);
+
+    for (size_t i = 0; i < PROF_N_PHASES; i++) {
+        phase_stat_t *stat = &phases[i];
+        uint64_t count = atomic_load_explicit(&stat->count, memory_order_relaxed);
+        uint64_t total_ns = atomic_load_explicit(&stat->total_ns, memory_order_relaxed);
+
+        if (count == 0) {
+            snprintf(buf, LINE_MAX, "%-16s %10d\n", phase_names[i], 0);
+            writefn(buf);
+            continue;
+        }
+
+        snprintf(
+            buf,
+            LINE_MAX,
+            "%-16s %10llu %12.3f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+            phase_names[i],
+            (unsigned long long) count,
+            (double) total_ns / 1.0E6,
+            (double) total_ns / (double) count / 1.0E3,
+            (double) phase_percentile(stat, count, 50.0) / 1.0E3,
+            (double) phase_percentile(stat, count, 95.0) / 1.0E3,
+            (double) phase_percentile(stat, count, 99.0) / 1.0E3,
+            (double) atomic_load_explicit(&stat->max_ns, memory_order_relaxed) / 1.0E3
+        );
+        writefn(buf);
+    }
+
+    snprintf(buf, LINE_MAX, "\n%-16s %10s\n", "Counter", "count");
+    writefn(buf);
+
+    for (size_t i = 0; i < PROF_N_COUNTERS; i++) {
+        snprintf(
+            buf,
+            LINE_MAX,
+            "%-16s %10llu\n",
+            counter_names[i],
+            (unsigned long long) atomic_load_explicit(&counters[i], memory_order_relaxed)
+        );
+        writefn(buf);
+    }
+
+    /* the most telling number of a map is its average probe length */
+    uint64_t n_gets = atomic_load_explicit(&counters[PROF_MAP_GET], memory_order_relaxed);
+    if (n_gets) {
+        uint64_t n_probes = atomic_load_explicit(&counters[PROF_MAP_PROBES], memory_order_relaxed);
+        snprintf(buf, LINE_MAX, "(%.2f probes per map_get)\n", (double) n_probes / (double) n_gets);
+        writefn(buf);
+    }
+}
+
+#else
+
+/* compiled out, see profile.h */
+
+void prof_record(prof_phase_t phase, uint64_t ns) {
+    UNUSED(phase);
+    UNUSED(ns);
+}
+
+void prof_count(prof_counter_t counter, uint64_t n) {
+    UNUSED(counter);
+    UNUSED(n);
+}
+
+void prof_reset(void) {}
+
+void prof_report(void (*writefn)(const char *)) {
+    writefn("Profiling is compiled out of this build. Rebuild with `make PROFILE=1` to enable it.\n");
+}
+
+#endif /* PROFILE */
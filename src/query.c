@@ -0,0 +1,360 @@
+/**
+ * @implements query.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h> // for LINE_MAX
+
+#include "printing.h"
+#include "defs.h"
+#include "common.h"
+#include "list.h"
+#include "query.h"
+
+
+typedef enum lexeme_type {
+    LEX_WORD = 0,
+    LEX_LPAR,
+    LEX_RPAR,
+    LEX_OP,
+    LEX_QUOTE,
+} lexeme_type_t;
+
+/* a single word, parenthesis or operator of the query */
+typedef struct lexeme {
+    lexeme_type_t type;
+    query_op_t op; // if type is LEX_OP
+    char *text;    // null-terminated copy of the lexeme as it appeared in the query
+} lexeme_t;
+
+/* state of the recursive descent parser */
+typedef struct parser {
+    lexeme_t *lexemes;
+    size_t n_lexemes;
+    size_t pos;
+    char *errbuf;
+} parser_t;
+
+
+const char *query_op_str(query_op_t op) {
+    switch (op) {
+        case QUERY_AND:
+            return "&&";
+        case QUERY_OR:
+            return "||";
+        case QUERY_ANDNOT:
+            return "&!";
+        case QUERY_PHRASE:
+            return "\"";
+        case QUERY_WILDCARD:
+            return "*";
+        default:
+            break;
+    }
+    return "<term>";
+}
+
+void query_destroy(query_node_t *node) {
+    if (!node) {
+        return;
+    }
+    query_destroy(node->left);
+    query_destroy(node->right);
+    free(node->term);
+    free(node);
+}
+
+static query_node_t *new_node(query_op_t op, char *term, query_node_t *left, query_node_t *right) {
+    query_node_t *node = malloc(sizeof(query_node_t));
+    if (!node) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    node->op = op;
+    node->term = term;
+    node->left = left;
+    node->right = right;
+
+    return node;
+}
+
+/* -------------------------Lexing------------------------ */
+
+static void add_lexeme(list_t *dst, lexeme_type_t type, query_op_t op, const char *text, size_t len) {
+    lexeme_t *lex = malloc(sizeof(lexeme_t));
+    char *cpy = strndup(text, len);
+
+    if (!lex || !cpy || list_addlast(dst, lex) < 0) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    lex->type = type;
+    lex->op = op;
+    lex->text = cpy;
+}
+
+/**
+ * Split a single query token into words, parentheses and operators
+ * @returns 0 on success, otherwise -1 and errbuf is set
+ */
+static int lex_token(const char *token, list_t *dst, char *errbuf) {
+    const char *c = token;
+
+    while (*c) {
+        if (is_ascii_alnum(*c) || *c == '*') {
+            const char *start = c;
+            while (is_ascii_alnum(*c) || *c == '*') {
+                c++;
+            }
+            add_lexeme(dst, LEX_WORD, QUERY_TERM, start, c - start);
+        } else if (*c == '(' || *c == ')') {
+            add_lexeme(dst, (*c == '(') ? LEX_LPAR : LEX_RPAR, QUERY_TERM, c, 1);
+            c++;
+        } else if (*c == '"') {
+            add_lexeme(dst, LEX_QUOTE, QUERY_TERM, c, 1);
+            c++;
+        } else if (c[0] == '&' && c[1] == '&') {
+            add_lexeme(dst, LEX_OP, QUERY_AND, c, 2);
+            c += 2;
+        } else if (c[0] == '|' && c[1] == '|') {
+            add_lexeme(dst, LEX_OP, QUERY_OR, c, 2);
+            c += 2;
+        } else if (c[0] == '&' && c[1] == '!') {
+            add_lexeme(dst, LEX_OP, QUERY_ANDNOT, c, 2);
+            c += 2;
+        } else {
+            snprintf(errbuf, LINE_MAX, "invalid operator at \"%s\" (expected &&, || or &!)", c);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* ------------------------Parsing------------------------ */
+
+static lexeme_t *peek(parser_t *p) {
+    return (p->pos < p->n_lexemes) ? &p->lexemes[p->pos] : NULL;
+}
+
+/* description of the lexeme at the current position, for error messages */
+static const char *peek_text(parser_t *p) {
+    lexeme_t *lex = peek(p);
+    return lex ? lex->text : "end of query";
+}
+
+static query_node_t *parse_query(parser_t *p);
+
+/* a word, or a pattern if it has any "*" */
+static query_node_t *new_word(lexeme_t *lex) {
+    char *word = strdup(lex->text);
+    if (!word) {
+        PANIC("Failed to allocate memory\n");
+    }
+    return new_node(strchr(word, '*') ? QUERY_WILDCARD : QUERY_TERM, word, NULL, NULL);
+}
+
+/**
+ * phrase ::= '"' word { word } '"'
+ * The words are chained from the right, e.g. "a b c" becomes PHRASE(a, PHRASE(b, c)). A phrase of a single
+ * word is just that word.
+ */
+static query_node_t *parse_phrase(parser_t *p) {
+    p->pos++; // opening quote
+    size_t first = p->pos;
+
+    while (peek(p) && peek(p)->type == LEX_WORD) {
+        p->pos++;
+    }
+
+    lexeme_t *lex = peek(p);
+    if (!lex || lex->type != LEX_QUOTE) {
+        snprintf(
+            p->errbuf,
+            LINE_MAX,
+            "expected word or closing '\"' of phrase, found \"%s\"",
+            peek_text(p)
+        );
+        return NULL;
+    }
+    if (p->pos == first) {
+        snprintf(p->errbuf, LINE_MAX, "empty phrase");
+        return NULL;
+    }
+    for (size_t i = first; i < p->pos; i++) {
+        if (strchr(p->lexemes[i].text, '*')) {
+            snprintf(
+                p->errbuf,
+                LINE_MAX,
+                "patterns are not allowed in phrases, found \"%s\"",
+                p->lexemes[i].text
+            );
+            return NULL;
+        }
+    }
+
+    size_t end = p->pos++; // closing quote
+    query_node_t *node = new_word(&p->lexemes[end - 1]);
+
+    for (size_t i = end - 1; i > first; i--) {
+        node = new_node(QUERY_PHRASE, NULL, new_word(&p->lexemes[i - 1]), node);
+    }
+
+    return node;
+}
+
+/* term ::= "(" query ")" | phrase | pattern | word */
+static query_node_t *parse_term(parser_t *p) {
+    lexeme_t *lex = peek(p);
+
+    if (lex && lex->type == LEX_WORD) {
+        p->pos++;
+        return new_word(lex);
+    }
+
+    if (lex && lex->type == LEX_QUOTE) {
+        return parse_phrase(p);
+    }
+
+    if (lex && lex->type == LEX_LPAR) {
+        p->pos++;
+        query_node_t *inner = parse_query(p);
+        if (!inner) {
+            return NULL;
+        }
+
+        lex = peek(p);
+        if (!lex || lex->type != LEX_RPAR) {
+            snprintf(p->errbuf, LINE_MAX, "expected \")\", found \"%s\"", peek_text(p));
+            query_destroy(inner);
+            return NULL;
+        }
+        p->pos++;
+        return inner;
+    }
+
+    if (p->pos == 0) {
+        snprintf(
+            p->errbuf,
+            LINE_MAX,
+            "expected word, phrase or \"(\" at start of query, found \"%s\"",
+            peek_text(p)
+        );
+    } else {
+        snprintf(
+            p->errbuf,
+            LINE_MAX,
+            "expected word, phrase or \"(\" after \"%s\", found \"%s\"",
+            p->lexemes[p->pos - 1].text,
+            peek_text(p)
+        );
+    }
+    return NULL;
+}
+
+/**
+ * Shared by the three binary rules of the grammar, which only differ by operator and operand rule:
+ * rule ::= operand | operand <op> rule
+ */
+static query_node_t *parse_binary(parser_t *p, query_op_t op, query_node_t *(*parse_operand)(parser_t *)) {
+    query_node_t *left = parse_operand(p);
+    if (!left) {
+        return NULL;
+    }
+
+    lexeme_t *lex = peek(p);
+    if (!lex || lex->type != LEX_OP || lex->op != op) {
+        return left;
+    }
+    p->pos++;
+
+    query_node_t *right = parse_binary(p, op, parse_operand);
+    if (!right) {
+        query_destroy(left);
+        return NULL;
+    }
+
+    return new_node(op, NULL, left, right);
+}
+
+/* orterm ::= term | term "||" orterm */
+static query_node_t *parse_orterm(parser_t *p) {
+    return parse_binary(p, QUERY_OR, parse_term);
+}
+
+/* andterm ::= orterm | orterm "&&" andterm */
+static query_node_t *parse_andterm(parser_t *p) {
+    return parse_binary(p, QUERY_AND, parse_orterm);
+}
+
+/* query ::= andterm | andterm "&!" query */
+static query_node_t *parse_query(parser_t *p) {
+    return parse_binary(p, QUERY_ANDNOT, parse_andterm);
+}
+
+query_node_t *query_parse(list_t *tokens, char *errbuf) {
+    list_t *lexemes = list_create(NULL);
+    list_iter_t *iter = list_createiter(tokens);
+
+    if (!lexemes || !iter) {
+        snprintf(errbuf, LINE_MAX, "out of memory");
+        list_destroy(lexemes, NULL);
+        list_destroyiter(iter);
+        return NULL;
+    }
+
+    int status = 0;
+    while (status == 0 && list_hasnext(iter)) {
+        status = lex_token(list_next(iter), lexemes, errbuf);
+    }
+    list_destroyiter(iter);
+
+    /* move the lexemes to a contiguous array, as the parser needs to look back for error messages */
+    parser_t p = {
+        .lexemes = calloc(list_length(lexemes) + 1, sizeof(lexeme_t)),
+        .n_lexemes = 0,
+        .pos = 0,
+        .errbuf = errbuf,
+    };
+    if (!p.lexemes) {
+        PANIC("Failed to allocate memory\n");
+    }
+    while (list_length(lexemes)) {
+        lexeme_t *lex = list_popfirst(lexemes);
+        p.lexemes[p.n_lexemes++] = *lex;
+        free(lex);
+    }
+    list_destroy(lexemes, NULL);
+
+    query_node_t *root = NULL;
+
+    if (status == 0) {
+        root = parse_query(&p);
+
+        /* the entire query must be consumed by the top-level rule */
+        if (root && p.pos < p.n_lexemes) {
+            lexeme_t *lex = peek(&p);
+            if (lex->type == LEX_RPAR) {
+                snprintf(errbuf, LINE_MAX, "unmatched \")\"");
+            } else {
+                snprintf(
+                    errbuf,
+                    LINE_MAX,
+                    "expected operator after \"%s\", found \"%s\"",
+                    p.lexemes[p.pos - 1].text,
+                    lex->text
+                );
+            }
+            query_destroy(root);
+            root = NULL;
+        }
+    }
+
+    for (size_t i = 0; i < p.n_lexemes; i++) {
+        free(p.lexemes[i].text);
+    }
+    free(p.lexemes);
+
+    return root;
+}
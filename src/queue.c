@@ -0,0 +1,174 @@
+/**
+ * @implements queue.h
+ *
+ * @brief Ring buffer of items and their weights, grown as needed, with one lock and a condition for each
+ * direction of waiting.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "queue.h"
+
+
+/* SETTING: initial number of slots of the ring buffer */
+#define QUEUE_CAPACITY_INITIAL 64
+
+typedef struct slot {
+    void *item;
+    size_t weight;
+} slot_t;
+
+struct queue {
+    pthread_mutex_t lock; // protects all members below
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    slot_t *slots;
+    size_t capacity; // number of slots
+    size_t head;     // index of the first item
+    size_t length;   // number of items
+    size_t weight;   // total weight of the items
+    size_t max_weight;
+    size_t n_producers; // producers not yet done
+    int cancelled;
+};
+
+
+queue_t *queue_create(size_t max_weight, size_t n_producers) {
+    queue_t *queue = malloc(sizeof(queue_t));
+    if (!queue) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    queue->slots = malloc(QUEUE_CAPACITY_INITIAL * sizeof(slot_t));
+    if (!queue->slots) {
+        pr_error("Failed to allocate memory\n");
+        free(queue);
+        return NULL;
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    queue->capacity = QUEUE_CAPACITY_INITIAL;
+    queue->head = 0;
+    queue->length = 0;
+    queue->weight = 0;
+    queue->max_weight = max_weight;
+    queue->n_producers = n_producers;
+    queue->cancelled = 0;
+
+    return queue;
+}
+
+void queue_destroy(queue_t *queue, void (*item_free)(void *)) {
+    if (!queue) {
+        return;
+    }
+
+    for (size_t i = 0; item_free && i < queue->length; i++) {
+        item_free(queue->slots[(queue->head + i) % queue->capacity].item);
+    }
+
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->slots);
+    free(queue);
+}
+
+/* double the number of slots, unwrapping the items to the start of the new buffer */
+static void grow(queue_t *queue) {
+    size_t new_capacity = queue->capacity * 2;
+    slot_t *new_slots = malloc(new_capacity * sizeof(slot_t));
+    if (!new_slots) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    for (size_t i = 0; i < queue->length; i++) {
+        new_slots[i] = queue->slots[(queue->head + i) % queue->capacity];
+    }
+
+    free(queue->slots);
+    queue->slots = new_slots;
+    queue->capacity = new_capacity;
+    queue->head = 0;
+}
+
+int queue_push(queue_t *queue, void *item, size_t weight) {
+    pthread_mutex_lock(&queue->lock);
+
+    /* an item too heavy to ever fit is let through once the queue is empty */
+    while (!queue->cancelled && queue->length && queue->weight + weight > queue->max_weight) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+
+    if (queue->cancelled) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    if (queue->length == queue->capacity) {
+        grow(queue);
+    }
+
+    slot_t *slot = &queue->slots[(queue->head + queue->length) % queue->capacity];
+    slot->item = item;
+    slot->weight = weight;
+    queue->length++;
+    queue->weight += weight;
+
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+
+    return 0;
+}
+
+void *queue_pop(queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+
+    while (!queue->cancelled && !queue->length && queue->n_producers) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+
+    if (queue->cancelled || !queue->length) {
+        pthread_mutex_unlock(&queue->lock);
+        return NULL;
+    }
+
+    slot_t *slot = &queue->slots[queue->head];
+    void *item = slot->item;
+
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->length--;
+    queue->weight -= slot->weight;
+
+    /* items vary in weight, so the room made may be enough for any of the waiting producers */
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+
+    return item;
+}
+
+void queue_producer_done(queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->n_producers && --queue->n_producers == 0) {
+        pthread_cond_broadcast(&queue->not_empty);
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void queue_cancel(queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+
+    queue->cancelled = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_cond_broadcast(&queue->not_full);
+
+    pthread_mutex_unlock(&queue->lock);
+}
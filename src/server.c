@@ -0,0 +1,590 @@
+/**
+ * @implements server.h
+ *
+ * @brief Each connection keeps its requests in a list, in the order they were sent. The event loop pushes
+ * every request to a queue, which the workers pop from, and the workers hand each request back through a
+ * list of done requests, waking the event loop with an eventfd. The event loop then moves the replies at the
+ * front of each list that are done to the output buffer of the connection.
+ *
+ * Only the event loop touches the connections. A worker only touches the request it runs.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h> // for LINE_MAX
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "queue.h"
+#include "net.h"
+#include "server.h"
+
+
+/* SETTING: max number of requests of a connection that may be run or wait for their reply at once */
+#define SERVER_PIPELINE_MAX 64
+
+/* SETTING: a connection stops reading requests while this many bytes of replies wait to be sent to it */
+#define SERVER_OUTPUT_MAX (1024 * 1024)
+
+/* SETTING: max number of events handled per wait of the event loop */
+#define SERVER_EVENTS_MAX 64
+
+typedef struct conn conn_t;
+
+/* a request of a connection, run by a worker */
+typedef struct job {
+    conn_t *conn;
+    char *request;
+    char *reply;
+    struct job *next;      // next request of the connection
+    struct job *next_done; // next request of the list of done requests
+    int done;              // set by the event loop, once the job is taken from the list of done requests
+} job_t;
+
+struct conn {
+    int fd;
+    char in[LINE_MAX]; // received bytes, not yet split into requests
+    size_t in_len;
+
+    char *out; // replies not yet sent, from `out_off`
+    size_t out_len;
+    size_t out_off;
+    size_t out_capacity;
+
+    job_t *first; // requests not yet replied to, in the order they were sent
+    job_t *last;
+    size_t n_jobs;
+    size_t n_running; // requests among them that are not done
+
+    int closing;          // no more requests will be read. Closed once the rest are replied to.
+    atomic_int broken;    // the connection failed. Closed once no worker runs its requests.
+    uint32_t events;      // events it is registered for
+    int dead;             // closed, and freed at the end of the iteration of the event loop
+    struct conn *prev;    // in the list of every connection of the server
+    struct conn *next;
+    struct conn *next_dirty; // in the list of connections to update, if `dirty`
+    int dirty;
+};
+
+struct server {
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd; // eventfd, written to once a request is done, or the server should stop
+    atomic_int stop;
+    pthread_t thread; // runs the event loop
+
+    server_handler_fn handler;
+    void *arg;
+    queue_t *jobs; // requests waiting for a worker
+    pthread_t *workers;
+    size_t n_workers;
+
+    pthread_mutex_t lock; // protects `done`
+    job_t *done;          // requests run by a worker, not yet seen by the event loop
+
+    conn_t *conns; // every open connection
+    conn_t *dead;  // closed connections, to free at the end of the iteration
+};
+
+
+/* ------------------------Workers------------------------ */
+
+/* add 1 to an eventfd, waking whoever polls or reads it */
+static void eventfd_signal(int fd) {
+    uint64_t one = 1;
+    ssize_t n = write(fd, &one, sizeof(one));
+    (void) n; // can only fail if the counter overflows, in which case it is signalled anyway
+}
+
+/* thread routine: run requests until the queue is cancelled */
+static void *worker_run(void *arg) {
+    server_t *server = arg;
+    job_t *job;
+
+    while ((job = queue_pop(server->jobs))) {
+        /* no one is left to read the reply of a broken connection */
+        if (!atomic_load_explicit(&job->conn->broken, memory_order_relaxed)) {
+            job->reply = server->handler(job->request, server->arg);
+        }
+
+        pthread_mutex_lock(&server->lock);
+        job->next_done = server->done;
+        server->done = job;
+        pthread_mutex_unlock(&server->lock);
+
+        eventfd_signal(server->wake_fd);
+    }
+
+    return NULL;
+}
+
+
+/* ----------------------Connections---------------------- */
+
+static void conn_free(conn_t *conn) {
+    while (conn->first) {
+        job_t *job = conn->first;
+        conn->first = job->next;
+        free(job->request);
+        free(job->reply);
+        free(job);
+    }
+    close(conn->fd);
+    free(conn->out);
+    free(conn);
+}
+
+/* close the connection. It is freed at the end of the iteration, as later events may still refer to it. */
+static void conn_close(server_t *server, conn_t *conn) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn->dead = 1;
+
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        server->conns = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+
+    conn->next = server->dead;
+    server->dead = conn;
+}
+
+/* the connection failed. Nothing more is sent to it, or read from it. */
+static void conn_break(server_t *server, conn_t *conn) {
+    atomic_store_explicit(&conn->broken, 1, memory_order_relaxed);
+    conn->closing = 1;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn->events = 0;
+}
+
+static void out_append(conn_t *conn, const char *buf, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (conn->out_len + len > conn->out_capacity) {
+        size_t capacity = conn->out_capacity ? conn->out_capacity : 4096;
+        while (capacity < conn->out_len + len) {
+            capacity *= 2;
+        }
+
+        conn->out = realloc(conn->out, capacity);
+        if (!conn->out) {
+            PANIC("Failed to allocate memory\n");
+        }
+        conn->out_capacity = capacity;
+    }
+
+    memcpy(conn->out + conn->out_len, buf, len);
+    conn->out_len += len;
+}
+
+/* move the replies at the front that are done to the output, each ended by an empty line */
+static void take_replies(conn_t *conn) {
+    while (conn->first && conn->first->done) {
+        job_t *job = conn->first;
+        conn->first = job->next;
+        if (!conn->first) {
+            conn->last = NULL;
+        }
+        conn->n_jobs--;
+
+        size_t len = job->reply ? strlen(job->reply) : 0;
+        out_append(conn, job->reply, len);
+
+        if (len && job->reply[len - 1] != '\n') {
+            out_append(conn, "\n", 1);
+        }
+        out_append(conn, "\n", 1);
+
+        free(job->request);
+        free(job->reply);
+        free(job);
+    }
+}
+
+/* queue a request for the workers */
+static void add_job(server_t *server, conn_t *conn, const char *request, size_t len) {
+    job_t *job = malloc(sizeof(job_t));
+    char *copy = malloc(len + 1);
+    if (!job || !copy) {
+        PANIC("Failed to allocate memory\n");
+    }
+    memcpy(copy, request, len);
+    copy[len] = '\0';
+
+    *job = (job_t) { .conn = conn, .request = copy };
+
+    if (conn->last) {
+        conn->last->next = job;
+    } else {
+        conn->first = job;
+    }
+    conn->last = job;
+    conn->n_jobs++;
+    conn->n_running++;
+
+    /* the queue is unbounded, as each connection bounds its own requests */
+    if (queue_push(server->jobs, job, 1) != 0) {
+        /* cancelled, the server is stopping. The job is freed along with its connection. */
+        conn->n_running--;
+    }
+}
+
+/* whether the connection may take more requests, bounding what is held for it */
+static int conn_has_room(conn_t *conn) {
+    return conn->n_jobs < SERVER_PIPELINE_MAX && conn->out_len - conn->out_off < SERVER_OUTPUT_MAX;
+}
+
+/* split the received bytes into requests, as long as there is room for them */
+static void split_requests(server_t *server, conn_t *conn) {
+    size_t start = 0;
+
+    while (conn_has_room(conn)) {
+        char *newline = memchr(conn->in + start, '\n', conn->in_len - start);
+        if (!newline) {
+            break;
+        }
+
+        size_t len = (size_t) (newline - (conn->in + start));
+
+        /* also accept lines ended by "\r\n", as sent by telnet */
+        size_t trimmed = (len && conn->in[start + len - 1] == '\r') ? len - 1 : len;
+        if (trimmed) {
+            add_job(server, conn, conn->in + start, trimmed);
+        }
+        start += len + 1;
+    }
+
+    memmove(conn->in, conn->in + start, conn->in_len - start);
+    conn->in_len -= start;
+
+    /* the rest of a line that does not fit will never end within the buffer */
+    if (conn->in_len == sizeof(conn->in) && conn_has_room(conn)) {
+        pr_warn("Closing connection after a request longer than %d bytes\n", LINE_MAX);
+        conn->closing = 1;
+    }
+}
+
+/* send as much of the output as the socket takes right away */
+static void send_output(server_t *server, conn_t *conn) {
+    while (conn->out_off < conn->out_len) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_off, conn->out_len - conn->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                conn_break(server, conn);
+            }
+            break;
+        }
+        conn->out_off += (size_t) n;
+    }
+
+    if (conn->out_off == conn->out_len) {
+        conn->out_off = 0;
+        conn->out_len = 0;
+    }
+}
+
+/* read what the connection has sent. Called once it is readable. */
+static void recv_input(server_t *server, conn_t *conn) {
+    ssize_t n = recv(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0);
+
+    if (n > 0) {
+        conn->in_len += (size_t) n;
+    } else if (n == 0) {
+        conn->closing = 1; // closed by the client, which may still wait for the replies
+    } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+        conn_break(server, conn);
+    }
+}
+
+/**
+ * Bring the connection up to date: take the replies that are done, read the requests that fit, send what it
+ * takes, and register for the events it then waits for. Closes the connection once it is done with.
+ */
+static void conn_update(server_t *server, conn_t *conn) {
+    if (atomic_load_explicit(&conn->broken, memory_order_relaxed)) {
+        if (conn->n_running == 0) {
+            conn_close(server, conn);
+        }
+        return;
+    }
+
+    take_replies(conn);
+    if (!conn->closing) {
+        split_requests(server, conn);
+    }
+    send_output(server, conn);
+
+    if (atomic_load_explicit(&conn->broken, memory_order_relaxed)) {
+        conn_update(server, conn);
+        return;
+    }
+    if (conn->closing && conn->n_jobs == 0 && conn->out_len == 0) {
+        conn_close(server, conn);
+        return;
+    }
+
+    uint32_t events = 0;
+    if (!conn->closing && conn_has_room(conn) && conn->in_len < sizeof(conn->in)) {
+        events |= EPOLLIN;
+    }
+    if (conn->out_len) {
+        events |= EPOLLOUT;
+    }
+
+    if (events != conn->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = conn };
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->events = events;
+    }
+}
+
+static void accept_conns(server_t *server) {
+    while (1) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                pr_error("Failed to accept connection: %s\n", strerror(errno));
+            }
+            return;
+        }
+
+        /* replies are sent whole, and a pipelining client may wait for each of them */
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        conn_t *conn = calloc(1, sizeof(conn_t));
+        if (!conn) {
+            PANIC("Failed to allocate memory\n");
+        }
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        atomic_init(&conn->broken, 0);
+
+        struct epoll_event ev = { .events = conn->events, .data.ptr = conn };
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            pr_error("Failed to add connection to the event loop: %s\n", strerror(errno));
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        conn->next = server->conns;
+        if (server->conns) {
+            server->conns->prev = conn;
+        }
+        server->conns = conn;
+    }
+}
+
+/* hand the requests done by the workers back to their connections, and update each of those once */
+static void take_done(server_t *server) {
+    uint64_t n_wakes;
+    ssize_t n = read(server->wake_fd, &n_wakes, sizeof(n_wakes));
+    (void) n;
+
+    pthread_mutex_lock(&server->lock);
+    job_t *done = server->done;
+    server->done = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    conn_t *dirty = NULL;
+
+    for (job_t *job = done; job; job = job->next_done) {
+        job->done = 1;
+        job->conn->n_running--;
+
+        if (!job->conn->dirty) {
+            job->conn->dirty = 1;
+            job->conn->next_dirty = dirty;
+            dirty = job->conn;
+        }
+    }
+
+    while (dirty) {
+        conn_t *conn = dirty;
+        dirty = conn->next_dirty;
+        conn->dirty = 0;
+        conn_update(server, conn);
+    }
+}
+
+/* thread routine: run the event loop until stopped */
+static void *loop_run(void *arg) {
+    server_t *server = arg;
+    struct epoll_event events[SERVER_EVENTS_MAX];
+
+    while (!atomic_load(&server->stop)) {
+        int n = epoll_wait(server->epoll_fd, events, SERVER_EVENTS_MAX, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            pr_error("Failed to wait for events: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+
+            if (ptr == &server->listen_fd) {
+                accept_conns(server);
+            } else if (ptr == &server->wake_fd) {
+                take_done(server);
+            } else {
+                conn_t *conn = ptr;
+                if (conn->dead) {
+                    continue;
+                }
+
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    conn_break(server, conn);
+                } else if (events[i].events & EPOLLIN) {
+                    recv_input(server, conn);
+                }
+                conn_update(server, conn);
+            }
+        }
+
+        while (server->dead) {
+            conn_t *conn = server->dead;
+            server->dead = conn->next;
+            conn_free(conn);
+        }
+    }
+
+    return NULL;
+}
+
+
+/* -------------------------Server------------------------ */
+
+/* free what server_start set up, where each member is either set up or zero/-1 */
+static void server_free(server_t *server) {
+    queue_destroy(server->jobs, NULL);
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+    }
+    if (server->epoll_fd >= 0) {
+        close(server->epoll_fd);
+    }
+    if (server->wake_fd >= 0) {
+        close(server->wake_fd);
+    }
+    pthread_mutex_destroy(&server->lock);
+    free(server->workers);
+    free(server);
+}
+
+server_t *server_start(const char *addr, size_t n_workers, server_handler_fn handler, void *arg) {
+    server_t *server = calloc(1, sizeof(server_t));
+    if (!server) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    server->handler = handler;
+    server->arg = arg;
+    server->n_workers = n_workers ? n_workers : 1;
+    server->epoll_fd = -1;
+    server->wake_fd = -1;
+    atomic_init(&server->stop, 0);
+    pthread_mutex_init(&server->lock, NULL);
+
+    server->listen_fd = net_listen(addr);
+    if (server->listen_fd < 0) {
+        server_free(server);
+        return NULL;
+    }
+
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    server->jobs = queue_create(SIZE_MAX, 1);
+    server->workers = calloc(server->n_workers, sizeof(pthread_t));
+
+    struct epoll_event listen_ev = { .events = EPOLLIN, .data.ptr = &server->listen_fd };
+    struct epoll_event wake_ev = { .events = EPOLLIN, .data.ptr = &server->wake_fd };
+
+    if (server->epoll_fd < 0 || server->wake_fd < 0 || !server->jobs || !server->workers
+        || fcntl(server->listen_fd, F_SETFL, O_NONBLOCK) < 0
+        || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &listen_ev) < 0
+        || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->wake_fd, &wake_ev) < 0) {
+        pr_error("Failed to set up the server: %s\n", strerror(errno));
+        server_free(server);
+        return NULL;
+    }
+
+    size_t n_started = 0;
+    int err = 0;
+
+    while (n_started < server->n_workers && !err) {
+        err = pthread_create(&server->workers[n_started], NULL, worker_run, server);
+        n_started += !err;
+    }
+    if (!err) {
+        err = pthread_create(&server->thread, NULL, loop_run, server);
+    }
+
+    if (err) {
+        pr_error("Failed to start server thread: %s\n", strerror(err));
+        queue_cancel(server->jobs);
+        for (size_t i = 0; i < n_started; i++) {
+            pthread_join(server->workers[i], NULL);
+        }
+        server_free(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+void server_stop(server_t *server) {
+    if (!server) {
+        return;
+    }
+
+    atomic_store(&server->stop, 1);
+    eventfd_signal(server->wake_fd);
+    pthread_join(server->thread, NULL);
+
+    /* requests not yet run are dropped, and those running are waited for */
+    queue_cancel(server->jobs);
+    for (size_t i = 0; i < server->n_workers; i++) {
+        pthread_join(server->workers[i], NULL);
+    }
+
+    /* every request is held by its connection, whether queued, done or neither */
+    while (server->conns) {
+        conn_t *conn = server->conns;
+        server->conns = conn->next;
+        conn_free(conn);
+    }
+    while (server->dead) {
+        conn_t *conn = server->dead;
+        server->dead = conn->next;
+        conn_free(conn);
+    }
+
+    server_free(server);
+}
@@ -0,0 +1,1121 @@
+/**
+ * @implements shard.h
+ *
+ * @brief Messages are built in, and read from, a growable buffer per connection. Each shard of a coordinator
+ * keeps a pool of idle connections, and a query takes one connection of every shard for as long as it runs.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h> // for LINE_MAX
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include <sys/socket.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "list.h"
+#include "query.h"
+#include "index.h"
+#include "net.h"
+#include "profile.h"
+#include "shard.h"
+
+
+/* SETTING: max size of a message, in bytes. Larger ones are taken as malformed, and the connection closed. */
+#define SHARD_MSG_MAX (64 * 1024 * 1024)
+
+/**
+ * SETTING: milliseconds a shard server waits before accepting connections again, after failing to for lack of
+ * file descriptors or memory. Connections that close in the meantime give them back.
+ */
+#define SHARD_ACCEPT_BACKOFF_MS 100
+
+/* max depth of the AST of a query. Queries are read from lines of at most LINE_MAX characters. */
+#define SHARD_QUERY_DEPTH_MAX LINE_MAX
+
+/* type of message, the byte following its length */
+typedef enum shard_msg {
+    MSG_STATS = 1,
+    MSG_SEARCH,
+    MSG_INFO,
+    MSG_STATS_REPLY,
+    MSG_RESULTS,
+    MSG_INFO_REPLY,
+    MSG_ERROR,
+} shard_msg_t;
+
+/* message being built or read. Reused for every message of a connection. */
+typedef struct msg {
+    uint8_t *buf;
+    size_t len;
+    size_t capacity;
+} msg_t;
+
+/* read position in the payload of a received message */
+typedef struct reader {
+    const uint8_t *p;
+    const uint8_t *end;
+    int failed; // set once a read runs past the end, after which every read yields 0
+} reader_t;
+
+
+/* ------------------------Encoding----------------------- */
+
+static void put_bytes(msg_t *msg, const void *src, size_t n) {
+    if (msg->len + n > msg->capacity) {
+        size_t capacity = msg->capacity ? msg->capacity : 256;
+        while (capacity < msg->len + n) {
+            capacity *= 2;
+        }
+
+        uint8_t *buf = realloc(msg->buf, capacity);
+        if (!buf) {
+            PANIC("Failed to allocate memory\n");
+        }
+        msg->buf = buf;
+        msg->capacity = capacity;
+    }
+
+    memcpy(msg->buf + msg->len, src, n);
+    msg->len += n;
+}
+
+/* append the lowest `n_bytes` of val, least significant first */
+static void put_uint(msg_t *msg, uint64_t val, size_t n_bytes) {
+    uint8_t bytes[8];
+
+    for (size_t i = 0; i < n_bytes; i++) {
+        bytes[i] = (uint8_t) (val >> (8 * i));
+    }
+    put_bytes(msg, bytes, n_bytes);
+}
+
+static inline void put_u8(msg_t *msg, uint8_t val) {
+    put_uint(msg, val, 1);
+}
+
+static inline void put_u16(msg_t *msg, uint16_t val) {
+    put_uint(msg, val, 2);
+}
+
+static inline void put_u32(msg_t *msg, uint32_t val) {
+    put_uint(msg, val, 4);
+}
+
+static inline void put_u64(msg_t *msg, uint64_t val) {
+    put_uint(msg, val, 8);
+}
+
+static inline void put_f64(msg_t *msg, double val) {
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    put_u64(msg, bits);
+}
+
+/* strings longer than a u16 can hold are cut short, which no term or path of a document is */
+static void put_str(msg_t *msg, const char *str) {
+    size_t len = strlen(str);
+    if (len > UINT16_MAX) {
+        len = UINT16_MAX;
+    }
+    put_u16(msg, (uint16_t) len);
+    put_bytes(msg, str, len);
+}
+
+static uint64_t get_uint(reader_t *r, size_t n_bytes) {
+    if (r->failed || (size_t) (r->end - r->p) < n_bytes) {
+        r->failed = 1;
+        return 0;
+    }
+
+    uint64_t val = 0;
+    for (size_t i = 0; i < n_bytes; i++) {
+        val |= (uint64_t) r->p[i] << (8 * i);
+    }
+    r->p += n_bytes;
+
+    return val;
+}
+
+static inline uint8_t get_u8(reader_t *r) {
+    return (uint8_t) get_uint(r, 1);
+}
+
+static inline uint32_t get_u32(reader_t *r) {
+    return (uint32_t) get_uint(r, 4);
+}
+
+static inline uint64_t get_u64(reader_t *r) {
+    return get_uint(r, 8);
+}
+
+static inline double get_f64(reader_t *r) {
+    uint64_t bits = get_u64(r);
+    double val;
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+/* @returns a null-terminated copy of the string, or NULL if the read fails */
+static char *get_str(reader_t *r) {
+    size_t len = get_uint(r, 2);
+    if (r->failed || (size_t) (r->end - r->p) < len) {
+        r->failed = 1;
+        return NULL;
+    }
+
+    char *str = strndup((const char *) r->p, len);
+    if (!str) {
+        PANIC("Failed to allocate memory\n");
+    }
+    r->p += len;
+
+    return str;
+}
+
+/* start a message of the given type, replacing any message in the buffer */
+static void msg_begin(msg_t *msg, shard_msg_t type) {
+    msg->len = 0;
+    put_u32(msg, 0); // length, filled in by msg_send
+    put_u8(msg, (uint8_t) type);
+}
+
+/* @returns 0 on success, otherwise -1 */
+static int msg_send(int fd, msg_t *msg) {
+    uint32_t len = (uint32_t) (msg->len - sizeof(uint32_t));
+
+    for (size_t i = 0; i < sizeof(uint32_t); i++) {
+        msg->buf[i] = (uint8_t) (len >> (8 * i));
+    }
+    return net_write_full(fd, msg->buf, msg->len);
+}
+
+/**
+ * Receive a message into the buffer
+ * @param type: set to the type of the message
+ * @param payload: set to read the payload of the message, which is valid until the buffer is reused
+ * @returns 0 on success, or -1 if the connection fails or the message is malformed
+ */
+static int msg_recv(int fd, msg_t *msg, shard_msg_t *type, reader_t *payload) {
+    uint8_t header[sizeof(uint32_t)];
+    if (net_read_full(fd, header, sizeof(header)) < 0) {
+        return -1;
+    }
+
+    reader_t r = { .p = header, .end = header + sizeof(header), .failed = 0 };
+    uint32_t len = get_u32(&r);
+    if (len == 0 || len > SHARD_MSG_MAX) {
+        return -1;
+    }
+
+    if (len > msg->capacity) {
+        uint8_t *buf = realloc(msg->buf, len);
+        if (!buf) {
+            PANIC("Failed to allocate memory\n");
+        }
+        msg->buf = buf;
+        msg->capacity = len;
+    }
+
+    if (net_read_full(fd, msg->buf, len) < 0) {
+        return -1;
+    }
+    msg->len = len;
+
+    *type = (shard_msg_t) msg->buf[0];
+    *payload = (reader_t) { .p = msg->buf + 1, .end = msg->buf + len, .failed = 0 };
+
+    return 0;
+}
+
+/* Append the AST of a query, in prefix order */
+static void put_query(msg_t *msg, query_node_t *node) {
+    put_u8(msg, (uint8_t) node->op);
+
+    if (node->op == QUERY_TERM || node->op == QUERY_WILDCARD) {
+        put_str(msg, node->term);
+        return;
+    }
+    put_query(msg, node->left);
+    put_query(msg, node->right);
+}
+
+/**
+ * Read the AST of a query. Any AST that query_parse could not have produced is rejected, as the index relies
+ * on its shape, e.g. that each word of a phrase is a term.
+ * @returns the root of the AST, or NULL if it is malformed
+ */
+static query_node_t *get_query(reader_t *r, size_t depth) {
+    query_op_t op = (query_op_t) get_u8(r);
+    if (r->failed || depth > SHARD_QUERY_DEPTH_MAX) {
+        return NULL;
+    }
+
+    query_node_t *node = malloc(sizeof(query_node_t));
+    if (!node) {
+        PANIC("Failed to allocate memory\n");
+    }
+    node->op = op;
+    node->term = NULL;
+    node->left = NULL;
+    node->right = NULL;
+
+    int valid;
+
+    switch (op) {
+        case QUERY_TERM:
+            ATTR_FALLTHROUGH;
+        case QUERY_WILDCARD:
+            node->term = get_str(r);
+            valid = node->term && *node->term && (strchr(node->term, '*') != NULL) == (op == QUERY_WILDCARD);
+            break;
+        case QUERY_AND:
+            ATTR_FALLTHROUGH;
+        case QUERY_OR:
+            ATTR_FALLTHROUGH;
+        case QUERY_ANDNOT:
+            node->left = get_query(r, depth + 1);
+            node->right = node->left ? get_query(r, depth + 1) : NULL;
+            valid = node->right != NULL;
+            break;
+        case QUERY_PHRASE:
+            node->left = get_query(r, depth + 1);
+            node->right = node->left ? get_query(r, depth + 1) : NULL;
+            valid = node->right && node->left->op == QUERY_TERM
+                    && (node->right->op == QUERY_TERM || node->right->op == QUERY_PHRASE);
+            break;
+        default:
+            valid = 0;
+            break;
+    }
+
+    if (!valid) {
+        query_destroy(node);
+        return NULL;
+    }
+
+    return node;
+}
+
+static void put_stats(msg_t *msg, const index_stats_t *stats) {
+    put_u64(msg, stats->n_docs);
+    put_u64(msg, stats->total_length);
+    put_u32(msg, (uint32_t) stats->n_terms);
+
+    for (size_t i = 0; i < stats->n_terms; i++) {
+        put_str(msg, stats->terms[i].term);
+        put_u64(msg, stats->terms[i].n_docs);
+    }
+}
+
+/**
+ * Read statistics, such as put_stats writes
+ * @returns the statistics, to be destroyed with index_stats_destroy, or NULL if they are malformed. The terms
+ * must be distinct and in ascending order, which the index relies on.
+ */
+static index_stats_t *get_stats(reader_t *r) {
+    index_stats_t *stats = malloc(sizeof(index_stats_t));
+    if (!stats) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    stats->n_docs = get_u64(r);
+    stats->total_length = get_u64(r);
+    stats->n_terms = 0;
+
+    /* each term takes up at least 10 bytes, which bounds what a message can claim to hold */
+    size_t n_terms = get_u32(r);
+    if (r->failed || n_terms > (size_t) (r->end - r->p) / 10) {
+        free(stats);
+        return NULL;
+    }
+
+    stats->terms = malloc((n_terms + 1) * sizeof(term_stat_t));
+    if (!stats->terms) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    for (size_t i = 0; i < n_terms; i++) {
+        char *term = get_str(r);
+        uint64_t n_docs = get_u64(r);
+
+        if (r->failed || (i > 0 && strcmp(stats->terms[i - 1].term, term) >= 0)) {
+            free(term);
+            index_stats_destroy(stats);
+            return NULL;
+        }
+        stats->terms[stats->n_terms++] = (term_stat_t) { .term = term, .n_docs = n_docs };
+    }
+
+    return stats;
+}
+
+/* -------------------------Server------------------------ */
+
+/* a connection of a coordinator to the server, served by a thread of its own */
+typedef struct conn {
+    shard_server_t *server;
+    int fd;
+    pthread_t thread;
+    atomic_int done; // set once the thread is about to return
+} conn_t;
+
+struct shard_server {
+    index_t *index;
+    int listen_fd;
+    atomic_int stop;
+    pthread_t thread; // accepts connections
+
+    pthread_mutex_t lock; // protects the connections
+    conn_t **conns;
+    size_t n_conns;
+    size_t conns_capacity;
+};
+
+/* reply to STATS */
+static int handle_stats(index_t *index, reader_t *r, msg_t *reply) {
+    query_node_t *query = get_query(r, 0);
+    if (!query || r->p != r->end) {
+        query_destroy(query);
+        return -1;
+    }
+
+    char errmsg[LINE_MAX];
+    index_stats_t *stats = index_query_stats(index, query, errmsg);
+    query_destroy(query);
+
+    if (!stats) {
+        msg_begin(reply, MSG_ERROR);
+        put_str(reply, errmsg);
+        return 0;
+    }
+
+    msg_begin(reply, MSG_STATS_REPLY);
+    put_stats(reply, stats);
+    index_stats_destroy(stats);
+
+    return 0;
+}
+
+/* reply to SEARCH */
+static int handle_search(index_t *index, reader_t *r, msg_t *reply) {
+    uint64_t k = get_u64(r);
+    index_stats_t *stats = get_stats(r);
+    query_node_t *query = stats ? get_query(r, 0) : NULL;
+
+    if (!query || r->p != r->end) {
+        index_stats_destroy(stats);
+        query_destroy(query);
+        return -1;
+    }
+
+    char errmsg[LINE_MAX];
+    match_count_t n_matches = { .n = 0, .exact = 1 };
+    list_t *results = index_query_parsed(index, query, (size_t) k, stats, &n_matches, errmsg);
+    index_stats_destroy(stats);
+    query_destroy(query);
+
+    if (!results) {
+        msg_begin(reply, MSG_ERROR);
+        put_str(reply, errmsg);
+        return 0;
+    }
+
+    msg_begin(reply, MSG_RESULTS);
+    put_u64(reply, n_matches.n);
+    put_u8(reply, (uint8_t) n_matches.exact);
+    put_u32(reply, (uint32_t) list_length(results));
+
+    while (list_length(results)) {
+        query_result_t *res = list_popfirst(results);
+        put_f64(reply, res->score);
+        put_str(reply, res->doc_name);
+        free(res);
+    }
+    list_destroy(results, NULL);
+
+    return 0;
+}
+
+/**
+ * Build the reply to a request
+ * @returns 0 on success, or -1 if the request is malformed
+ */
+static int handle_request(index_t *index, shard_msg_t type, reader_t *r, msg_t *reply) {
+    switch (type) {
+        case MSG_STATS:
+            return handle_stats(index, r, reply);
+        case MSG_SEARCH:
+            return handle_search(index, r, reply);
+        case MSG_INFO: {
+            size_t n_docs, n_terms;
+            index_stat(index, &n_docs, &n_terms);
+
+            msg_begin(reply, MSG_INFO_REPLY);
+            put_u64(reply, n_docs);
+            put_u64(reply, n_terms);
+            return (r->p == r->end) ? 0 : -1;
+        }
+        default:
+            return -1;
+    }
+}
+
+/* thread routine: answer the requests of a connection until it is closed */
+static void *conn_run(void *arg) {
+    conn_t *conn = arg;
+    msg_t request = { .buf = NULL, .len = 0, .capacity = 0 };
+    msg_t reply = { .buf = NULL, .len = 0, .capacity = 0 };
+
+    while (!atomic_load(&conn->server->stop)) {
+        shard_msg_t type;
+        reader_t payload;
+
+        if (msg_recv(conn->fd, &request, &type, &payload) < 0) {
+            break; // closed by the coordinator, or malformed
+        }
+        if (handle_request(conn->server->index, type, &payload, &reply) < 0) {
+            pr_warn("Closing connection after a malformed request\n");
+            break;
+        }
+        if (msg_send(conn->fd, &reply) < 0) {
+            break;
+        }
+    }
+
+    free(request.buf);
+    free(reply.buf);
+    atomic_store(&conn->done, 1);
+
+    return NULL;
+}
+
+/* join and free the connection, once its thread is done or made to stop */
+static void conn_destroy(conn_t *conn) {
+    pthread_join(conn->thread, NULL);
+    close(conn->fd);
+    free(conn);
+}
+
+/* join the threads of closed connections, such that they do not pile up. Must be called with `lock` held. */
+static void reap_conns(shard_server_t *server) {
+    size_t n_open = 0;
+
+    for (size_t i = 0; i < server->n_conns; i++) {
+        conn_t *conn = server->conns[i];
+        if (atomic_load(&conn->done)) {
+            conn_destroy(conn);
+        } else {
+            server->conns[n_open++] = conn;
+        }
+    }
+    server->n_conns = n_open;
+}
+
+static void add_conn(shard_server_t *server, int fd) {
+    conn_t *conn = malloc(sizeof(conn_t));
+    if (!conn) {
+        PANIC("Failed to allocate memory\n");
+    }
+    conn->server = server;
+    conn->fd = fd;
+    atomic_init(&conn->done, 0);
+
+    pthread_mutex_lock(&server->lock);
+    reap_conns(server);
+
+    if (server->n_conns == server->conns_capacity) {
+        server->conns_capacity = server->conns_capacity ? server->conns_capacity * 2 : 8;
+        server->conns = realloc(server->conns, server->conns_capacity * sizeof(conn_t *));
+        if (!server->conns) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+
+    int err = pthread_create(&conn->thread, NULL, conn_run, conn);
+    if (err != 0) {
+        pr_error("Failed to create thread for connection: %s\n", strerror(err));
+        close(fd);
+        free(conn);
+    } else {
+        server->conns[server->n_conns++] = conn;
+    }
+
+    pthread_mutex_unlock(&server->lock);
+}
+
+/* thread routine: accept connections until stopped */
+static void *accept_run(void *arg) {
+    shard_server_t *server = arg;
+
+    while (!atomic_load(&server->stop)) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            int err = errno;
+
+            /* only stop once the listening socket is shut down, see shard_server_stop */
+            if (atomic_load(&server->stop) || err == EINVAL || err == EBADF) {
+                break;
+            }
+            if (err == EINTR || err == ECONNABORTED) {
+                continue;
+            }
+
+            /**
+             * Out of file descriptors or memory (EMFILE, ENFILE, ENOBUFS, ENOMEM), or a network error of the
+             * pending connection, which Linux reports here as well. Either way later connections may be
+             * accepted, so give back the descriptors of closed connections and back off rather than retry
+             * right away.
+             */
+            pr_error("Failed to accept connection: %s\n", strerror(err));
+            pthread_mutex_lock(&server->lock);
+            reap_conns(server);
+            pthread_mutex_unlock(&server->lock);
+            struct timespec backoff = { .tv_sec = 0, .tv_nsec = SHARD_ACCEPT_BACKOFF_MS * 1000000L };
+            nanosleep(&backoff, NULL);
+            continue;
+        }
+
+        add_conn(server, fd);
+    }
+
+    return NULL;
+}
+
+shard_server_t *shard_server_start(index_t *index, const char *addr) {
+    shard_server_t *server = calloc(1, sizeof(shard_server_t));
+    if (!server) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    server->index = index;
+    server->listen_fd = net_listen(addr);
+    if (server->listen_fd < 0) {
+        free(server);
+        return NULL;
+    }
+
+    atomic_init(&server->stop, 0);
+    pthread_mutex_init(&server->lock, NULL);
+
+    int err = pthread_create(&server->thread, NULL, accept_run, server);
+    if (err != 0) {
+        pr_error("Failed to start shard server thread: %s\n", strerror(err));
+        pthread_mutex_destroy(&server->lock);
+        close(server->listen_fd);
+        free(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+void shard_server_stop(shard_server_t *server) {
+    if (!server) {
+        return;
+    }
+
+    /* shutting the sockets down wakes any thread blocked on them */
+    atomic_store(&server->stop, 1);
+    shutdown(server->listen_fd, SHUT_RDWR);
+    pthread_join(server->thread, NULL);
+    close(server->listen_fd);
+
+    for (size_t i = 0; i < server->n_conns; i++) {
+        shutdown(server->conns[i]->fd, SHUT_RDWR);
+        conn_destroy(server->conns[i]);
+    }
+
+    pthread_mutex_destroy(&server->lock);
+    free(server->conns);
+    free(server);
+}
+
+/* ----------------------Coordinator---------------------- */
+
+typedef struct shard {
+    char *addr;
+    pthread_mutex_t lock; // protects the idle connections
+    int *idle;            // open connections not in use by any query
+    size_t n_idle;
+    size_t idle_capacity;
+} shard_t;
+
+struct coordinator {
+    shard_t *shards;
+    size_t n_shards;
+};
+
+/* take an idle connection to the shard, or open a new one. -1 on failure. */
+static int shard_acquire(shard_t *shard) {
+    int fd = -1;
+
+    pthread_mutex_lock(&shard->lock);
+    if (shard->n_idle) {
+        fd = shard->idle[--shard->n_idle];
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return (fd >= 0) ? fd : net_connect(shard->addr);
+}
+
+/* hand a connection back to the shard, to be used by the next query */
+static void shard_release(shard_t *shard, int fd) {
+    pthread_mutex_lock(&shard->lock);
+
+    if (shard->n_idle == shard->idle_capacity) {
+        shard->idle_capacity = shard->idle_capacity ? shard->idle_capacity * 2 : 4;
+        shard->idle = realloc(shard->idle, shard->idle_capacity * sizeof(int));
+        if (!shard->idle) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+    shard->idle[shard->n_idle++] = fd;
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+coordinator_t *coordinator_create(const char *addrs) {
+    coordinator_t *coord = calloc(1, sizeof(coordinator_t));
+    char *addrs_cpy = strdup(addrs);
+    if (!coord || !addrs_cpy) {
+        pr_error("Failed to allocate memory\n");
+        free(coord);
+        free(addrs_cpy);
+        return NULL;
+    }
+
+    size_t max_shards = 1;
+    for (const char *c = addrs; *c; c++) {
+        max_shards += (*c == ',');
+    }
+
+    coord->shards = calloc(max_shards, sizeof(shard_t));
+    if (!coord->shards) {
+        pr_error("Failed to allocate memory\n");
+        free(coord);
+        free(addrs_cpy);
+        return NULL;
+    }
+
+    char *saveptr = NULL;
+    int status = 0;
+
+    for (char *addr = strtok_r(addrs_cpy, ",", &saveptr); addr; addr = strtok_r(NULL, ",", &saveptr)) {
+        shard_t *shard = &coord->shards[coord->n_shards++];
+
+        shard->addr = strdup(addr);
+        if (!shard->addr) {
+            PANIC("Failed to allocate memory\n");
+        }
+        pthread_mutex_init(&shard->lock, NULL);
+
+        int fd = net_connect(shard->addr);
+        if (fd < 0) {
+            status = -1;
+            break;
+        }
+        shard_release(shard, fd);
+    }
+    free(addrs_cpy);
+
+    if (status == 0 && coord->n_shards == 0) {
+        pr_error("Expected the address of at least one shard\n");
+        status = -1;
+    }
+
+    if (status < 0) {
+        coordinator_destroy(coord);
+        return NULL;
+    }
+
+    return coord;
+}
+
+void coordinator_destroy(coordinator_t *coord) {
+    if (!coord) {
+        return;
+    }
+
+    for (size_t i = 0; i < coord->n_shards; i++) {
+        shard_t *shard = &coord->shards[i];
+
+        for (size_t j = 0; j < shard->n_idle; j++) {
+            close(shard->idle[j]);
+        }
+        free(shard->idle);
+        free(shard->addr);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(coord->shards);
+    free(coord);
+}
+
+/* the state of one shard during a query */
+typedef struct request {
+    int fd;              // connection to the shard. -1 once it fails.
+    msg_t reply;
+    shard_msg_t type;    // of the reply
+    reader_t payload;    // of the reply
+    index_stats_t *stats; // reply to STATS
+    query_result_t **results; // reply to SEARCH, best first
+    size_t n_results;
+    match_count_t n_matches;
+} request_t;
+
+/**
+ * Send the message to each shard, then wait for the reply of each. Shards whose connection fails get their
+ * `fd` set to -1, and an error written to `errmsg`, unless some other error is already.
+ * @returns 0 if every shard replied, otherwise -1
+ */
+static int scatter_gather(coordinator_t *coord, request_t *reqs, msg_t *msg, char *errmsg) {
+    int status = 0;
+
+    for (size_t i = 0; i < coord->n_shards; i++) {
+        if (reqs[i].fd >= 0 && msg_send(reqs[i].fd, msg) < 0) {
+            close(reqs[i].fd);
+            reqs[i].fd = -1;
+        }
+    }
+
+    for (size_t i = 0; i < coord->n_shards; i++) {
+        if (reqs[i].fd >= 0 && msg_recv(reqs[i].fd, &reqs[i].reply, &reqs[i].type, &reqs[i].payload) < 0) {
+            close(reqs[i].fd);
+            reqs[i].fd = -1;
+        }
+
+        if (reqs[i].fd < 0) {
+            if (status == 0) {
+                snprintf(errmsg, LINE_MAX, "lost connection to shard at \"%s\"", coord->shards[i].addr);
+            }
+            status = -1;
+        }
+    }
+
+    return status;
+}
+
+/**
+ * Check the type of the reply of each shard, writing the first error any shard replied with to `errmsg`
+ * @returns 0 if every shard replied with `type`, otherwise -1
+ */
+static int check_replies(coordinator_t *coord, request_t *reqs, shard_msg_t type, char *errmsg) {
+    for (size_t i = 0; i < coord->n_shards; i++) {
+        if (reqs[i].type == type) {
+            continue;
+        }
+
+        if (reqs[i].type == MSG_ERROR) {
+            char *shard_errmsg = get_str(&reqs[i].payload);
+            snprintf(errmsg, LINE_MAX, "%s", shard_errmsg ? shard_errmsg : "unknown error");
+            free(shard_errmsg);
+        } else {
+            snprintf(errmsg, LINE_MAX, "unexpected reply from shard at \"%s\"", coord->shards[i].addr);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/* sum the statistics of every shard. Each term is counted by the shards it is in. */
+static index_stats_t *sum_stats(coordinator_t *coord, request_t *reqs) {
+    index_stats_t *sum = calloc(1, sizeof(index_stats_t));
+    size_t n_terms = 0;
+
+    for (size_t i = 0; i < coord->n_shards; i++) {
+        n_terms += reqs[i].stats->n_terms;
+    }
+
+    term_stat_t *terms = malloc((n_terms + 1) * sizeof(term_stat_t));
+    if (!sum || !terms) {
+        PANIC("Failed to allocate memory\n");
+    }
+    sum->terms = terms;
+
+    /* the terms of each shard are in ascending order, so merge them, adding up those in several shards */
+    size_t *pos = calloc(coord->n_shards, sizeof(size_t));
+    if (!pos) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    while (1) {
+        const char *next = NULL;
+
+        for (size_t i = 0; i < coord->n_shards; i++) {
+            index_stats_t *stats = reqs[i].stats;
+            if (pos[i] < stats->n_terms && (!next || strcmp(stats->terms[pos[i]].term, next) < 0)) {
+                next = stats->terms[pos[i]].term;
+            }
+        }
+        if (!next) {
+            break;
+        }
+
+        term_stat_t *dst = &sum->terms[sum->n_terms++];
+        *dst = (term_stat_t) { .term = strdup(next), .n_docs = 0 };
+        if (!dst->term) {
+            PANIC("Failed to allocate memory\n");
+        }
+
+        for (size_t i = 0; i < coord->n_shards; i++) {
+            index_stats_t *stats = reqs[i].stats;
+            if (pos[i] < stats->n_terms && strcmp(stats->terms[pos[i]].term, dst->term) == 0) {
+                dst->n_docs += stats->terms[pos[i]++].n_docs;
+            }
+        }
+    }
+    free(pos);
+
+    for (size_t i = 0; i < coord->n_shards; i++) {
+        sum->n_docs += reqs[i].stats->n_docs;
+        sum->total_length += reqs[i].stats->total_length;
+    }
+
+    return sum;
+}
+
+/* read the results of a shard, in the same form as index_query_topk. -1 if the reply is malformed. */
+static int get_results(request_t *req) {
+    reader_t *r = &req->payload;
+
+    req->n_matches.n = (size_t) get_u64(r);
+    req->n_matches.exact = (get_u8(r) != 0);
+    size_t n_results = get_u32(r);
+
+    /* each result takes up at least 10 bytes */
+    if (r->failed || n_results > (size_t) (r->end - r->p) / 10) {
+        return -1;
+    }
+
+    req->results = malloc((n_results + 1) * sizeof(query_result_t *));
+    if (!req->results) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    for (size_t i = 0; i < n_results; i++) {
+        double score = get_f64(r);
+        char *doc_name = get_str(r);
+        if (!doc_name) {
+            return -1;
+        }
+
+        size_t name_size = strlen(doc_name) + 1;
+        query_result_t *res = malloc(sizeof(query_result_t) + name_size);
+        if (!res) {
+            PANIC("Failed to allocate memory\n");
+        }
+        res->doc_name = memcpy(res + 1, doc_name, name_size);
+        res->score = score;
+        free(doc_name);
+
+        req->results[req->n_results++] = res;
+    }
+
+    return 0;
+}
+
+/**
+ * Merge the results of every shard into the `k` best, in descending order of score. Ties are broken by the
+ * order of the shards. Results left out are freed.
+ */
+static void merge_results(coordinator_t *coord, request_t *reqs, size_t k, list_t *dst) {
+    size_t *pos = calloc(coord->n_shards, sizeof(size_t));
+    if (!pos) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    while (k == 0 || list_length(dst) < k) {
+        request_t *best = NULL;
+        size_t i_best = 0;
+
+        for (size_t i = 0; i < coord->n_shards; i++) {
+            if (pos[i] < reqs[i].n_results
+                && (!best || reqs[i].results[pos[i]]->score > best->results[pos[i_best]]->score)) {
+                best = &reqs[i];
+                i_best = i;
+            }
+        }
+        if (!best) {
+            break;
+        }
+
+        if (list_addlast(dst, best->results[pos[i_best]++]) < 0) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+
+    for (size_t i = 0; i < coord->n_shards; i++) {
+        for (size_t j = pos[i]; j < reqs[i].n_results; j++) {
+            free(reqs[i].results[j]);
+        }
+    }
+    free(pos);
+}
+
+list_t *coordinator_query_topk(
+    coordinator_t *coord,
+    list_t *query_tokens,
+    size_t k,
+    match_count_t *n_matches,
+    char *errmsg
+) {
+    PROF_START(t_parse);
+    query_node_t *root = query_parse(query_tokens, errmsg);
+    PROF_STOP(PROF_QUERY_PARSE, t_parse);
+
+    if (!root) {
+        return NULL;
+    }
+
+    PROF_START(t_eval);
+
+    list_t *results = list_create((cmp_fn) compare_results_by_score);
+    request_t *reqs = calloc(coord->n_shards, sizeof(request_t));
+    msg_t msg = { .buf = NULL, .len = 0, .capacity = 0 };
+    if (!results || !reqs) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    int status = 0;
+
+    for (size_t i = 0; i < coord->n_shards; i++) {
+        reqs[i].fd = shard_acquire(&coord->shards[i]);
+        if (reqs[i].fd < 0 && status == 0) {
+            snprintf(errmsg, LINE_MAX, "failed to connect to shard at \"%s\"", coord->shards[i].addr);
+            status = -1;
+        }
+    }
+
+    /* 1. gather the statistics of the collection */
+    index_stats_t *stats = NULL;
+
+    if (status == 0) {
+        msg_begin(&msg, MSG_STATS);
+        put_query(&msg, root);
+        status = scatter_gather(coord, reqs, &msg, errmsg);
+    }
+    if (status == 0) {
+        status = check_replies(coord, reqs, MSG_STATS_REPLY, errmsg);
+    }
+    for (size_t i = 0; i < coord->n_shards && status == 0; i++) {
+        reqs[i].stats = get_stats(&reqs[i].payload);
+        if (!reqs[i].stats) {
+            snprintf(errmsg, LINE_MAX, "malformed statistics from shard at \"%s\"", coord->shards[i].addr);
+            status = -1;
+        }
+    }
+    if (status == 0) {
+        stats = sum_stats(coord, reqs);
+    }
+
+    /* 2. rank the matches of every shard by them, and gather the best of each */
+    if (status == 0) {
+        msg_begin(&msg, MSG_SEARCH);
+        put_u64(&msg, k);
+        put_stats(&msg, stats);
+        put_query(&msg, root);
+        status = scatter_gather(coord, reqs, &msg, errmsg);
+    }
+    if (status == 0) {
+        status = check_replies(coord, reqs, MSG_RESULTS, errmsg);
+    }
+    for (size_t i = 0; i < coord->n_shards && status == 0; i++) {
+        if (get_results(&reqs[i]) < 0) {
+            snprintf(errmsg, LINE_MAX, "malformed results from shard at \"%s\"", coord->shards[i].addr);
+            status = -1;
+        }
+    }
+
+    match_count_t n_total = { .n = 0, .exact = 1 };
+
+    if (status == 0) {
+        for (size_t i = 0; i < coord->n_shards; i++) {
+            n_total.n += reqs[i].n_matches.n;
+            n_total.exact &= reqs[i].n_matches.exact;
+        }
+        merge_results(coord, reqs, k, results);
+    } else {
+        for (size_t i = 0; i < coord->n_shards; i++) {
+            for (size_t j = 0; j < reqs[i].n_results; j++) {
+                free(reqs[i].results[j]);
+            }
+        }
+        list_destroy(results, NULL);
+        results = NULL;
+    }
+
+    /* every connection that did not fail has read the reply to each request, and can be reused as is */
+    for (size_t i = 0; i < coord->n_shards; i++) {
+        if (reqs[i].fd >= 0) {
+            shard_release(&coord->shards[i], reqs[i].fd);
+        }
+        index_stats_destroy(reqs[i].stats);
+        free(reqs[i].results);
+        free(reqs[i].reply.buf);
+    }
+
+    index_stats_destroy(stats);
+    free(reqs);
+    free(msg.buf);
+    query_destroy(root);
+
+    if (results && n_matches) {
+        *n_matches = n_total;
+    }
+
+    PROF_STOP(PROF_QUERY_EVAL, t_eval);
+
+    return results;
+}
+
+int coordinator_stat(coordinator_t *coord, size_t *n_docs, size_t *n_shards) {
+    request_t *reqs = calloc(coord->n_shards, sizeof(request_t));
+    msg_t msg = { .buf = NULL, .len = 0, .capacity = 0 };
+    char errmsg[LINE_MAX];
+    if (!reqs) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    int status = 0;
+
+    for (size_t i = 0; i < coord->n_shards; i++) {
+        reqs[i].fd = shard_acquire(&coord->shards[i]);
+        if (reqs[i].fd < 0) {
+            status = -1;
+        }
+    }
+
+    if (status == 0) {
+        msg_begin(&msg, MSG_INFO);
+        status = scatter_gather(coord, reqs, &msg, errmsg);
+    }
+    if (status == 0) {
+        status = check_replies(coord, reqs, MSG_INFO_REPLY, errmsg);
+    }
+
+    *n_docs = 0;
+    *n_shards = coord->n_shards;
+
+    for (size_t i = 0; i < coord->n_shards; i++) {
+        if (status == 0) {
+            *n_docs += (size_t) get_u64(&reqs[i].payload);
+        }
+        if (reqs[i].fd >= 0) {
+            shard_release(&coord->shards[i], reqs[i].fd);
+        }
+        free(reqs[i].reply.buf);
+    }
+
+    free(reqs);
+    free(msg.buf);
+
+    return status;
+}
@@ -0,0 +1,212 @@
+/**
+ * @implements termdict.h
+ *
+ * @brief The strings are encoded back to back in one buffer, each as two LEB128 varints (the length of the
+ * prefix it shares with the string before it, and the length of the rest), followed by the rest. The first
+ * string of each block shares nothing, so it can be read in place.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "termdict.h"
+#include "memstat.h"
+
+
+/* SETTING: strings per block. Larger blocks share more prefixes, but lookups scan more of a block. */
+#define TERMDICT_BLOCK_SIZE 16
+
+struct termdict {
+    uint8_t *buf;    // encoded strings
+    size_t n_bytes;
+    size_t *blocks;  // offset in buf of the first string of each block
+    size_t n_blocks;
+    void **vals;     // value of each string, in order
+    size_t n_strs;
+    size_t max_len;  // length of the longest string
+};
+
+
+static inline size_t len_encode(uint8_t *dst, size_t val) {
+    size_t n = 0;
+
+    while (val >= 0x80) {
+        dst[n++] = (uint8_t) (val | 0x80);
+        val >>= 7;
+    }
+    dst[n++] = (uint8_t) val;
+
+    return n;
+}
+
+static inline size_t len_decode(const uint8_t *src, size_t *val) {
+    size_t n = 0;
+    unsigned shift = 0;
+
+    *val = 0;
+    do {
+        *val |= (size_t) (src[n] & 0x7f) << shift;
+        shift += 7;
+    } while (src[n++] & 0x80);
+
+    return n;
+}
+
+termdict_t *termdict_create(const char **strs, void **vals, size_t n) {
+    termdict_t *dict = malloc(sizeof(termdict_t));
+    if (!dict) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    /* an upper bound of the encoded size: both lengths of each string fit in 10 bytes each */
+    size_t capacity = 1;
+    for (size_t i = 0; i < n; i++) {
+        capacity += strlen(strs[i]) + 20;
+    }
+
+    dict->n_blocks = (n + TERMDICT_BLOCK_SIZE - 1) / TERMDICT_BLOCK_SIZE;
+    dict->buf = malloc(capacity);
+    dict->blocks = malloc((dict->n_blocks + 1) * sizeof(size_t));
+    dict->vals = malloc((n + 1) * sizeof(void *));
+    if (!dict->buf || !dict->blocks || !dict->vals) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    dict->n_bytes = 0;
+    dict->n_strs = n;
+    dict->max_len = 0;
+
+    const char *prev = "";
+
+    for (size_t i = 0; i < n; i++) {
+        const char *str = strs[i];
+        size_t len = strlen(str);
+        size_t shared = 0;
+
+        if (i % TERMDICT_BLOCK_SIZE == 0) {
+            dict->blocks[i / TERMDICT_BLOCK_SIZE] = dict->n_bytes;
+        } else {
+            while (prev[shared] && prev[shared] == str[shared]) {
+                shared++;
+            }
+        }
+
+        dict->n_bytes += len_encode(&dict->buf[dict->n_bytes], shared);
+        dict->n_bytes += len_encode(&dict->buf[dict->n_bytes], len - shared);
+        memcpy(&dict->buf[dict->n_bytes], str + shared, len - shared);
+        dict->n_bytes += len - shared;
+
+        dict->vals[i] = vals ? vals[i] : NULL;
+        if (len > dict->max_len) {
+            dict->max_len = len;
+        }
+        prev = str;
+    }
+
+    /* the bound is loose, as most strings share a prefix */
+    uint8_t *shrunk = realloc(dict->buf, dict->n_bytes ? dict->n_bytes : 1);
+    if (shrunk) {
+        dict->buf = shrunk;
+    }
+    MEM_RECORD(MEM_TERMDICT, (int64_t) termdict_size(dict), 4);
+
+    return dict;
+}
+
+void termdict_destroy(termdict_t *dict) {
+    if (!dict) {
+        return;
+    }
+    MEM_RECORD(MEM_TERMDICT, -(int64_t) termdict_size(dict), -4);
+    free(dict->buf);
+    free(dict->blocks);
+    free(dict->vals);
+    free(dict);
+}
+
+size_t termdict_length(termdict_t *dict) {
+    return dict->n_strs;
+}
+
+size_t termdict_size(termdict_t *dict) {
+    size_t tables = dict->n_blocks * sizeof(size_t) + dict->n_strs * sizeof(void *);
+    return sizeof(termdict_t) + dict->n_bytes + tables;
+}
+
+/* compare the first string of a block with the prefix: < 0, 0 or > 0 if it sorts before, starts with or sorts
+ * after the prefix */
+static int compare_block(termdict_t *dict, size_t block, const char *prefix, size_t len) {
+    const uint8_t *p = &dict->buf[dict->blocks[block]];
+    size_t shared, str_len;
+
+    p += len_decode(p, &shared);
+    p += len_decode(p, &str_len);
+
+    int cmp = memcmp(p, prefix, (str_len < len) ? str_len : len);
+    if (cmp == 0 && str_len < len) {
+        return -1;
+    }
+    return cmp;
+}
+
+size_t termdict_prefix(termdict_t *dict, const char *prefix, size_t len, termdict_fn fn, void *arg) {
+    if (dict->n_strs == 0) {
+        return 0;
+    }
+
+    /* the first string with the prefix is in the last block that starts before it, or starts the next one */
+    size_t lo = 0;
+    size_t hi = dict->n_blocks;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare_block(dict, mid, prefix, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t block = lo ? lo - 1 : 0;
+
+    char *str = malloc(dict->max_len + 1);
+    if (!str) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    const uint8_t *p = &dict->buf[dict->blocks[block]];
+    const uint8_t *end = dict->buf + dict->n_bytes;
+    size_t i = block * TERMDICT_BLOCK_SIZE;
+    size_t n_visited = 0;
+
+    for (; p < end; i++) {
+        size_t shared, rest;
+        p += len_decode(p, &shared);
+        p += len_decode(p, &rest);
+
+        memcpy(str + shared, p, rest);
+        str[shared + rest] = '\0';
+        p += rest;
+
+        size_t str_len = shared + rest;
+        int cmp = memcmp(str, prefix, (str_len < len) ? str_len : len);
+
+        if (cmp < 0 || (cmp == 0 && str_len < len)) {
+            continue; // before the first string with the prefix
+        }
+        if (cmp > 0) {
+            break; // past the last one
+        }
+
+        n_visited++;
+        if (fn(str, dict->vals[i], arg) != 0) {
+            break;
+        }
+    }
+
+    free(str);
+
+    return n_visited;
+}
@@ -5,15 +5,28 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "printing.h"
 #include "tokenize.h"
 #include "common.h"
 #include "list.h"
+#include "arena.h"
+#include "intern.h"
 
 
 /* Helper: append token to list if above the length threshold */
@@ -89,10 +102,9 @@ int tokenize_string(
                 head = base;
                 offset = 0;
             } else if (offset >= offset_lim) {
-                /* skip token, iterating to next splitter */
-                const char *s = str;
-                while (*s && !delimitfn(*s)) {
-                    s++;
+                /* skip token, iterating up to the next splitter, which is processed by the next iteration */
+                while (str[1] && !delimitfn(str[1])) {
+                    str++;
                 }
                 head = base;
                 offset = 0;
@@ -108,6 +120,349 @@ int tokenize_string(
     return status;
 }
 
+/* bytes classified at a time by the ascii_words kernel */
+#define BLOCK_SIZE 64
+
+/* the ascii_words kernel copies runs of a token in pieces of this size, which may overshoot by as much */
+#define COPY_SIZE 16
+
+/**
+ * State of the streaming tokenizer, carried from one chunk to the next. A token may straddle any number of
+ * chunk boundaries, as it is built in `token` rather than in the chunk.
+ */
+typedef struct token_stream {
+    char token[TOKEN_SIZE_MAX + COPY_SIZE];
+    size_t len;   // current length of the token we are building
+    int skipping; // the token exceeded the max size, and is dropped up to the next delimiter
+    int ended;    // a null byte was found, which ends the content
+    size_t min_token_len;
+    int (*delimitfn)(int);
+    int (*filterfn)(int);
+    int (*transformfn)(int);
+    token_fn emitfn;
+    void *arg;
+    int ascii_words; // the functions are those of the ingestion path, see use_ascii_words
+} token_stream_t;
+
+/**
+ * Whether the given configuration is the one every file is indexed with: split at whitespace, keep only
+ * ascii alphanumeric chars, convert to lowercase and ommit empty tokens. Content tokenized with this
+ * configuration is classified a block at a time, instead of with three indirect calls per byte.
+ */
+static inline int use_ascii_words(
+    size_t min_token_len,
+    int (*delimitfn)(int),
+    int (*filterfn)(int),
+    int (*transformfn)(int)
+) {
+    return min_token_len > 0 && delimitfn == isspace && filterfn == is_ascii_alnum && transformfn == tolower;
+}
+
+/* Helper: emit the token being built if above the length threshold, and get ready for a new one */
+static inline int stream_emit(token_stream_t *ts) {
+    int status = 0;
+
+    if (ts->len >= ts->min_token_len) {
+        ts->token[ts->len] = '\0';
+        status = ts->emitfn(ts->token, ts->len, ts->arg);
+    }
+    ts->len = 0;
+
+    return status;
+}
+
+/* Feed a chunk to the stream byte by byte, calling the functions of the stream on each byte */
+static int stream_feed_generic(token_stream_t *ts, const char *chunk, size_t size) {
+    static const size_t offset_lim = (TOKEN_SIZE_MAX - 2); // must leave room for null terminator + next char
+    int status = 0;
+
+    for (size_t i = 0; i < size && status == 0 && !ts->ended; i++) {
+        int c = chunk[i];
+
+        if (c == '\0') {
+            ts->ended = 1;
+            break;
+        }
+
+        int is_delimiter = ts->delimitfn(c);
+
+        if (ts->skipping) {
+            /* drop the rest of the oversized token, up to the next delimiter */
+            if (!is_delimiter) {
+                continue;
+            }
+            ts->skipping = 0;
+        }
+
+        if (is_delimiter) {
+            /* delimiter found. split here. */
+            status = stream_emit(ts);
+        }
+
+        if (ts->filterfn == NULL || ts->filterfn(c)) {
+            /* Transform character if appliccable, then add it to the token */
+            ts->token[ts->len++] = ts->transformfn ? ts->transformfn(c) : c;
+
+            /* a delimiter that passes the filter is included as its own token */
+            if (is_delimiter) {
+                status = stream_emit(ts);
+            } else if (ts->len >= offset_lim) {
+                ts->skipping = 1;
+                ts->len = 0;
+            }
+        }
+    }
+
+    return status;
+}
+
+/* Classes of each byte of a block, one bit per byte, as computed by the functions of use_ascii_words */
+typedef struct block_class {
+    uint64_t space; // isspace
+    uint64_t alnum; // is_ascii_alnum
+    uint64_t nul;   // end of content
+    char lower[BLOCK_SIZE + COPY_SIZE]; // tolower of every byte
+} block_class_t;
+
+#if defined(__AVX2__)
+
+/* bytes of x in [lo, hi]. Bytes are signed, so any non-ascii byte is below every ascii range. */
+static inline __m256i in_range_avx2(__m256i x, char lo, char hi) {
+    return _mm256_and_si256(
+        _mm256_cmpgt_epi8(x, _mm256_set1_epi8((char) (lo - 1))),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (hi + 1)), x)
+    );
+}
+
+static inline void classify_block(const char *src, block_class_t *dst) {
+    for (size_t k = 0; k < BLOCK_SIZE; k += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (src + k));
+
+        __m256i upper = in_range_avx2(x, 'A', 'Z');
+        __m256i lower = _mm256_or_si256(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+        __m256i alnum = _mm256_or_si256(in_range_avx2(lower, 'a', 'z'), in_range_avx2(x, '0', '9'));
+        __m256i space = _mm256_or_si256(
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), in_range_avx2(x, '\t', '\r')
+        );
+        __m256i nul = _mm256_cmpeq_epi8(x, _mm256_setzero_si256());
+
+        _mm256_storeu_si256((__m256i *) (dst->lower + k), lower);
+        dst->alnum |= (uint64_t) (uint32_t) _mm256_movemask_epi8(alnum) << k;
+        dst->space |= (uint64_t) (uint32_t) _mm256_movemask_epi8(space) << k;
+        dst->nul |= (uint64_t) (uint32_t) _mm256_movemask_epi8(nul) << k;
+    }
+}
+
+#elif defined(__SSE2__)
+
+/* bytes of x in [lo, hi]. Bytes are signed, so any non-ascii byte is below every ascii range. */
+static inline __m128i in_range_sse2(__m128i x, char lo, char hi) {
+    return _mm_and_si128(
+        _mm_cmpgt_epi8(x, _mm_set1_epi8((char) (lo - 1))), _mm_cmplt_epi8(x, _mm_set1_epi8((char) (hi + 1)))
+    );
+}
+
+static inline void classify_block(const char *src, block_class_t *dst) {
+    for (size_t k = 0; k < BLOCK_SIZE; k += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (src + k));
+
+        __m128i upper = in_range_sse2(x, 'A', 'Z');
+        __m128i lower = _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+        __m128i alnum = _mm_or_si128(in_range_sse2(lower, 'a', 'z'), in_range_sse2(x, '0', '9'));
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), in_range_sse2(x, '\t', '\r'));
+        __m128i nul = _mm_cmpeq_epi8(x, _mm_setzero_si128());
+
+        _mm_storeu_si128((__m128i *) (dst->lower + k), lower);
+        dst->alnum |= (uint64_t) (uint16_t) _mm_movemask_epi8(alnum) << k;
+        dst->space |= (uint64_t) (uint16_t) _mm_movemask_epi8(space) << k;
+        dst->nul |= (uint64_t) (uint16_t) _mm_movemask_epi8(nul) << k;
+    }
+}
+
+#else
+
+static inline void classify_block(const char *src, block_class_t *dst) {
+    for (size_t k = 0; k < BLOCK_SIZE; k++) {
+        unsigned char c = (unsigned char) src[k];
+        unsigned char lower = (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+        uint64_t bit = 1ull << k;
+
+        dst->lower[k] = (char) lower;
+        dst->alnum |= ((lower >= 'a' && lower <= 'z') || (c >= '0' && c <= '9')) ? bit : 0;
+        dst->space |= (c == ' ' || (c >= '\t' && c <= '\r')) ? bit : 0;
+        dst->nul |= (c == '\0') ? bit : 0;
+    }
+}
+
+#endif
+
+/* mask of the bits [from, to) */
+static inline uint64_t bit_range(size_t from, size_t to) {
+    uint64_t below_to = (to >= 64) ? ~0ull : (1ull << to) - 1;
+
+    return below_to & ~((1ull << from) - 1);
+}
+
+/**
+ * Feed the first `n` bytes of a classified block to the stream. Each run of bytes up to the next delimiter is
+ * added to the token at once, and the token is emitted at the delimiter.
+ */
+static int stream_feed_block(token_stream_t *ts, block_class_t *block, size_t n) {
+    static const size_t offset_lim = (TOKEN_SIZE_MAX - 2); // same limit as stream_feed_generic
+    uint64_t space = block->space & bit_range(0, n);
+    size_t pos = 0;
+    int status = 0;
+
+    while (pos < n && status == 0) {
+        uint64_t rest = space & bit_range(pos, n);
+        size_t end = rest ? (size_t) __builtin_ctzll(rest) : n;
+
+        if (!ts->skipping) {
+            uint64_t run_mask = bit_range(pos, end);
+            uint64_t keep = block->alnum & run_mask;
+
+            /* only count the kept bytes if the run could reach the limit, as popcount may be a library call */
+            if (ts->len + (end - pos) >= offset_lim
+                && ts->len + (size_t) __builtin_popcountll(keep) >= offset_lim) {
+                /* the token would reach the max size within this run, drop it up to the next delimiter */
+                ts->skipping = 1;
+                ts->len = 0;
+            } else if (keep == run_mask) {
+                /* fixed-size copies are inlined, and the token and block both have room for the overshoot */
+                for (size_t k = 0; k < end - pos; k += COPY_SIZE) {
+                    memcpy(ts->token + ts->len + k, block->lower + pos + k, COPY_SIZE);
+                }
+                ts->len += end - pos;
+            } else {
+                while (keep) {
+                    ts->token[ts->len++] = block->lower[__builtin_ctzll(keep)];
+                    keep &= keep - 1;
+                }
+            }
+        }
+
+        if (end == n) {
+            /* the token continues in the next block */
+            break;
+        }
+
+        /* delimiter found. split here. Delimiters never pass the filter, so they are never tokens. */
+        ts->skipping = 0;
+        status = stream_emit(ts);
+        pos = end + 1;
+    }
+
+    return status;
+}
+
+/* Feed a chunk to the stream a block at a time. Only for streams with the functions of use_ascii_words. */
+static int stream_feed_ascii_words(token_stream_t *ts, const char *chunk, size_t size) {
+    int status = 0;
+
+    for (size_t i = 0; i < size && status == 0 && !ts->ended; i += BLOCK_SIZE) {
+        block_class_t block = { .space = 0, .alnum = 0, .nul = 0 };
+        size_t n = size - i;
+
+        if (n >= BLOCK_SIZE) {
+            n = BLOCK_SIZE;
+            classify_block(chunk + i, &block);
+        } else {
+            /* the bits of the bytes past the end are ignored */
+            char tail[BLOCK_SIZE] = { 0 };
+            memcpy(tail, chunk + i, n);
+            classify_block(tail, &block);
+        }
+
+        uint64_t nul = block.nul & bit_range(0, n);
+        if (nul) {
+            n = (size_t) __builtin_ctzll(nul);
+            ts->ended = 1;
+        }
+
+        status = stream_feed_block(ts, &block, n);
+    }
+
+    return status;
+}
+
+/**
+ * Feed the next chunk of content to the stream. Splits exactly like tokenize_string, given the same content.
+ * @returns 0 on success, otherwise the (negative) error code of the emit function
+ */
+static int stream_feed(token_stream_t *ts, const char *chunk, size_t size) {
+    if (ts->ascii_words) {
+        return stream_feed_ascii_words(ts, chunk, size);
+    }
+    return stream_feed_generic(ts, chunk, size);
+}
+
+/* Read a stream to the end in chunks of TOKENIZE_CHUNK_SIZE, feeding each to the tokenizer */
+static int stream_file(token_stream_t *ts, FILE *f, int fd) {
+    char *chunk = malloc(TOKENIZE_CHUNK_SIZE);
+    if (chunk == NULL) {
+        pr_error("Malloc failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int status = 0;
+    size_t n_total = 0; // bytes read in total
+
+    while (status == 0 && !ts->ended) {
+        ssize_t n_read;
+
+        if (f) {
+            n_read = (ssize_t) fread(chunk, 1, TOKENIZE_CHUNK_SIZE, f);
+            if (n_read == 0 && ferror(f)) {
+                n_read = -1;
+            }
+        } else {
+            n_read = read(fd, chunk, TOKENIZE_CHUNK_SIZE);
+            if (n_read < 0 && errno == EINTR) {
+                continue;
+            }
+        }
+
+        if (n_read < 0) {
+            pr_warn("Error during read of file: %s\n", strerror(errno));
+            status = -2;
+            break;
+        }
+        if (n_read == 0) {
+            break;
+        }
+
+        n_total += (size_t) n_read;
+        status = stream_feed(ts, chunk, (size_t) n_read);
+    }
+
+    /* done, if we have a token built up, add it. An empty file has no tokens at all. */
+    if (status == 0 && n_total > 0) {
+        status = stream_emit(ts);
+    }
+
+    free(chunk);
+
+    return status;
+}
+
+/* token_fn of tokenize_file: duplicate each token onto the list */
+static int emit_token_dup(char *token, size_t len, void *list) {
+    char *cpy = malloc(len + 1);
+    if (cpy == NULL) {
+        pr_error("Malloc failed: %s\n", strerror(errno));
+        return -1;
+    }
+    memcpy(cpy, token, len + 1);
+
+    if (list_addlast(list, cpy) < 0) {
+        pr_error("list_addlast failed\n");
+        free(cpy);
+        return -1;
+    }
+
+    return 0;
+}
+
 int tokenize_file(
     FILE *f,
     list_t *list,
@@ -116,41 +471,328 @@ int tokenize_file(
     int (*filterfn)(int),
     int (*transformfn)(int)
 ) {
-    long maybe_file_size = fsize(f);
-    if (maybe_file_size < 0) {
+    token_stream_t ts = {
+        .len = 0,
+        .skipping = 0,
+        .ended = 0,
+        .min_token_len = min_token_len,
+        .delimitfn = delimitfn,
+        .filterfn = filterfn,
+        .transformfn = transformfn,
+        .emitfn = emit_token_dup,
+        .arg = list,
+        .ascii_words = use_ascii_words(min_token_len, delimitfn, filterfn, transformfn),
+    };
+    size_t list_len_before = list_length(list);
+
+    int status = stream_file(&ts, f, -1);
+
+    /* either complete the operation, or revert list state on error */
+    while ((status < 0) && (list_length(list) > list_len_before)) {
+        free(list_poplast(list));
+    }
+
+    return status;
+}
+
+int tokenize_file_stream(
+    const char *fpath,
+    token_fn emitfn,
+    void *arg,
+    size_t min_token_len,
+    int (*delimitfn)(int),
+    int (*filterfn)(int),
+    int (*transformfn)(int)
+) {
+    int fd = open(fpath, O_RDONLY);
+    if (fd < 0) {
+        pr_error("Failed to open %s: %s\n", fpath, strerror(errno));
+        return -2;
+    }
+
+    /* we only pass over the content once, front to back */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    token_stream_t ts = {
+        .len = 0,
+        .skipping = 0,
+        .ended = 0,
+        .min_token_len = min_token_len,
+        .delimitfn = delimitfn,
+        .filterfn = filterfn,
+        .transformfn = transformfn,
+        .emitfn = emitfn,
+        .arg = arg,
+        .ascii_words = use_ascii_words(min_token_len, delimitfn, filterfn, transformfn),
+    };
+
+    int status = stream_file(&ts, NULL, fd);
+    close(fd);
+
+    return status;
+}
+
+int tokenize_buffer_stream(
+    const char *buf,
+    size_t size,
+    token_fn emitfn,
+    void *arg,
+    size_t min_token_len,
+    int (*delimitfn)(int),
+    int (*filterfn)(int),
+    int (*transformfn)(int)
+) {
+    token_stream_t ts = {
+        .len = 0,
+        .skipping = 0,
+        .ended = 0,
+        .min_token_len = min_token_len,
+        .delimitfn = delimitfn,
+        .filterfn = filterfn,
+        .transformfn = transformfn,
+        .emitfn = emitfn,
+        .arg = arg,
+        .ascii_words = use_ascii_words(min_token_len, delimitfn, filterfn, transformfn),
+    };
+
+    /* an empty buffer has no tokens at all, just as an empty file */
+    if (size == 0) {
+        return 0;
+    }
+
+    int status = stream_feed(&ts, buf, size);
+
+    /* done, if we have a token built up, add it */
+    if (status == 0) {
+        status = stream_emit(&ts);
+    }
+
+    return status;
+}
+
+/**
+ * Helper: append the token being built in the arena to list if above the length threshold. If an interner is
+ * given, the canonical copy is appended instead, and the arena space is left to be reused by the next token.
+ */
+static inline int append_token_arena(
+    list_t *list,
+    arena_t *arena,
+    interner_t *interner,
+    char *token,
+    size_t len,
+    size_t min_token_len
+) {
+    if (len < min_token_len) {
+        /* nothing is committed, so the reserved space is simply reused by the next token */
+        return 0;
+    }
+
+    if (interner) {
+        token = intern(interner, token, len);
+    } else {
+        token[len] = '\0';
+        arena_commit(arena, len + 1);
+    }
+
+    if (list_addlast(list, token) < 0) {
+        pr_error("list_addlast failed\n");
         return -1;
     }
 
-    /* cast to unsigned */
-    size_t file_size = (size_t) maybe_file_size;
+    return 0;
+}
 
-    if (file_size == 0 || file_size < min_token_len) {
-        return 0; /* nothing to do */
+/* where tokenize_span_ascii_words puts its tokens */
+typedef struct arena_sink {
+    list_t *list;
+    arena_t *arena;
+    interner_t *interner;
+} arena_sink_t;
+
+/* token_fn of tokenize_span_ascii_words: same as append_token_arena, for a token built outside the arena */
+static int emit_token_arena(char *token, size_t len, void *arg) {
+    arena_sink_t *sink = arg;
+
+    if (sink->interner) {
+        token = intern(sink->interner, token, len);
+    } else {
+        token = arena_strndup(sink->arena, token, len);
     }
 
-    /* allocated a temp buffer equal to the size of the file */
-    char *content = malloc(file_size + 1);
-    if (content == NULL) {
-        pr_error("Malloc failed: %s\n", strerror(errno));
+    if (list_addlast(sink->list, token) < 0) {
+        pr_error("list_addlast failed\n");
         return -1;
     }
 
-    errno = 0;
-    /* read the entire file in one gulp */
-    size_t read_bytes = fread(content, 1, file_size, f);
-    if (errno) {
-        pr_warn("Error during read of file: %s\n", strerror(errno));
-        free(content);
+    return 0;
+}
+
+/* tokenize_span for the configuration of use_ascii_words, through the block kernel of the stream */
+static int tokenize_span_ascii_words(
+    const char *str,
+    size_t size,
+    list_t *list,
+    arena_t *arena,
+    interner_t *interner,
+    size_t min_token_len
+) {
+    arena_sink_t sink = { .list = list, .arena = arena, .interner = interner };
+    token_stream_t ts = {
+        .len = 0,
+        .skipping = 0,
+        .ended = 0,
+        .min_token_len = min_token_len,
+        .delimitfn = isspace,
+        .filterfn = is_ascii_alnum,
+        .transformfn = tolower,
+        .emitfn = emit_token_arena,
+        .arg = &sink,
+        .ascii_words = 1,
+    };
+    size_t list_len_before = list_length(list);
+
+    int status = stream_feed(&ts, str, size);
+
+    /* done, if we have a token built up, add it */
+    if (status == 0) {
+        status = stream_emit(&ts);
+    }
+
+    /* either complete the operation, or revert list state on error. The arena/interner owns the strings. */
+    while ((status < 0) && (list_length(list) > list_len_before)) {
+        list_poplast(list);
+    }
+
+    return status;
+}
+
+/**
+ * Same as tokenize_string, but for a buffer of `size` bytes that is not null-terminated, writing tokens to
+ * the arena instead of duplicating them through a temporary buffer. A null byte still ends the content.
+ */
+static int tokenize_span(
+    const char *str,
+    size_t size,
+    list_t *list,
+    arena_t *arena,
+    interner_t *interner,
+    size_t min_token_len,
+    int (*delimitfn)(int),
+    int (*filterfn)(int),
+    int (*transformfn)(int)
+) {
+    if (use_ascii_words(min_token_len, delimitfn, filterfn, transformfn)) {
+        return tokenize_span_ascii_words(str, size, list, arena, interner, min_token_len);
+    }
+
+    static const size_t offset_lim = (TOKEN_SIZE_MAX - 2); // must leave room for null terminator + next char
+    size_t list_len_before = list_length(list);
+
+    int status = 0; // will be set negative on error, otherwise 0
+    size_t len = 0; // current length of the token we are building
+    char *token = arena_reserve(arena, TOKEN_SIZE_MAX);
+
+    for (size_t i = 0; status == 0; i++) {
+        int c = (i < size) ? str[i] : '\0';
+
+        if (c == '\0') {
+            /* done, if we have a token built up, add it and break out */
+            status = append_token_arena(list, arena, interner, token, len, min_token_len);
+            break;
+        }
+
+        int is_delimiter = delimitfn(c);
+
+        if (is_delimiter) {
+            /* delimiter found. split here, and get ready for a new token */
+            status = append_token_arena(list, arena, interner, token, len, min_token_len);
+            token = arena_reserve(arena, TOKEN_SIZE_MAX);
+            len = 0;
+        }
+
+        if (filterfn == NULL || filterfn(c)) {
+            /* Transform character if appliccable, then add it to the token */
+            token[len++] = transformfn ? transformfn(c) : c;
+
+            /* a delimiter that passes the filter is included as its own token */
+            if (is_delimiter) {
+                status = append_token_arena(list, arena, interner, token, len, min_token_len);
+                token = arena_reserve(arena, TOKEN_SIZE_MAX);
+                len = 0;
+            } else if (len >= offset_lim) {
+                /* skip token, iterating up to the next splitter, which is processed by the next iteration */
+                while (i + 1 < size && str[i + 1] && !delimitfn(str[i + 1])) {
+                    i++;
+                }
+                len = 0;
+            }
+        }
+    }
+
+    /* either complete the operation, or revert list state on error. The arena/interner owns the strings. */
+    while ((status < 0) && (list_length(list) > list_len_before)) {
+        list_poplast(list);
+    }
+
+    return status;
+}
+
+int tokenize_file_mmap(
+    const char *fpath,
+    list_t *list,
+    arena_t *arena,
+    interner_t *interner,
+    size_t min_token_len,
+    int (*delimitfn)(int),
+    int (*filterfn)(int),
+    int (*transformfn)(int)
+) {
+    int fd = open(fpath, O_RDONLY);
+    if (fd < 0) {
+        pr_error("Failed to open %s: %s\n", fpath, strerror(errno));
+        return -2;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        pr_error("Failed to stat %s: %s\n", fpath, strerror(errno));
+        close(fd);
+        return -2;
+    }
+
+    size_t file_size = (size_t) st.st_size;
+
+    if (file_size == 0 || file_size < min_token_len) {
+        close(fd);
+        return 0; /* nothing to do */
+    }
+
+    char *content = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /* the mapping stays valid after the descriptor is closed */
+    close(fd);
+
+    if (content == MAP_FAILED) {
+        pr_error("Failed to map %s: %s\n", fpath, strerror(errno));
         return -2;
     }
 
-    content[read_bytes - 1] = '\0';
+    /* we only pass over the content once, front to back */
+    madvise(content, file_size, MADV_SEQUENTIAL);
 
-    /* run tokenize on the buffer */
-    int rv = tokenize_string(content, list, min_token_len, delimitfn, filterfn, transformfn);
+    int rv = tokenize_span(
+        content,
+        file_size,
+        list,
+        arena,
+        interner,
+        min_token_len,
+        delimitfn,
+        filterfn,
+        transformfn
+    );
 
-    /* free the temp buffer. Tokenize will have allocated individual strings per token. */
-    free(content);
+    munmap(content, file_size);
 
     return rv;
 }
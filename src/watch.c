@@ -0,0 +1,366 @@
+/**
+ * @implements watch.h
+ *
+ * @brief One inotify instance watches every directory of the tree. The path of the directory of each watch
+ * descriptor is kept in a table indexed by it, to turn the name in an event back into a full path.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "list.h"
+#include "set.h"
+#include "findfiles.h"
+#include "watch.h"
+
+
+/* SETTING: initial number of slots of the table of watched directories */
+#define WATCH_DIRS_INITIAL 64
+
+/* changes watched for in each directory. Files still open elsewhere once deleted are taken as removed. */
+#define WATCH_MASK \
+    (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+struct watch {
+    int fd;      // inotify instance
+    int stop_fd; // eventfd, written to once the thread should stop
+    atomic_int stop;
+    set_t *valid_exts;
+    watch_fn fn;
+    void *arg;
+    char **dirs;   // path of the directory watched by each watch descriptor, or NULL
+    size_t n_dirs; // number of slots of dirs
+    pthread_t thread;
+    int started;
+};
+
+
+/* path of `name` in the directory at `dir_path`, with a trailing '/' if `is_dir` */
+static char *join_path(const char *dir_path, const char *name, int is_dir) {
+    size_t dir_len = strlen(dir_path);
+    size_t name_len = strlen(name);
+
+    char *path = malloc(dir_len + name_len + 3);
+    if (!path) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    memcpy(path, dir_path, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len);
+    path[dir_len + 1 + name_len] = '/';
+    path[dir_len + 1 + name_len + is_dir] = '\0';
+
+    return path;
+}
+
+/* record the path of the directory watched by `wd`, replacing any path it was watched under before */
+static void set_dir(watch_t *watch, int wd, const char *dir_path) {
+    if ((size_t) wd >= watch->n_dirs) {
+        size_t n_dirs = watch->n_dirs;
+        while (n_dirs <= (size_t) wd) {
+            n_dirs *= 2;
+        }
+
+        char **dirs = realloc(watch->dirs, n_dirs * sizeof(char *));
+        if (!dirs) {
+            PANIC("Failed to allocate memory\n");
+        }
+        memset(dirs + watch->n_dirs, 0, (n_dirs - watch->n_dirs) * sizeof(char *));
+
+        watch->dirs = dirs;
+        watch->n_dirs = n_dirs;
+    }
+
+    free(watch->dirs[wd]);
+    watch->dirs[wd] = strdup(dir_path);
+    if (!watch->dirs[wd]) {
+        PANIC("Failed to allocate memory\n");
+    }
+}
+
+/**
+ * Watch one directory, and queue its subdirectories.
+ * @param pending: directories left to watch
+ * @param report: hand each file of the directory to the callback, as a change
+ */
+static void watch_dir(watch_t *watch, const char *dir_path, list_t *pending, int report) {
+    /* watch before reading the directory, so no file added in between is missed */
+    int wd = inotify_add_watch(watch->fd, dir_path, WATCH_MASK);
+    if (wd < 0) {
+        pr_warn("Failed to watch directory \"%s\": %s. Ignoring.\n", dir_path, strerror(errno));
+        return;
+    }
+    set_dir(watch, wd, dir_path);
+
+    int fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = (fd < 0) ? NULL : fdopendir(fd);
+    if (!dir) {
+        pr_warn("Failed to open directory \"%s\": %s. Ignoring.\n", dir_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    struct dirent *entry;
+
+    while ((entry = readdir(dir))) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        /* same as the walk of find_files: symlinks are followed */
+        unsigned char type = entry->d_type;
+
+        if (type == DT_LNK || type == DT_UNKNOWN) {
+            struct stat path_stat;
+
+            if (fstatat(fd, name, &path_stat, 0) == -1) {
+                continue;
+            }
+            type = S_ISDIR(path_stat.st_mode) ? DT_DIR : S_ISREG(path_stat.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type == DT_DIR) {
+            if (list_addlast(pending, join_path(dir_path, name, 0)) < 0) {
+                PANIC("Failed to allocate memory\n");
+            }
+        } else if (type == DT_REG && report) {
+            char *path = join_path(dir_path, name, 0);
+
+            if (has_valid_ext(watch->valid_exts, path)) {
+                watch->fn(WATCH_FILE_CHANGED, path, watch->arg);
+            } else {
+                free(path);
+            }
+        }
+    }
+
+    closedir(dir);
+}
+
+/* watch the directory at `root_path` and every directory below it */
+static void watch_tree(watch_t *watch, const char *root_path, int report) {
+    list_t *pending = list_create((cmp_fn) strcmp);
+    char *root_cpy = strdup(root_path);
+
+    if (!pending || !root_cpy || list_addlast(pending, root_cpy) < 0) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    while (list_length(pending)) {
+        char *dir_path = list_poplast(pending);
+        watch_dir(watch, dir_path, pending, report);
+        free(dir_path);
+    }
+
+    list_destroy(pending, NULL);
+}
+
+/**
+ * Stop watching the directory at `dir_path` and every directory below it. Any of them that are still in the
+ * tree under a new path are watched again under that path, once the move is reported.
+ */
+static void unwatch_tree(watch_t *watch, const char *dir_path) {
+    size_t len = strlen(dir_path);
+
+    for (size_t wd = 0; wd < watch->n_dirs; wd++) {
+        const char *path = watch->dirs[wd];
+
+        if (path && strncmp(path, dir_path, len) == 0 && (path[len] == '\0' || path[len] == '/')) {
+            inotify_rm_watch(watch->fd, (int) wd);
+            free(watch->dirs[wd]);
+            watch->dirs[wd] = NULL;
+        }
+    }
+}
+
+static void handle_event(watch_t *watch, const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        pr_warn("Missed some changes to the watched files, as too many happened at once\n");
+        return;
+    }
+
+    size_t wd = (size_t) event->wd;
+    if (wd >= watch->n_dirs || !watch->dirs[wd]) {
+        return; // the directory is no longer watched
+    }
+
+    /* the directory was deleted or moved out of the filesystem, which is reported by its parent */
+    if (event->mask & IN_IGNORED) {
+        free(watch->dirs[wd]);
+        watch->dirs[wd] = NULL;
+        return;
+    }
+
+    if (event->len == 0) {
+        return; // the event is about the directory itself
+    }
+
+    const char *dir_path = watch->dirs[wd];
+
+    if (event->mask & IN_ISDIR) {
+        char *path = join_path(dir_path, event->name, 0);
+
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            watch_tree(watch, path, 1);
+            free(path);
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            unwatch_tree(watch, path);
+            free(path);
+            watch->fn(WATCH_DIR_REMOVED, join_path(dir_path, event->name, 1), watch->arg);
+        } else {
+            free(path);
+        }
+        return;
+    }
+
+    watch_event_t type;
+
+    if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        type = WATCH_FILE_CHANGED;
+    } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        type = WATCH_FILE_REMOVED;
+    } else {
+        return; // a file was created, which is reported once it is written to and closed
+    }
+
+    char *path = join_path(dir_path, event->name, 0);
+
+    if (has_valid_ext(watch->valid_exts, path)) {
+        watch->fn(type, path, watch->arg);
+    } else {
+        free(path);
+    }
+}
+
+/* thread routine: hand changes to the callback until stopped */
+static void *watch_run(void *arg) {
+    watch_t *watch = arg;
+
+    /* room for many events, and at least one with the longest name */
+    char buf[4096 + sizeof(struct inotify_event) + NAME_MAX + 1]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    struct pollfd fds[2] = {
+        { .fd = watch->fd, .events = POLLIN },
+        { .fd = watch->stop_fd, .events = POLLIN },
+    };
+
+    while (!atomic_load(&watch->stop)) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            pr_error("Failed to wait for changes to the watched files: %s\n", strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents) {
+            break;
+        }
+
+        ssize_t n = read(watch->fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            pr_error("Failed to read changes to the watched files: %s\n", strerror(errno));
+            break;
+        }
+
+        for (char *p = buf; p < buf + n && !atomic_load(&watch->stop);) {
+            const struct inotify_event *event = (const struct inotify_event *) p;
+            handle_event(watch, event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return NULL;
+}
+
+watch_t *watch_create(const char *dir_path, set_t *valid_exts, watch_fn fn, void *arg) {
+    watch_t *watch = calloc(1, sizeof(watch_t));
+    if (!watch) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watch->stop_fd = eventfd(0, EFD_CLOEXEC);
+    watch->dirs = calloc(WATCH_DIRS_INITIAL, sizeof(char *));
+
+    if (watch->fd < 0 || watch->stop_fd < 0 || !watch->dirs) {
+        pr_error("Failed to create file watcher: %s\n", strerror(errno));
+        watch_destroy(watch);
+        return NULL;
+    }
+
+    atomic_init(&watch->stop, 0);
+    watch->valid_exts = valid_exts;
+    watch->fn = fn;
+    watch->arg = arg;
+    watch->n_dirs = WATCH_DIRS_INITIAL;
+
+    watch_tree(watch, dir_path, 0);
+
+    return watch;
+}
+
+int watch_start(watch_t *watch) {
+    int status = pthread_create(&watch->thread, NULL, watch_run, watch);
+    if (status != 0) {
+        pr_error("Failed to start file watcher thread: %s\n", strerror(status));
+        return -1;
+    }
+
+    watch->started = 1;
+
+    return 0;
+}
+
+void watch_destroy(watch_t *watch) {
+    if (!watch) {
+        return;
+    }
+
+    if (watch->started) {
+        uint64_t one = 1;
+
+        atomic_store(&watch->stop, 1);
+        if (write(watch->stop_fd, &one, sizeof(one)) < 0) {
+            pr_error("Failed to stop file watcher thread: %s\n", strerror(errno));
+        }
+        pthread_join(watch->thread, NULL);
+    }
+
+    for (size_t wd = 0; watch->dirs && wd < watch->n_dirs; wd++) {
+        free(watch->dirs[wd]);
+    }
+    free(watch->dirs);
+
+    if (watch->fd >= 0) {
+        close(watch->fd);
+    }
+    if (watch->stop_fd >= 0) {
+        close(watch->stop_fd);
+    }
+    free(watch);
+}
@@ -0,0 +1,695 @@
+#!/usr/bin/env python3
+"""
+Regression checks of the query engine against a reference evaluator, run by `make check`.
+
+A fixed corpus is generated from a seed, then indexed and queried with the indexer in several
+configurations (built with one or more threads, saved and loaded, with and without positions, with and
+without the query cache, ranking different numbers of documents). The queries of tests/queries.txt cover
+the boolean operators and the planner, BM25 ranking and MaxScore pruning, phrases and patterns, and
+malformed queries.
+
+Each query is evaluated again here, by brute force over the tokens of every file, and the output of the
+indexer is compared with it:
+- the number of matches, or a lower bound of it if the indexer stopped ranking early
+- the ranked documents, whose scores must match to the printed precision. Documents with the same score
+  may be ranked in either order, and may each be the one cut off at the end of the table.
+- the message of a rejected query
+
+The reference output itself (ties broken by name) is kept in tests/expected.txt, which catches any change
+of the corpus or of the reference. `--update` rewrites it, after a change to the queries for example.
+
+Last, a file is edited over and over while the indexer watches it (--watch), to check that the old versions
+it removes are compacted away.
+
+usage: check.py <indexer> [--work <dir>] [--update]
+"""
+
+import bisect
+import math
+import os
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import time
+
+TESTS_DIR = os.path.dirname(os.path.abspath(__file__))
+QUERIES_PATH = os.path.join(TESTS_DIR, "queries.txt")
+EXPECTED_PATH = os.path.join(TESTS_DIR, "expected.txt")
+
+# same as the indexer (src/adt/index.c, src/main.c)
+BM25_K1 = 1.2
+BM25_B = 0.75
+WILDCARD_MAX_TERMS = 4096
+MAX_RESULT_TABLE_ROWS = 20
+
+# the printed scores have 3 decimals. Scores summed in another order may round the other way.
+SCORE_EPS = 1.5e-3
+
+# ------------------------Corpus------------------------
+
+SEED = 0x5EED
+N_DOCS = 4600  # enough for the most frequent terms to get containers (CONTAINER_MIN_DOCS)
+N_WORDS = 6000  # enough for "*" to match more than WILDCARD_MAX_TERMS terms
+SYLLABLES = ["ba", "ko", "ri", "su", "te", "na", "lu", "me", "pi", "do", "ga", "fe"]
+
+# phrases mixed into the text, along with their words in another order
+PHRASES = [
+    (0.06, ["quick", "brown", "fox"]),
+    (0.04, ["brown", "quick", "fox"]),
+    (0.03, ["lazy", "dog"]),
+    (0.02, ["dog", "lazy", "dog"]),
+]
+
+
+class Random:
+    """splitmix64, so that the corpus does not depend on the version of Python"""
+
+    def __init__(self, seed):
+        self.state = seed
+
+    def next(self):
+        self.state = (self.state + 0x9E3779B97F4A7C15) & 0xFFFFFFFFFFFFFFFF
+        z = self.state
+        z = ((z ^ (z >> 30)) * 0xBF58476D1CE4E5B9) & 0xFFFFFFFFFFFFFFFF
+        z = ((z ^ (z >> 27)) * 0x94D049BB133111EB) & 0xFFFFFFFFFFFFFFFF
+        return z ^ (z >> 31)
+
+    def uniform(self):
+        return (self.next() >> 11) / float(1 << 53)
+
+    def below(self, n):
+        return self.next() % n
+
+
+def word(i):
+    """the i-th most frequent word. Words that share a first syllable share a prefix, for patterns."""
+    syllables = [SYLLABLES[i % len(SYLLABLES)]]
+    i //= len(SYLLABLES)
+    while i:
+        syllables.append(SYLLABLES[i % len(SYLLABLES)])
+        i //= len(SYLLABLES)
+    return "".join(syllables)
+
+
+def generate_corpus(path):
+    """Write the corpus to `path`. Words are drawn with a Zipf distribution, and a few documents are long."""
+    rng = Random(SEED)
+    words = [word(i) for i in range(N_WORDS)]
+    cumulative = []
+    total = 0.0
+    for rank in range(N_WORDS):
+        total += 1.0 / (rank + 1)
+        cumulative.append(total)
+
+    os.makedirs(path)
+    for d in range(N_DOCS):
+        if rng.below(100) == 0:
+            length = 2000 + rng.below(2000)
+        else:
+            length = 10 + rng.below(300)
+
+        tokens = []
+        while len(tokens) < length:
+            for p, phrase in PHRASES:
+                if rng.uniform() < p / 50:
+                    tokens.extend(phrase)
+            w = words[bisect.bisect(cumulative, rng.uniform() * total)]
+
+            # the indexer lowercases terms and drops any other character
+            r = rng.below(100)
+            if r < 3:
+                w = w.capitalize()
+            elif r < 5:
+                w += ","
+            elif r < 6:
+                w = "(" + w + ")."
+            tokens.append(w)
+
+        lines = [" ".join(tokens[i:i + 12]) for i in range(0, len(tokens), 12)]
+        with open(os.path.join(path, "doc%04d.txt" % d), "w") as f:
+            f.write("\n".join(lines) + "\n")
+
+
+# ------------------------Reference index------------------------
+
+
+def tokenize_document(content):
+    """Split on whitespace, keep ASCII alphanumerics and lowercase, as the indexer does"""
+    tokens = []
+    for raw in content.split():
+        token = re.sub(rb"[^0-9A-Za-z]", b"", raw).lower()
+        if token:
+            tokens.append(token.decode())
+    return tokens
+
+
+class Reference:
+    def __init__(self, corpus):
+        self.docs = {}      # name -> tokens
+        self.postings = {}  # term -> {name: tf}
+        for name in sorted(os.listdir(corpus)):
+            with open(os.path.join(corpus, name), "rb") as f:
+                tokens = tokenize_document(f.read())
+            self.docs[name] = tokens
+            for t in tokens:
+                tfs = self.postings.setdefault(t, {})
+                tfs[name] = tfs.get(name, 0) + 1
+
+        self.terms = sorted(self.postings)
+        self.avg_length = sum(len(t) for t in self.docs.values()) / len(self.docs)
+
+    def expand(self, pattern):
+        regex = re.compile(".*".join(re.escape(part) for part in pattern.split("*")))
+        terms = [t for t in self.terms if regex.fullmatch(t)]
+        if len(terms) > WILDCARD_MAX_TERMS:
+            raise QueryError("a pattern matches more than %d terms, try a longer one" % WILDCARD_MAX_TERMS)
+        return terms
+
+    def phrase_matches(self, words):
+        candidates = set(self.postings.get(words[0], {}))
+        for w in words[1:]:
+            candidates &= set(self.postings.get(w, {}))
+
+        found = set()
+        for name in candidates:
+            tokens = self.docs[name]
+            for i in range(len(tokens) - len(words) + 1):
+                if tokens[i:i + len(words)] == words:
+                    found.add(name)
+                    break
+        return found
+
+    def matches(self, node):
+        op = node[0]
+        if op == "term":
+            return set(self.postings.get(node[1], {}))
+        if op == "pattern":
+            found = set()
+            for t in self.expand(node[1]):
+                found |= set(self.postings[t])
+            return found
+        if op == "phrase":
+            return self.phrase_matches(node[1])
+
+        left, right = self.matches(node[1]), self.matches(node[2])
+        if op == "&&":
+            return left & right
+        if op == "||":
+            return left | right
+        return left - right  # "&!"
+
+    def scored_terms(self, node, dst):
+        """every distinct term of the query in the index, but those on the right of "&!" """
+        op = node[0]
+        if op == "term":
+            terms = [node[1]]
+        elif op == "pattern":
+            terms = self.expand(node[1])
+        elif op == "phrase":
+            terms = node[1]
+        else:
+            self.scored_terms(node[1], dst)
+            if op != "&!":
+                self.scored_terms(node[2], dst)
+            return
+
+        for t in terms:
+            if t in self.postings and t not in dst:
+                dst.append(t)
+
+    def bm25(self, idf, tf, length):
+        norm = BM25_K1 * (1.0 - BM25_B + BM25_B * length / self.avg_length)
+        return idf * (tf * (BM25_K1 + 1.0)) / (tf + norm)
+
+    def rank(self, node, positions):
+        """
+        @returns every match of the query with its score, best first (ties by name)
+        @raises QueryError if the indexer rejects the query
+        """
+        if has_phrase(node) and not positions:
+            raise QueryError("phrases need an index that stores the positions of terms")
+
+        terms = []
+        self.scored_terms(node, terms)
+        matches = self.matches(node)
+
+        n = len(self.docs)
+        scorers = []
+        for t in terms:
+            tfs = self.postings[t]
+            idf = math.log(1.0 + (n - len(tfs) + 0.5) / (len(tfs) + 0.5))
+            max_score = self.bm25(idf, max(tfs.values()), 0)
+            scorers.append((max_score, idf, tfs))
+
+        # summed in the same order as the indexer, so that the scores are the same to the last bit
+        scorers.sort(key=lambda s: -s[0])
+
+        ranked = []
+        for name in matches:
+            length = len(self.docs[name])
+            score = 0.0
+            for _, idf, tfs in scorers:
+                if name in tfs:
+                    score += self.bm25(idf, tfs[name], length)
+            ranked.append((score, name))
+
+        ranked.sort(key=lambda r: (-r[0], r[1]))
+        return ranked
+
+
+# ------------------------Reference parser------------------------
+
+
+class QueryError(Exception):
+    pass
+
+
+def tokenize_query(query):
+    """Split on whitespace and parentheses, and keep the characters of words and operators, as main.c does"""
+    tokens = []
+    for raw in re.split(r"[\s()]+", query):
+        token = re.sub(r"[^0-9A-Za-z()|&!\"*]", "", raw).lower()
+        if token:
+            tokens.append(token)
+    return tokens
+
+
+def lex(tokens):
+    lexemes = []
+    for token in tokens:
+        i = 0
+        while i < len(token):
+            m = re.match(r"[0-9a-z*]+", token[i:])
+            if m:
+                lexemes.append(("word", m.group()))
+                i += len(m.group())
+            elif token[i] in "()\"":
+                lexemes.append((token[i], token[i]))
+                i += 1
+            elif token[i:i + 2] in ("&&", "||", "&!"):
+                lexemes.append(("op", token[i:i + 2]))
+                i += 2
+            else:
+                raise QueryError("invalid operator at \"%s\" (expected &&, || or &!)" % token[i:])
+    return lexemes
+
+
+class Parser:
+    """Port of the recursive descent parser of src/query.c, with the same error messages"""
+
+    def __init__(self, lexemes):
+        self.lexemes = lexemes
+        self.pos = 0
+
+    def peek(self):
+        return self.lexemes[self.pos] if self.pos < len(self.lexemes) else None
+
+    def peek_text(self):
+        lex = self.peek()
+        return lex[1] if lex else "end of query"
+
+    def word(self, text):
+        return ("pattern" if "*" in text else "term", text)
+
+    def phrase(self):
+        self.pos += 1
+        first = self.pos
+        while self.peek() and self.peek()[0] == "word":
+            self.pos += 1
+
+        if not self.peek() or self.peek()[0] != "\"":
+            raise QueryError("expected word or closing '\"' of phrase, found \"%s\"" % self.peek_text())
+        if self.pos == first:
+            raise QueryError("empty phrase")
+
+        words = [lex[1] for lex in self.lexemes[first:self.pos]]
+        for w in words:
+            if "*" in w:
+                raise QueryError("patterns are not allowed in phrases, found \"%s\"" % w)
+
+        self.pos += 1
+        return self.word(words[0]) if len(words) == 1 else ("phrase", words)
+
+    def term(self):
+        lex = self.peek()
+        if lex and lex[0] == "word":
+            self.pos += 1
+            return self.word(lex[1])
+        if lex and lex[0] == "\"":
+            return self.phrase()
+        if lex and lex[0] == "(":
+            self.pos += 1
+            inner = self.query()
+            if not self.peek() or self.peek()[0] != ")":
+                raise QueryError("expected \")\", found \"%s\"" % self.peek_text())
+            self.pos += 1
+            return inner
+
+        if self.pos == 0:
+            raise QueryError(
+                "expected word, phrase or \"(\" at start of query, found \"%s\"" % self.peek_text()
+            )
+        raise QueryError(
+            "expected word, phrase or \"(\" after \"%s\", found \"%s\""
+            % (self.lexemes[self.pos - 1][1], self.peek_text())
+        )
+
+    def binary(self, op, operand):
+        left = operand()
+        lex = self.peek()
+        if not lex or lex[0] != "op" or lex[1] != op:
+            return left
+        self.pos += 1
+        return (op, left, self.binary(op, operand))
+
+    def orterm(self):
+        return self.binary("||", self.term)
+
+    def andterm(self):
+        return self.binary("&&", self.orterm)
+
+    def query(self):
+        return self.binary("&!", self.andterm)
+
+    def parse(self):
+        root = self.query()
+        if self.pos < len(self.lexemes):
+            lex = self.peek()
+            if lex[0] == ")":
+                raise QueryError("unmatched \")\"")
+            raise QueryError(
+                "expected operator after \"%s\", found \"%s\"" % (self.lexemes[self.pos - 1][1], lex[1])
+            )
+        return root
+
+
+def has_phrase(node):
+    if node[0] == "phrase":
+        return True
+    if node[0] in ("term", "pattern"):
+        return False
+    return has_phrase(node[1]) or has_phrase(node[2])
+
+
+# ------------------------Results------------------------
+
+
+class Result:
+    """The outcome of a query: an error, a message, or the number of matches and the ranked documents"""
+
+    def __init__(self, error=None, message=None, n_matches=0, rows=None, n_more=0):
+        self.error = error
+        self.message = message
+        self.n_matches = n_matches
+        self.exact = True  # False if n_matches is a lower bound
+        self.rows = rows or []  # (printed score, name)
+        self.n_more = n_more
+
+
+def evaluate(ref, query, positions):
+    """@returns the Result of the reference, and every match with its score"""
+    tokens = tokenize_query(query)
+    if not tokens:
+        return Result(message="Found no usable characters in the query"), []
+
+    try:
+        ranked = ref.rank(Parser(lex(tokens)).parse(), positions)
+    except QueryError as e:
+        return Result(error=str(e)), []
+
+    rows = [("%.3f" % score, name) for score, name in ranked[:MAX_RESULT_TABLE_ROWS]]
+    return Result(n_matches=len(ranked), rows=rows, n_more=len(ranked) - len(rows)), ranked
+
+
+def render(query, result):
+    lines = [">>> " + query]
+    if result.error is not None:
+        lines.append("Invalid query: " + result.error)
+    elif result.message is not None:
+        lines.append(result.message)
+    else:
+        plural = "" if result.n_matches == 1 else "s"
+        lines.append("=== Found %d result%s ===" % (result.n_matches, plural))
+        lines.append("%-10s %s" % ("Score", "Document"))
+        lines += ["%-10s %s" % row for row in result.rows]
+        if result.n_more:
+            lines.append(" ... and %d more" % result.n_more)
+    return "\n".join(lines) + "\n"
+
+
+ANSI = re.compile(r"\x1b\[[0-9;]*m")
+
+
+def parse_output(output, n_queries):
+    """Split the output of the indexer into the Result of each query"""
+    results = []
+    for block in ANSI.sub("", output).split(">>> ")[1:]:
+        lines = block.rstrip("\n").split("\n")[1:]
+        result = Result()
+        if not lines:
+            result.message = ""
+        elif lines[0].startswith("Invalid query: "):
+            result.error = lines[0][len("Invalid query: "):]
+        elif not lines[0].startswith("=== Found "):
+            result.message = lines[0]
+        else:
+            result.exact = not lines[0].startswith("=== Found at least ")
+            result.n_matches = int(lines[0].split()[-5])
+            for line in lines[2:]:
+                if line.startswith(" ... and "):
+                    result.n_more = int(line.split()[-2])
+                elif line.strip():
+                    score, path = line.split(None, 1)
+                    result.rows.append((score, os.path.basename(path)))
+        results.append(result)
+
+    if len(results) != n_queries:
+        raise RuntimeError("expected the output of %d queries, found %d" % (n_queries, len(results)))
+    return results
+
+
+def compare(expected, ranked, actual, k):
+    """@returns a list of the differences between the result of the indexer and the reference"""
+    if expected.error is not None or expected.message is not None:
+        if (actual.error, actual.message) != (expected.error, expected.message):
+            return ["expected %r, got %r" % (expected.error or expected.message, actual.error or actual.message)]
+        return []
+    if actual.error is not None or actual.message is not None:
+        return ["unexpected %r" % (actual.error or actual.message)]
+
+    diffs = []
+    if actual.exact and actual.n_matches != expected.n_matches:
+        diffs.append("expected %d matches, got %d" % (expected.n_matches, actual.n_matches))
+    if not actual.exact and not len(actual.rows) <= actual.n_matches <= expected.n_matches:
+        diffs.append("expected %d matches, got at least %d" % (expected.n_matches, actual.n_matches))
+
+    n_rows = min(k or len(ranked), MAX_RESULT_TABLE_ROWS, len(ranked))
+    if len(actual.rows) != n_rows:
+        diffs.append("expected %d ranked documents, got %d" % (n_rows, len(actual.rows)))
+    if actual.n_more != actual.n_matches - len(actual.rows):
+        diffs.append("\"... and %d more\" of %d matches" % (actual.n_more, actual.n_matches))
+
+    scores = {name: score for score, name in ranked}
+    names = set()
+    for score, name in actual.rows:
+        if name not in scores:
+            diffs.append("%s does not match" % name)
+        elif abs(float(score) - scores[name]) > SCORE_EPS:
+            diffs.append("%s scores %.6f, got %s" % (name, scores[name], score))
+        if name in names:
+            diffs.append("%s is ranked twice" % name)
+        names.add(name)
+
+    # any document ranked below the last one shown must not score higher than it
+    if not diffs and actual.rows:
+        lowest = min(scores[name] for _, name in actual.rows)
+        for score, name in ranked:
+            if name not in names and score > lowest + SCORE_EPS:
+                diffs.append("%s (%.3f) is missing" % (name, score))
+                break
+        shown = [scores[name] for _, name in actual.rows]
+        if any(b > a + SCORE_EPS for a, b in zip(shown, shown[1:])):
+            diffs.append("documents are not ranked by score")
+    return diffs
+
+
+# ------------------------Watch------------------------
+
+N_WATCH_DOCS = 20
+N_EDITS = 30
+WATCH_MAX_UNPURGED = 2  # INDEX_COMPACT_RATIO of N_WATCH_DOCS, past which the index is compacted
+WATCH_TIMEOUT = 10.0  # seconds to wait for the server to start, or for an edit to be applied
+
+
+class Client:
+    """A connection to the query server of the indexer (--serve)"""
+
+    def __init__(self, port):
+        deadline = time.monotonic() + WATCH_TIMEOUT
+        while True:
+            try:
+                self.sock = socket.create_connection(("127.0.0.1", port), timeout=WATCH_TIMEOUT)
+                break
+            except ConnectionRefusedError:
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(0.05)
+        self.reader = self.sock.makefile("r")
+
+    def request(self, line):
+        """@returns the reply to a query or command, without the empty line that ends it"""
+        self.sock.sendall((line + "\n").encode())
+        reply = []
+        for reply_line in self.reader:
+            if reply_line == "\n":
+                break
+            reply.append(reply_line)
+        return ANSI.sub("", "".join(reply))
+
+    def close(self):
+        self.reader.close()
+        self.sock.close()
+
+
+def check_watch(indexer, work):
+    """
+    Edit one file N_EDITS times while the indexer watches it. Each edit removes the old version of the file
+    from the index, which must then be compacted now and then rather than hold on to every version.
+    @returns a list of the problems found
+    """
+    corpus = os.path.join(work, "watch")
+    os.makedirs(corpus)
+    for d in range(N_WATCH_DOCS):
+        with open(os.path.join(corpus, "doc%02d.txt" % d), "w") as f:
+            f.write("common doc%d\n" % d)
+
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        port = s.getsockname()[1]
+
+    cmd = [indexer, corpus, "--watch", "--serve", "127.0.0.1:%d" % port]
+    with open(os.path.join(work, "watch.log"), "w") as log:
+        proc = subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=log, stderr=log)
+
+    diffs = []
+    client = None
+    try:
+        client = Client(port)
+        for i in range(N_EDITS):
+            with open(os.path.join(corpus, "doc00.txt"), "w") as f:
+                f.write("common edit%d\n" % i)
+
+            deadline = time.monotonic() + WATCH_TIMEOUT
+            while not client.request("edit%d" % i).startswith("=== Found 1 result "):
+                if time.monotonic() > deadline:
+                    return ["edit %d was not applied within %.0fs" % (i, WATCH_TIMEOUT)]
+                time.sleep(0.01)
+
+        reply = client.request("common")
+        if not reply.startswith("=== Found %d results " % N_WATCH_DOCS):
+            diffs.append("expected %d documents, got %r" % (N_WATCH_DOCS, reply.split("\n")[0]))
+
+        stat = client.request(".stat")
+        m = re.search(r"Removed documents: (\d+) not yet compacted, (\d+) compactions", stat)
+        if not m:
+            diffs.append("no removed documents in %r" % stat)
+        elif int(m.group(1)) > WATCH_MAX_UNPURGED or int(m.group(2)) == 0:
+            diffs.append("%s not yet compacted after %d edits, in %s compactions"
+                         % (m.group(1), N_EDITS, m.group(2)))
+    finally:
+        if client:
+            client.close()
+        proc.terminate()
+        proc.wait(WATCH_TIMEOUT)
+
+    if proc.returncode != 0:
+        diffs.append("%s exited with %d" % (" ".join(cmd), proc.returncode))
+    return diffs
+
+
+# ------------------------Driver------------------------
+
+# configurations the indexer is run with, as (name, arguments, whether it has positions, top-k)
+# "{work}" is replaced with the working directory
+CONFIGS = [
+    ("build", ["{work}/corpus", "--positions", "--threads", "1"], True, 20),
+    ("build-threads", ["{work}/corpus", "--positions", "--threads", "4", "--save-index", "{work}/index.bin",
+                       "--topk", "3", "--cache", "0"], True, 3),
+    ("load", ["--load-index", "{work}/index.bin", "--query-threads", "2"], True, 20),
+    ("no-positions", ["{work}/corpus", "--topk", "0"], False, 0),
+]
+
+
+def read_queries():
+    with open(QUERIES_PATH) as f:
+        return [line.strip() for line in f if line.strip() and not line.startswith("#")]
+
+
+def main(argv):
+    if len(argv) < 2 or argv[1].startswith("-"):
+        print(__doc__.strip().split("\n")[-1], file=sys.stderr)
+        return 2
+
+    indexer = argv[1]
+    work = argv[argv.index("--work") + 1] if "--work" in argv else os.path.join("build", "check")
+    update = "--update" in argv
+
+    shutil.rmtree(work, ignore_errors=True)
+    generate_corpus(os.path.join(work, "corpus"))
+
+    ref = Reference(os.path.join(work, "corpus"))
+    queries = read_queries()
+    queries_path = os.path.join(work, "queries.txt")
+    with open(queries_path, "w") as f:
+        f.write("\n".join(queries) + "\n")
+    reference = {positions: [evaluate(ref, q, positions) for q in queries] for positions in (True, False)}
+
+    rendered = "".join(render(q, r) for q, (r, _) in zip(queries, reference[True]))
+    if update:
+        with open(EXPECTED_PATH, "w") as f:
+            f.write(rendered)
+        print("check: wrote %s" % EXPECTED_PATH)
+    else:
+        with open(EXPECTED_PATH) as f:
+            if f.read() != rendered:
+                print("check: the reference no longer gives %s. Run with --update if this is intended."
+                      % EXPECTED_PATH, file=sys.stderr)
+                return 1
+
+    n_failed = 0
+    for name, args, positions, k in CONFIGS:
+        cmd = [indexer] + [a.replace("{work}", work) for a in args]
+        # piped from a file, so that all of it can be read as soon as the indexer starts
+        with open(queries_path) as stdin:
+            proc = subprocess.run(cmd, stdin=stdin, capture_output=True, text=True)
+        if proc.returncode != 0:
+            print("check: %s: %s exited with %d" % (name, " ".join(cmd), proc.returncode), file=sys.stderr)
+            print(proc.stderr[-2000:], file=sys.stderr)
+            return 1
+
+        n_config_failed = 0
+        for query, (expected, ranked), actual in zip(queries, reference[positions],
+                                                     parse_output(proc.stdout, len(queries))):
+            diffs = compare(expected, ranked, actual, k)
+            if diffs:
+                n_config_failed += 1
+                print("check: %s: %s" % (name, query), file=sys.stderr)
+                for d in diffs[:5]:
+                    print("    " + d, file=sys.stderr)
+
+        status = "FAILED %d" % n_config_failed if n_config_failed else "ok"
+        print("check: %-14s %d queries %s" % (name, len(queries), status))
+        n_failed += n_config_failed
+
+    diffs = check_watch(indexer, work)
+    for d in diffs:
+        print("check: watch: " + d, file=sys.stderr)
+    print("check: %-14s %d edits %s" % ("watch", N_EDITS, "FAILED" if diffs else "ok"))
+
+    return 1 if n_failed or diffs else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))